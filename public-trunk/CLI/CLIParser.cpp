@@ -29,11 +29,13 @@
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <ctype.h>
 
 #include <config.h>
 #include "CLIParser.h"
 #include "Tokenizer.h"
 #include <Logger.h>
+#include <MemoryLock.h>
 #include <Globals.h>
 
 #include <GSMConfig.h>
@@ -42,6 +44,7 @@
 #include <TRXManager.h>
 #include <PowerManager.h>
 #include <SMSMessages.h>
+#include <RRLPSweep.h>
 
 using namespace std;
 using namespace CommandLine;
@@ -114,6 +117,7 @@ void CommandLine::printStats(ostream& os)
 	os << "SDCCH load: " << gBTS.SDCCHActive() << '/' << gBTS.SDCCHTotal() << endl;
 	os << "TCH/F load: " << gBTS.TCHActive() << '/' << gBTS.TCHTotal() << endl;
 	os << "AGCH/PCH load: " << gBTS.AGCHLoad() << ',' << gBTS.PCHLoad() << endl;
+	os << "AGCH/PCH drops: " << gBTS.AGCHDrops() << ',' << gBTS.PCHDrops() << endl;
 	// paging table size
 	os << "Paging table size: " << gBTS.pager().pagingEntryListSize() << endl;
 	os << "Transactions/TMSIs: " << gTransactionTable.size() << ',' << gTMSITable.size() << endl;
@@ -229,10 +233,32 @@ int dumpTMSIs(const char* filename)
 
 
 
+/**
+	Parse the optional "[first [count]]" arguments used to page through large tables.
+	@param i The index of the first paging argument.
+	@return False if an argument is not a number.
+*/
+static bool pageArgs(int argc, char** argv, int i, unsigned& first, unsigned& count)
+{
+	first = 0;
+	count = ~0U;
+	char *end;
+	if (argc>i) {
+		first = strtoul(argv[i],&end,10);
+		if (*end) return false;
+	}
+	if (argc>i+1) {
+		count = strtoul(argv[i+1],&end,10);
+		if (*end) return false;
+	}
+	return true;
+}
+
+
 /** Print or clear the TMSI table. */
 int tmsis(int argc, char** argv, ostream& os)
 {
-	if (argc>=2) {
+	if (argc>=2 && !isdigit(argv[1][0])) {
 		// Clear?
 		if (strcmp(argv[1],"clear")==0) {
 			if (argc!=2) return BAD_NUM_ARGS;
@@ -249,11 +275,14 @@ int tmsis(int argc, char** argv, ostream& os)
 		return BAD_VALUE;
 	}
 
-	if (argc!=1) return BAD_NUM_ARGS;
+	if (argc>3) return BAD_NUM_ARGS;
+	unsigned first, count;
+	if (!pageArgs(argc,argv,1,first,count)) return BAD_VALUE;
 
 	os << "TMSI       IMSI            IMEI              age  used" << endl;
-	gTMSITable.dump(os);
+	gTMSITable.dump(os,first,count);
 	os << endl << gTMSITable.size() << " TMSIs in table" << endl;
+	gTMSITable.sharedReport(os);
 	return SUCCESS;
 }
 
@@ -261,10 +290,12 @@ int tmsis(int argc, char** argv, ostream& os)
 /** Print the transactions table. */
 int trans(int argc, char** argv, ostream& os)
 {
-   if (argc!=1) return BAD_NUM_ARGS;
+   if (argc>3) return BAD_NUM_ARGS;
+   unsigned first, count;
+   if (!pageArgs(argc,argv,1,first,count)) return BAD_VALUE;
 
 //   os << "TMSI       IMSI            IMEI              age  used" << endl;
-   gTransactionTable.dump(os);
+   gTransactionTable.dump(os,first,count);
    os << endl << gTransactionTable.size() << " transactions in table" << endl;
    return SUCCESS;
 }
@@ -278,15 +309,11 @@ int findimsi(int argc, char** argv, ostream& os)
 		os << "usage: findimsi <imsiprefix>\n";
 		return BAD_VALUE;
 	}
-	// FIXME -- THis should be moved into the TMSITable object to make it thread-safe.
-	Control::TMSIMap::const_iterator tp = gTMSITable.begin();
-	char buf[50]; // max size in decimal digits plus 1 plus RandomPositive
-	while (tp != gTMSITable.end()) {
-		std::string target;
-		sprintf(buf, "%d", tp->first);
-		std::string imsi = buf;
-		target.assign(imsi, 0, strlen(argv[1]));
-		if (target == argv[1])
+	Control::TMSISnapshot view = gTMSITable.snapshot();
+	Control::TMSIMap::const_iterator tp = view->begin();
+	size_t prefixLen = strlen(argv[1]);
+	while (tp != view->end()) {
+		if (strncmp(tp->second.IMSI(),argv[1],prefixLen)==0)
 			os << tp->second << " 0x" << std::hex << tp->first << std::dec << endl;
 		++tp;
 	}
@@ -391,6 +418,29 @@ int sendrrlp(int argc, char** argv, ostream& os)
 	return SUCCESS;
 }
 
+/** Locate many MSs with RRLP. */
+int rrlpsweep(int argc, char** argv, ostream& os)
+{
+	GSM::RRLP::RRLPSweep *sweep = GSM::RRLP::RRLPSweep::instance();
+	if (argc==1) {
+		sweep->report(os);
+		return SUCCESS;
+	}
+	if (strcmp(argv[1],"stop")==0) {
+		if (argc!=2) return BAD_NUM_ARGS;
+		sweep->stop();
+		return SUCCESS;
+	}
+	if (strcmp(argv[1],"start")!=0) return BAD_VALUE;
+	unsigned period = 0;
+	if (argc>2) period = atoi(argv[2]);
+	vector<string> IMSIs;
+	for (int i=3; i<argc; i++) IMSIs.push_back(argv[i]);
+	sweep->start(period,true,IMSIs);
+	os << "sweep started" << endl;
+	return SUCCESS;
+}
+
 /** Send USSD to an IMSI. */
 int sendUSSD(int argc, char** argv, ostream& os)
 {
@@ -404,6 +454,14 @@ int sendUSSD(int argc, char** argv, ostream& os)
 	return SUCCESS;
 }
 
+/** Report MO USSD sessions and handler latency. */
+int ussd(int argc, char** argv, ostream& os)
+{
+	if (argc!=1) return BAD_NUM_ARGS;
+	gUSSDSessions.stats(os);
+	return SUCCESS;
+}
+
 /** Print current usage loads. */
 int cliPrintStats(int argc, char** argv, ostream& os)
 {
@@ -455,16 +513,17 @@ int cellID(int argc, char** argv, ostream& os)
 /** Print table of current transactions. */
 int calls(int argc, char** argv, ostream& os)
 {
-	if (argc!=1) return BAD_NUM_ARGS;
-	Control::TransactionMap::const_iterator trans = gTransactionTable.begin();
-	int count = 0;
-	gTransactionTable.clearDeadEntries();
-	while (trans != gTransactionTable.end()) {
+	if (argc>3) return BAD_NUM_ARGS;
+	unsigned first, count;
+	if (!pageArgs(argc,argv,1,first,count)) return BAD_VALUE;
+	Control::TransactionSnapshot view = gTransactionTable.snapshot();
+	Control::TransactionMap::const_iterator trans = view->begin();
+	for (unsigned i=0; i<first && trans!=view->end(); i++) ++trans;
+	while (trans != view->end() && count--) {
 		os << trans->second << endl;
 		++trans;
-		count++;
 	}
-	os << endl << count << " transactions in table" << endl;
+	os << endl << view->size() << " transactions in table" << endl;
 	return SUCCESS;
 }
 
@@ -695,25 +754,18 @@ void printChanInfo(const GSM::LogicalChannel* chan, ostream& os)
 
 int chans(int argc, char **argv, ostream& os)
 {
-	if (argc!=1) return BAD_NUM_ARGS;
+	if (argc>3) return BAD_NUM_ARGS;
+	unsigned first, count;
+	if (!pageArgs(argc,argv,1,first,count)) return BAD_VALUE;
 
 	os << "TN chan      transaction UPFER RSSI TXPWR TXTA DNLEV DNBER" << endl;
 	os << "TN type      id          pct    dB   dBm  sym   dBm   pct" << endl;
 
-	// SDCCHs
-	GSM::SDCCHList::const_iterator sChanItr = gBTS.SDCCHPool().begin();
-	while (sChanItr != gBTS.SDCCHPool().end()) {
-		const GSM::SDCCHLogicalChannel* sChan = *sChanItr;
-		if (sChan->active()) printChanInfo(sChan,os);
-		++sChanItr;
-	}
-
-	// TCHs
-	GSM::TCHList::const_iterator tChanItr = gBTS.TCHPool().begin();
-	while (tChanItr != gBTS.TCHPool().end()) {
-		const GSM::TCHFACCHLogicalChannel* tChan = *tChanItr;
-		if (tChan->active()) printChanInfo(tChan,os);
-		++tChanItr;
+	// SDCCHs, then TCHs
+	std::vector<const GSM::LogicalChannel*> active;
+	gBTS.activeChannels(active);
+	for (unsigned i=first; i<active.size() && count--; i++) {
+		printChanInfo(active[i],os);
 	}
 
 	os << endl;
@@ -778,6 +830,134 @@ int noise(int argc, char** argv, ostream& os)
         return SUCCESS;
 }
 
+int dfe(int argc, char** argv, ostream& os)
+{
+	if (argc!=1) return BAD_NUM_ARGS;
+
+	unsigned estimates, redesigns;
+	float change;
+	if (!gTRX.ARFCN(0)->getDFEStats(estimates,redesigns,change)) {
+		os << "DFE statistics not available" << endl;
+		return SUCCESS;
+	}
+	os << "channel estimates: " << estimates << endl;
+	os << "DFE redesigns: " << redesigns;
+	if (estimates) os << " (" << 100*redesigns/estimates << "%)";
+	os << endl;
+	os << "largest recent channel change: " << change << endl;
+
+	return SUCCESS;
+}
+
+/** Per-thread page faults, for checking deterministic-memory mode. */
+int pagefaults(int argc, char** argv, ostream& os)
+{
+	if (argc>2) return BAD_NUM_ARGS;
+	bool sinceLast = false;
+	if (argc==2) {
+		if (strcmp(argv[1],"delta")) return BAD_VALUE;
+		sinceLast = true;
+	}
+
+	os << "deterministic-memory mode " << (gDeterministicMemory() ? "on" : "off") << endl;
+	unsigned long total = gPageFaultReport(os,sinceLast);
+	os << "total: " << total << endl;
+
+	return SUCCESS;
+}
+
+/** Lock contention profile of the named Mutexes. */
+int locks(int argc, char** argv, ostream& os)
+{
+	if (argc>2) return BAD_NUM_ARGS;
+	if (argc==2) {
+		if (strcmp(argv[1],"on")==0) gLockProfiling = true;
+		else if (strcmp(argv[1],"off")==0) gLockProfiling = false;
+		else if (strcmp(argv[1],"clear")==0) gLockProfilingClear();
+		else return BAD_VALUE;
+		return SUCCESS;
+	}
+
+	gLockProfilingReport(os);
+
+	return SUCCESS;
+}
+
+/** Registered threads, with CPU use and service loop heartbeats. */
+int threads(int argc, char** argv, ostream& os)
+{
+	if (argc!=1) return BAD_NUM_ARGS;
+
+	gThreadReport(os);
+
+	return SUCCESS;
+}
+
+/** Allocation counts by subsystem and thread. */
+int allocs(int argc, char** argv, ostream& os)
+{
+	if (argc>2) return BAD_NUM_ARGS;
+	if (argc==2) {
+		if (strcmp(argv[1],"on")==0) gAllocTracking = true;
+		else if (strcmp(argv[1],"off")==0) gAllocTracking = false;
+		else if (strcmp(argv[1],"clear")==0) gAllocClear();
+		else return BAD_VALUE;
+		return SUCCESS;
+	}
+
+	gAllocReport(os);
+
+	return SUCCESS;
+}
+
+int txstats(int argc, char** argv, ostream& os)
+{
+	if (argc!=1) return BAD_NUM_ARGS;
+
+	unsigned bursts, late, stale, frames, avgFrameTime, maxFrameTime;
+	if (!gTRX.ARFCN(0)->getTxStats(bursts,late,stale,frames,avgFrameTime,maxFrameTime)) {
+		os << "transmit statistics not available" << endl;
+		return SUCCESS;
+	}
+	os << "bursts modulated: " << bursts << endl;
+	os << "modulated after deadline: " << late << endl;
+	os << "stale at radio: " << stale << endl;
+	os << "frames modulated: " << frames << endl;
+	os << "frame modulation time: " << avgFrameTime << " us mean, " << maxFrameTime << " us max since last report" << endl;
+
+	// Older transceivers run the radio on one thread and do not answer this.
+	int txSlackMin, txSlackAvg, rxLagMax;
+	unsigned rxDepthMax;
+	unsigned long rxOverflows;
+	if (gTRX.ARFCN(0)->getIOStats(txSlackMin,txSlackAvg,rxDepthMax,rxLagMax,rxOverflows)) {
+		os << "transmit slack: " << txSlackMin << " min, " << txSlackAvg << " mean timeslots" << endl;
+		os << "receive backlog: " << rxDepthMax << " bursts, " << rxLagMax << " timeslots max since last report" << endl;
+		os << "receive overflows: " << rxOverflows << endl;
+	}
+
+	return SUCCESS;
+}
+
+int ccch(int argc, char** argv, ostream& os)
+{
+	if (argc!=1) return BAD_NUM_ARGS;
+
+	// Queue depths in multiframe order; AGCH-only blocks are the ones not in the PCH list.
+	for (unsigned group=0; group<gBTS.numCCCHGroups(); group++) {
+		const GSM::CCCHList& AGCHs = gBTS.AGCHGroup(group);
+		const GSM::CCCHList& PCHs = gBTS.PCHGroup(group);
+		unsigned reserved = AGCHs.size()>PCHs.size() ? AGCHs.size()-PCHs.size() : 0;
+		os << "C0T" << 2*group << " AGCH depth:";
+		for (unsigned i=0; i<reserved; i++) os << " " << AGCHs[i]->load();
+		os << " PCH depth:";
+		for (unsigned i=0; i<PCHs.size(); i++) os << " " << PCHs[i]->load();
+		os << endl;
+	}
+	os << "AGCH drops: " << gBTS.AGCHDrops() << endl;
+	os << "PCH drops: " << gBTS.PCHDrops() << endl;
+	return SUCCESS;
+}
+
 int echofirst(int argc, char** argv, ostream& os)
 {
 	if (argc!=2) return BAD_NUM_ARGS;
@@ -879,16 +1059,18 @@ Parser::Parser()
 	addCommand("uptime", uptime, "-- show BTS uptime and BTS frame number.");
 	addCommand("help", showHelp, "[command] -- list available commands or gets help on a specific command.");
 	addCommand("exit", exit_function, "[wait] -- exit the application, either immediately, or waiting for existing calls to clear with a timeout in seconds");
-	addCommand("tmsis", tmsis, "[\"clear\"] or [\"dump\" filename] -- print/clear the TMSI table or dump it to a file.");
-	addCommand("trans", trans, "-- print the transactions table.");
+	addCommand("tmsis", tmsis, "[first [count]] or [\"clear\"] or [\"dump\" filename] -- print/clear the TMSI table or dump it to a file.");
+	addCommand("trans", trans, "[first [count]] -- print the transactions table.");
 	addCommand("findimsi", findimsi, "[IMSIPrefix] -- prints all imsi's that are prefixed by IMSIPrefix");
 	addCommand("sendsmsrpdu", sendsmsrpdu, "<IMSI> <src> <RPDU hex string> -- send pre-encoded SMS RPDU to <IMSI>, addressed from <src>.");
 	addCommand("sendsms", sendsms, "<IMSI> <src> <smsc> <text> -- send SMS to <IMSI>, addressed from <src> with SMS-Center <smsc>.");
 	addCommand("sendrrlp", sendrrlp, "<IMSI> <hexstring> -- send RRLP message <hexstring> to <IMSI>.");
+	addCommand("rrlpsweep", rrlpsweep, "[\"start\" [period [IMSI...]] | \"stop\"] -- report on RRLP location sweeps, or start them (every period seconds, 0 for once; all attached MSs if no IMSIs are given) or stop them");
 	addCommand("sendussd", sendUSSD, "<IMSI> -- send USSD to <IMSI>");
+	addCommand("ussd", ussd, "-- report USSD session counts and handler latency");
 	addCommand("load", cliPrintStats, "-- print the current activity loads.");
 	addCommand("cellid", cellID, "[MCC MNC LAC CI] -- get/set location area identity (MCC, MNC, LAC) and cell ID (CI)");
-	addCommand("calls", calls, "-- print the transaction table");
+	addCommand("calls", calls, "[first [count]] -- print the transaction table");
 	addCommand("config", config, "[] OR [patt] OR [key val(s)] -- print the current configuration, print configuration values matching a pattern, or set/change a configuration value");
 	addCommand("configsave", configsave, "<path> -- write the current configuration to a file");
 	addCommand("regperiod", regperiod, "[GSM] [SIP] -- get/set the registration period (GSM T3212), in MINUTES");
@@ -896,10 +1078,17 @@ Parser::Parser()
 	addCommand("version", version,"-- print the version string");
 	addCommand("page", page, "[IMSI time] -- dump the paging table or page the given IMSI for the given period");
 	addCommand("testcall", testcall, "IMSI time -- initiate a test call to a given IMSI with a given paging time");
-	addCommand("chans", chans, "-- report PHY status for active channels");
+	addCommand("chans", chans, "[first [count]] -- report PHY status for active channels");
 	addCommand("power", power, "[minAtten maxAtten] -- report current attentuation or set min/max bounds");
         addCommand("rxgain", rxgain, "[newRxgain] -- get/set the RX gain in dB");
         addCommand("noise", noise, "-- report receive noise level in RSSI dB");
+        addCommand("pagefaults", pagefaults, "[delta] -- report page faults per thread, or since the last \"pagefaults delta\"");
+        addCommand("dfe", dfe, "-- report equalizer channel estimates, DFE redesigns and channel change");
+	addCommand("threads", threads, "-- report threads by role with CPU time, context switches and time since the last service loop heartbeat");
+	addCommand("allocs", allocs, "[\"on\" | \"off\" | \"clear\"] -- report allocations, bytes live and high water by subsystem and thread, or start, stop or clear counting");
+	addCommand("locks", locks, "[\"on\" | \"off\" | \"clear\"] -- report lock contention, or start, stop or clear lock profiling");
+	addCommand("ccch", ccch, "-- report AGCH and PCH queue depths per CCCH block and congestion drops");
+        addCommand("txstats", txstats, "-- report transmit modulation counts, late and stale bursts, frame timing and radio thread slack");
 	addCommand("unconfig", unconfig, "key -- remove a config value");
 	addCommand("notices", notices, "-- show startup copyright and legal notices");
 	addCommand("echo", echofirst, "<string> -- print <string> to the screen");
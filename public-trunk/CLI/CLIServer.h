@@ -64,7 +64,7 @@ public:
 	}
 
 	/** Request thread to start. */
-	void start() { assert(state() == IDLE); state(STARTING); mThread.start(startFunc, this); }
+	void start() { assert(state() == IDLE); state(STARTING); mThread.start(startFunc, this, "CLI server"); }
 
 	/** Request thread to stop. */
 	void stop() { mConnSock->close(); }
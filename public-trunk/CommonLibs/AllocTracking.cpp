@@ -0,0 +1,240 @@
+/*
+* Copyright 2010 Free Software Foundation, Inc.
+*
+* This software is distributed under the terms of the GNU Affero Public License.
+* See the COPYING file in the main directory for details.
+*
+* This use of this software may be subject to additional restrictions.
+* See the LEGAL file in the main directory for details.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+
+#include "AllocTracking.h"
+#include "Threads.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <iomanip>
+
+using namespace std;
+
+
+volatile bool gAllocTracking = false;
+volatile bool gAllocStrict = false;
+
+static const char *sTagNames[AllocNumTags] = {
+	"other", "Transceiver", "L1FEC", "LAPDm", "Control", "SIP", "smqueue"
+};
+
+
+struct AllocCounters {
+	unsigned long allocs;		///< changed only by the owning thread
+	unsigned long frees;		///< changed by any thread
+	long live;					///< bytes live, changed by any thread
+	long highWater;				///< most bytes live
+	unsigned long lastAllocs;	///< allocs at the previous report
+};
+
+/** Allocation state of one thread.  These are never deleted. */
+struct AllocThread {
+	AllocThread *next;			///< next in sAllocThreads
+	pid_t tid;
+	const char *role;
+	AllocTag tag;				///< the current AllocScope
+	unsigned steadyDepth;		///< nesting of SteadyState scopes
+	unsigned long steadyAllocs;	///< allocations inside SteadyState scopes
+	AllocCounters counters[AllocNumTags];
+};
+
+// Plain pthreads and POD, since allocations start in global constructors.
+static pthread_mutex_t sAllocLock = PTHREAD_MUTEX_INITIALIZER;
+static AllocThread *sAllocThreads = NULL;
+static __thread AllocThread *tAllocThread = NULL;
+
+
+/** The calling thread's state, created on first use. */
+static AllocThread *allocThread()
+{
+	AllocThread *thread = tAllocThread;
+	if (thread) return thread;
+	thread = new AllocThread;
+	memset(thread,0,sizeof(AllocThread));
+	thread->tid = syscall(SYS_gettid);
+	thread->role = gThreadRole();
+	thread->tag = AllocOther;
+	pthread_mutex_lock(&sAllocLock);
+	thread->next = sAllocThreads;
+	sAllocThreads = thread;
+	pthread_mutex_unlock(&sAllocLock);
+	tAllocThread = thread;
+	return thread;
+}
+
+
+AllocCounters *gAllocRecordNew(size_t bytes)
+{
+	AllocThread *thread = allocThread();
+	AllocCounters *counters = &thread->counters[thread->tag];
+	counters->allocs++;
+	long live = __sync_add_and_fetch(&counters->live,(long)bytes);
+	if (live>counters->highWater) counters->highWater = live;
+	if (thread->steadyDepth) {
+		thread->steadyAllocs++;
+		if (gAllocStrict) {
+			fprintf(stderr,"allocation of %lu bytes in a steady-state path, thread %d (%s), tag %s\n",
+				(unsigned long)bytes, thread->tid, thread->role ? thread->role : "-", sTagNames[thread->tag]);
+			abort();
+		}
+	}
+	return counters;
+}
+
+
+void gAllocRecordDelete(AllocCounters *counters, size_t bytes)
+{
+	__sync_fetch_and_add(&counters->frees,1UL);
+	__sync_fetch_and_sub(&counters->live,(long)bytes);
+}
+
+
+static void printCounters(ostream& os, const AllocCounters& counters, unsigned long allocs, unsigned ms)
+{
+	os << setw(10) << (ms ? (allocs-counters.lastAllocs)*1000/ms : 0)
+		<< setw(12) << allocs << setw(12) << counters.frees
+		<< setw(12) << counters.live << setw(12) << counters.highWater << endl;
+}
+
+
+void gAllocReport(ostream& os)
+{
+	static struct timeval sLast = {0,0};
+	struct timeval now;
+	gettimeofday(&now,NULL);
+	unsigned ms = 0;
+	if (sLast.tv_sec) ms = (now.tv_sec-sLast.tv_sec)*1000 + (now.tv_usec-sLast.tv_usec)/1000;
+
+	pthread_mutex_lock(&sAllocLock);
+	sLast = now;
+
+	// Per tag, summed over the threads.
+	AllocCounters tags[AllocNumTags];
+	memset(tags,0,sizeof(tags));
+	for (const AllocThread *thread = sAllocThreads; thread; thread = thread->next) {
+		for (unsigned tag=0; tag<AllocNumTags; tag++) {
+			const AllocCounters &counters = thread->counters[tag];
+			tags[tag].allocs += counters.allocs;
+			tags[tag].frees += counters.frees;
+			tags[tag].live += counters.live;
+			tags[tag].highWater += counters.highWater;
+			tags[tag].lastAllocs += counters.lastAllocs;
+		}
+	}
+	os << "allocation tracking " << (gAllocTracking ? "on" : "off")
+		<< (gAllocStrict ? ", strict" : "") << endl;
+	os << setw(28) << left << "tag" << right << setw(10) << "allocs/s" << setw(12) << "allocs"
+		<< setw(12) << "frees" << setw(12) << "bytes live" << setw(12) << "high water" << endl;
+	for (unsigned tag=0; tag<AllocNumTags; tag++) {
+		if (!tags[tag].allocs) continue;
+		os << setw(28) << left << sTagNames[tag] << right;
+		printCounters(os,tags[tag],tags[tag].allocs,ms);
+	}
+	os << "(the high water of a tag is the sum over its threads)" << endl;
+
+	// Per thread and tag.
+	os << setw(8) << "TID" << " " << setw(19) << left << "role/tag" << right << setw(10) << "allocs/s" << setw(12) << "allocs"
+		<< setw(12) << "frees" << setw(12) << "bytes live" << setw(12) << "high water" << endl;
+	for (AllocThread *thread = sAllocThreads; thread; thread = thread->next) {
+		for (unsigned tag=0; tag<AllocNumTags; tag++) {
+			AllocCounters &counters = thread->counters[tag];
+			if (!counters.allocs) continue;
+			string name = thread->role ? thread->role : "-";
+			name += "/";
+			name += sTagNames[tag];
+			unsigned long allocs = counters.allocs;
+			os << setw(8) << thread->tid << " " << setw(19) << left << name << right;
+			printCounters(os,counters,allocs,ms);
+			counters.lastAllocs = allocs;
+		}
+		if (thread->steadyAllocs) os << setw(8) << thread->tid << " " << thread->steadyAllocs << " allocations in steady-state paths" << endl;
+	}
+	pthread_mutex_unlock(&sAllocLock);
+}
+
+
+void gAllocClear()
+{
+	pthread_mutex_lock(&sAllocLock);
+	for (AllocThread *thread = sAllocThreads; thread; thread = thread->next) {
+		thread->steadyAllocs = 0;
+		for (unsigned tag=0; tag<AllocNumTags; tag++) {
+			AllocCounters &counters = thread->counters[tag];
+			// Bytes live stay, so that later releases balance.
+			counters.allocs = 0;
+			counters.frees = 0;
+			counters.lastAllocs = 0;
+			counters.highWater = counters.live;
+		}
+	}
+	pthread_mutex_unlock(&sAllocLock);
+}
+
+
+
+AllocScope::AllocScope(AllocTag tag)
+{
+	AllocThread *thread = allocThread();
+	mPrevious = thread->tag;
+	thread->tag = tag;
+}
+
+
+AllocScope::~AllocScope()
+{
+	tAllocThread->tag = mPrevious;
+}
+
+
+
+SteadyState::SteadyState()
+{
+	AllocThread *thread = allocThread();
+	thread->steadyDepth++;
+	mStart = thread->steadyAllocs;
+}
+
+
+SteadyState::~SteadyState()
+{
+	tAllocThread->steadyDepth--;
+}
+
+
+unsigned long SteadyState::allocations() const
+{
+	return tAllocThread->steadyAllocs - mStart;
+}
+
+
+
+// vim: ts=4 sw=4
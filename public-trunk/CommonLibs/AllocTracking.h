@@ -0,0 +1,127 @@
+/*
+* Copyright 2010 Free Software Foundation, Inc.
+*
+* This software is distributed under the terms of the GNU Affero Public License.
+* See the COPYING file in the main directory for details.
+*
+* This use of this software may be subject to additional restrictions.
+* See the LEGAL file in the main directory for details.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef ALLOCTRACKING_H
+#define ALLOCTRACKING_H
+
+#include <stddef.h>
+#include <ostream>
+
+
+/**@name Allocation tracking.
+	When enabled, allocations made through the instrumented containers
+	(Vector, the Interthread FIFOs, the smqueue arena) are counted per thread
+	and per subsystem tag, with bytes live and the high-water mark.
+	Each allocation is charged to the thread and tag that made it,
+	wherever it is freed.  When disabled, the cost is one branch per allocation.
+*/
+//@{
+
+/** Subsystems that allocations are charged to, set with AllocScope. */
+enum AllocTag {
+	AllocOther,
+	AllocTransceiver,
+	AllocL1FEC,
+	AllocLAPDm,
+	AllocControl,
+	AllocSIP,
+	AllocSMqueue,
+	AllocNumTags
+};
+
+/** Set to count allocations. */
+extern volatile bool gAllocTracking;
+
+/** Set, along with gAllocTracking, to abort on any allocation inside a SteadyState scope. */
+extern volatile bool gAllocStrict;
+
+/** Counters for one thread and tag. */
+struct AllocCounters;
+
+/** Count an allocation; returns the counters to pass to gAllocRecordDelete(). */
+AllocCounters *gAllocRecordNew(size_t bytes);
+
+/** Count the release of an allocation counted by gAllocRecordNew(). */
+void gAllocRecordDelete(AllocCounters *counters, size_t bytes);
+
+/** Count an allocation if tracking is on; NULL if it is not. */
+inline AllocCounters *gAllocNew(size_t bytes)
+	{ return gAllocTracking ? gAllocRecordNew(bytes) : NULL; }
+
+/** Count a release, if the allocation was counted. */
+inline void gAllocDelete(AllocCounters *counters, size_t bytes)
+	{ if (counters) gAllocRecordDelete(counters,bytes); }
+
+/**
+	Write per-tag and per-thread allocation counts, bytes live and high-water marks.
+	Rates are since the previous report.
+*/
+void gAllocReport(std::ostream& os);
+
+/** Zero the counts and reset the high-water marks to the bytes now live. */
+void gAllocClear();
+
+
+/** Charge the calling thread's allocations to a tag until the end of the scope. */
+class AllocScope {
+
+	private:
+
+	AllocTag mPrevious;
+
+	public:
+
+	AllocScope(AllocTag tag);
+
+	~AllocScope();
+};
+
+
+/**
+	Mark a steady-state path, one that should not allocate.
+	Allocations counted on the calling thread inside the scope are counted
+	again here, and abort the process if gAllocStrict is set.
+*/
+class SteadyState {
+
+	private:
+
+	unsigned long mStart;
+
+	public:
+
+	SteadyState();
+
+	~SteadyState();
+
+	/** Number of allocations counted inside the scope so far. */
+	unsigned long allocations() const;
+};
+
+//@}
+
+
+#endif
+// vim: ts=4 sw=4
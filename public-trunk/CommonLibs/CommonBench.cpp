@@ -0,0 +1,405 @@
+/*
+* Copyright 2008 Free Software Foundation, Inc.
+*
+* This software is distributed under the terms of the GNU Affero Public License.
+* See the COPYING file in the main directory for details.
+*
+* This use of this software may be subject to additional restrictions.
+* See the LEGAL file in the main directory for details.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+	Microbenchmarks for CommonLibs.
+
+	Usage: CommonBench [-s scale] [-p producers] [-u port] [name...]
+
+	Each result is one tab-separated line:
+		benchmark  param  iterations  ns/op  ops/s  allocs/op  p50 ns  p99 ns  max ns
+	with "-" where a column does not apply.  Lines starting with '#' are
+	comments; the first names the format version, which changes only if
+	the columns do.  Benchmark names are stable, so results from two builds
+	can be compared by joining on the first two columns.
+
+	Times are measured with allocation tracking off.  allocs/op comes from a
+	shorter, separate pass with tracking on, on the calling thread only.
+*/
+
+
+#include "Interthread.h"
+#include "BitVector.h"
+#include "Vector.h"
+#include "Sockets.h"
+#include "Logger.h"
+#include "Configuration.h"
+#include "AllocTracking.h"
+#include "Threads.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+ConfigurationTable gConfig;
+
+static const unsigned sFormatVersion = 1;
+
+static double gScale = 1.0;				///< multiplier on iteration counts
+static unsigned gMaxProducers = 4;		///< queue benchmark runs 1..gMaxProducers producers
+static unsigned short gUDPPort = 28790;	///< loopback benchmark uses this port and the next
+static vector<const char*> gNames;		///< benchmarks to run, all if empty
+
+static volatile uint64_t gSink;			///< keeps results live
+
+
+/** Monotonic time in ns. */
+static uint64_t nowNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+
+/** Scaled iteration count, at least 1. */
+static unsigned long scaled(unsigned long n)
+{
+	unsigned long s = (unsigned long)(n*gScale);
+	return s ? s : 1;
+}
+
+
+/** True if the named benchmark was selected on the command line. */
+static bool selected(const char* name)
+{
+	if (gNames.empty()) return true;
+	for (unsigned i=0; i<gNames.size(); i++) {
+		if (strncmp(name,gNames[i],strlen(gNames[i]))==0) return true;
+	}
+	return false;
+}
+
+
+/**
+	Print one result line.
+	@param allocsPerOp Negative if not measured.
+	@param latencies Per-operation latencies in ns, sorted here; NULL if not measured.
+*/
+static void report(const char* name, const char* param, unsigned long iterations, uint64_t ns,
+	double allocsPerOp=-1, vector<uint32_t>* latencies=NULL)
+{
+	printf("%s\t%s\t%lu\t%.1f\t%.0f\t",
+		name, param, iterations, (double)ns/iterations, ns ? iterations*1e9/ns : 0.0);
+	if (allocsPerOp<0) printf("-\t");
+	else printf("%.3f\t",allocsPerOp);
+	if (latencies && latencies->size()) {
+		sort(latencies->begin(),latencies->end());
+		size_t n = latencies->size();
+		printf("%u\t%u\t%u\n", (*latencies)[n/2], (*latencies)[n*99/100], (*latencies)[n-1]);
+	} else {
+		printf("-\t-\t-\n");
+	}
+	fflush(stdout);
+}
+
+
+/** A single-threaded benchmark body, run for a number of iterations. */
+typedef void (*BenchFunction)(unsigned long iterations);
+
+/** Time a benchmark body, then count its allocations in a shorter pass. */
+static void run(const char* name, const char* param, BenchFunction body, unsigned long iterations)
+{
+	if (!selected(name)) return;
+	body(iterations/100+1);			// warm up
+	uint64_t start = nowNs();
+	body(iterations);
+	uint64_t ns = nowNs()-start;
+
+	unsigned long countIterations = iterations/10+1;
+	gAllocTracking = true;
+	double allocsPerOp;
+	{
+		SteadyState steady;
+		body(countIterations);
+		allocsPerOp = (double)steady.allocations()/countIterations;
+	}
+	gAllocTracking = false;
+
+	report(name,param,iterations,ns,allocsPerOp);
+}
+
+
+
+/**@name InterthreadQueue write to read latency and throughput.
+	The producers write as fast as they can, so latency includes queueing.
+*/
+//@{
+
+struct QueueMessage {
+	uint64_t sent;		///< nowNs() at write
+};
+
+static InterthreadQueue<QueueMessage> gBenchQueue;
+static unsigned long gProducerIterations;
+
+static void *queueProducer(void*)
+{
+	for (unsigned long i=0; i<gProducerIterations; i++) {
+		QueueMessage *msg = new QueueMessage;
+		msg->sent = nowNs();
+		gBenchQueue.write(msg);
+	}
+	return NULL;
+}
+
+static void benchQueue()
+{
+	if (!selected("queue.write-read")) return;
+	for (unsigned producers=1; producers<=gMaxProducers; producers++) {
+		gProducerIterations = scaled(200000)/producers;
+		unsigned long total = gProducerIterations*producers;
+		vector<uint32_t> latencies;
+		latencies.reserve(total);
+		vector<Thread*> threads;
+		uint64_t start = nowNs();
+		for (unsigned i=0; i<producers; i++) {
+			Thread *thread = new Thread;
+			thread->start(queueProducer,NULL,"bench producer");
+			threads.push_back(thread);
+		}
+		for (unsigned long i=0; i<total; i++) {
+			QueueMessage *msg = gBenchQueue.read();
+			latencies.push_back((uint32_t)(nowNs()-msg->sent));
+			delete msg;
+		}
+		uint64_t ns = nowNs()-start;
+		for (unsigned i=0; i<producers; i++) {
+			threads[i]->join();
+			delete threads[i];
+		}
+		char param[32];
+		sprintf(param,"producers=%u",producers);
+		report("queue.write-read",param,total,ns,-1,&latencies);
+	}
+}
+
+//@}
+
+
+
+/**@name BitVector and SoftVector. */
+//@{
+
+static void benchWriteField(unsigned long iterations)
+{
+	BitVector bits(184);
+	for (unsigned long i=0; i<iterations; i++) {
+		size_t wp = 0;
+		for (unsigned j=0; j<23; j++) bits.writeField(wp,i+j,8);
+	}
+	gSink += bits.peekField(0,8);
+}
+
+static void benchReadField(unsigned long iterations)
+{
+	BitVector bits(184);
+	bits.zero();
+	uint64_t sum = 0;
+	for (unsigned long i=0; i<iterations; i++) {
+		size_t rp = 0;
+		for (unsigned j=0; j<23; j++) sum += bits.readField(rp,8);
+	}
+	gSink += sum;
+}
+
+static void benchFillField(unsigned long iterations)
+{
+	BitVector bits(184);
+	for (unsigned long i=0; i<iterations; i++) {
+		for (unsigned j=0; j<23; j++) bits.fillField(j*8,i+j,8);
+	}
+	gSink += bits.peekField(0,8);
+}
+
+static ViterbiR2O4 gViterbi;
+
+static void benchDecode(unsigned long iterations)
+{
+	SoftVector coded(456);
+	for (unsigned i=0; i<coded.size(); i++) coded[i] = (i*7919%1000)/1000.0F;
+	BitVector decoded(228);
+	for (unsigned long i=0; i<iterations; i++) coded.decode(gViterbi,decoded);
+	gSink += decoded.peekField(0,8);
+}
+
+//@}
+
+
+
+/**@name Vector copy and segment. */
+//@{
+
+// Const, since copying from a non-const Vector transfers its data.
+static const Vector<float> gBurst(1250);
+
+static void benchVectorCopy(unsigned long iterations)
+{
+	for (unsigned long i=0; i<iterations; i++) {
+		Vector<float> copy(gBurst);
+		gSink += (uint64_t)copy[i%copy.size()];
+	}
+}
+
+static void benchVectorCopyTo(unsigned long iterations)
+{
+	Vector<float> target(gBurst.size());
+	for (unsigned long i=0; i<iterations; i++) gBurst.copyTo(target);
+	gSink += (uint64_t)target[0];
+}
+
+static void benchVectorSegment(unsigned long iterations)
+{
+	for (unsigned long i=0; i<iterations; i++) {
+		const Vector<float> seg = gBurst.segment(i%1000,148);
+		gSink += seg.size();
+	}
+}
+
+//@}
+
+
+
+/**@name UDP loopback. */
+//@{
+
+static UDPSocket *gUDPSender;
+static UDPSocket *gUDPReceiver;
+
+static void benchUDP(unsigned long iterations)
+{
+	char burst[158];
+	memset(burst,0,sizeof(burst));
+	char buffer[MAX_UDP_LENGTH];
+	for (unsigned long i=0; i<iterations; i++) {
+		gUDPSender->write(burst,sizeof(burst));
+		gSink += gUDPReceiver->read(buffer);
+	}
+}
+
+//@}
+
+
+
+/**@name Logging and configuration lookups. */
+//@{
+
+static void benchLog(unsigned long iterations)
+{
+	for (unsigned long i=0; i<iterations; i++) LOG(INFO) << "bench " << i;
+}
+
+static void benchGetNum(unsigned long iterations)
+{
+	long sum = 0;
+	for (unsigned long i=0; i<iterations; i++) sum += gConfig.getNum("Bench.Number");
+	gSink += sum;
+}
+
+static void benchDefines(unsigned long iterations)
+{
+	unsigned long sum = 0;
+	for (unsigned long i=0; i<iterations; i++) sum += gConfig.defines("Bench.Missing");
+	gSink += sum;
+}
+
+//@}
+
+
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	while ((opt=getopt(argc,argv,"s:p:u:"))!=-1) {
+		switch (opt) {
+			case 's': gScale = atof(optarg); break;
+			case 'p': gMaxProducers = atoi(optarg); break;
+			case 'u': gUDPPort = atoi(optarg); break;
+			default:
+				fprintf(stderr,"usage: %s [-s scale] [-p producers] [-u port] [name...]\n",argv[0]);
+				exit(-1);
+		}
+	}
+	for (int i=optind; i<argc; i++) gNames.push_back(argv[i]);
+
+	// Keep stdout for results.
+	gSetLogFile(stderr);
+	gLogInit("NOTICE");
+	gConfig.set("Bench.Number",42);
+
+	struct utsname host;
+	uname(&host);
+	char date[64];
+	time_t now = time(NULL);
+	strftime(date,sizeof(date),"%Y-%m-%dT%H:%M:%S",localtime(&now));
+	printf("# CommonBench %u\n",sFormatVersion);
+	printf("# host %s %s %s, %ld CPUs, %s, scale %g\n",
+		host.nodename, host.release, host.machine, sysconf(_SC_NPROCESSORS_ONLN), date, gScale);
+	printf("# benchmark\tparam\titerations\tns/op\tops/s\tallocs/op\tp50 ns\tp99 ns\tmax ns\n");
+
+	benchQueue();
+
+	run("bitvector.writeField","8x23",benchWriteField,scaled(500000));
+	run("bitvector.readField","8x23",benchReadField,scaled(500000));
+	run("bitvector.fillField","8x23",benchFillField,scaled(500000));
+	run("softvector.decode","456->228",benchDecode,scaled(5000));
+
+	run("vector.copy","float[1250]",benchVectorCopy,scaled(500000));
+	run("vector.copyTo","float[1250]",benchVectorCopyTo,scaled(500000));
+	run("vector.segment","float[148]",benchVectorSegment,scaled(5000000));
+
+	if (selected("udp.loopback")) {
+		gUDPReceiver = new UDPSocket(gUDPPort+1);
+		gUDPSender = new UDPSocket(gUDPPort,"127.0.0.1",gUDPPort+1);
+		run("udp.loopback","158 bytes",benchUDP,scaled(100000));
+		delete gUDPSender;
+		delete gUDPReceiver;
+	}
+
+	// LOG(INFO) with the level at NOTICE, then at INFO into /dev/null.
+	run("log.disabled","INFO<NOTICE",benchLog,scaled(1000000));
+	FILE *devNull = fopen("/dev/null","w");
+	if (devNull && selected("log.enabled")) {
+		gSetLogFile(devNull);
+		gConfig.set("Log.Level","INFO");
+		run("log.enabled","/dev/null",benchLog,scaled(100000));
+		gConfig.set("Log.Level","NOTICE");
+		gSetLogFile(stderr);
+	}
+
+	run("config.getNum","defined",benchGetNum,scaled(1000000));
+	run("config.defines","undefined",benchDefines,scaled(1000000));
+
+	return 0;
+}
+
+
+// vim: ts=4 sw=4
@@ -0,0 +1,103 @@
+/*
+* Copyright 2010 Free Software Foundation, Inc.
+*
+* This software is distributed under the terms of the GNU Affero Public License.
+* See the COPYING file in the main directory for details.
+*
+* This use of this software may be subject to additional restrictions.
+* See the LEGAL file in the main directory for details.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef COPYONWRITE_H
+#define COPYONWRITE_H
+
+
+/**
+	A reference-counted container value with copy-on-write.
+
+	A table keeps its contents in one of these and hands out copies as snapshots.
+	Taking a snapshot only bumps a counter, and the snapshot stays unchanged and
+	readable without any lock for as long as it is held.  The table's next write
+	copies the contents first if a snapshot still shares them, so writers never
+	wait for a slow reader, and nothing is copied when no snapshot is out.
+
+	Taking snapshots and writing must be serialized by the owner's lock.
+	Snapshots may be copied and destroyed from any thread without it.
+*/
+template <class T>
+class CopyOnWrite {
+
+	private:
+
+	struct Body {
+		T mData;
+		volatile int mRefs;
+		Body():mRefs(1) {}
+		Body(const T& wData):mData(wData),mRefs(1) {}
+	};
+
+	Body *mBody;
+
+	void release()
+	{
+		if (__sync_sub_and_fetch(&mBody->mRefs,1)==0) delete mBody;
+	}
+
+	public:
+
+	CopyOnWrite():mBody(new Body) {}
+
+	CopyOnWrite(const CopyOnWrite& other)
+		:mBody(other.mBody)
+	{ __sync_add_and_fetch(&mBody->mRefs,1); }
+
+	~CopyOnWrite() { release(); }
+
+	CopyOnWrite& operator=(const CopyOnWrite& other)
+	{
+		if (other.mBody==mBody) return *this;
+		__sync_add_and_fetch(&other.mBody->mRefs,1);
+		release();
+		mBody = other.mBody;
+		return *this;
+	}
+
+	/** Read access; valid until the next write through this object. */
+	const T& read() const { return mBody->mData; }
+
+	const T& operator*() const { return mBody->mData; }
+	const T* operator->() const { return &mBody->mData; }
+
+	/** Write access, copying the contents first if a snapshot shares them. */
+	T& write()
+	{
+		if (mBody->mRefs > 1) {
+			Body *copy = new Body(mBody->mData);
+			release();
+			mBody = copy;
+		}
+		return mBody->mData;
+	}
+
+	/** True if a snapshot shares the contents. */
+	bool shared() const { return mBody->mRefs > 1; }
+};
+
+
+#endif
+// vim: ts=4 sw=4
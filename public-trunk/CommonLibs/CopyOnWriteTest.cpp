@@ -0,0 +1,78 @@
+/*
+* Copyright 2010 Free Software Foundation, Inc.
+*
+* This software is distributed under the terms of the GNU Affero Public License.
+* See the COPYING file in the main directory for details.
+*
+* This use of this software may be subject to additional restrictions.
+* See the LEGAL file in the main directory for details.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include "CopyOnWrite.h"
+#include "Threads.h"
+#include <iostream>
+#include <map>
+
+using namespace std;
+
+
+typedef map<int,int> IntMap;
+
+CopyOnWrite<IntMap> gTable;
+Mutex gLock;
+
+
+void *writer(void*)
+{
+	for (int i=0; i<100000; i++) {
+		gLock.lock();
+		gTable.write()[i%1000] = i;
+		gLock.unlock();
+	}
+	return NULL;
+}
+
+
+int main(int argc, char *argv[])
+{
+	gTable.write()[1] = 1;
+
+	// A snapshot does not see later writes.
+	CopyOnWrite<IntMap> snap = gTable;
+	cout << "shared after snapshot: " << gTable.shared() << endl;
+	gTable.write()[2] = 2;
+	cout << "shared after write: " << gTable.shared() << endl;
+	cout << "table size " << gTable->size() << ", snapshot size " << snap->size() << endl;
+
+	// Snapshots taken under the lock stay consistent while a writer runs.
+	Thread thread;
+	thread.start(writer,NULL);
+	for (int i=0; i<1000; i++) {
+		gLock.lock();
+		CopyOnWrite<IntMap> view = gTable;
+		gLock.unlock();
+		size_t size = view->size();
+		IntMap::const_iterator p = view->begin();
+		size_t count = 0;
+		while (p!=view->end()) { ++count; ++p; }
+		if (count!=size) cout << "inconsistent snapshot " << count << " " << size << endl;
+	}
+	thread.join();
+	cout << "final size " << gTable->size() << endl;
+}
@@ -28,6 +28,7 @@
 
 #include "Timeval.h"
 #include "Threads.h"
+#include "AllocTracking.h"
 #include "LinkedLists.h"
 #include <map>
 #include <vector>
@@ -53,6 +54,10 @@ template <class T> class InterthreadQueue {
 
 	public:
 
+	InterthreadQueue()
+		:mLock("InterthreadQueue")
+	{ }
+
 	/** Delete contents. */
 	void clear()
 	{
@@ -148,6 +153,10 @@ template <class T> class InterthreadQueueWithWait {
 
 	public:
 
+	InterthreadQueueWithWait()
+		:mLock("InterthreadQueueWithWait")
+	{ }
+
 	/** Delete contents. */
 	void clear()
 	{
@@ -240,6 +249,131 @@ template <class T> class InterthreadQueueWithWait {
 
 
 
+/**
+	Bounded ring of pointers between exactly one writer thread and one reader thread.
+	Writes and reads do not lock; the lock is taken only to put an idle reader
+	to sleep and to wake it up.  A full ring refuses writes rather than blocking,
+	so a writer that must keep pace with hardware never waits on its reader.
+*/
+template <class T> class InterthreadRing {
+
+	private:
+
+	T** mBuf;
+	unsigned mMask;			///< capacity-1, capacity is a power of two
+	volatile unsigned mHead;	///< count of writes, advanced only by the writer
+	volatile unsigned mTail;	///< count of reads, advanced only by the reader
+	volatile unsigned mWaiting;	///< nonzero while the reader is asleep
+	AllocCounters *mAllocOwner;	///< where mBuf was counted, see AllocTracking.h
+	mutable Mutex mLock;
+	mutable Signal mWriteSignal;
+
+	/** No copies. */
+	InterthreadRing(const InterthreadRing&);
+	InterthreadRing& operator=(const InterthreadRing&);
+
+	public:
+
+	/** @param wCapacity Minimum capacity, rounded up to a power of two. */
+	InterthreadRing(unsigned wCapacity=64)
+		:mHead(0),mTail(0),mWaiting(0),mLock("InterthreadRing")
+	{
+		unsigned capacity = 2;
+		while (capacity<wCapacity) capacity <<= 1;
+		mBuf = new T*[capacity];
+		mAllocOwner = gAllocNew(capacity*sizeof(T*));
+		mMask = capacity-1;
+	}
+
+	/** Delete contents.  Only safe when neither side is running. */
+	virtual ~InterthreadRing()
+	{
+		while (T* val = readNoBlock()) delete val;
+		gAllocDelete(mAllocOwner,(mMask+1)*sizeof(T*));
+		delete[] mBuf;
+	}
+
+	unsigned capacity() const { return mMask+1; }
+
+	/** Number of entries; exact only from the reader or the writer. */
+	unsigned size() const
+	{
+		__sync_synchronize();
+		return mHead - mTail;
+	}
+
+	/**
+		Non-blocking write.  Writer thread only.
+		@return false if the ring is full; the caller keeps val.
+	*/
+	bool write(T* val)
+	{
+		unsigned head = mHead;
+		if (head - mTail > mMask) return false;
+		mBuf[head & mMask] = val;
+		// Publish the entry before the index, and the index before checking for a sleeper.
+		__sync_synchronize();
+		mHead = head+1;
+		__sync_synchronize();
+		if (mWaiting) {
+			mLock.lock();
+			mWriteSignal.signal();
+			mLock.unlock();
+		}
+		return true;
+	}
+
+	/**
+		Non-blocking read.  Reader thread only.
+		@return Pointer to object or NULL if the ring is empty.
+	*/
+	T* readNoBlock()
+	{
+		unsigned tail = mTail;
+		if (tail == mHead) return NULL;
+		__sync_synchronize();
+		T* retVal = mBuf[tail & mMask];
+		__sync_synchronize();
+		mTail = tail+1;
+		return retVal;
+	}
+
+	/**
+		Wait for the ring to become non-empty.  Reader thread only.
+		@param timeout The wait timeout in ms.
+		@return true if there is something to read.
+	*/
+	bool wait(unsigned timeout)
+	{
+		if (size()>0) return true;
+		if (timeout==0) return false;
+		Timeval waitTime(timeout);
+		mLock.lock();
+		mWaiting = 1;
+		// A writer that missed the flag has already moved mHead, which we see here.
+		__sync_synchronize();
+		while ((size()==0) && (!waitTime.passed()))
+			mWriteSignal.wait(mLock,waitTime.remaining());
+		mWaiting = 0;
+		mLock.unlock();
+		return size()>0;
+	}
+
+	/**
+		Blocking read with a timeout.  Reader thread only.
+		@param timeout The read timeout in ms.
+		@return Pointer to object or NULL on timeout.
+	*/
+	T* read(unsigned timeout)
+	{
+		wait(timeout);
+		return readNoBlock();
+	}
+
+};
+
+
+
 
 
 /** Thread-safe map of pointers to class D, keyed by class K. */
@@ -254,6 +388,10 @@ protected:
 
 public:
 
+	InterthreadMap()
+		:mLock("InterthreadMap")
+	{ }
+
 	void clear()
 	{
 		mLock.lock();
@@ -460,6 +598,10 @@ template <class T, class C = std::vector<T*>, class Cmp = PointerCompare<T> > cl
 
 	public:
 
+	InterthreadPriorityQueue()
+		:mLock("InterthreadPriorityQueue")
+	{ }
+
 
 	/** Clear the FIFO. */
 	void clear()
@@ -539,7 +681,7 @@ class Semaphore {
 	public:
 
 	Semaphore()
-		:mFlag(false)
+		:mFlag(false),mLock("Semaphore")
 	{ }
 
 	void post()
@@ -34,6 +34,7 @@ using namespace std;
 
 InterthreadQueue<int> gQ;
 InterthreadMap<int,int> gMap;
+InterthreadRing<int> gRing(8);
 
 void* qWriter(void*)
 {
@@ -89,6 +90,36 @@ void* mapReader(void*)
 
 
 
+void* ringWriter(void*)
+{
+	for (int i=0; i<20; i++) {
+		int *p = new int;
+		*p = i;
+		// The ring refuses writes when full; the writer decides what to do.
+		while (!gRing.write(p)) usleep(1000);
+		COUT("ring write " << *p);
+		if (random()%2) sleep(1);
+	}
+	int *p = new int;
+	*p = -1;
+	while (!gRing.write(p)) usleep(1000);
+	return NULL;
+}
+
+void* ringReader(void*)
+{
+	int expected = 0;
+	bool done = false;
+	while (!done) {
+		int *p = gRing.read(500);
+		if (!p) continue;
+		COUT("ring read " << *p);
+		if (*p<0) done=true;
+		else if (*p!=expected++) COUT("ring out of order, expected " << expected-1);
+		delete p;
+	}
+	return NULL;
+}
 
 
 
@@ -98,16 +129,22 @@ int main(int argc, char *argv[])
 	qReaderThread.start(qReader,NULL);
 	Thread mapReaderThread;
 	mapReaderThread.start(mapReader,NULL);
+	Thread ringReaderThread;
+	ringReaderThread.start(ringReader,NULL);
 
 	Thread qWriterThread;
 	qWriterThread.start(qWriter,NULL);
 	Thread mapWriterThread;
 	mapWriterThread.start(mapWriter,NULL);
+	Thread ringWriterThread;
+	ringWriterThread.start(ringWriter,NULL);
 
 	qReaderThread.join();
 	qWriterThread.join();
 	mapReaderThread.join();
 	mapWriterThread.join();
+	ringReaderThread.join();
+	ringWriterThread.join();
 }
 
 
@@ -26,6 +26,7 @@
 
 
 #include "LinkedLists.h"
+#include "AllocTracking.h"
 
 
 
@@ -60,7 +61,11 @@ void* PointerFIFO::get()
 
 ListNode *PointerFIFO::allocate()
 {
-	if (mFreeList==NULL) return new ListNode;
+	if (mFreeList==NULL) {
+		// Nodes stay in the pool for the life of the FIFO, so they are never counted as released.
+		gAllocNew(sizeof(ListNode));
+		return new ListNode;
+	}
 	ListNode* retVal = mFreeList;
 	mFreeList = mFreeList->next();
 	return retVal;
@@ -39,7 +39,7 @@ extern ConfigurationTable gConfig;
 
 
 /** The global logging lock. */
-static Mutex gLogLock;
+static Mutex gLogLock("gLogLock");
 
 
 
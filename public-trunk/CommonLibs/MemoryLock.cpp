@@ -0,0 +1,182 @@
+/*
+* Copyright 2010 Free Software Foundation, Inc.
+*
+* This software is distributed under the terms of the GNU Affero Public License.
+* See the COPYING file in the main directory for details.
+*
+* This use of this software may be subject to additional restrictions.
+* See the LEGAL file in the main directory for details.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+
+#include "MemoryLock.h"
+#include "Threads.h"
+
+#include <sys/mman.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <alloca.h>
+#include <iomanip>
+#include <map>
+
+using namespace std;
+
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0x40000
+#endif
+
+/** Size of a hugepage; sample buffers are rounded up to this. */
+#define HUGEPAGESIZE (2*1024*1024)
+
+/** Offset of user data in a sample buffer; the header holds the mapping length. */
+#define SAMPLEBUFFERHEADER 64
+
+
+static bool sDeterministicMemory = false;
+
+
+bool gEnableDeterministicMemory()
+{
+	sDeterministicMemory = true;
+	return mlockall(MCL_CURRENT|MCL_FUTURE)==0;
+}
+
+
+bool gDeterministicMemory()
+{
+	return sDeterministicMemory;
+}
+
+
+void gPrefaultStack(size_t wBytes)
+{
+	static const size_t pageSize = sysconf(_SC_PAGESIZE);
+	volatile char *stack = (volatile char*)alloca(wBytes);
+	for (size_t i=0; i<wBytes; i+=pageSize) stack[i] = 0;
+}
+
+
+void* gAllocSampleBuffer(size_t wBytes)
+{
+	size_t length = wBytes + SAMPLEBUFFERHEADER;
+	void *base = MAP_FAILED;
+	if (sDeterministicMemory) {
+		size_t hugeLength = ((length + HUGEPAGESIZE - 1)/HUGEPAGESIZE)*HUGEPAGESIZE;
+		base = mmap(NULL,hugeLength,PROT_READ|PROT_WRITE,
+				MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+		if (base!=MAP_FAILED) length = hugeLength;
+	}
+	if (base==MAP_FAILED) {
+		base = mmap(NULL,length,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+		if (base==MAP_FAILED) return NULL;
+	}
+	if (sDeterministicMemory) {
+		// Write every page now so the radio path never takes the fault.
+		memset(base,0,length);
+		mlock(base,length);
+	}
+	*(size_t*)base = length;
+	return (char*)base + SAMPLEBUFFERHEADER;
+}
+
+
+void gFreeSampleBuffer(void* buffer)
+{
+	if (!buffer) return;
+	char *base = (char*)buffer - SAMPLEBUFFERHEADER;
+	munmap(base,*(size_t*)base);
+}
+
+
+
+/** Read the name and fault counters of one task from /proc. */
+static bool readTaskFaults(const char* tid, string& name, unsigned long& minor, unsigned long& major)
+{
+	char path[64];
+	snprintf(path,sizeof(path),"/proc/self/task/%s/stat",tid);
+	FILE *fp = fopen(path,"r");
+	if (!fp) return false;
+	char buf[512];
+	size_t n = fread(buf,1,sizeof(buf)-1,fp);
+	fclose(fp);
+	buf[n] = '\0';
+	// The name is parenthesized and may contain spaces.
+	char *open = strchr(buf,'(');
+	char *close = strrchr(buf,')');
+	if (!open || !close || close<open) return false;
+	name.assign(open+1,close-open-1);
+	// state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt
+	char state;
+	int ppid, pgrp, session, tty, tpgid;
+	unsigned flags;
+	unsigned long cminor;
+	int count = sscanf(close+1," %c %d %d %d %d %d %u %lu %lu %lu",
+		&state,&ppid,&pgrp,&session,&tty,&tpgid,&flags,&minor,&cminor,&major);
+	return count==10;
+}
+
+
+unsigned long gPageFaultReport(ostream& os, bool sinceLast)
+{
+	typedef map<int,pair<unsigned long,unsigned long> > FaultMap;
+	static FaultMap sLast;
+	static Mutex sLock;
+
+	DIR *dir = opendir("/proc/self/task");
+	if (!dir) {
+		os << "cannot open /proc/self/task" << endl;
+		return 0;
+	}
+
+	sLock.lock();
+	unsigned long total = 0;
+	os << setw(8) << "TID" << " " << setw(16) << left << "name" << right
+		<< setw(10) << "minor" << setw(10) << "major" << endl;
+	struct dirent *entry;
+	while ((entry=readdir(dir))!=NULL) {
+		if (entry->d_name[0]=='.') continue;
+		string name;
+		unsigned long minor, major;
+		if (!readTaskFaults(entry->d_name,name,minor,major)) continue;
+		int tid = atoi(entry->d_name);
+		unsigned long reportMinor = minor;
+		unsigned long reportMajor = major;
+		if (sinceLast) {
+			FaultMap::const_iterator prev = sLast.find(tid);
+			if (prev!=sLast.end()) {
+				reportMinor -= prev->second.first;
+				reportMajor -= prev->second.second;
+			}
+			sLast[tid] = pair<unsigned long,unsigned long>(minor,major);
+		}
+		total += reportMinor + reportMajor;
+		os << setw(8) << tid << " " << setw(16) << left << name << right
+			<< setw(10) << reportMinor << setw(10) << reportMajor << endl;
+	}
+	sLock.unlock();
+	closedir(dir);
+	return total;
+}
+
+
+// vim: ts=4 sw=4
@@ -0,0 +1,78 @@
+/*
+* Copyright 2010 Free Software Foundation, Inc.
+*
+* This software is distributed under the terms of the GNU Affero Public License.
+* See the COPYING file in the main directory for details.
+*
+* This use of this software may be subject to additional restrictions.
+* See the LEGAL file in the main directory for details.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef MEMORYLOCK_H
+#define MEMORYLOCK_H
+
+#include <stddef.h>
+#include <ostream>
+
+
+/**@name Deterministic-memory mode.
+	When enabled, all current and future pages are locked into RAM,
+	new thread stacks are prefaulted when the thread starts, and sample
+	buffers are placed on hugepages where the kernel has them reserved.
+	The goal is zero page faults once the radio path is running.
+*/
+//@{
+
+/**
+	Enable deterministic-memory mode for this process.
+	Call this early in main(), before any threads are started.
+	@return true if mlockall() succeeded; the mode is enabled either way.
+*/
+bool gEnableDeterministicMemory();
+
+/** Return true if deterministic-memory mode is enabled. */
+bool gDeterministicMemory();
+
+/** Touch the next wBytes of the calling thread's stack so it is resident. */
+void gPrefaultStack(size_t wBytes);
+
+/**
+	Allocate a zeroed, 64-byte aligned buffer for time-critical sample data.
+	In deterministic-memory mode the buffer is taken from hugepages if
+	available, and is prefaulted and locked.
+	@param wBytes The size of the buffer.
+	@return The buffer, or NULL on failure.
+*/
+void* gAllocSampleBuffer(size_t wBytes);
+
+/** Release a buffer obtained from gAllocSampleBuffer. */
+void gFreeSampleBuffer(void* buffer);
+
+/**
+	Write a per-thread table of minor and major page faults.
+	@param os The output stream.
+	@param sinceLast If true, report counts since the previous call with sinceLast set.
+	@return The total number of faults reported.
+*/
+unsigned long gPageFaultReport(std::ostream& os, bool sinceLast=false);
+
+//@}
+
+
+#endif
+// vim: ts=4 sw=4
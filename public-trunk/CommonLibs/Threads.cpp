@@ -27,15 +27,26 @@
 
 #include "Threads.h"
 #include "Timeval.h"
+#include "MemoryLock.h"
 
 #include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+#include <sys/prctl.h>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <algorithm>
 
 using namespace std;
 
 
 
 
-Mutex gStreamLock;		///< Global lock to control access to cout and cerr.
+Mutex gStreamLock("gStreamLock");		///< Global lock to control access to cout and cerr.
 
 void lockCout()
 {
@@ -71,8 +82,153 @@ void unlockCerr()
 
 
 
-Mutex::Mutex()
+volatile bool gLockProfiling = false;
+
+
+/** Number of histogram buckets; bucket N>0 counts times of 2^(N-1) to 2^N-1 us. */
+#define LOCKHISTBUCKETS 20
+
+/** Statistics shared by all the Mutexes of one name. */
+struct LockStats {
+	const char *name;
+	LockStats *next;						///< next in sLockStatsList
+	unsigned long long acquisitions;
+	unsigned long long contended;			///< acquisitions that had to wait
+	unsigned long long signalWaits;			///< Signal waits that released the lock
+	unsigned long long waitTotal;			///< total wait for contended acquisitions, us
+	unsigned long long holdTotal;			///< total hold time, us
+	unsigned waitMax;
+	unsigned holdMax;
+	pthread_t holdMaxOwner;					///< thread that held it for holdMax
+	pthread_t lastBlocker;					///< thread holding it at the last contended acquisition
+	unsigned waitHist[LOCKHISTBUCKETS];
+	unsigned holdHist[LOCKHISTBUCKETS];
+};
+
+// The list is built on first use, not at static initialization,
+// so that global Mutexes can be named in any order.
+static pthread_mutex_t sLockStatsLock = PTHREAD_MUTEX_INITIALIZER;
+static LockStats *sLockStatsList = NULL;
+
+/** Find or create the statistics for a lock name.  They are never deleted. */
+static LockStats *findLockStats(const char *name)
+{
+	pthread_mutex_lock(&sLockStatsLock);
+	LockStats *stats = sLockStatsList;
+	while (stats && strcmp(stats->name,name)) stats = stats->next;
+	if (!stats) {
+		stats = new LockStats;
+		memset(stats,0,sizeof(LockStats));
+		stats->name = name;
+		stats->next = sLockStatsList;
+		sLockStatsList = stats;
+	}
+	pthread_mutex_unlock(&sLockStatsLock);
+	return stats;
+}
+
+static unsigned long long usNow()
+{
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec*1000000ULL + tv.tv_usec;
+}
+
+/** Microseconds since a usNow() time, 0 if the clock stepped back. */
+static unsigned usSince(unsigned long long then)
+{
+	unsigned long long now = usNow();
+	if (now<then) return 0;
+	unsigned long long delta = now-then;
+	return delta>0xffffffffULL ? 0xffffffffU : (unsigned)delta;
+}
+
+static unsigned histBucket(unsigned us)
+{
+	unsigned bucket = 0;
+	while (us && bucket<LOCKHISTBUCKETS-1) { us >>= 1; bucket++; }
+	return bucket;
+}
+
+/** Record a time in a histogram, a total and a maximum; true if it is a new maximum. */
+static bool recordTime(unsigned us, unsigned *hist, unsigned long long &total, unsigned &max)
+{
+	__sync_fetch_and_add(&hist[histBucket(us)],1);
+	__sync_fetch_and_add(&total,(unsigned long long)us);
+	unsigned old = max;
+	while (us>old) {
+		if (__sync_bool_compare_and_swap(&max,old,us)) return true;
+		old = max;
+	}
+	return false;
+}
+
+static void printHist(ostream& os, const unsigned *hist)
+{
+	for (unsigned i=0; i<LOCKHISTBUCKETS; i++) {
+		if (!hist[i]) continue;
+		if (i==LOCKHISTBUCKETS-1) os << " >=" << (1U<<(i-1)) << "us:" << hist[i];
+		else os << " <" << (1U<<i) << "us:" << hist[i];
+	}
+}
+
+static bool hotter(const LockStats *a, const LockStats *b)
+{
+	if (a->contended != b->contended) return a->contended > b->contended;
+	return a->waitTotal > b->waitTotal;
+}
+
+void gLockProfilingReport(ostream& os)
 {
+	vector<const LockStats*> all;
+	pthread_mutex_lock(&sLockStatsLock);
+	for (const LockStats *stats = sLockStatsList; stats; stats = stats->next) all.push_back(stats);
+	pthread_mutex_unlock(&sLockStatsLock);
+	sort(all.begin(),all.end(),hotter);
+
+	os << "lock profiling " << (gLockProfiling ? "on" : "off") << endl;
+	for (unsigned i=0; i<all.size(); i++) {
+		const LockStats *stats = all[i];
+		if (!stats->acquisitions) continue;
+		os << stats->name << ": " << stats->acquisitions << " acquisitions, "
+			<< stats->contended << " contended (" << 100*stats->contended/stats->acquisitions << "%), "
+			<< stats->signalWaits << " signal waits" << endl;
+		if (stats->contended) {
+			os << "  wait: " << stats->waitTotal/stats->contended << " us mean, " << stats->waitMax << " us max,"
+				<< " last blocked by thread " << stats->lastBlocker << endl;
+			os << "  wait histogram:";
+			printHist(os,stats->waitHist);
+			os << endl;
+		}
+		os << "  hold: " << stats->holdTotal << " us total, " << stats->holdMax << " us max"
+			<< " by thread " << stats->holdMaxOwner << endl;
+		os << "  hold histogram:";
+		printHist(os,stats->holdHist);
+		os << endl;
+	}
+}
+
+void gLockProfilingClear()
+{
+	pthread_mutex_lock(&sLockStatsLock);
+	for (LockStats *stats = sLockStatsList; stats; stats = stats->next) {
+		const char *name = stats->name;
+		LockStats *next = stats->next;
+		memset(stats,0,sizeof(LockStats));
+		stats->name = name;
+		stats->next = next;
+	}
+	pthread_mutex_unlock(&sLockStatsLock);
+}
+
+
+
+void Mutex::init()
+{
+	mStats = NULL;
+	mDepth = 0;
+	mAcquired = 0;
+	mOwner = (pthread_t)0;
 	pthread_mutexattr_init(&mAttribs);
 	int s = pthread_mutexattr_settype(&mAttribs,PTHREAD_MUTEX_RECURSIVE);
 	assert(s==0);
@@ -80,6 +236,75 @@ Mutex::Mutex()
 }
 
 
+Mutex::Mutex()
+	:mName(NULL)
+{
+	init();
+}
+
+
+Mutex::Mutex(const char *wName)
+	:mName(wName)
+{
+	init();
+}
+
+
+void Mutex::profiledLock()
+{
+	if (!mStats) mStats = findLockStats(mName);
+	LockStats *stats = mStats;
+	if (pthread_mutex_trylock(&mMutex)==0) {
+		__sync_fetch_and_add(&stats->acquisitions,1ULL);
+	} else {
+		pthread_t blocker = mOwner;
+		unsigned long long start = usNow();
+		pthread_mutex_lock(&mMutex);
+		unsigned waited = usSince(start);
+		__sync_fetch_and_add(&stats->acquisitions,1ULL);
+		__sync_fetch_and_add(&stats->contended,1ULL);
+		recordTime(waited,stats->waitHist,stats->waitTotal,stats->waitMax);
+		stats->lastBlocker = blocker;
+	}
+	// The hold time runs from the outermost lock to the matching unlock.
+	if (mDepth++ == 0) {
+		mOwner = pthread_self();
+		mAcquired = usNow();
+	}
+}
+
+
+void Mutex::profiledUnlock()
+{
+	if (--mDepth == 0) {
+		LockStats *stats = mStats;
+		if (recordTime(usSince(mAcquired),stats->holdHist,stats->holdTotal,stats->holdMax))
+			stats->holdMaxOwner = mOwner;
+	}
+	pthread_mutex_unlock(&mMutex);
+}
+
+
+unsigned Mutex::suspendHold()
+{
+	unsigned depth = mDepth;
+	LockStats *stats = mStats;
+	__sync_fetch_and_add(&stats->signalWaits,1ULL);
+	if (recordTime(usSince(mAcquired),stats->holdHist,stats->holdTotal,stats->holdMax))
+		stats->holdMaxOwner = mOwner;
+	mDepth = 0;
+	return depth;
+}
+
+
+void Mutex::resumeHold(unsigned depth)
+{
+	mDepth = depth;
+	mOwner = pthread_self();
+	mAcquired = usNow();
+}
+
+
 Mutex::~Mutex()
 {
 	pthread_mutex_destroy(&mMutex);
@@ -94,7 +319,26 @@ void Signal::wait(Mutex& wMutex, unsigned timeout) const
 {
 	Timeval then(timeout);
 	struct timespec waitTime = then.timespec();
+	if (!wMutex.mDepth) {
+		pthread_cond_timedwait(&mSignal,&wMutex.mMutex,&waitTime);
+		return;
+	}
+	// A profiled lock is not held during the wait.
+	unsigned depth = wMutex.suspendHold();
 	pthread_cond_timedwait(&mSignal,&wMutex.mMutex,&waitTime);
+	wMutex.resumeHold(depth);
+}
+
+
+void Signal::wait(Mutex& wMutex) const
+{
+	if (!wMutex.mDepth) {
+		pthread_cond_wait(&mSignal,&wMutex.mMutex);
+		return;
+	}
+	unsigned depth = wMutex.suspendHold();
+	pthread_cond_wait(&mSignal,&wMutex.mMutex);
+	wMutex.resumeHold(depth);
 }
 
 ThreadSemaphore::Result ThreadSemaphore::wait(unsigned timeoutMs)
@@ -159,7 +403,157 @@ ThreadSemaphore::Result ThreadSemaphore::post()
 	return TSEM_OK;
 }
 
-void Thread::start(void *(*task)(void*), void *arg)
+/** A registered thread; it lives from Thread::start() until its task returns. */
+struct ThreadEntry {
+	ThreadEntry *next;					///< next in sThreadList
+	void *(*task)(void*);
+	void *arg;							///< task argument, the owning object
+	const char *role;
+	size_t stackSize;
+	volatile pid_t tid;					///< kernel thread ID, 0 until the thread runs
+	volatile unsigned beat;				///< time of the last heartbeat, ms, or 0 for none yet
+	volatile bool idle;					///< waiting for input since the last heartbeat
+	bool stalled;						///< found stalled by the last gThreadStallCheck()
+};
+
+// The registry is plain pthreads and POD, since threads start
+// from the constructors of global objects.
+static pthread_mutex_t sThreadListLock = PTHREAD_MUTEX_INITIALIZER;
+static ThreadEntry *sThreadList = NULL;
+
+/** The calling thread's registry entry, or NULL for threads not started by Thread. */
+static __thread ThreadEntry *tThreadEntry = NULL;
+
+/** A millisecond clock; only differences are meaningful. */
+static unsigned msNow()
+{
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec*1000U + tv.tv_usec/1000U;
+}
+
+
+void gThreadHeartbeat()
+{
+	ThreadEntry *entry = tThreadEntry;
+	if (!entry) return;
+	// 0 means no heartbeat yet.
+	unsigned now = msNow();
+	entry->beat = now ? now : 1;
+	entry->idle = false;
+}
+
+
+const char *gThreadRole()
+{
+	ThreadEntry *entry = tThreadEntry;
+	return entry ? entry->role : NULL;
+}
+
+
+void gThreadIdle()
+{
+	ThreadEntry *entry = tThreadEntry;
+	if (!entry) return;
+	entry->idle = true;
+}
+
+
+/** Read CPU time in ms and context switches of one task from /proc. */
+static bool readTaskCPU(pid_t tid, unsigned long& user, unsigned long& sys,
+		unsigned long& voluntary, unsigned long& involuntary)
+{
+	static const long ticksPerSecond = sysconf(_SC_CLK_TCK);
+	char path[64];
+	snprintf(path,sizeof(path),"/proc/self/task/%d/stat",tid);
+	FILE *fp = fopen(path,"r");
+	if (!fp) return false;
+	char buf[512];
+	size_t n = fread(buf,1,sizeof(buf)-1,fp);
+	fclose(fp);
+	buf[n] = '\0';
+	// The name is parenthesized and may contain spaces.
+	char *close = strrchr(buf,')');
+	if (!close) return false;
+	// state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt cmajflt utime stime
+	unsigned long utime, stime;
+	int count = sscanf(close+1," %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",&utime,&stime);
+	if (count!=2) return false;
+	user = utime*1000/ticksPerSecond;
+	sys = stime*1000/ticksPerSecond;
+
+	snprintf(path,sizeof(path),"/proc/self/task/%d/status",tid);
+	fp = fopen(path,"r");
+	if (!fp) return false;
+	voluntary = involuntary = 0;
+	char line[128];
+	while (fgets(line,sizeof(line),fp)) {
+		sscanf(line,"voluntary_ctxt_switches: %lu",&voluntary);
+		sscanf(line,"nonvoluntary_ctxt_switches: %lu",&involuntary);
+	}
+	fclose(fp);
+	return true;
+}
+
+
+void gThreadReport(ostream& os)
+{
+	// Copy the entries so that /proc is read without the lock.
+	vector<ThreadEntry> entries;
+	pthread_mutex_lock(&sThreadListLock);
+	for (ThreadEntry *entry = sThreadList; entry; entry = entry->next) entries.push_back(*entry);
+	pthread_mutex_unlock(&sThreadListLock);
+
+	unsigned now = msNow();
+	os << setw(8) << "TID" << " " << setw(20) << left << "role" << right
+		<< setw(16) << "owner" << setw(10) << "user ms" << setw(10) << "sys ms"
+		<< setw(10) << "vol csw" << setw(10) << "invol csw" << "  heartbeat" << endl;
+	for (int i=entries.size()-1; i>=0; i--) {
+		const ThreadEntry &entry = entries[i];
+		unsigned long user=0, sys=0, voluntary=0, involuntary=0;
+		bool cpu = entry.tid && readTaskCPU(entry.tid,user,sys,voluntary,involuntary);
+		os << setw(8) << entry.tid << " " << setw(20) << left << (entry.role ? entry.role : "-") << right
+			<< setw(16) << entry.arg;
+		if (cpu) os << setw(10) << user << setw(10) << sys << setw(10) << voluntary << setw(10) << involuntary;
+		else os << setw(40) << "-";
+		os << "  ";
+		if (!entry.beat) os << "-";
+		else if (entry.idle) os << "idle";
+		else {
+			os << now - entry.beat << " ms";
+			if (entry.stalled) os << " STALLED";
+		}
+		os << endl;
+	}
+}
+
+
+void gThreadStallCheck(unsigned wDeadline, vector<string>& stalled, vector<string>& recovered)
+{
+	unsigned now = msNow();
+	pthread_mutex_lock(&sThreadListLock);
+	for (ThreadEntry *entry = sThreadList; entry; entry = entry->next) {
+		// Only service loops have heartbeats.
+		if (!entry->beat) continue;
+		unsigned age = now - entry->beat;
+		bool stall = !entry->idle && age>wDeadline;
+		if (stall==entry->stalled) continue;
+		entry->stalled = stall;
+		ostringstream desc;
+		desc << "thread " << entry->tid << " (" << (entry->role ? entry->role : "-") << ", " << entry->arg << ")";
+		if (stall) {
+			desc << " stalled, no heartbeat for " << age << " ms";
+			stalled.push_back(desc.str());
+		} else {
+			recovered.push_back(desc.str());
+		}
+	}
+	pthread_mutex_unlock(&sThreadListLock);
+}
+
+
+
+void Thread::start(void *(*task)(void*), void *arg, const char *role)
 {
 	int s;
 	assert(mThread==((pthread_t)0));
@@ -168,10 +562,54 @@ void Thread::start(void *(*task)(void*), void *arg)
 	assert(s == 0);
 	s = pthread_attr_setstacksize(&mAttrib, mStackSize);
 	assert(s == 0);
-	s = pthread_create(&mThread, &mAttrib, task, arg);
+
+	ThreadEntry *entry = new ThreadEntry;
+	memset(entry,0,sizeof(ThreadEntry));
+	entry->task = task;
+	entry->arg = arg;
+	entry->role = role;
+	entry->stackSize = mStackSize;
+	pthread_mutex_lock(&sThreadListLock);
+	entry->next = sThreadList;
+	sThreadList = entry;
+	pthread_mutex_unlock(&sThreadListLock);
+
+	s = pthread_create(&mThread, &mAttrib, run, entry);
 	assert(s == 0);
 }
 
 
+/** Stack space left untouched by the prefault, for TLS and the thread descriptor. */
+#define STACKPREFAULTRESERVE 16384
+
+void *Thread::run(void *wEntry)
+{
+	ThreadEntry *entry = (ThreadEntry*)wEntry;
+	entry->tid = syscall(SYS_gettid);
+	tThreadEntry = entry;
+	// The kernel keeps 15 characters, enough to tell threads apart in top and pagefaults.
+	if (entry->role) prctl(PR_SET_NAME,entry->role,0,0,0);
+
+	if (gDeterministicMemory()) {
+		if (entry->stackSize > 2*STACKPREFAULTRESERVE)
+			gPrefaultStack(entry->stackSize - STACKPREFAULTRESERVE);
+		else
+			gPrefaultStack(entry->stackSize/2);
+	}
+
+	void *retVal = entry->task(entry->arg);
+
+	// Deregister.
+	tThreadEntry = NULL;
+	pthread_mutex_lock(&sThreadListLock);
+	ThreadEntry **link = &sThreadList;
+	while (*link && *link!=entry) link = &(*link)->next;
+	if (*link) *link = entry->next;
+	pthread_mutex_unlock(&sThreadListLock);
+	delete entry;
+	return retVal;
+}
+
+
 
 // vim: ts=4 sw=4
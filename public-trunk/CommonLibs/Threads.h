@@ -28,6 +28,8 @@
 
 #include <pthread.h>
 #include <iostream>
+#include <string>
+#include <vector>
 #include <assert.h>
 #include <semaphore.h>
 
@@ -65,7 +67,22 @@ void unlockCout();		///< call after writing cout
 /**@defgroup C++ wrappers for pthread mechanisms. */
 //@{
 
-/** A class for recursive mutexes based on pthread_mutex. */
+/**@name Lock profiling, see Mutex. */
+//@{
+extern volatile bool gLockProfiling;	///< true to gather statistics on named Mutexes
+void gLockProfilingReport(std::ostream& os);	///< print the statistics, hottest lock first
+void gLockProfilingClear();			///< zero the statistics
+//@}
+
+struct LockStats;
+
+
+/**
+	A class for recursive mutexes based on pthread_mutex.
+	While gLockProfiling is set, a named Mutex gathers acquisition counts,
+	contention and wait and hold times; Mutexes with the same name share statistics.
+	When it is not set, the profiling costs one branch in lock() and unlock().
+*/
 class Mutex {
 
 	private:
@@ -73,15 +90,44 @@ class Mutex {
 	pthread_mutex_t mMutex;
 	pthread_mutexattr_t mAttribs;
 
+	/**@name Profiling state, changed only by the thread that holds the lock. */
+	//@{
+	const char *mName;			///< name for profiling, or NULL
+	LockStats *mStats;			///< shared statistics for mName, found on first use
+	unsigned mDepth;			///< profiled lock() calls not yet unlocked
+	unsigned long long mAcquired;	///< when the outermost profiled lock() returned, in us
+	pthread_t mOwner;			///< thread holding a profiled lock
+	//@}
+
+	void init();
+
+	/** lock() with statistics. */
+	void profiledLock();
+
+	/** unlock() with statistics. */
+	void profiledUnlock();
+
+	/** Close the hold time at the start of a Signal wait. */
+	unsigned suspendHold();
+
+	/** Reopen the hold time at the end of a Signal wait. */
+	void resumeHold(unsigned depth);
+
 	public:
 
 	Mutex();
 
+	/** A Mutex included in the lock profile under wName, which must be a constant string. */
+	Mutex(const char *wName);
+
 	~Mutex();
 
-	void lock() { pthread_mutex_lock(&mMutex); }
+	void lock() { if (gLockProfiling && mName) profiledLock(); else pthread_mutex_lock(&mMutex); }
+
+	void unlock() { if (mDepth) profiledUnlock(); else pthread_mutex_unlock(&mMutex); }
 
-	void unlock() { pthread_mutex_unlock(&mMutex); }
+	/** Set the profiling name, as for the constructor. */
+	void name(const char *wName) { mName = wName; }
 
 	friend class Signal;
 
@@ -112,8 +158,7 @@ class Signal {
 		Block for the signal.
 		Under Linux, spurious returns are possible.
 	*/
-	void wait(Mutex& wMutex) const
-		{ pthread_cond_wait(&mSignal,&wMutex.mMutex); }
+	void wait(Mutex& wMutex) const;
 
 	void signal() { pthread_cond_signal(&mSignal); }
 
@@ -181,6 +226,39 @@ class ThreadSemaphore {
 #define START_THREAD(thread,function,argument) \
 	thread.start((void *(*)(void*))function, (void*)argument);
 
+
+/**@name Thread registry.
+	Every Thread registers itself with its role and owning object while its task runs.
+	Service loops call gThreadHeartbeat() each time around, and gThreadIdle()
+	before they block for input, so the watchdog can tell a stall from an idle wait.
+*/
+//@{
+
+/** Mark the calling thread alive and busy. */
+void gThreadHeartbeat();
+
+/** Mark the calling thread as waiting for input, until the next heartbeat. */
+void gThreadIdle();
+
+/** The calling thread's role, or NULL if it has none. */
+const char *gThreadRole();
+
+/** Write a table of registered threads with CPU time, context switches and heartbeat age. */
+void gThreadReport(std::ostream& os);
+
+/**
+	Check for stalled service loops, those that have gone longer than
+	wDeadline ms without a heartbeat while not idle.
+	@param stalled Descriptions of the threads stalled since the last check.
+	@param recovered Descriptions of the threads that have recovered since the last check.
+*/
+void gThreadStallCheck(unsigned wDeadline, std::vector<std::string>& stalled, std::vector<std::string>& recovered);
+
+//@}
+
+
+struct ThreadEntry;
+
 /** A C++ wrapper for pthread threads.  */
 class Thread {
 
@@ -190,7 +268,9 @@ class Thread {
 	pthread_attr_t mAttrib;
 	// FIXME -- Can this be reduced now?
 	size_t mStackSize;
-	
+
+	/** Entry point that registers the thread, and prefaults the stack if needed, before running the task. */
+	static void *run(void *entry);
 
 	public:
 
@@ -204,8 +284,14 @@ class Thread {
 	~Thread() { int s = pthread_attr_destroy(&mAttrib); assert(s==0); }
 
 
-	/** Start the thread on a task. */
-	void start(void *(*task)(void*), void *arg);
+	/**
+		Start the thread on a task.
+		In deterministic-memory mode the stack is prefaulted first.
+		@param task The thread function.
+		@param arg Its argument, reported as the owning object.
+		@param role A constant string naming the thread in the registry and to the kernel.
+	*/
+	void start(void *(*task)(void*), void *arg, const char *role=NULL);
 
 	/** Join a thread that will stop on its own. */
 
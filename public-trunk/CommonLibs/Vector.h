@@ -32,6 +32,7 @@
 #include <string.h>
 #include <iostream>
 #include <assert.h>
+#include "AllocTracking.h"
 
 
 /**
@@ -56,6 +57,7 @@ template <class T> class Vector {
 	T* mData;		///< allocated data block, if any
 	T* mStart;		///< start of useful data
 	T* mEnd;		///< end of useful data + 1
+	AllocCounters* mAllocOwner;	///< where mData was counted, if it was, see AllocTracking.h
 
 	public:
 
@@ -73,9 +75,16 @@ template <class T> class Vector {
 	/** Change the size of the Vector, discarding content. */
 	void resize(size_t newSize)
 	{
-		if (mData!=NULL) delete[] mData;
+		if (mData!=NULL) {
+			gAllocDelete(mAllocOwner,(mEnd-mData)*sizeof(T));
+			delete[] mData;
+		}
+		mAllocOwner = NULL;
 		if (newSize==0) mData=NULL;
-		else mData = new T[newSize];
+		else {
+			mData = new T[newSize];
+			mAllocOwner = gAllocNew(newSize*sizeof(T));
+		}
 		mStart = mData;
 		mEnd = mStart + newSize;
 	}
@@ -97,29 +106,29 @@ template <class T> class Vector {
 	//@{
 
 	/** Build an empty Vector of a given size. */
-	Vector(size_t wSize=0):mData(NULL) { resize(wSize); }
+	Vector(size_t wSize=0):mData(NULL),mAllocOwner(NULL) { resize(wSize); }
 
 	/** Build a Vector by shifting the data block. */
 	Vector(Vector<T>& other)
-		:mData(other.mData),mStart(other.mStart),mEnd(other.mEnd)
+		:mData(other.mData),mStart(other.mStart),mEnd(other.mEnd),mAllocOwner(other.mAllocOwner)
 	{ other.mData=NULL; }
 
 	/** Build a Vector by copying another. */
-	Vector(const Vector<T>& other):mData(NULL) { clone(other); }
+	Vector(const Vector<T>& other):mData(NULL),mAllocOwner(NULL) { clone(other); }
 
 	/** Build a Vector with explicit values. */
 	Vector(T* wData, T* wStart, T* wEnd)
-		:mData(wData),mStart(wStart),mEnd(wEnd)
+		:mData(wData),mStart(wStart),mEnd(wEnd),mAllocOwner(NULL)
 	{ }
 
 	/** Build a vector from an existing block, NOT to be deleted upon destruction. */
 	Vector(T* wStart, size_t span)
-		:mData(NULL),mStart(wStart),mEnd(wStart+span)
+		:mData(NULL),mStart(wStart),mEnd(wStart+span),mAllocOwner(NULL)
 	{ }
 
 	/** Build a Vector by concatenation. */
 	Vector(const Vector<T>& other1, const Vector<T>& other2)
-		:mData(NULL)
+		:mData(NULL),mAllocOwner(NULL)
 	{
 		resize(other1.size()+other2.size());
 		memcpy(mStart, other1.mStart, other1.bytes());
@@ -143,6 +152,7 @@ template <class T> class Vector {
 		mData=other.mData;
 		mStart=other.mStart;
 		mEnd=other.mEnd;
+		mAllocOwner=other.mAllocOwner;
 		other.mData=NULL;
 	}
 
@@ -58,5 +58,18 @@ int main(int argc, char *argv[])
 		cout << testD << endl;
 	}
 
+	// Allocations are counted when tracking is on; aliases do not allocate.
+	gAllocTracking = true;
+	{
+		AllocScope scope(AllocL1FEC);
+		TestVector testE(100);
+		SteadyState steady;
+		TestVector testF(testE.segment(10,10));
+		testF.fill(1);
+		cout << "steady-state allocations: " << steady.allocations() << endl;
+	}
+	TestVector testG(test1,test2);
+	gAllocReport(cout);
+
 	return 0;
 }
@@ -1008,8 +1008,8 @@ void Control::EmergencyCall(const L3CMServiceRequest* req, LogicalChannel *LCH)
 	// If we got a TMSI, find the IMSI.
 	L3MobileIdentity mobileIdentity = req->mobileIdentity();
 	if (mobileIdentity.type()==TMSIType) {
-		const char *IMSI = gTMSITable.IMSI(mobileIdentity.TMSI());
-		if (IMSI) mobileIdentity = L3MobileIdentity(IMSI);
+		string IMSI = gTMSITable.IMSI(mobileIdentity.TMSI());
+		if (!IMSI.empty()) mobileIdentity = L3MobileIdentity(IMSI.c_str());
 	}
 
 	// Can't find the TMSI?  Ask for an IMSI.
@@ -33,6 +33,7 @@
 
 #include "CollectMSInfo.h"
 #include "RRLPQueryController.h"
+#include "RRLPSweep.h"
 
 namespace GSM {
 namespace RRLP {
@@ -131,6 +132,11 @@ void collectMSInfo(L3MobileIdentity mobID, LogicalChannel* LCH, bool withRRLP)
 	// RRLP Test code. we now have a channel, send a request for position
 	static const char* rrlpOnName = "GSM.RRLP";
 	PositionResult pr;
+	// An MS waiting in a location sweep is queried on this channel instead of being paged.
+	if (RRLPSweep::instance()->claim(mobID, LCH, pr)) {
+		logMSInfo(LCH, pr, mobID);
+		return;
+	}
 	if (gConfig.defines(rrlpOnName) && gConfig.getNum(rrlpOnName) == 1 && withRRLP) {
 		LOG(INFO) << "Doing RRLPQuery";
 		pr = doRRLPQuery(mobID, LCH); // FIXME: put this back in RRLP::RRLPQuery
@@ -26,6 +26,7 @@
 
 
 #include "ControlCommon.h"
+#include "SharedTMSIStore.h"
 #include <CLIParser.h>
 #include <GSMLogicalChannel.h>
 #include <GSML3Message.h>
@@ -51,6 +52,9 @@ TransactionTable gTransactionTable;
 // The global TMSI table.
 TMSITable gTMSITable;
 
+// The MO USSD session workers.
+USSDSessionManager gUSSDSessions;
+
 
 ostream& Control::operator<<(ostream& os, USSDData::USSDMessageType type)
 {
@@ -282,7 +286,7 @@ void TransactionTable::add(const TransactionEntry& value)
 {
 	LOG(INFO) << "new transaction " << value;
 	mLock.lock();
-	mTable[value.ID()]=value;
+	mTable.write()[value.ID()]=value;
 	mLock.unlock();
 }
 
@@ -292,12 +296,12 @@ void TransactionTable::update(const TransactionEntry& value)
 	// ID==0 is a non-valid special case.
 	assert(value.ID());
 	mLock.lock();
-	if (mTable.find(value.ID())==mTable.end()) {
+	if (mTable->find(value.ID())==mTable->end()) {
 		mLock.unlock();
 		LOG(WARN) << "attempt to update non-existent transaction entry with key " << value.ID();
 		return;
 	}
-	mTable[value.ID()]=value;
+	mTable.write()[value.ID()]=value;
 	mLock.unlock();
 }
 
@@ -309,18 +313,18 @@ bool TransactionTable::find(unsigned key, TransactionEntry& target)
 	// ID==0 is a non-valid special case.
 	assert(key);
 	mLock.lock();
-	TransactionMap::iterator itr = mTable.find(key);
-	if (itr==mTable.end()) {
+	TransactionMap::const_iterator itr = mTable->find(key);
+	if (itr==mTable->end()) {
 		mLock.unlock();
 		return false;
 	}
 	if (itr->second.dead()) {
-		mTable.erase(itr);
+		mTable.write().erase(key);
 		mLock.unlock();
 		return false;
 	}
-	mLock.unlock();
 	target = itr->second;
+	mLock.unlock();
 	return true;
 }
 
@@ -331,7 +335,8 @@ bool TransactionTable::remove(unsigned key)
 	// ID==0 is a non-valid special case.
 	assert(key);
 	mLock.lock();
-	bool retVal = mTable.erase(key);
+	bool retVal = false;
+	if (mTable->find(key)!=mTable->end()) retVal = mTable.write().erase(key);
 	mLock.unlock();
 	return retVal;
 }
@@ -341,14 +346,20 @@ bool TransactionTable::remove(unsigned key)
 void TransactionTable::clearDeadEntries()
 {
 	mLock.lock();
-	TransactionMap::iterator itr = mTable.begin();
-	while (itr!=mTable.end()) {
-		if (!itr->second.dead()) ++itr;
-		else {
-			LOG(DEBUG) << "erasing " << itr->first;
-			TransactionMap::iterator old = itr;
-			itr++;
-			mTable.erase(old);
+	// Look before writing, so a snapshot is only copied if something is really dead.
+	TransactionMap::const_iterator itr = mTable->begin();
+	while (itr!=mTable->end() && !itr->second.dead()) ++itr;
+	if (itr!=mTable->end()) {
+		TransactionMap& table = mTable.write();
+		TransactionMap::iterator witr = table.begin();
+		while (witr!=table.end()) {
+			if (!witr->second.dead()) ++witr;
+			else {
+				LOG(DEBUG) << "erasing " << witr->first;
+				TransactionMap::iterator old = witr;
+				witr++;
+				table.erase(old);
+			}
 		}
 	}
 	mLock.unlock();
@@ -367,8 +378,8 @@ bool TransactionTable::find(const L3MobileIdentity& mobileID, TransactionEntry&
 	bool foundIt = false;
 	mLock.lock();
 	clearDeadEntries();
-	TransactionMap::const_iterator itr = mTable.begin();
-	while (itr!=mTable.end()) {
+	TransactionMap::const_iterator itr = mTable->begin();
+	while (itr!=mTable->end()) {
 		const TransactionEntry& transaction = itr->second;
 		if (transaction.subscriber()==mobileID) {
 			// No need to check dead(), since we just cleared the table.
@@ -395,8 +406,8 @@ bool TransactionTable::find(const L3MobileIdentity& mobileID, GSM::L3CMServiceTy
 	bool foundIt = false;
 	mLock.lock();
 	clearDeadEntries();
-	TransactionMap::const_iterator itr = mTable.begin();
-	while (itr!=mTable.end()) {
+	TransactionMap::const_iterator itr = mTable->begin();
+	while (itr!=mTable->end()) {
 		const TransactionEntry& transaction = itr->second;
 		if (transaction.subscriber()==mobileID && transaction.service()==serviceType) {
 			// No need to check dead(), since we just cleared the table.
@@ -410,21 +421,35 @@ bool TransactionTable::find(const L3MobileIdentity& mobileID, GSM::L3CMServiceTy
 	return foundIt;
 }
 
-size_t TransactionTable::size()
+size_t TransactionTable::size() const
 {
-	return mTable.size();
+	mLock.lock();
+	size_t retVal = mTable->size();
+	mLock.unlock();
+	return retVal;
 }
 
 
-void TransactionTable::dump(ostream& os) const
+TransactionSnapshot TransactionTable::snapshot()
 {
 	mLock.lock();
-	TransactionMap::const_iterator tp = mTable.begin();
-	while (tp != mTable.end()) {
+	clearDeadEntries();
+	TransactionSnapshot retVal = mTable;
+	mLock.unlock();
+	return retVal;
+}
+
+
+void TransactionTable::dump(ostream& os, unsigned first, unsigned count)
+{
+	// Format from a snapshot, so a slow stream does not hold up call control.
+	TransactionSnapshot view = snapshot();
+	TransactionMap::const_iterator tp = view->begin();
+	for (unsigned i=0; i<first && tp!=view->end(); i++) ++tp;
+	while (tp != view->end() && count--) {
 		os << hex << "0x" << tp->first << " " << dec << tp->second << endl;
 		++tp;
 	}
-	mLock.unlock();
 }
 
 
@@ -454,7 +479,7 @@ void Control::clearTransactionHistory(unsigned transactionID)
 
 void TMSIRecord::save(unsigned TMSI, FILE* fp) const
 {
-	fprintf(fp, "%10u %10u %10u %15s %15s\n", TMSI, mCreated.sec(), mTouched.sec(), mIMSI.c_str(), mIMEI.c_str());
+	fprintf(fp, "%10u %10u %10u %15s %15s\n", TMSI, mCreated.sec(), (unsigned)mTouched, mIMSI.c_str(), mIMEI.c_str());
 }
 
 
@@ -473,25 +498,70 @@ unsigned TMSIRecord::load(FILE* fp)
 	}
 	mIMSI = IMSI;
 	mIMEI = IMEI;
-	mTouched = Timeval(touched,0);
+	mTouched = touched;
 	mCreated = Timeval(created,0);
 	return TMSI;
 }
 
 
 
+/** A TMSIRecord from a shared table slot. */
+static TMSIRecord sharedRecord(const SharedTMSISlot& slot)
+{
+	return TMSIRecord(slot.IMSI, slot.IMEI, slot.created, slot.touched, slot.registered);
+}
+
+
+bool TMSITable::share(const char* path, const L3LocationAreaIdentity& LAI, unsigned registrar)
+{
+	SharedTMSIStore *shared = new SharedTMSIStore;
+	if (!shared->open(path, gConfig.getNum("Control.TMSITable.MaxSize"), LAI)) {
+		delete shared;
+		return false;
+	}
+	mLock.lock();
+	mShared = shared;
+	mRegistrar = registrar;
+	mLock.unlock();
+	return true;
+}
+
+
+bool TMSITable::siteLAI(const L3LocationAreaIdentity& LAI) const
+{
+	return mShared && mShared->siteLAI(LAI);
+}
+
+
+void TMSITable::cache(unsigned TMSI, const TMSIRecord& record)
+{
+	mMap.write()[TMSI] = record;
+}
+
+
 unsigned TMSITable::assign(const char* IMSI, const char* IMEI)
 {
 	purge();
 	mLock.lock();
-	// Is this IMSI already in here?
-	unsigned oldTMSI = TMSI(IMSI);
-	if (oldTMSI) {
-		mLock.unlock();
-		return oldTMSI;
+	unsigned TMSI;
+	if (mShared) {
+		// The site's counter, so that TMSIs are unique across its BTSs.
+		// The shared table returns the existing TMSI if there is one.
+		SharedTMSISlot slot;
+		TMSI = mShared->assign(IMSI, IMEI, slot);
+		TMSIMap::const_iterator iter = mMap->find(TMSI);
+		if (iter==mMap->end()) cache(TMSI, sharedRecord(slot));
+		else iter->second.touch();
+	} else {
+		// Is this IMSI already in here?
+		unsigned oldTMSI = this->TMSI(IMSI);
+		if (oldTMSI) {
+			mLock.unlock();
+			return oldTMSI;
+		}
+		TMSI = mCounter++;
+		mMap.write()[TMSI] = TMSIRecord(IMSI, IMEI);
 	}
-	unsigned TMSI = mCounter++;
-	mMap[TMSI] = TMSIRecord(IMSI, IMEI);
 	mLock.unlock();
 	if (gConfig.defines("Control.TMSITable.SavePath")) save(gConfig.getStr("Control.TMSITable.SavePath"));
 	return TMSI;
@@ -501,11 +571,13 @@ unsigned TMSITable::assign(const char* IMSI, const char* IMEI)
 bool TMSITable::setIMEI(unsigned TMSI, const std::string& IMEI)
 {
 	mLock.lock();
-	TMSIMap::iterator iter = mMap.find(TMSI);
-	if (iter==mMap.end()) {
+	// Lookups do not copy shared records here, so the TMSI may be only in the shared table.
+	bool shared = mShared && mShared->setIMEI(TMSI, IMEI.c_str());
+	if (mMap->find(TMSI)==mMap->end()) {
 		mLock.unlock();
-		return false;
+		return shared;
 	}
+	TMSIMap::iterator iter = mMap.write().find(TMSI);
 	iter->second.IMEI(IMEI);
 	iter->second.touch();
 	mLock.unlock();
@@ -516,15 +588,21 @@ bool TMSITable::setIMEI(unsigned TMSI, const std::string& IMEI)
 bool TMSITable::find(unsigned TMSI, TMSIRecord& target)
 {
 	mLock.lock();
-	TMSIMap::iterator iter = mMap.find(TMSI);
-	if (iter==mMap.end()) {
-		mLock.unlock();
-		return false;
+	TMSIMap::const_iterator iter = mMap->find(TMSI);
+	if (iter==mMap->end()) {
+		// Maybe another BTS of the site assigned it.
+		SharedTMSISlot slot;
+		if (!mShared || !mShared->find(TMSI, slot)) {
+			mLock.unlock();
+			return false;
+		}
+		cache(TMSI, sharedRecord(slot));
+		iter = mMap->find(TMSI);
 	}
 	target = iter->second;
 	// Is it too old?
 	if (target.age() > 3600*gConfig.getNum("Control.TMSITable.MaxAge")) {
-		mMap.erase(iter);
+		mMap.write().erase(TMSI);
 		mLock.unlock();
 		return false;
 	}
@@ -533,14 +611,22 @@ bool TMSITable::find(unsigned TMSI, TMSIRecord& target)
 	return true;
 }
 
-const char* TMSITable::IMSI(unsigned TMSI) const
+string TMSITable::IMSI(unsigned TMSI) const
 {
 	mLock.lock();
-	TMSIMap::const_iterator iter = mMap.find(TMSI);
+	TMSIMap::const_iterator iter = mMap->find(TMSI);
+	// A copy, since a write during a snapshot replaces the map body.
+	string retVal;
+	if (iter!=mMap->end()) {
+		iter->second.touch();
+		retVal = iter->second.IMSI();
+	} else if (mShared) {
+		// Maybe another BTS of the site assigned it.
+		SharedTMSISlot slot;
+		if (mShared->find(TMSI, slot)) retVal = slot.IMSI;
+	}
 	mLock.unlock();
-	if (iter==mMap.end()) return NULL;
-	iter->second.touch();
-	return iter->second.IMSI();
+	return retVal;
 }
 
 unsigned TMSITable::TMSI(const char* IMSI) const
@@ -550,8 +636,8 @@ unsigned TMSITable::TMSI(const char* IMSI) const
 	string IMSIc(IMSI);
 	mLock.lock();
 	// brute force search
-	TMSIMap::const_iterator itr = mMap.begin();
-	while (itr!=mMap.end()) {
+	TMSIMap::const_iterator itr = mMap->begin();
+	while (itr!=mMap->end()) {
 		if (itr->second.IMSI() == IMSIc) {
 			TMSI = itr->first;
 			itr->second.touch();
@@ -559,6 +645,11 @@ unsigned TMSITable::TMSI(const char* IMSI) const
 		}
 		++itr;
 	}
+	if (!TMSI && mShared) {
+		// Maybe another BTS of the site assigned it.
+		SharedTMSISlot slot;
+		TMSI = mShared->find(IMSI, slot);
+	}
 	mLock.unlock();
 	return TMSI;
 }
@@ -569,9 +660,57 @@ unsigned TMSITable::TMSI(const char* IMSI) const
 void TMSITable::erase(unsigned TMSI)
 {
 	mLock.lock();
-	TMSIMap::iterator iter = mMap.find(TMSI);
-	if (iter!=mMap.end()) mMap.erase(iter);
+	if (mMap->find(TMSI)!=mMap->end()) mMap.write().erase(TMSI);
+	if (mShared) mShared->erase(TMSI);
+	mLock.unlock();
+}
+
+
+void TMSITable::registered(unsigned TMSI)
+{
+	mLock.lock();
+	if (mMap->find(TMSI)!=mMap->end()) mMap.write()[TMSI].registered(time(NULL));
+	if (mShared) mShared->registered(TMSI, mRegistrar);
+	mLock.unlock();
+}
+
+
+bool TMSITable::registeredRecently(unsigned TMSI, unsigned maxAge) const
+{
+	if (mShared) {
+		SharedTMSISlot slot;
+		if (!mShared->find(TMSI, slot)) return false;
+		if (!slot.registered || slot.registrar!=mRegistrar) return false;
+		return (unsigned)(time(NULL)-slot.registered) < maxAge;
+	}
+	mLock.lock();
+	TMSIMap::const_iterator iter = mMap->find(TMSI);
+	bool retVal = iter!=mMap->end() && iter->second.registered()<maxAge;
+	mLock.unlock();
+	return retVal;
+}
+
+
+void TMSITable::sharedReport(ostream& os) const
+{
+	if (mShared) mShared->report(os);
+}
+
+
+void TMSITable::clear()
+{
+	mLock.lock();
+	mMap.write().clear();
+	mLock.unlock();
+}
+
+
+TMSISnapshot TMSITable::snapshot() const
+{
+	mLock.lock();
+	TMSISnapshot retVal = mMap;
 	mLock.unlock();
+	return retVal;
 }
 
 
@@ -579,7 +718,7 @@ void TMSITable::erase(unsigned TMSI)
 
 size_t TMSITable::size() const {
 	mLock.lock();
-	size_t retVal = mMap.size();
+	size_t retVal = mMap->size();
 	mLock.unlock();
 	return retVal;
 }
@@ -590,8 +729,14 @@ void TMSITable::purge()
 	mLock.lock();
 	// We rely on the fact the TMSIs are assigned in numeric order
 	// to erase the oldest first.
-	while ( (mMap.size()>gConfig.getNum("Control.TMSITable.MaxSize")) && (mClear!=mCounter) )
-		mMap.erase(mClear++);
+	unsigned maxSize = gConfig.getNum("Control.TMSITable.MaxSize");
+	if (mShared) {
+		// Our records are a sparse subset of the site's.
+		while (mMap->size()>maxSize) mMap.write().erase(mMap->begin()->first);
+	} else {
+		while ( (mMap->size()>maxSize) && (mClear!=mCounter) )
+			mMap.write().erase(mClear++);
+	}
 	mLock.unlock();
 }
 
@@ -621,15 +766,16 @@ ostream& Control::operator<<(ostream& os, const TMSIRecord& rec)
 }
 
 
-void TMSITable::dump(ostream& os) const
+void TMSITable::dump(ostream& os, unsigned first, unsigned count) const
 {
-	mLock.lock();
-	TMSIMap::const_iterator tp = mMap.begin();
-	while (tp != mMap.end()) {
+	// Format from a snapshot, so a slow stream does not hold up location updates.
+	TMSISnapshot view = snapshot();
+	TMSIMap::const_iterator tp = view->begin();
+	for (unsigned i=0; i<first && tp!=view->end(); i++) ++tp;
+	while (tp != view->end() && count--) {
 		os << hex << "0x" << tp->first << " " << dec << tp->second << endl;
 		++tp;
 	}
-	mLock.unlock();
 }
 
 
@@ -641,13 +787,12 @@ void TMSITable::save(const char* filename) const
 		return;
 	}
 	LOG(INFO) << "saving TMSI table to " << filename;
-	mLock.lock();
-	TMSIMap::const_iterator tp = mMap.begin();
-	while (tp != mMap.end()) {
+	TMSISnapshot view = snapshot();
+	TMSIMap::const_iterator tp = view->begin();
+	while (tp != view->end()) {
 		tp->second.save(tp->first,fp);
 		++tp;
 	}
-	mLock.unlock();
 	fclose(fp);
 }
 
@@ -664,7 +809,7 @@ void TMSITable::load(const char* filename)
 		TMSIRecord val;
 		unsigned key = val.load(fp);
 		if (!key) break;
-		mMap[key] = val;
+		mMap.write()[key] = val;
 	}
 	mLock.unlock();
 	fclose(fp);
@@ -787,321 +932,300 @@ USSDHandler::ResultCode USSDHandler::postUSSDData(Control::USSDData::USSDMessage
 	return USSD_OK;
 }
 
-void *USSDHandler::runWrapper(void *pThis)
+bool USSDHandler::step()
 {
-	((USSDHandler*)pThis)->run();
-	return NULL;
+	Control::USSDData::USSDMessageType messageType;
+	std::string USSDString;
+	ResultCode result = waitUSSDData(&messageType, &USSDString, USSDHandler::trywait);
+	// Nothing posted after all.
+	if (result == USSD_TIMEOUT) return true;
+	if (result != USSD_OK) return false;
+	if (!handle(messageType, USSDString)) return false;
+	if (postUSSDData(messageType, USSDString) != USSD_OK) return false;
+	// The controller closes the transaction after sending either of these.
+	return (messageType != USSDData::response) && (messageType != USSDData::release);
 }
 
-void MOTestHandler::run()
+void USSDHandler::run()
 {
-	LOG(DEBUG) << "USSD MO Test Handler RUN";
 	while(true)
 	{
 		Control::USSDData::USSDMessageType messageType;
 		std::string USSDString;
 		if (waitUSSDData(&messageType, &USSDString, gConfig.getNum("USSD.timeout"))) break;
-		if (USSDString == ">")
-		{
-			if (mString == "")
-			{
-				messageType = USSDData::release;
-			}
-			else
-			{
-				USSDString = mString;
-				messageType = USSDData::request;
-			}
-		}
-		else if (USSDString == "*100#")
-		{
-			USSDString = "handle response ";
-			messageType = USSDData::response;
-		}
-		else if(USSDString == "*101#")
+		if (!handle(messageType, USSDString)) break;
+		postUSSDData(messageType, USSDString);
+	}
+}
+
+bool MOTestHandler::handle(Control::USSDData::USSDMessageType& messageType, std::string& USSDString)
+{
+	LOG(DEBUG) << "USSD MO Test Handler: " << USSDString;
+	if (USSDString == ">")
+	{
+		if (mString == "")
 		{
-			USSDString = "handle request String objects are a special type of container, specifically designed to operate with sequences of characters. Unlike traditional c-strings, which are mere sequences of characters in a memory array, C++ string objects belong to a class with many built-in features to operate with strings in a more intuitive way and with some additional useful features common to C++ containers. The string class is an instantiation of the basic_string class template, defined in string as:";
-			messageType = USSDData::request;
+			messageType = USSDData::release;
 		}
-		else if(USSDString == "*1011#")
+		else
 		{
-			USSDString = "handle request";
+			USSDString = mString;
 			messageType = USSDData::request;
 		}
-		else if(USSDString == "*102#")
-		{
-			USSDString = "handle notify";
-			messageType = USSDData::notify;
-		}
-		else if(USSDString == "*103#")
+	}
+	else if (USSDString == "*100#")
+	{
+		USSDString = "handle response ";
+		messageType = USSDData::response;
+	}
+	else if(USSDString == "*101#")
+	{
+		USSDString = "handle request String objects are a special type of container, specifically designed to operate with sequences of characters. Unlike traditional c-strings, which are mere sequences of characters in a memory array, C++ string objects belong to a class with many built-in features to operate with strings in a more intuitive way and with some additional useful features common to C++ containers. The string class is an instantiation of the basic_string class template, defined in string as:";
+		messageType = USSDData::request;
+	}
+	else if(USSDString == "*1011#")
+	{
+		USSDString = "handle request";
+		messageType = USSDData::request;
+	}
+	else if(USSDString == "*102#")
+	{
+		USSDString = "handle notify";
+		messageType = USSDData::notify;
+	}
+	else if(USSDString == "*103#")
+	{
+		USSDString = "";
+		messageType = USSDData::release;
+	}
+	else if(USSDString == "*104#")
+	{
+		messageType = USSDData::error;
+	}
+	else
+	{
+		messageType = USSDData::release;
+	}
+	return true;
+}
+
+bool MOHttpHandler::handle(Control::USSDData::USSDMessageType& messageType, std::string& USSDString)
+{
+	LOG(DEBUG) << "USSD MO Http Handler: " << USSDString;
+	if (USSDString == ">")
+	{
+		if (mString == "")
 		{
-			USSDString = "";
 			messageType = USSDData::release;
 		}
-		else if(USSDString == "*104#")
-		{
-			messageType = USSDData::error;
-		}
 		else
 		{
-			messageType = USSDData::release;
+			USSDString = mString;
+			messageType = USSDData::request;
 		}
-
-		postUSSDData(messageType, USSDString);
-	}	
+	}    
+	else if(USSDString == "*101#")
+	{
+		USSDString = "send command";
+		messageType = USSDData::request;
+	}
+	else 
+	{
+		char command[2048];
+		sprintf(command,"wget -T 5 -q -O - \"http://%s/http/%s&to=%s&text=%s\"",
+					gConfig.getStr("USSD.HTTP.Gateway"),
+					gConfig.getStr("USSD.HTTP.AccessString"),
+					"server", USSDString.c_str());
+		LOG(NOTICE) << "MOUSSD: send HTTP sending with " << command;
+		// HTTP "GET" method with wget.
+		char mystring [182];
+		FILE* wget = popen(command,"r");
+		if (!wget) {
+			LOG(NOTICE) << "cannot open wget with " << command;
+			USSDString = "cannot open wget";
+			messageType = USSDData::error;
+			return true;
+		}
+		if (!fgets (mystring , 182 , wget)) mystring[0] = '\0';
+		pclose(wget);
+		LOG(NOTICE) << "wget response " << mystring;
+		std::string tmpStr(mystring);
+		USSDString = tmpStr;
+		messageType = USSDData::request;
+	}
+	return true;
 }
 
-void MOHttpHandler::run()
+bool MOCLIHandler::handle(Control::USSDData::USSDMessageType& messageType, std::string& USSDString)
 {
-	LOG(DEBUG) << "USSD MO Http Handler RUN";
-	while(true)
+	LOG(DEBUG) << "USSD MO CLI Handler: " << USSDString;
+	if (USSDString == ">")
 	{
-		Control::USSDData::USSDMessageType messageType;
-		std::string USSDString;
-		if (waitUSSDData(&messageType, &USSDString, gConfig.getNum("USSD.timeout"))) break;
-
-		if (USSDString == ">")
-		{
-			if (mString == "")
-			{
-				messageType = USSDData::release;
-			}
-			else
-			{
-				USSDString = mString;
-				messageType = USSDData::request;
-			}
-		}    
-		else if(USSDString == "*101#")
+		if (mString == "")
 		{
-			USSDString = "send command";
-			messageType = USSDData::request;
+			messageType = USSDData::release;
 		}
-		else 
+		else
 		{
-			char command[2048];
-			sprintf(command,"wget -T 5 -q -O - \"http://%s/http/%s&to=%s&text=%s\"",
-						gConfig.getStr("USSD.HTTP.Gateway"),
-						gConfig.getStr("USSD.HTTP.AccessString"),
-						"server", USSDString.c_str());
-			LOG(NOTICE) << "MOUSSD: send HTTP sending with " << command;
-			// HTTP "GET" method with wget.
-			char mystring [182];
-			FILE* wget = popen(command,"r");
-			if (!wget) {
-				LOG(NOTICE) << "cannot open wget with " << command;
-				USSDString = "cannot open wget";
-				messageType = USSDData::error;
-			}
-			fgets (mystring , 182 , wget);
-			LOG(NOTICE) << "wget response " << mystring;
-			std::string tmpStr(mystring);
-			USSDString = tmpStr;
+			USSDString = mString;
 			messageType = USSDData::request;
 		}
-		postUSSDData(messageType, USSDString);
-	}	
+	}
+	else if(USSDString == "*101#")
+	{
+		USSDString = "send command";
+		messageType = USSDData::request;
+	}
+	else
+	{
+		const char* line;
+		line =  USSDString.c_str();
+		std::ostringstream os;
+		gParser.process(line, os);
+		LOG(INFO) << "Running line \"" << line << "\" returned result \"" << os.str() << "\"";
+		USSDString = os.str();
+		messageType = USSDData::request;
+	}
+	return true;
 }
 
-void MOCLIHandler::run()
+bool MTTestHandler::handle(Control::USSDData::USSDMessageType& messageType, std::string& USSDString)
 {
-	LOG(DEBUG) << "USSD MO CLI Handler RUN";
-	while(true)
+	LOG(DEBUG) << "USSD MT Test Handler: " << USSDString;
+	if(messageType == USSDData::REGrequest)
 	{
-		Control::USSDData::USSDMessageType messageType;
-		std::string USSDString;
-		if (waitUSSDData(&messageType, &USSDString, gConfig.getNum("USSD.timeout"))) break;
-	    
-		if (USSDString == ">")
+		USSDString = "REGrequest message";
+	}
+	else if(messageType == USSDData::response)
+	{
+		if (USSDString == "111")
 		{
-			if (mString == "")
-			{
-				messageType = USSDData::release;
-			}
-			else
-			{
-				USSDString = mString;
-				messageType = USSDData::request;
-			}
+			USSDString = "release message";
+			messageType = USSDData::release;
 		}
-		else if(USSDString == "*101#")
+		else if (USSDString == "100")
 		{
-			USSDString = "send command";
+			USSDString = "request message";
 			messageType = USSDData::request;
 		}
-		else
+		else if (USSDString == "101")
 		{
-			const char* line;
-			line =  USSDString.c_str();
-			std::ostringstream os;
-			std::istringstream is;
-			gParser.process(line, os);
-			LOG(INFO) << "Running line \"" << line << "\" returned result \"" << os.str() << "\"";
-			USSDString = os.str();
-			messageType = USSDData::request;
+			messageType = USSDData::error;
 		}
-		postUSSDData(messageType, USSDString);
-	}	
+		else if (USSDString == "102")
+		{
+			USSDString = "notify message";
+			messageType = USSDData::notify;
+		}
+	}
+	else
+	{
+		USSDString = "release message";
+		messageType = USSDData::release;
+	}
+	return true;
 }
 
-void MTTestHandler::run()
+bool UssdSipHandler::handle(Control::USSDData::USSDMessageType& messageType, std::string& USSDString)
 {
-	LOG(DEBUG) << "USSD MT Test Handler RUN";
-	while(true)
+	LOG(DEBUG) << "USSD SIP Handler: " << USSDString;
+	if (USSDString == ">")
 	{
-		Control::USSDData::USSDMessageType messageType;
-		std::string USSDString;
-		if (waitUSSDData(&messageType, &USSDString, gConfig.getNum("USSD.timeout"))) break;
-			
-		if(messageType == USSDData::REGrequest)
-		{
-			USSDString = "REGrequest message";
-		}
-		else if(messageType == USSDData::response)
+		if (mString == "")
 		{
-			if (USSDString == "111")
-			{
-				USSDString = "release message";
-				messageType = USSDData::release;
-			}
-			else if (USSDString == "100")
-			{
-				USSDString = "request message";
-				messageType = USSDData::request;
-			}
-			else if (USSDString == "101")
-			{
-				messageType = USSDData::error;
-			}
-			else if (USSDString == "102")
-			{
-				USSDString = "notify message";
-				messageType = USSDData::notify;
-			}
+			messageType = USSDData::release;
 		}
 		else
 		{
-			USSDString = "release message";
-			messageType = USSDData::release;
+			USSDString = mString;
+			messageType = USSDData::request;
 		}
-	
-		postUSSDData(messageType, USSDString);
+		return true;
 	}
-}
 
-void UssdSipHandler::run()
-{
-	LOG(DEBUG) << "USSD SIP Handler RUN";
-	mNum = 0;
-	while(true)
+	// Steps:
+	// 1 -- Setup SIP part of the transaction record.
+	// 2 -- Send the message to the server.
+	// 3 -- Wait for a response message and parse it.
+
+	// Step 1 -- Setup SIP part of the transaction record.
+	TransactionEntry transaction;
+	if (!gTransactionTable.find(transactionID(), transaction))
 	{
-		Control::USSDData::USSDMessageType messageType;
-		std::string USSDString;
-		unsigned timeout = 100000;
+		// Transaction not found. Something is wrong. Bail out.
+		return false;
+	}
+	SIP::SIPEngine& engine = transaction.SIP();
 
-		// Get next data string from ME
-		ResultCode result = waitUSSDData(&messageType, &USSDString, timeout);
-		if (result != USSD_OK)
-		{
-			// Operation has been canceled by ME or timed out.
-			// Finish USSD session if it hasn't been not cleared in waitUSSDData();
+	// If we got a TMSI, find the IMSI.
+	L3MobileIdentity mobileID = transaction.subscriber();
+	if (mobileID.type()==TMSIType) {
+		string IMSI = gTMSITable.IMSI(mobileID.TMSI());
+		if (!IMSI.empty()) mobileID = L3MobileIdentity(IMSI.c_str());
+		else {
+			// Something is wrong on the ME side.
 			postUSSDData(USSDData::error, "");
-
-			// TODO:: Send error to SIP side too?
-			break;
+			return false;
 		}
+	}
 
-		if (USSDString == ">")
-		{
-			if (mString == "")
-			{
-				messageType = USSDData::release;
-			}
-			else
-			{
-				USSDString = mString;
-				messageType = USSDData::request;
-			}
-		} else {
-			// Steps:
-			// 1 -- Setup SIP part of the transaction record.
-			// 2 -- Send the message to the server.
-			// 3 -- Wait for a response message and parse it.
-
-			// Step 1 -- Setup SIP part of the transaction record.
-			TransactionEntry transaction;
-			if (!gTransactionTable.find(transactionID(), transaction))
-			{
-				// Transaction not found. Something is wrong. Bail out.
-				break;
-			}
-			SIP::SIPEngine& engine = transaction.SIP();
-
-			// If we got a TMSI, find the IMSI.
-			L3MobileIdentity mobileID = transaction.subscriber();
-			if (mobileID.type()==TMSIType) {
-				const char *IMSI = gTMSITable.IMSI(mobileID.TMSI());
-				if (IMSI) mobileID = L3MobileIdentity(IMSI);
-				else {
-					// Something is wrong on the ME side.
-					postUSSDData(USSDData::error, "");
-					break;
-				}
-			}
+	engine.User(mobileID.digits());
+	LOG(DEBUG) << "MOUSSD: transaction: " << transaction;
 
-			engine.User(mobileID.digits());
-			LOG(DEBUG) << "MOUSSD: transaction: " << transaction;
-
-			// Step 2 -- Send the message to the server.
-			std::ostringstream outSipBody;
-			outSipBody << (int)messageType << std::endl << USSDString;
-			LOG(DEBUG) << "Created USSD SIP message: " << outSipBody.str();
-			engine.MOSMSSendMESSAGE(gConfig.getStr("USSD.SIP.user"),
-				gConfig.getStr("USSD.SIP.domain"),
-				outSipBody.str().c_str(), true);
-			SIP::SIPState state = engine.MOSMSWaitForSubmit();
-
-			LOG(DEBUG) << "Clearing call ID " << engine.callID()
-			           << " from transaction " << transaction.ID();
-			gSIPInterface.removeCall(engine.callID());
-
-			if (state != SIP::Cleared)
-			{
-				// Something is wrong on the SIP side.
-				postUSSDData(USSDData::error, "");
-				break;
-			}
+	// Step 2 -- Send the message to the server.
+	std::ostringstream outSipBody;
+	outSipBody << (int)messageType << std::endl << USSDString;
+	LOG(DEBUG) << "Created USSD SIP message: " << outSipBody.str();
+	engine.MOSMSSendMESSAGE(gConfig.getStr("USSD.SIP.user"),
+		gConfig.getStr("USSD.SIP.domain"),
+		outSipBody.str().c_str(), true);
+	SIP::SIPState state = engine.MOSMSWaitForSubmit();
 
-			// Step 3 -- Wait for a response SIP message and ACK it.
-			transaction.ussdData()->waitIncomingData(/*TODO:: timeout */);
-			engine.MTSMSSendOK();
-			LOG(DEBUG) << "Clearing call ID " << engine.callID()
-			           << " from transaction " << transaction.ID();
-			gSIPInterface.removeCall(engine.callID());
-
-			// Step 4 -- Get response and parse it.
-			if (!gTransactionTable.find(transactionID(), transaction))
-			{
-				// Transaction not found. Something is wrong. Bail out.
-				break;
-			}
-			std::istringstream inSipBody(transaction.message());
-			std::stringbuf messageText;
-			int tmp;
-			inSipBody >> tmp >> &messageText;
-			messageType = (Control::USSDData::USSDMessageType)tmp;
-			USSDString = messageText.str();
-			LOG(DEBUG) << "Parsed USSD server response. messageType=" << messageType
-			           << "(" << tmp << ")"
-			           << " string=\"" << USSDString << "\"";
+	LOG(DEBUG) << "Clearing call ID " << engine.callID()
+	           << " from transaction " << transaction.ID();
+	gSIPInterface.removeCall(engine.callID());
 
-		}
+	if (state != SIP::Cleared)
+	{
+		// Something is wrong on the SIP side.
+		postUSSDData(USSDData::error, "");
+		return false;
+	}
 
-		postUSSDData(messageType, USSDString);
+	// Step 3 -- Wait for a response SIP message and ACK it.
+	// This runs on a shared worker, so it must not wait forever.
+	if (transaction.ussdData()->waitIncomingData(gConfig.getNum("USSD.timeout")) != 0)
+	{
+		LOG(NOTICE) << "no USSD response from SIP side for transaction " << transaction.ID();
+		postUSSDData(USSDData::error, "");
+		return false;
+	}
+	engine.MTSMSSendOK();
+	LOG(DEBUG) << "Clearing call ID " << engine.callID()
+	           << " from transaction " << transaction.ID();
+	gSIPInterface.removeCall(engine.callID());
+
+	// Step 4 -- Get response and parse it.
+	if (!gTransactionTable.find(transactionID(), transaction))
+	{
+		// Transaction not found. Something is wrong. Bail out.
+		return false;
 	}
+	std::istringstream inSipBody(transaction.message());
+	std::stringbuf messageText;
+	int tmp;
+	inSipBody >> tmp >> &messageText;
+	messageType = (Control::USSDData::USSDMessageType)tmp;
+	USSDString = messageText.str();
+	LOG(DEBUG) << "Parsed USSD server response. messageType=" << messageType
+	           << "(" << tmp << ")"
+	           << " string=\"" << USSDString << "\"";
+	return true;
 }
 
 
+
+
 bool Control::waitForPrimitive(LogicalChannel *LCH, Primitive primitive, unsigned timeout_ms)
 {
 	bool waiting = true;
@@ -1184,11 +1308,11 @@ unsigned  Control::resolveIMSI(bool sameLAI, L3MobileIdentity& mobID, LogicalCha
 	// Must be a TMSI.
 	// Look in the table to see if it's one we assigned.
 	unsigned TMSI = mobID.TMSI();
-	const char* IMSI = NULL;
+	string IMSI;
 	if (sameLAI) IMSI = gTMSITable.IMSI(TMSI);
-	if (IMSI) {
+	if (!IMSI.empty()) {
 		// We assigned this TMSI and the TMSI/IMSI pair is already in the table.
-		mobID = L3MobileIdentity(IMSI);
+		mobID = L3MobileIdentity(IMSI.c_str());
 		LOG(DEBUG) << "resolving mobile ID (table): " << mobID;
 		return TMSI;
 	}
@@ -1233,8 +1357,8 @@ void  Control::resolveIMSI(L3MobileIdentity& mobileIdentity, LogicalChannel* LCH
 
 	// If we got a TMSI, find the IMSI.
 	if (mobileIdentity.type()==TMSIType) {
-		const char *IMSI = gTMSITable.IMSI(mobileIdentity.TMSI());
-		if (IMSI) mobileIdentity = L3MobileIdentity(IMSI);
+		string IMSI = gTMSITable.IMSI(mobileIdentity.TMSI());
+		if (!IMSI.empty()) mobileIdentity = L3MobileIdentity(IMSI.c_str());
 	}
 
 	// Still no IMSI?  Ask for one.
@@ -1272,24 +1396,6 @@ void  Control::resolveIMSI(L3MobileIdentity& mobileIdentity, LogicalChannel* LCH
 	}
 }
 
-bool Control::USSDMatchHandler(const std::string &handlerName, const std::string &ussdString)
-{
-	std::string handlerKeyName("USSD.Handler.");
-	handlerKeyName += handlerName;
-	if (gConfig.defines(handlerKeyName))
-	{
-		std::string handlerRegexpStr = gConfig.getStr(handlerKeyName);
-		Regexp handlerRegexp(handlerRegexpStr.data());
-		if (handlerRegexp.match(ussdString.data()))
-		{
-			LOG(DEBUG) << "Request " << ussdString << " matches regexp \""
-			           << handlerRegexpStr << "\" for USSD handler " << handlerName;
-			return true;
-		}
-	}
-	return false;
-}
-
 unsigned Control::USSDDispatcher(GSM::L3MobileIdentity &mobileIdentity,
                                  unsigned TIFlag,
                                  unsigned TIValue,
@@ -1308,32 +1414,7 @@ unsigned Control::USSDDispatcher(GSM::L3MobileIdentity &mobileIdentity,
 		transaction.ussdData()->postMS();
 		gTransactionTable.update(transaction);
 
-		Thread* thread = new Thread;
-		if (USSDMatchHandler("HTTP", ussdString))
-		{
-			 MOHttpHandler* handler = new MOHttpHandler(transaction.ID());
-			thread->start((void*(*)(void*))USSDHandler::runWrapper, handler);
-		}
-		else if (USSDMatchHandler("CLI", ussdString))
-		{
-			 MOCLIHandler* handler = new MOCLIHandler(transaction.ID());
-			thread->start((void*(*)(void*))USSDHandler::runWrapper, handler);
-		}
-		else if (USSDMatchHandler("Test", ussdString))
-		{
-			MOTestHandler* handler = new MOTestHandler(transaction.ID());
-			thread->start((void*(*)(void*))USSDHandler::runWrapper, handler);
-		}
-		else if (USSDMatchHandler("SIP", ussdString))
-		{
-			UssdSipHandler* handler = new UssdSipHandler(transaction.ID());
-			thread->start((void*(*)(void*))USSDHandler::runWrapper, handler);
-		}
-		else
-		{
-			MOTestHandler* handler = new MOTestHandler(transaction.ID());
-			thread->start((void*(*)(void*))USSDHandler::runWrapper, handler);
-		}
+		gUSSDSessions.open(transaction.ID(), ussdString);
 	}
 	else
 	{
@@ -1349,4 +1430,198 @@ unsigned Control::USSDDispatcher(GSM::L3MobileIdentity &mobileIdentity,
 }
 
 
+
+static USSDHandler *newHttpHandler(unsigned transactionID) { return new MOHttpHandler(transactionID); }
+static USSDHandler *newCLIHandler(unsigned transactionID) { return new MOCLIHandler(transactionID); }
+static USSDHandler *newTestHandler(unsigned transactionID) { return new MOTestHandler(transactionID); }
+static USSDHandler *newSipHandler(unsigned transactionID) { return new UssdSipHandler(transactionID); }
+
+
+USSDSessionManager::USSDSessionManager()
+	:mLock("USSDSessionManager"),mWorkers(NULL),mNumWorkers(0),
+	mOpened(0),mPeak(0),mSteps(0),mExpired(0),
+	mTotalLatency(0),mMaxLatency(0)
+{
+	static const char *names[numRoutes] = { "HTTP", "CLI", "Test", "SIP" };
+	static const HandlerMaker makers[numRoutes] = { newHttpHandler, newCLIHandler, newTestHandler, newSipHandler };
+	for (unsigned i=0; i<numRoutes; i++) {
+		mRoutes[i].name = names[i];
+		mRoutes[i].maker = makers[i];
+		mRoutes[i].regexp = NULL;
+	}
+}
+
+
+void USSDSessionManager::start(unsigned numWorkers)
+{
+	if (mWorkers) return;
+	if (numWorkers==0) numWorkers = 1;
+	mNumWorkers = numWorkers;
+	mWorkers = new Thread[numWorkers];
+	for (unsigned i=0; i<numWorkers; i++) {
+		mWorkers[i].start((void*(*)(void*))USSDSessionLoopAdapter, this, "USSD worker");
+	}
+}
+
+
+const USSDSessionManager::Route& USSDSessionManager::route(const std::string& USSDString)
+{
+	mRouteLock.lock();
+	const Route *retVal = NULL;
+	for (unsigned i=0; i<numRoutes; i++) {
+		Route &route = mRoutes[i];
+		// Recompile only when the configured pattern has changed.
+		std::string key("USSD.Handler.");
+		key += route.name;
+		std::string pattern;
+		if (gConfig.defines(key)) pattern = gConfig.getStr(key);
+		if (pattern != route.pattern || (route.regexp==NULL && !pattern.empty())) {
+			delete route.regexp;
+			route.regexp = NULL;
+			route.pattern = pattern;
+			if (!pattern.empty()) route.regexp = new Regexp(pattern.c_str());
+			LOG(INFO) << "USSD handler " << route.name << " pattern \"" << pattern << "\"";
+		}
+		if (!retVal && route.regexp && route.regexp->match(USSDString.c_str())) {
+			LOG(DEBUG) << "Request " << USSDString << " matches regexp \""
+			           << route.pattern << "\" for USSD handler " << route.name;
+			retVal = &route;
+		}
+	}
+	// The test handler is the default.
+	if (!retVal) retVal = &mRoutes[2];
+	mRouteLock.unlock();
+	return *retVal;
+}
+
+
+void USSDSessionManager::open(unsigned transactionID, const std::string& USSDString)
+{
+	USSDHandler *handler = route(USSDString).maker(transactionID);
+	mLock.lock();
+	Session &session = mSessions[transactionID];
+	session.handler = handler;
+	// The dispatcher has already posted the initial request.
+	session.events = 1;
+	session.busy = false;
+	session.queued = true;
+	session.queuedAt.now();
+	session.lastEvent.now();
+	mReady.push_back(transactionID);
+	mOpened++;
+	if (mSessions.size() > mPeak) mPeak = mSessions.size();
+	mWork.signal();
+	mLock.unlock();
+}
+
+
+void USSDSessionManager::signal(unsigned transactionID)
+{
+	mLock.lock();
+	SessionMap::iterator i = mSessions.find(transactionID);
+	if (i!=mSessions.end()) {
+		Session &session = i->second;
+		session.events++;
+		session.lastEvent.now();
+		// A busy session is requeued by its worker.
+		if (!session.queued && !session.busy) {
+			session.queued = true;
+			session.queuedAt.now();
+			mReady.push_back(transactionID);
+			mWork.signal();
+		}
+	}
+	mLock.unlock();
+}
+
+
+void USSDSessionManager::serviceLoop()
+{
+	mLock.lock();
+	while (true) {
+		if (mReady.size()==0) {
+			mWork.wait(mLock,1000);
+			reap();
+			continue;
+		}
+		unsigned transactionID = mReady.front();
+		mReady.pop_front();
+		SessionMap::iterator i = mSessions.find(transactionID);
+		if (i==mSessions.end()) continue;
+		// Sessions are only erased when not busy, so the iterator holds across step().
+		Session &session = i->second;
+		session.queued = false;
+		session.busy = true;
+		if (session.events) session.events--;
+		Timeval queuedAt = session.queuedAt;
+		USSDHandler *handler = session.handler;
+		mLock.unlock();
+
+		bool alive = handler->step();
+
+		mLock.lock();
+		unsigned latency = queuedAt.elapsed();
+		mSteps++;
+		mTotalLatency += latency;
+		if (latency > mMaxLatency) mMaxLatency = latency;
+		session.busy = false;
+		if (!alive) {
+			LOG(DEBUG) << "USSD session " << transactionID << " ended";
+			delete handler;
+			mSessions.erase(i);
+			continue;
+		}
+		if (session.events) {
+			session.queued = true;
+			session.queuedAt = session.lastEvent;
+			mReady.push_back(transactionID);
+		}
+	}
+}
+
+
+void USSDSessionManager::reap()
+{
+	// Allow the controller its own MS timeout before giving up on a session.
+	long limit = 2*gConfig.getNum("USSD.timeout");
+	SessionMap::iterator i = mSessions.begin();
+	while (i!=mSessions.end()) {
+		Session &session = i->second;
+		if (session.busy || session.queued || session.lastEvent.elapsed() < limit) {
+			++i;
+			continue;
+		}
+		LOG(NOTICE) << "expiring idle USSD session " << i->first;
+		delete session.handler;
+		mSessions.erase(i++);
+		mExpired++;
+	}
+}
+
+
+void USSDSessionManager::stats(std::ostream& os)
+{
+	mLock.lock();
+	os << "workers: " << mNumWorkers << endl;
+	os << "sessions: " << mSessions.size() << " open, " << mReady.size() << " ready, "
+		<< mPeak << " peak" << endl;
+	os << "sessions opened: " << mOpened << ", expired: " << mExpired << endl;
+	os << "handler steps: " << mSteps << endl;
+	if (mSteps) {
+		os << "step latency: " << mTotalLatency/mSteps << " ms mean, "
+			<< mMaxLatency << " ms max since last report" << endl;
+	}
+	mMaxLatency = 0;
+	mLock.unlock();
+}
+
+
+void *Control::USSDSessionLoopAdapter(USSDSessionManager *manager)
+{
+	AllocScope allocScope(AllocControl);
+	manager->serviceLoop();
+	return NULL;
+}
+
+
 // vim: ts=4 sw=4
@@ -35,6 +35,7 @@
 #include <Logger.h>
 #include <Interthread.h>
 #include <Timeval.h>
+#include <CopyOnWrite.h>
 
 
 #include <GSML3CommonElements.h>
@@ -46,6 +47,8 @@
 
 // Enough forward refs to prevent "kitchen sick" includes and circularity.
 
+class Regexp;
+
 namespace GSM {
 class Time;
 class L3Message;
@@ -267,6 +270,7 @@ class PagingEntry {
 	GSM::ChannelType mType;			///< The needed channel type.
 	unsigned mTransactionID;		///< The associated transaction ID.
 	Timeval mExpiration;			///< The expiration time for this entry.
+	bool mPaged;					///< True once a paging request for this entry was sent.
 
 	public:
 
@@ -277,7 +281,8 @@ class PagingEntry {
 	*/
 	PagingEntry(const GSM::L3MobileIdentity& wID, GSM::ChannelType wType,
 			unsigned wTransactionID, unsigned wLife)
-		:mID(wID),mType(wType),mTransactionID(wTransactionID),mExpiration(wLife)
+		:mID(wID),mType(wType),mTransactionID(wTransactionID),mExpiration(wLife),
+		mPaged(false)
 	{}
 
 	/** Access the ID. */
@@ -294,6 +299,12 @@ class PagingEntry {
 	/** Returns true if the entry is expired. */
 	bool expired() const { return mExpiration.passed(); }
 
+	/** Note that a paging request for this entry was sent. */
+	void markPaged() { mPaged = true; }
+
+	/** True if a paging request for this entry was ever sent. */
+	bool paged() const { return mPaged; }
+
 };
 
 typedef std::list<PagingEntry> PagingEntryList;
@@ -311,7 +322,7 @@ class Pager {
 	private:
 
 	PagingEntryList mPageIDs;				///< List of ID's to be paged.
-	Mutex mLock;							///< Lock for thread-safe access.
+	mutable Mutex mLock;					///< Lock for thread-safe access.
 	Signal mPageSignal;						///< signal to wake the paging loop
 	Thread mPagingThread;					///< Thread for the paging loop.
 	volatile bool mRunning;
@@ -319,7 +330,7 @@ class Pager {
 	public:
 
 	Pager()
-		:mRunning(false)
+		:mLock("Pager"),mRunning(false)
 	{}
 
 	/** Set the output FIFO and start the paging loop. */
@@ -365,7 +376,10 @@ public:
 	/** return size of PagingEntryList */
 	size_t pagingEntryListSize();
 
-	/** Dump the paging list to an ostream. */
+	/** Copy the paging list, for reporting without holding the pager. */
+	void snapshot(PagingEntryList&) const;
+
+	/** Dump the paging list to an ostream, from a snapshot. */
 	void dump(std::ostream&) const;
 };
 
@@ -611,6 +625,9 @@ std::ostream& operator<<(std::ostream& os, TransactionEntry::Q931CallState);
 /** A map of transactions keyed by ID. */
 class TransactionMap : public std::map<unsigned,TransactionEntry> {};
 
+/** A read-only view of the transaction table, unaffected by later changes. */
+typedef CopyOnWrite<TransactionMap> TransactionSnapshot;
+
 /**
 	A table for tracking the states of active transactions.
 	Note that transaction table add and find operations
@@ -623,7 +640,7 @@ class TransactionTable {
 	// FIXME -- We need to support log-time lookup by transaction ID _or_ IMSI.
 	// Right now, it's log-time for transaction ID and linear time for IMSI.
 
-	TransactionMap mTable;
+	TransactionSnapshot mTable;			///< copied on write while a snapshot is out
 	mutable Mutex mLock;
 	unsigned mIDCounter;
 
@@ -631,7 +648,7 @@ class TransactionTable {
 
 	TransactionTable()
 		// This assumes the main application uses sdevrandom.
-		:mIDCounter(random())
+		:mLock("TransactionTable"),mIDCounter(random())
 	{ }
 
 	/**
@@ -693,16 +710,20 @@ class TransactionTable {
 	*/
 	void clearDeadEntries();
 
-	/**@Access to raw map. */
-	//@{
-	TransactionMap::const_iterator begin() { clearDeadEntries(); return mTable.begin(); }
-	TransactionMap::const_iterator end() const { return mTable.end(); }
-	//@}
+	/**
+		Get a consistent view of the table for reporting, after clearing dead entries.
+		Writers never wait for the holder.
+	*/
+	TransactionSnapshot snapshot();
 
-	size_t size();
+	size_t size() const;
 
-	/** Write entries as text to a stream. */
-	void dump(std::ostream&) const;
+	/**
+		Write entries as text to a stream, from a snapshot.
+		@param first The index of the first entry to write.
+		@param count The maximum number of entries to write.
+	*/
+	void dump(std::ostream&, unsigned first=0, unsigned count=~0U);
 };
 
 //@} // Transaction Table
@@ -720,26 +741,51 @@ class TMSIRecord {
 	std::string mIMSI;
 	std::string mIMEI;
 	Timeval mCreated;				///< Time when this TMSI was created.
-	mutable Timeval mTouched;		///< Time when this TMSI was last accessed.
+	/**
+		Time of the last access in seconds since the epoch.
+		Lookups touch records in place in the shared map body, so this is a
+		single word that touch() only stores and snapshot readers only load.
+	*/
+	mutable volatile time_t mTouched;
+	time_t mRegistered;				///< Time of the last successful SIP registration, or 0.
 
 	public:
 
-	TMSIRecord() {}
+	TMSIRecord():mTouched(time(NULL)),mRegistered(0) {}
 	
 	TMSIRecord(const char* wIMSI, const char* wIMEI = NULL):
-		mIMSI(wIMSI), mIMEI(wIMEI!=NULL?wIMEI:"?")
+		mIMSI(wIMSI), mIMEI(wIMEI!=NULL?wIMEI:"?"),
+		mTouched(time(NULL)),mRegistered(0)
+	{ }
+
+	/** A record copied from the shared TMSI table, times in seconds since the epoch. */
+	TMSIRecord(const char* wIMSI, const char* wIMEI, time_t created, time_t touched, time_t registered):
+		mIMSI(wIMSI), mIMEI(wIMEI),
+		mCreated(created,0), mTouched(touched),
+		mRegistered(registered)
 	{ }
 
 	const char* IMSI() const { return mIMSI.c_str(); }
 	const char* IMEI() const { return mIMEI.c_str(); }
 	void IMEI(const std::string &imei) { mIMEI = imei; }
-	void touch() const { mTouched.now(); }
+	void touch() const { mTouched = time(NULL); }
 
 	/** Record age in seconds. */
 	unsigned age() const { return mCreated.elapsed()/1000; }
 
 	/** Time since last access in seconds. */
-	unsigned touched() const { return mTouched.elapsed()/1000; }
+	unsigned touched() const
+	{
+		time_t when = mTouched;
+		time_t now = time(NULL);
+		return now>when ? now-when : 0;
+	}
+
+	/** Note a successful SIP registration. */
+	void registered(time_t when) { mRegistered = when; }
+
+	/** Time since the last successful SIP registration in seconds, ~0 if none. */
+	unsigned registered() const { return mRegistered ? time(NULL)-mRegistered : ~0U; }
 
 	void save(unsigned TMSI, FILE*) const;
 
@@ -755,23 +801,48 @@ std::ostream& operator<<(std::ostream&, const TMSIRecord&);
 
 typedef std::map<unsigned,TMSIRecord> TMSIMap;
 
+/** A read-only view of the TMSI table, unaffected by later changes. */
+typedef CopyOnWrite<TMSIMap> TMSISnapshot;
+
+class SharedTMSIStore;
+
 class TMSITable {
 
 	private:
 
-	TMSIMap mMap;							///< IMSI/TMSI mapping
+	TMSISnapshot mMap;						///< IMSI/TMSI mapping, copied on write while a snapshot is out
 	unsigned mCounter;						///< a counter to generate new TMSIs
 	unsigned mClear;						///< next TMSI to be cleared from the table
 	mutable Mutex mLock;					///< concurrency control
+	SharedTMSIStore *mShared;				///< the site's shared table, or NULL
+	unsigned mRegistrar;					///< our ID in mShared
 
 
 	public:
 
 	TMSITable()
 		:mCounter(time(NULL)),
-		mClear(mCounter)
+		mClear(mCounter),
+		mLock("TMSITable"),
+		mShared(NULL),mRegistrar(0)
 	{}
 
+	/**
+		Share TMSIs and registrations with the other BTS processes of a site.
+		TMSIs are then assigned from the shared table and lookups that miss
+		this table are tried there.  Only assign() and find() copy records
+		into this table, so read-only lookups never copy its body.
+		Call before the control layer starts.
+		@param path The shared table file.
+		@param LAI The LAI of this BTS, added to the site's list.
+		@param registrar An ID for this BTS, unique on the site.
+		@return true on success.
+	*/
+	bool share(const char* path, const GSM::L3LocationAreaIdentity& LAI, unsigned registrar);
+
+	/** True if the LAI belongs to another BTS sharing this table, so its TMSIs are ours. */
+	bool siteLAI(const GSM::L3LocationAreaIdentity& LAI) const;
+
 	/**
 		Create a new entry in the table.
 		@param IMSI	The IMSI to create an entry for.
@@ -790,10 +861,10 @@ class TMSITable {
 	/**
 		Find an IMSI in the table.
 		This is a log-time operation.
-		@param TMSI The TMSI to find.post to
-		@return Pointer to c-string IMSI or NULL.
+		@param TMSI The TMSI to find.
+		@return A copy of the IMSI, empty if not found.
 	*/
-	const char* IMSI(unsigned TMSI) const;
+	std::string IMSI(unsigned TMSI) const;
 
 
 	/**
@@ -824,8 +895,25 @@ class TMSITable {
 	*/
 	void erase(unsigned TMSI);
 
-	/** Write entries as text to a stream. */
-	void dump(std::ostream&) const;
+	/** Note a successful SIP registration, made by this BTS, for a TMSI. */
+	void registered(unsigned TMSI);
+
+	/**
+		True if this BTS registered the TMSI with the SIP server within maxAge seconds.
+		A registration made by another BTS of the site does not count,
+		since the SIP server must learn the new contact address.
+	*/
+	bool registeredRecently(unsigned TMSI, unsigned maxAge) const;
+
+	/** Describe the shared table, if any. */
+	void sharedReport(std::ostream&) const;
+
+	/**
+		Write entries as text to a stream, from a snapshot.
+		@param first The index of the first entry to write.
+		@param count The maximum number of entries to write.
+	*/
+	void dump(std::ostream&, unsigned first=0, unsigned count=~0U) const;
 	
 	/** Save the table to a file. */
 	void save(const char* filename) const;
@@ -834,19 +922,24 @@ class TMSITable {
 	void load(const char*filename);
 
 	/** Clear the table completely. */
-	void clear() { mMap.clear(); }
+	void clear();
 
 	size_t size() const;
 
-	// FIXME -- These are not thread safe and should be removed.
-	TMSIMap::const_iterator begin() const { return mMap.begin(); }
-	TMSIMap::const_iterator end() const { return mMap.end(); }
+	/**
+		Get a consistent view of the table for reporting.
+		This is constant time and writers never wait for the holder.
+	*/
+	TMSISnapshot snapshot() const;
 
 	private:
 
 	/** Erase entries, oldest first, to limit the table size. */
 	void purge();
 
+	/** Copy a record from the shared table; mLock must be held. */
+	void cache(unsigned TMSI, const TMSIRecord& record);
+
 };
 
 
@@ -928,12 +1021,17 @@ extern Control::TMSITable gTMSITable;
 
 namespace Control {
 
-bool USSDMatchHandler(const std::string &handlerName, const std::string &ussdString);
 unsigned USSDDispatcher(GSM::L3MobileIdentity &mobileIdentity,	unsigned TIFlag,
                         unsigned TIValue, Control::USSDData::USSDMessageType messageType,
                         const std::string &ussdString, bool MO);
 
 
+/**
+	A USSD application handler.
+	MO sessions are event driven: the USSDSessionManager calls step() on one of its
+	workers each time the MS side posts data, so an idle session holds no thread.
+	run() drives a handler synchronously, for MT sessions started from the CLI.
+*/
 class USSDHandler {
 
 	public:
@@ -970,16 +1068,30 @@ class USSDHandler {
 			mContinueStr(gConfig.getStr("USSD.ContinueStr"))
 		{}
 
+		virtual ~USSDHandler() {}
+
 		/** Wait USSD data from MS. Return: 0 - successful, 1 - clear transaction, 2 - error or timeout */
 		USSDHandler::ResultCode waitUSSDData(Control::USSDData::USSDMessageType* messageType, std::string* USSDString, unsigned timeout = USSDHandler::infinitely);
 		/** Post USSD data and update transaction with new USSDData (messageType and USSDString)*/
 		USSDHandler::ResultCode postUSSDData( Control::USSDData::USSDMessageType messageType, const std::string &USSDString);
 		unsigned transactionID() { return mTransactionID; }
 		void transactionID(unsigned wTransactionID) { wTransactionID = mTransactionID; }
-		static void *runWrapper(void *pThis);
+
+		/**
+			Handle whatever the MS has posted, without waiting for more.
+			@return False when the session is over.
+		*/
+		bool step();
+
+		/** Handle the session to its end, blocking for each message from the MS. */
+		void run();
 
 	protected:
-		virtual void run() = 0;	
+		/**
+			Turn one message from the MS into the reply.
+			@return False to end the session without posting the reply.
+		*/
+		virtual bool handle(Control::USSDData::USSDMessageType& messageType, std::string& USSDString) = 0;
 
 };
 
@@ -989,7 +1101,8 @@ class MOTestHandler : public USSDHandler {
 		MOTestHandler(unsigned wTransactionID)
 			:USSDHandler(wTransactionID)
 		{}
-		void run();
+	protected:
+		bool handle(Control::USSDData::USSDMessageType& messageType, std::string& USSDString);
 };
 
 class MOHttpHandler : public USSDHandler {
@@ -997,21 +1110,18 @@ class MOHttpHandler : public USSDHandler {
 		MOHttpHandler(unsigned wTransactionID)
 			:USSDHandler(wTransactionID)
 		{}
-	
-		void run();
+	protected:
+		bool handle(Control::USSDData::USSDMessageType& messageType, std::string& USSDString);
 };
 
 class UssdSipHandler : public USSDHandler {
-	private:
-	   std::string mStr;
-	   unsigned mNum;
 	public:
 
 	   UssdSipHandler(unsigned wTransactionID)
 	   : USSDHandler(wTransactionID)
 	   {}
-
-	   void run();
+	protected:
+	   bool handle(Control::USSDData::USSDMessageType& messageType, std::string& USSDString);
 };
 
 class MOCLIHandler : public USSDHandler {
@@ -1019,8 +1129,8 @@ class MOCLIHandler : public USSDHandler {
 		MOCLIHandler(unsigned wTransactionID)
 			:USSDHandler(wTransactionID)
 		{}
-	
-		void run();
+	protected:
+		bool handle(Control::USSDData::USSDMessageType& messageType, std::string& USSDString);
 };
 
 class MTTestHandler : public USSDHandler {
@@ -1028,17 +1138,109 @@ class MTTestHandler : public USSDHandler {
 		MTTestHandler(unsigned wTransactionID)
 			:USSDHandler(wTransactionID)
 		{}	
-	
-		void run();
+	protected:
+		bool handle(Control::USSDData::USSDMessageType& messageType, std::string& USSDString);
 };
 
+
+
+/**
+	Runs MO USSD sessions on a fixed pool of worker threads
+	and routes new sessions to handlers by the USSD.Handler.* regexps.
+*/
+class USSDSessionManager {
+
+	private:
+
+	/** A handler factory. */
+	typedef USSDHandler* (*HandlerMaker)(unsigned transactionID);
+
+	/** One entry of the routing table. */
+	struct Route {
+		const char *name;		///< handler name, as in USSD.Handler.<name>
+		HandlerMaker maker;
+		std::string pattern;	///< the regexp as configured, empty if the handler is disabled
+		Regexp *regexp;			///< the compiled pattern, NULL if the handler is disabled
+	};
+
+	static const unsigned numRoutes = 4;
+	Route mRoutes[numRoutes];	///< in order of precedence
+	Mutex mRouteLock;
+
+	/** Scheduling state of one session. */
+	struct Session {
+		USSDHandler *handler;
+		unsigned events;		///< posts by the MS not yet handled
+		bool queued;			///< on the ready list
+		bool busy;				///< in step() on a worker
+		Timeval queuedAt;		///< when it went on the ready list
+		Timeval lastEvent;		///< when the MS last posted
+	};
+	typedef std::map<unsigned,Session> SessionMap;
+
+	SessionMap mSessions;				///< sessions by transaction ID
+	std::list<unsigned> mReady;			///< sessions with events to handle
+	mutable Mutex mLock;
+	Signal mWork;						///< signaled when a session becomes ready
+	Thread *mWorkers;
+	unsigned mNumWorkers;
+
+	/**@name Statistics. */
+	//@{
+	unsigned mOpened;
+	unsigned mPeak;
+	unsigned mSteps;
+	unsigned mExpired;
+	unsigned long long mTotalLatency;	///< sum of step latencies, in ms
+	unsigned mMaxLatency;				///< longest step latency since the last report, in ms
+	//@}
+
+	public:
+
+	USSDSessionManager();
+
+	/** Start the workers. */
+	void start(unsigned numWorkers);
+
+	/**
+		Create the handler for a new MO session and queue its first message.
+		The MS must already have posted that message to the USSD data.
+	*/
+	void open(unsigned transactionID, const std::string& USSDString);
+
+	/** Tell a session the MS has posted data, or has gone away. */
+	void signal(unsigned transactionID);
+
+	/** Report session counts and handling latency. */
+	void stats(std::ostream& os);
+
+	/** Worker thread body. */
+	void serviceLoop();
+
+	private:
+
+	/** Pick the handler for an initial request, recompiling routes whose config changed. */
+	const Route& route(const std::string& USSDString);
+
+	/** Delete sessions the controller abandoned.  mLock must be held. */
+	void reap();
+};
+
+
+void *USSDSessionLoopAdapter(USSDSessionManager*);
+
+
 //@}
 
 
 }	//Control
 
 
-
+/**@addtogroup Globals */
+//@{
+/** The MO USSD session workers. */
+extern Control::USSDSessionManager gUSSDSessions;
+//@}
 
 
 #endif
@@ -105,6 +105,7 @@ void DCCHDispatchRR(const L3RRMessage* req, LogicalChannel *DCCH)
 /** Example of a closed-loop, persistent-thread control function for the DCCH. */
 void Control::DCCHDispatcher(LogicalChannel *DCCH)
 {
+	AllocScope allocScope(AllocControl);
 	const L3Message *message = NULL;
 	while (1) {
 		try {
@@ -88,16 +88,12 @@ void Control::IMSIDetachController(const L3IMSIDetachIndication* idi, LogicalCha
 	LOG(INFO) << *idi;
 
 	// The IMSI detach maps to a SIP unregister with the local Asterisk server.
-	try { 
-		// FIXME -- Resolve TMSIs to IMSIs.
-		if (idi->mobileIdentity().type()==IMSIType) {
-			SIPEngine engine;
-			engine.User(idi->mobileIdentity().digits());
-			engine.Unregister();
-		}
-	}
-	catch(SIPTimeout) {
-		LOG(ALARM) "SIP registration timed out.  Is Asterisk running?";
+	// Nothing here depends on the result, so don't hold the channel for it.
+	// FIXME -- Resolve TMSIs to IMSIs.
+	if (idi->mobileIdentity().type()==IMSIType) {
+		SIPEngine engine;
+		engine.User(idi->mobileIdentity().digits());
+		engine.sendUnregister();
 	}
 	// No reponse required, so just close the channel.
 	DCCH->send(L3ChannelRelease());
@@ -147,14 +143,26 @@ void Control::LocationUpdatingController(const L3LocationUpdatingRequest* lur, S
 	// This operation will throw an exception, caught in a higher scope,
 	// if it fails in the GSM domain.
 	L3MobileIdentity mobID = lur->mobileIdentity();
-	bool sameLAI = (lur->LAI() == gBTS.LAI());
+	// A TMSI from another BTS sharing our TMSI table is as good as ours.
+	bool sameLAI = (lur->LAI() == gBTS.LAI()) || gTMSITable.siteLAI(lur->LAI());
 	unsigned preexistingTMSI = resolveIMSI(sameLAI,mobID,SDCCH);
 	// IMSIAttach set to true if this is a new registration.
 	bool IMSIAttach = (preexistingTMSI==0);
+	// If we registered this phone recently, the SIP server still has it.
+	// Keep the freshness well inside the registration period.
+	bool fresh = false;
+	if (preexistingTMSI && gConfig.defines("Control.LUR.RegistrationFreshness")) {
+		unsigned maxAge = gConfig.getNum("Control.LUR.RegistrationFreshness");
+		unsigned period = gConfig.getNum("SIP.RegistrationPeriod");
+		if (maxAge > period/2) maxAge = period/2;
+		fresh = gTMSITable.registeredRecently(preexistingTMSI,maxAge);
+	}
 	// Try to register the IMSI with Asterisk.
 	// This will be set true if registration succeeded in the SIP world.
-	bool success = false;
-	try {
+	bool success = fresh;
+	if (fresh) {
+		LOG(INFO) << "registration still fresh: " << mobID;
+	} else try {
 		SIPEngine engine;
 		engine.User(mobID.digits());
 		LOG(DEBUG) << "waiting for registration";
@@ -185,6 +193,12 @@ void Control::LocationUpdatingController(const L3LocationUpdatingRequest* lur, S
 			newTMSI = gTMSITable.assign(mobID.digits());
 	}
 
+	// Note a new registration, for the freshness test above.
+	if (success && !fresh) {
+		unsigned tmsi = newTMSI?newTMSI:preexistingTMSI;
+		if (tmsi) gTMSITable.registered(tmsi);
+	}
+
 
 	// Query for IMEI?
 	// Note: IMEI is requested only on IMSI attach, i.e. only when user
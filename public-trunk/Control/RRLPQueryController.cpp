@@ -33,6 +33,7 @@ long getNumWithDefault(const std::string& key, long default_value) {
 
 RRLPQueryManager::RRLPQueryManager(unsigned accuracy)
     : m_accuracy(accuracy)
+    , m_lock("RRLPQueryManager")
     , m_numQueries(0)
     , m_numPositionResponses(0)
 {
@@ -54,13 +55,28 @@ PositionResult RRLPQueryManager::doTransaction(L3MobileIdentity mobID, LogicalCh
 {
     if (accuracy == 0)
         accuracy = m_accuracy;
+    RRLPQueryController QC(chan, nextReference(mobID), accuracy);
+    return record(QC.doTransaction());
+}
+
+unsigned RRLPQueryManager::nextReference(L3MobileIdentity mobID)
+{
+    m_lock.lock();
     if (m_data.count(mobID) == 0) {
         // first time
         m_data.insert(std::pair<L3MobileIdentity, RRLP_MS_Data>(mobID, RRLP_MS_Data()));
     }
     RRLP_MS_Data& data = m_data[mobID];
     data.lastSentReferenceNumber = 1 + (data.lastSentReferenceNumber % 7);
-    RRLPQueryController QC(chan, data.lastSentReferenceNumber, accuracy);
+    unsigned reference = data.lastSentReferenceNumber;
+    m_lock.unlock();
+    return reference;
+}
+
+PositionResult RRLPQueryManager::doTransaction(L3MobileIdentity mobID, LogicalChannel* chan
+                    , const BitVector& request, const BitVector& assistance)
+{
+    RRLPQueryController QC(chan, request, assistance);
     return record(QC.doTransaction());
 }
 
@@ -74,8 +90,10 @@ PositionResult RRLPQueryManager::doTransaction(L3MobileIdentity mobID, LogicalCh
 
 PositionResult RRLPQueryManager::record(PositionResult res)
 {
+    m_lock.lock();
     m_numQueries ++;
     if (res.mValid) m_numPositionResponses++;
+    m_lock.unlock();
     return res;
 }
 
@@ -126,7 +144,19 @@ void buildRRLPQueryFromParams(BitVector& out, unsigned referenceNumber, unsigned
               << accuracy << ";built " << out;
 }
 
-void RRLPQueryController::init(unsigned reference)
+// Empty assistance data, sent ahead of the request.
+void buildRRLPAssistanceData(BitVector& out, unsigned referenceNumber)
+{
+    out.resize(2*8);
+    out.fillField(0, 0, 16);
+    // reference number in high 3 bits
+    // component number in zeros are for no optional components, no extensions.
+    out.fillField(0, referenceNumber, 3);
+    // set component type to ASSISTANCE_DATA (bits 4,5,6)
+    out.fillField(4, ASSISTANCE_DATA, 3);
+}
+
+void RRLPQueryController::init(unsigned reference, const BitVector* assistance)
 {
     if (reference > 7 || reference == 0) {
         LOG(ERROR) << "Programming error: reference must be in the range [1,7]";
@@ -137,13 +167,10 @@ void RRLPQueryController::init(unsigned reference)
     m_retrans_on_ack = false;
     m_continue = true;
     // initialize assistance data
-    m_assistance_data.resize(2*8);
-    m_assistance_data.fillField(0, 0, 16);
-    // reference number in high 3 bits
-    // component number in zeros are for no optional components, no extensions.
-    m_assistance_data.fillField(0, m_reference, 3);
-    // set component type to ASSISTANCE_DATA (bits 4,5,6)
-    m_assistance_data.fillField(4, ASSISTANCE_DATA, 3);
+    if (assistance)
+        m_assistance_data.clone(*assistance);
+    else
+        buildRRLPAssistanceData(m_assistance_data, m_reference);
 }
 
 RRLPQueryController::RRLPQueryController(LogicalChannel* chan,
@@ -163,6 +190,14 @@ RRLPQueryController::RRLPQueryController(LogicalChannel* chan,
     init(m_rrlp_position_request.peekField(0, 3));
 }
 
+RRLPQueryController::RRLPQueryController(LogicalChannel* chan,
+    const BitVector& rrlp_position_request, const BitVector& assistance_data)
+        : m_chan(chan)
+        , m_rrlp_position_request(rrlp_position_request)
+{
+    init(m_rrlp_position_request.peekField(0, 3), &assistance_data);
+}
+
 void RRLPQueryController::setReferenceNumber(unsigned reference)
 {
     m_reference = reference;
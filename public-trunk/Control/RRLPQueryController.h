@@ -2,6 +2,7 @@
 #define __RRLP_QUERY_CONTROLLER_H__
 
 #include "BitVector.h"
+#include "Threads.h"
 #include "CollectMSInfo.h" // for PositionResult
 
 /**
@@ -36,6 +37,7 @@ namespace GSM {
         private:
             std::map<L3MobileIdentity, RRLP_MS_Data> m_data;
             unsigned m_accuracy;
+            Mutex m_lock; // queries run concurrently on their own DCCHs
 
             unsigned m_numQueries;
             unsigned m_numPositionResponses; // the shit
@@ -58,6 +60,14 @@ namespace GSM {
             /** Same but with a user provided query. Will not touch the reference number.
              */
             PositionResult doTransaction(L3MobileIdentity, LogicalChannel*, BitVector&);
+            /** Same but with prebuilt PDUs, made with nextReference(), as cached by a sweep.
+             */
+            PositionResult doTransaction(L3MobileIdentity, LogicalChannel*,
+                const BitVector& request, const BitVector& assistance);
+
+            /** The next reference number (1..7) to use for this MS.
+             */
+            unsigned nextReference(L3MobileIdentity);
 
 
             // Setter/Getter for accuracy
@@ -72,6 +82,10 @@ namespace GSM {
         // Low level - a single query
 
         void buildRRLPQueryFromParams(BitVector& out, unsigned int referenceNumber, unsigned int accuracy);
+        void buildRRLPAssistanceData(BitVector& out, unsigned int referenceNumber);
+
+        // Config value or default
+        long getNumWithDefault(const std::string& key, long default_value);
 
         // RRLP Packet Elements definition
 
@@ -110,7 +124,7 @@ namespace GSM {
             PositionResult m_pr;
         private:
             // helper called by constructors
-            void init(unsigned reference);
+            void init(unsigned reference, const BitVector* assistance=NULL);
 
        public:
             // Constructor for testing purposes only
@@ -125,6 +139,10 @@ namespace GSM {
             RRLPQueryController(LogicalChannel* chan,
                 const BitVector rrlp_position_request);
 
+            // Give prebuilt query and assistance data with matching reference numbers
+            RRLPQueryController(LogicalChannel* chan,
+                const BitVector& rrlp_position_request, const BitVector& assistance_data);
+
             PositionResult doTransaction();
 
             // API meant for RRLPQueryManager
@@ -0,0 +1,334 @@
+/*
+* Copyright 2010 Free Software Foundation, Inc.
+*
+* This software is distributed under the terms of the GNU Affero Public License.
+* See the COPYING file in the main directory for details.
+*
+* This use of this software may be subject to additional restrictions.
+* See the LEGAL file in the main directory for details.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "RRLPSweep.h"
+#include "RRLPQueryController.h"
+#include "ControlCommon.h"
+#include "GSMLogicalChannel.h"
+#include "GSMConfig.h"
+#include "GSML3RRMessages.h"
+#include <Logger.h>
+#include <AllocTracking.h>
+#include <iomanip>
+
+using namespace std;
+using namespace GSM;
+using namespace GSM::RRLP;
+using namespace Control;
+
+
+void RRLPSweepStats::clear(unsigned wNumber)
+{
+	number = wNumber;
+	targets = paged = answered = reused = 0;
+	positions = noFix = noAnswer = busy = 0;
+	peakChannels = 0;
+	channelMs = 0;
+	start.now();
+	elapsed = 0;
+}
+
+
+ostream& GSM::RRLP::operator<<(ostream& os, const RRLPSweepStats& stats)
+{
+	long elapsed = stats.elapsed ? stats.elapsed : stats.start.elapsed();
+	os << "sweep " << stats.number << ": " << stats.targets << " targets, "
+		<< stats.paged << " paged, " << stats.answered << " answered, "
+		<< stats.reused << " on existing channels, " << stats.noAnswer << " unanswered, "
+		<< stats.busy << " busy" << endl;
+	os << stats.positions << " positions, " << stats.noFix << " without a fix, in " << elapsed << " ms";
+	if (elapsed>0) {
+		os << ", " << setprecision(3) << stats.positions*1000.0/elapsed << " positions/s";
+		os << ", mean " << setprecision(3) << (double)stats.channelMs/elapsed << " SDCCHs held";
+	}
+	os << ", peak " << stats.peakChannels << endl;
+	return os;
+}
+
+
+
+RRLPSweep::RRLPSweep()
+	:mLock("RRLPSweep"),mRunning(false),
+	mActive(false),mPeriod(0),mScheduled(false),
+	mInFlight(0)
+{
+}
+
+
+RRLPSweep* RRLPSweep::instance()
+{
+	static RRLPSweep* instance = new RRLPSweep;
+	return instance;
+}
+
+
+void RRLPSweep::start(unsigned period, bool now, const vector<string>& IMSIs)
+{
+	mLock.lock();
+	mPeriod = period;
+	mRequested = IMSIs;
+	mScheduled = true;
+	mNextSweep = Timeval(now ? 0 : period*1000);
+	LOG(NOTICE) << "RRLP sweeps every " << period << " s, first in " << mNextSweep.remaining() << " ms";
+	if (!mRunning) {
+		mRunning = true;
+		mThread.start((void*(*)(void*))RRLPSweepServiceLoopAdapter,this,"RRLP sweep");
+	}
+	mSignal.signal();
+	mLock.unlock();
+}
+
+
+void RRLPSweep::stop()
+{
+	mLock.lock();
+	mPeriod = 0;
+	mQueue.clear();
+	mQueued.clear();
+	mScheduled = false;
+	mLock.unlock();
+}
+
+
+void *GSM::RRLP::RRLPSweepServiceLoopAdapter(RRLPSweep *sweep)
+{
+	AllocScope allocScope(AllocControl);
+	sweep->serviceLoop();
+	return NULL;
+}
+
+
+void RRLPSweep::serviceLoop()
+{
+	mLock.lock();
+	while (true) {
+		if (!mActive) {
+			if (!mScheduled || !mNextSweep.passed()) {
+				gThreadIdle();
+				mSignal.wait(mLock,1000);
+				gThreadHeartbeat();
+				continue;
+			}
+			beginSweep();
+		}
+		gThreadHeartbeat();
+		expirePages();
+		pageMore();
+		// Done?
+		if (mQueued.empty() && mPaged.empty() && mInFlight==0) {
+			mActive = false;
+			mCurrent.elapsed = mCurrent.start.elapsed();
+			mLast = mCurrent;
+			// The period runs from the start of one sweep to the start of the next.
+			mScheduled = mPeriod>0;
+			long wait = (long)mPeriod*1000 - mCurrent.elapsed;
+			mNextSweep = Timeval(wait>0 ? wait : 0);
+			mBusyTries.clear();
+			ostringstream summary;
+			summary << mLast;
+			LOG(NOTICE) << "RRLP " << summary.str();
+			continue;
+		}
+		// Queries signal as they finish, so this is the pacing interval.
+		mSignal.wait(mLock,200);
+	}
+}
+
+
+void RRLPSweep::beginSweep()
+{
+	mCurrent.clear(mLast.number+1);
+	mQueue.clear();
+	mQueued.clear();
+
+	// The targets, in order.
+	unsigned maxIdle = getNumWithDefault("RRLP.Sweep.MaxIdle",0);
+	if (mRequested.size()) {
+		for (unsigned i=0; i<mRequested.size(); i++) {
+			if (mQueued.insert(mRequested[i]).second) mQueue.push_back(mRequested[i]);
+		}
+	} else {
+		TMSISnapshot view = gTMSITable.snapshot();
+		for (TMSIMap::const_iterator tp = view->begin(); tp != view->end(); ++tp) {
+			if (maxIdle && tp->second.touched()>maxIdle) continue;
+			string IMSI = tp->second.IMSI();
+			if (mQueued.insert(IMSI).second) mQueue.push_back(IMSI);
+		}
+	}
+	mCurrent.targets = mQueue.size();
+
+	// Build the PDUs for the sweep.
+	unsigned accuracy = getNumWithDefault("RRLP.Sweep.Accuracy",RRLPQueryManager::instance()->accuracy());
+	for (unsigned reference=1; reference<=7; reference++) {
+		buildRRLPQueryFromParams(mRequests[reference],reference,accuracy);
+		buildRRLPAssistanceData(mAssistance[reference],reference);
+	}
+
+	mActive = true;
+	LOG(NOTICE) << "RRLP sweep " << mCurrent.number << " starting, " << mCurrent.targets << " targets";
+}
+
+
+void RRLPSweep::pageMore()
+{
+	unsigned budget = getNumWithDefault("RRLP.Sweep.SDCCHBudget",4);
+	unsigned reserve = getNumWithDefault("RRLP.Sweep.SDCCHReserve",2);
+	unsigned pageTime = getNumWithDefault("RRLP.Sweep.PageTimeout",gConfig.getNum("GSM.T3113"));
+
+	// Each MS gets at most one look per call, so requeued MSs cannot spin.
+	size_t looks = mQueue.size();
+	while (looks-- && mPaged.size()+mInFlight<budget && gBTS.SDCCHAvailable()>reserve) {
+		string IMSI = mQueue.front();
+		mQueue.pop_front();
+		// Claimed by claim() since it was queued?
+		if (!mQueued.count(IMSI)) continue;
+		L3MobileIdentity mobID(IMSI.c_str());
+
+		// An MS with a transaction already is busy with something else.
+		// Try again later in the sweep, in case it shows up on a channel.
+		TransactionEntry other;
+		if (gTransactionTable.find(mobID,other)) {
+			if (mBusyTries[IMSI]++ < 3) mQueue.push_back(IMSI);
+			else {
+				mQueued.erase(IMSI);
+				mCurrent.busy++;
+			}
+			continue;
+		}
+		mQueued.erase(IMSI);
+
+		TransactionEntry transaction(mobID,L3CMServiceType::LocationSweep,L3CallingPartyBCDNumber());
+		gTransactionTable.add(transaction);
+		gBTS.pager().addID(mobID,SDCCHType,transaction,pageTime);
+		PagedMS &paged = mPaged[IMSI];
+		paged.transactionID = transaction.ID();
+		paged.paged.now();
+		mCurrent.paged++;
+	}
+}
+
+
+void RRLPSweep::expirePages()
+{
+	// Allow a response that started just before the pager gave up.
+	long limit = getNumWithDefault("RRLP.Sweep.PageTimeout",gConfig.getNum("GSM.T3113")) + 2000;
+	map<string,PagedMS>::iterator pp = mPaged.begin();
+	while (pp != mPaged.end()) {
+		if (pp->second.paged.elapsed()<limit) {
+			++pp;
+			continue;
+		}
+		LOG(INFO) << "no paging response from " << pp->first;
+		gTransactionTable.remove(pp->second.transactionID);
+		mCurrent.noAnswer++;
+		mPaged.erase(pp++);
+	}
+}
+
+
+PositionResult RRLPSweep::query(const L3MobileIdentity& mobID, LogicalChannel* DCCH)
+{
+	RRLPQueryManager *manager = RRLPQueryManager::instance();
+	unsigned reference = manager->nextReference(mobID);
+	mLock.lock();
+	mInFlight++;
+	if (mInFlight>mCurrent.peakChannels) mCurrent.peakChannels = mInFlight;
+	const BitVector request(mRequests[reference]);
+	const BitVector assistance(mAssistance[reference]);
+	mLock.unlock();
+
+	Timeval start;
+	PositionResult pr = manager->doTransaction(mobID,DCCH,request,assistance);
+
+	mLock.lock();
+	mInFlight--;
+	mCurrent.channelMs += start.elapsed();
+	if (pr.mValid) mCurrent.positions++;
+	else mCurrent.noFix++;
+	mSignal.signal();
+	mLock.unlock();
+	return pr;
+}
+
+
+void RRLPSweep::pagingResponse(TransactionEntry& transaction, LogicalChannel* DCCH)
+{
+	L3MobileIdentity mobID = transaction.subscriber();
+	mLock.lock();
+	bool expected = mPaged.erase(mobID.digits())>0;
+	if (expected) mCurrent.answered++;
+	mLock.unlock();
+	if (!expected) LOG(NOTICE) << "late sweep paging response from " << mobID;
+
+	transaction.Q931State(TransactionEntry::Active);
+	gTransactionTable.update(transaction);
+	PositionResult pr = query(mobID,DCCH);
+	logMSInfo(DCCH,pr,mobID);
+	DCCH->send(L3ChannelRelease());
+	gTransactionTable.remove(transaction.ID());
+}
+
+
+bool RRLPSweep::claim(const L3MobileIdentity& mobID, LogicalChannel* DCCH, PositionResult& pr)
+{
+	// A copy, since the query below takes seconds.
+	string IMSI;
+	if (mobID.type()==IMSIType) IMSI = mobID.digits();
+	else if (mobID.type()==TMSIType) IMSI = gTMSITable.IMSI(mobID.TMSI());
+	if (IMSI.empty()) return false;
+
+	mLock.lock();
+	bool waiting = mActive && mQueued.erase(IMSI)>0;
+	if (waiting) mCurrent.reused++;
+	mLock.unlock();
+	if (!waiting) return false;
+
+	LOG(INFO) << "sweep query of " << mobID << " on " << DCCH->type();
+	pr = query(L3MobileIdentity(IMSI.c_str()),DCCH);
+	return true;
+}
+
+
+void RRLPSweep::report(ostream& os) const
+{
+	mLock.lock();
+	if (mActive) {
+		os << "in progress, " << mQueued.size() << " waiting, " << mPaged.size() << " paged, "
+			<< mInFlight << " querying" << endl;
+		os << mCurrent;
+	} else if (mScheduled) {
+		os << "next sweep in " << mNextSweep.remaining()/1000 << " s" << endl;
+	} else {
+		os << "not sweeping" << endl;
+	}
+	if (mLast.number) os << "last " << mLast;
+	mLock.unlock();
+	os << "SDCCH: " << gBTS.SDCCHActive() << " active of " << gBTS.SDCCHTotal() << endl;
+	RRLPQueryManager *manager = RRLPQueryManager::instance();
+	os << "all RRLP queries: " << manager->numQueries() << ", " << manager->numPositions() << " with positions" << endl;
+}
+
+
+// vim: ts=4 sw=4
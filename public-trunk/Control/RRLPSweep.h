@@ -0,0 +1,180 @@
+/*
+* Copyright 2010 Free Software Foundation, Inc.
+*
+* This software is distributed under the terms of the GNU Affero Public License.
+* See the COPYING file in the main directory for details.
+*
+* This use of this software may be subject to additional restrictions.
+* See the LEGAL file in the main directory for details.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef RRLPSWEEP_H
+#define RRLPSWEEP_H
+
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include <BitVector.h>
+#include <Threads.h>
+#include <Timeval.h>
+#include "CollectMSInfo.h"
+
+
+namespace Control {
+class TransactionEntry;
+};
+
+
+namespace GSM {
+namespace RRLP {
+
+
+/** Counts for one sweep. */
+struct RRLPSweepStats {
+	unsigned number;			///< sweep number, from 1
+	unsigned targets;			///< MSs to locate
+	unsigned paged;				///< MSs paged
+	unsigned answered;			///< paging responses
+	unsigned reused;			///< queries on a channel the MS already held
+	unsigned positions;			///< queries that returned a position
+	unsigned noFix;				///< queries that did not
+	unsigned noAnswer;			///< pages that timed out
+	unsigned busy;				///< MSs skipped because of another transaction
+	unsigned peakChannels;		///< most SDCCHs held by sweep queries at once
+	unsigned long channelMs;	///< total SDCCH time held by sweep queries
+	Timeval start;
+	long elapsed;				///< ms, set when the sweep ends
+
+	RRLPSweepStats() { clear(0); }
+
+	void clear(unsigned wNumber);
+};
+
+
+/**
+	Locates every attached MS with RRLP, many at a time.
+	A sweep pages MSs from the TMSI table (or a given list of IMSIs) and queries
+	each one on the SDCCH it answers on, keeping no more than RRLP.Sweep.SDCCHBudget
+	queries paged or running and at least RRLP.Sweep.SDCCHReserve SDCCHs free.
+	An MS still waiting in the sweep that shows up for something else is queried
+	on the channel it already has; see collectMSInfo().
+	The RRLP PDUs are built once per sweep, for every reference number.
+	Sweeps repeat every RRLP.Sweep.Period seconds, if set.
+*/
+class RRLPSweep {
+
+	private:
+
+	mutable Mutex mLock;
+	Signal mSignal;				///< signaled when a query ends or a sweep is requested
+	Thread mThread;
+	bool mRunning;				///< true once the service thread is started
+
+	bool mActive;				///< true while a sweep is in progress
+	unsigned mPeriod;			///< seconds between sweep starts, 0 for one sweep
+	bool mScheduled;			///< true if another sweep is to start
+	Timeval mNextSweep;			///< when it starts
+	std::vector<std::string> mRequested;	///< explicit IMSIs for the next sweep, all if empty
+
+	std::list<std::string> mQueue;			///< IMSIs not yet paged, in order
+	std::set<std::string> mQueued;			///< the same IMSIs, for lookup
+	std::map<std::string,unsigned> mBusyTries;	///< requeues of MSs with other transactions
+
+	struct PagedMS {
+		unsigned transactionID;
+		Timeval paged;
+	};
+	std::map<std::string,PagedMS> mPaged;	///< IMSIs paged and not yet answered
+
+	unsigned mInFlight;			///< queries running on a channel
+
+	BitVector mRequests[8];		///< position requests by reference number, built per sweep
+	BitVector mAssistance[8];	///< assistance data by reference number, built per sweep
+
+	RRLPSweepStats mCurrent;	///< the sweep in progress
+	RRLPSweepStats mLast;		///< the last complete sweep
+
+	RRLPSweep();
+
+	public:
+
+	static RRLPSweep* instance();
+
+	/**
+		Start sweeping.
+		@param period Seconds between sweeps, or 0 for just one.
+		@param now Start the first sweep now, rather than after one period.
+		@param IMSIs MSs to locate; if empty, every MS in the TMSI table.
+	*/
+	void start(unsigned period, bool now, const std::vector<std::string>& IMSIs=std::vector<std::string>());
+
+	/** Stop sweeping; pages and queries already out are allowed to finish. */
+	void stop();
+
+	/**
+		Query an MS that answered a sweep page, then release the channel.
+		Called from the paging response handler.
+	*/
+	void pagingResponse(Control::TransactionEntry& transaction, LogicalChannel* DCCH);
+
+	/**
+		If the MS is waiting in the current sweep, query it now on its channel.
+		The channel is left open.
+		@return true if a query was made, with the result in pr.
+	*/
+	bool claim(const L3MobileIdentity& mobID, LogicalChannel* DCCH, PositionResult& pr);
+
+	/** Write sweep progress, positions/s and SDCCH occupancy. */
+	void report(std::ostream& os) const;
+
+	private:
+
+	void serviceLoop();
+
+	friend void *RRLPSweepServiceLoopAdapter(RRLPSweep*);
+
+	/** Start a sweep; mLock must be held. */
+	void beginSweep();
+
+	/** Page MSs up to the budget; mLock must be held. */
+	void pageMore();
+
+	/** Drop pages that were not answered; mLock must be held. */
+	void expirePages();
+
+	/** Run one query with the cached PDUs and count the result. */
+	PositionResult query(const L3MobileIdentity& mobID, LogicalChannel* DCCH);
+};
+
+
+void *RRLPSweepServiceLoopAdapter(RRLPSweep*);
+
+
+std::ostream& operator<<(std::ostream&, const RRLPSweepStats&);
+
+
+}; // namespace RRLP
+}; // namespace GSM
+
+
+#endif
+// vim: ts=4 sw=4
@@ -30,8 +30,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <list>
+#include <map>
+#include <vector>
 
 #include "ControlCommon.h"
+#include "RRLPSweep.h"
 #include "GSMLogicalChannel.h"
 #include "GSMConfig.h"
 
@@ -155,13 +158,14 @@ void Control::AccessGrantResponder(
 		return;
 	}
 
-	// Get an AGCH to send on.
-	CCCHLogicalChannel *AGCH = gBTS.getAGCH();
+	// Get an AGCH to send on, on the CCCH timeslot of the RACH burst.
+	CCCHLogicalChannel *AGCH = gBTS.getAGCH(when.TN());
 	// Someone had better have created a least one AGCH.
 	assert(AGCH);
 	// Check AGCH load now.
 	if (AGCH->load()>gConfig.getNum("GSM.AGCH.QMax")) {
 		LOG(NOTICE) "AccessGrantResponder: AGCH congestion";
+		gBTS.countAGCHDrop();
 		return;
 	}
 
@@ -238,8 +242,8 @@ void Control::PagingResponseHandler(const L3PagingResponse* resp, LogicalChannel
 	// If we got a TMSI, find the IMSI.
 	L3MobileIdentity mobileID = resp->mobileIdentity();
 	if (mobileID.type()==TMSIType) {
-		const char *IMSI = gTMSITable.IMSI(mobileID.TMSI());
-		if (IMSI) mobileID = L3MobileIdentity(IMSI);
+		string IMSI = gTMSITable.IMSI(mobileID.TMSI());
+		if (!IMSI.empty()) mobileID = L3MobileIdentity(IMSI.c_str());
 		else {
 			// Don't try too hard to resolve.
 			// The handset is supposed to respond with the same ID type as in the request.
@@ -282,6 +286,9 @@ void Control::PagingResponseHandler(const L3PagingResponse* resp, LogicalChannel
 			case L3CMServiceType::SupplementaryService:
 				MTUSSDController(transaction, DCCH);
 				return;
+			case L3CMServiceType::LocationSweep:
+				GSM::RRLP::RRLPSweep::instance()->pagingResponse(transaction, DCCH);
+				return;
 			default:
 				// Flush stray MOC entries.
 				// There should not be any, but...
@@ -401,37 +408,70 @@ unsigned Pager::pageAll()
 			// DO NOT remove the transaction entry here.
 			// It may be in use in an active call.
 			LOG(INFO) << "erasing " << lp->ID();
+			// A page that congestion kept off the PCH for its whole life is a drop.
+			if (!lp->paged()) {
+				LOG(NOTICE) << "page for " << lp->ID() << " expired unsent";
+				gBTS.countPCHDrop();
+			}
 			lp=mPageIDs.erase(lp);
 		}
 	}
 
 	LOG(INFO) << "paging " << mPageIDs.size() << " mobile(s)";
 
-	// Page remaining entries, two at a time if possible.
+	// Sort the IDs into the paging blocks their MSs listen to, GSM 05.02 6.5.2.
+	// An ID with no known IMSI goes into every paging block.
+	// The blocks point into mPageIDs, so sending can mark the entries.
+	typedef vector<PagingEntry*> BlockEntries;
+	typedef map<CCCHLogicalChannel*,BlockEntries> BlockMap;
+	BlockMap blocks;
+	for (lp = mPageIDs.begin(); lp != mPageIDs.end(); ++lp) {
+		const L3MobileIdentity& id = lp->ID();
+		string IMSI;
+		if (id.type()==IMSIType) IMSI = id.digits();
+		else if (id.type()==TMSIType) IMSI = gTMSITable.IMSI(id.TMSI());
+		if (!IMSI.empty()) {
+			blocks[gBTS.getPCH(IMSI.c_str())].push_back(&*lp);
+			continue;
+		}
+		for (unsigned i=0; i<gBTS.numPCHs(); i++) blocks[gBTS.getPCH((size_t)i)].push_back(&*lp);
+	}
+
+	// Page each block, two at a time if possible.
 	// These PCH send operations are non-blocking.
-	lp = mPageIDs.begin();
-	while (lp != mPageIDs.end()) {
-		// FIXME -- This completely ignores the paging groups.
-		// HACK -- So we send every page twice.
-		// That will probably mean a different Pager for each subchannel.
-		// See GSM 04.08 10.5.2.11 and GSM 05.02 6.5.2.
-		const L3MobileIdentity& id1 = lp->ID();
-		ChannelType type1 = lp->type();
-		++lp;
-		if (lp==mPageIDs.end()) {
-			// Just one ID left?
-			LOG(DEBUG) << "paging " << id1;
-			gBTS.getPCH(0)->send(L3PagingRequestType1(id1,type1));
-			gBTS.getPCH(0)->send(L3PagingRequestType1(id1,type1));
-			break;
+	unsigned QMax = gConfig.defines("GSM.PCH.QMax") ? gConfig.getNum("GSM.PCH.QMax") : 5;
+	for (BlockMap::iterator bp = blocks.begin(); bp != blocks.end(); ++bp) {
+		CCCHLogicalChannel *PCH = bp->first;
+		const BlockEntries& IDs = bp->second;
+		// A congested block skips this round; the IDs stay in the table for the next.
+		// They count as drops only if they expire unsent, above.
+		if (PCH->load()>QMax) {
+			LOG(NOTICE) << "PCH congestion on C0T" << PCH->TN() << ", deferring " << IDs.size() << " page(s)";
+			continue;
+		}
+		// Every page is sent twice, once for each multiframe of BS_PA_MFRMS.
+		BlockEntries::const_iterator ip = IDs.begin();
+		while (ip != IDs.end()) {
+			(*ip)->markPaged();
+			const L3MobileIdentity& id1 = (*ip)->ID();
+			ChannelType type1 = (*ip)->type();
+			++ip;
+			if (ip==IDs.end()) {
+				// Just one ID left?
+				LOG(DEBUG) << "paging " << id1 << " on C0T" << PCH->TN();
+				PCH->send(L3PagingRequestType1(id1,type1));
+				PCH->send(L3PagingRequestType1(id1,type1));
+				break;
+			}
+			// Page by pairs when possible.
+			(*ip)->markPaged();
+			const L3MobileIdentity& id2 = (*ip)->ID();
+			ChannelType type2 = (*ip)->type();
+			++ip;
+			LOG(DEBUG) << "paging " << id1 << " and " << id2 << " on C0T" << PCH->TN();
+			PCH->send(L3PagingRequestType1(id1,type1,id2,type2));
+			PCH->send(L3PagingRequestType1(id1,type1,id2,type2));
 		}
-		// Page by pairs when possible.
-		const L3MobileIdentity& id2 = lp->ID();
-		ChannelType type2 = lp->type();
-		++lp;
-		LOG(DEBUG) << "paging " << id1 << " and " << id2;
-		gBTS.getPCH(0)->send(L3PagingRequestType1(id1,type1,id2,type2));
-		gBTS.getPCH(0)->send(L3PagingRequestType1(id1,type1,id2,type2));
 	}
 	
 	mLock.unlock();
@@ -448,13 +488,14 @@ void Pager::start()
 {
 	if (mRunning) return;
 	mRunning=true;
-	mPagingThread.start((void* (*)(void*))PagerServiceLoopAdapter, (void*)this);
+	mPagingThread.start((void* (*)(void*))PagerServiceLoopAdapter, (void*)this, "pager");
 }
 
 
 
 void* Control::PagerServiceLoopAdapter(Pager *pager)
 {
+	AllocScope allocScope(AllocControl);
 	pager->serviceLoop();
 	return NULL;
 }
@@ -464,27 +505,41 @@ void Pager::serviceLoop()
 	while (mRunning) {
 
 		LOG(DEBUG) << "Pager blocking for signal";
+		gThreadIdle();
 		mLock.lock();
 		while (mPageIDs.size()==0) mPageSignal.wait(mLock);
 		mLock.unlock();
+		gThreadHeartbeat();
 
 		// page everything
 		pageAll();
 
 		// Wait for pending activity to clear the channel.
 		// This wait is what causes PCH to have lower priority than AGCH.
-		unsigned load = gBTS.getPCH()->load();
+		unsigned load = gBTS.PCHMaxLoad();
 		LOG(DEBUG) << "Pager waiting for " << load << " multiframes";
+		// A deep PCH queue can hold this wait past the stall deadline, so it counts as idle.
+		gThreadIdle();
 		if (load) sleepFrames(51*load);
 	}
 }
 
 
 
+void Pager::snapshot(PagingEntryList& IDs) const
+{
+	mLock.lock();
+	IDs = mPageIDs;
+	mLock.unlock();
+}
+
+
 void Pager::dump(ostream& os) const
 {
-	PagingEntryList::const_iterator lp = mPageIDs.begin();
-	while (lp != mPageIDs.end()) {
+	PagingEntryList IDs;
+	snapshot(IDs);
+	PagingEntryList::const_iterator lp = IDs.begin();
+	while (lp != IDs.end()) {
 		os << lp->ID() << " " << lp->type() << " " << lp->expired() << endl;
 		++lp;
 	}
@@ -0,0 +1,282 @@
+/*
+* Copyright 2010 Free Software Foundation, Inc.
+*
+* This software is distributed under the terms of the GNU Affero Public License.
+* See the COPYING file in the main directory for details.
+*
+* This use of this software may be subject to additional restrictions.
+* See the LEGAL file in the main directory for details.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "SharedTMSIStore.h"
+#include <GSML3CommonElements.h>
+#include <Logger.h>
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sstream>
+
+using namespace std;
+using namespace Control;
+
+
+static const char sMagic[8] = { 'O','B','T','S','T','M','S','I' };
+static const uint32_t sVersion = 1;
+static const unsigned sMaxLAIs = 16;
+
+
+struct SharedTMSIStore::Header {
+	char magic[8];
+	uint32_t version;
+	uint32_t slots;				///< number of SharedTMSISlots after the header
+	uint32_t counter;			///< the next TMSI to assign
+	uint32_t numLAIs;
+	char LAIs[sMaxLAIs][40];	///< as written by L3LocationAreaIdentity::text
+};
+
+
+static string LAIString(const GSM::L3LocationAreaIdentity& LAI)
+{
+	ostringstream os;
+	LAI.text(os);
+	return os.str().substr(0,39);
+}
+
+
+
+SharedTMSIStore::~SharedTMSIStore()
+{
+	if (mHeader) munmap(mHeader,mBytes);
+	if (mFD>=0) close(mFD);
+}
+
+
+void SharedTMSIStore::lock(bool exclusive)
+{
+	mLock.lock();
+	while (flock(mFD,exclusive ? LOCK_EX : LOCK_SH)<0 && errno==EINTR) {}
+}
+
+
+void SharedTMSIStore::unlock()
+{
+	flock(mFD,LOCK_UN);
+	mLock.unlock();
+}
+
+
+bool SharedTMSIStore::open(const char* path, unsigned slots, const GSM::L3LocationAreaIdentity& LAI)
+{
+	mPath = path;
+	mFD = ::open(path,O_RDWR|O_CREAT,0644);
+	if (mFD<0) {
+		LOG(ALARM) << "cannot open shared TMSI table " << path << ": " << strerror(errno);
+		return false;
+	}
+	lock(true);
+
+	// The first process to get here initializes the table.
+	Header header;
+	struct stat info;
+	fstat(mFD,&info);
+	bool valid = (size_t)info.st_size>=sizeof(Header)
+		&& pread(mFD,&header,sizeof(header),0)==(ssize_t)sizeof(header)
+		&& memcmp(header.magic,sMagic,sizeof(sMagic))==0
+		&& header.version==sVersion
+		&& (size_t)info.st_size==sizeof(Header)+header.slots*sizeof(SharedTMSISlot);
+	if (!valid) {
+		if (info.st_size) LOG(ALARM) << "reinitializing shared TMSI table " << path;
+		memset(&header,0,sizeof(header));
+		memcpy(header.magic,sMagic,sizeof(sMagic));
+		header.version = sVersion;
+		header.slots = slots;
+		header.counter = time(NULL);
+		// Zero-filled slots are empty.
+		if (ftruncate(mFD,0)<0
+			|| ftruncate(mFD,sizeof(Header)+slots*sizeof(SharedTMSISlot))<0
+			|| pwrite(mFD,&header,sizeof(header),0)!=(ssize_t)sizeof(header)) {
+			LOG(ALARM) << "cannot initialize shared TMSI table " << path << ": " << strerror(errno);
+			unlock();
+			return false;
+		}
+	} else if (header.slots!=slots) {
+		LOG(WARN) << "shared TMSI table " << path << " has " << header.slots << " slots, not " << slots;
+	}
+
+	mBytes = sizeof(Header)+header.slots*sizeof(SharedTMSISlot);
+	void *map = mmap(NULL,mBytes,PROT_READ|PROT_WRITE,MAP_SHARED,mFD,0);
+	if (map==MAP_FAILED) {
+		LOG(ALARM) << "cannot map shared TMSI table " << path << ": " << strerror(errno);
+		unlock();
+		return false;
+	}
+	mHeader = (Header*)map;
+	mSlots = (SharedTMSISlot*)(mHeader+1);
+
+	// Add our LAI to the site list.
+	string ours = LAIString(LAI);
+	unsigned i=0;
+	while (i<mHeader->numLAIs && strcmp(mHeader->LAIs[i],ours.c_str())!=0) i++;
+	if (i==mHeader->numLAIs) {
+		if (i<sMaxLAIs) {
+			strcpy(mHeader->LAIs[i],ours.c_str());
+			mHeader->numLAIs++;
+		} else {
+			LOG(WARN) << "shared TMSI table " << path << " LAI list is full";
+		}
+	}
+	unlock();
+	LOG(NOTICE) << "sharing TMSI table " << path << ", " << mHeader->slots << " slots";
+	return true;
+}
+
+
+SharedTMSISlot* SharedTMSIStore::slot(unsigned TMSI)
+{
+	if (!TMSI) return NULL;
+	SharedTMSISlot *slot = &mSlots[TMSI % mHeader->slots];
+	return slot->TMSI==TMSI ? slot : NULL;
+}
+
+
+SharedTMSISlot* SharedTMSIStore::slot(const char* IMSI)
+{
+	for (unsigned i=0; i<mHeader->slots; i++) {
+		SharedTMSISlot *slot = &mSlots[i];
+		if (slot->TMSI && strncmp(slot->IMSI,IMSI,sizeof(slot->IMSI))==0) return slot;
+	}
+	return NULL;
+}
+
+
+unsigned SharedTMSIStore::assign(const char* IMSI, const char* IMEI, SharedTMSISlot& copy)
+{
+	lock(true);
+	SharedTMSISlot *slot = this->slot(IMSI);
+	if (slot) {
+		slot->touched = time(NULL);
+		copy = *slot;
+		unlock();
+		return copy.TMSI;
+	}
+	// Zero marks an empty slot.
+	unsigned TMSI = mHeader->counter++;
+	if (!TMSI) TMSI = mHeader->counter++;
+	slot = &mSlots[TMSI % mHeader->slots];
+	memset(slot,0,sizeof(SharedTMSISlot));
+	slot->TMSI = TMSI;
+	slot->created = slot->touched = time(NULL);
+	strncpy(slot->IMSI,IMSI,sizeof(slot->IMSI)-1);
+	strncpy(slot->IMEI,IMEI ? IMEI : "?",sizeof(slot->IMEI)-1);
+	copy = *slot;
+	unlock();
+	return TMSI;
+}
+
+
+bool SharedTMSIStore::find(unsigned TMSI, SharedTMSISlot& copy)
+{
+	lock(false);
+	SharedTMSISlot *found = slot(TMSI);
+	if (found) {
+		// Racing touches store the same value, near enough.
+		found->touched = time(NULL);
+		copy = *found;
+	}
+	unlock();
+	return found!=NULL;
+}
+
+
+unsigned SharedTMSIStore::find(const char* IMSI, SharedTMSISlot& copy)
+{
+	lock(false);
+	SharedTMSISlot *found = slot(IMSI);
+	if (found) {
+		found->touched = time(NULL);
+		copy = *found;
+	}
+	unlock();
+	return found ? copy.TMSI : 0;
+}
+
+
+bool SharedTMSIStore::setIMEI(unsigned TMSI, const char* IMEI)
+{
+	lock(true);
+	SharedTMSISlot *found = slot(TMSI);
+	if (found) {
+		memset(found->IMEI,0,sizeof(found->IMEI));
+		strncpy(found->IMEI,IMEI,sizeof(found->IMEI)-1);
+		found->touched = time(NULL);
+	}
+	unlock();
+	return found!=NULL;
+}
+
+
+void SharedTMSIStore::registered(unsigned TMSI, unsigned registrar)
+{
+	lock(true);
+	SharedTMSISlot *found = slot(TMSI);
+	if (found) {
+		found->registered = found->touched = time(NULL);
+		found->registrar = registrar;
+	}
+	unlock();
+}
+
+
+void SharedTMSIStore::erase(unsigned TMSI)
+{
+	lock(true);
+	SharedTMSISlot *found = slot(TMSI);
+	if (found) memset(found,0,sizeof(SharedTMSISlot));
+	unlock();
+}
+
+
+bool SharedTMSIStore::siteLAI(const GSM::L3LocationAreaIdentity& LAI)
+{
+	string theirs = LAIString(LAI);
+	lock(false);
+	bool found = false;
+	for (unsigned i=0; i<mHeader->numLAIs && !found; i++) found = strcmp(mHeader->LAIs[i],theirs.c_str())==0;
+	unlock();
+	return found;
+}
+
+
+void SharedTMSIStore::report(ostream& os)
+{
+	lock(false);
+	unsigned used = 0;
+	for (unsigned i=0; i<mHeader->slots; i++) if (mSlots[i].TMSI) used++;
+	os << "shared with the site in " << mPath << ": " << used << " of " << mHeader->slots << " slots used" << endl;
+	for (unsigned i=0; i<mHeader->numLAIs; i++) os << "site LAI " << mHeader->LAIs[i] << endl;
+	unlock();
+}
+
+
+// vim: ts=4 sw=4
@@ -0,0 +1,142 @@
+/*
+* Copyright 2010 Free Software Foundation, Inc.
+*
+* This software is distributed under the terms of the GNU Affero Public License.
+* See the COPYING file in the main directory for details.
+*
+* This use of this software may be subject to additional restrictions.
+* See the LEGAL file in the main directory for details.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef SHAREDTMSISTORE_H
+#define SHAREDTMSISTORE_H
+
+#include <stdint.h>
+#include <string>
+#include <ostream>
+#include <Threads.h>
+
+
+namespace GSM {
+class L3LocationAreaIdentity;
+};
+
+
+namespace Control {
+
+
+/** A TMSI record as stored in the shared table. */
+struct SharedTMSISlot {
+	uint32_t TMSI;			///< 0 if the slot is empty
+	uint32_t created;		///< seconds since the epoch
+	uint32_t touched;		///< seconds since the epoch
+	uint32_t registered;	///< time of the last SIP registration, 0 if none
+	uint32_t registrar;		///< SIP.Port of the BTS that made that registration
+	char IMSI[16];
+	char IMEI[16];
+};
+
+
+/**
+	A TMSI table in a memory-mapped file, shared by the BTS processes of a site.
+	TMSIs are assigned from one counter, so they are unique across the site,
+	and each TMSI lives in slot TMSI%slots, so the oldest TMSI is the one
+	replaced when the table is full, as in TMSITable.
+	Processes are serialized with flock(), which is released if a process dies,
+	and the threads of a process with a Mutex, since flock() does not see them.
+	The table also lists the LAIs of the BTSs using it, so that a TMSI from
+	a neighbouring cell on the site can be trusted.
+*/
+class SharedTMSIStore {
+
+	private:
+
+	struct Header;
+
+	int mFD;
+	Header *mHeader;
+	SharedTMSISlot *mSlots;
+	size_t mBytes;			///< size of the mapping
+	std::string mPath;
+	Mutex mLock;			///< serializes the threads of this process
+
+	public:
+
+	SharedTMSIStore()
+		:mFD(-1),mHeader(NULL),mSlots(NULL),mBytes(0),
+		mLock("SharedTMSIStore")
+	{ }
+
+	~SharedTMSIStore();
+
+	/**
+		Open the table, creating it if needed, and add an LAI to its site list.
+		@param path The table file, usually in /dev/shm.
+		@param slots The table size, if it is created here.
+		@param LAI The LAI of this BTS.
+		@return true on success.
+	*/
+	bool open(const char* path, unsigned slots, const GSM::L3LocationAreaIdentity& LAI);
+
+	/**
+		Find or assign the TMSI for an IMSI.
+		@param IMEI The IMEI for a new record, or NULL.
+		@param slot A copy of the record.
+		@return The TMSI.
+	*/
+	unsigned assign(const char* IMSI, const char* IMEI, SharedTMSISlot& slot);
+
+	/** Find a record by TMSI and touch it; false if not found. */
+	bool find(unsigned TMSI, SharedTMSISlot& slot);
+
+	/** Find a record by IMSI and touch it; returns its TMSI, or 0 if not found.  Linear time. */
+	unsigned find(const char* IMSI, SharedTMSISlot& slot);
+
+	/** Set the IMEI of a record. */
+	bool setIMEI(unsigned TMSI, const char* IMEI);
+
+	/** Note a successful SIP registration. */
+	void registered(unsigned TMSI, unsigned registrar);
+
+	/** Remove a record. */
+	void erase(unsigned TMSI);
+
+	/** True if the LAI is one of the site's. */
+	bool siteLAI(const GSM::L3LocationAreaIdentity& LAI);
+
+	/** Write the table size, use and site LAIs. */
+	void report(std::ostream& os);
+
+	private:
+
+	/** The slot for a TMSI, if it holds that TMSI; mFD must be locked. */
+	SharedTMSISlot* slot(unsigned TMSI);
+
+	/** The slot for an IMSI, or NULL; mFD must be locked.  Linear time. */
+	SharedTMSISlot* slot(const char* IMSI);
+
+	void lock(bool exclusive);
+	void unlock();
+};
+
+
+};	// namespace Control
+
+
+#endif
+// vim: ts=4 sw=4
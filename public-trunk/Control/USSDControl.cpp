@@ -359,7 +359,10 @@ void Control::MOUSSDController(const L3CMServiceRequest *request, LogicalChannel
 		// Notify handler
 		gTransactionTable.update(transaction);
 		pUssdData->postMS();
+		gUSSDSessions.signal(transactionID);
 	}
+	// Let the handler see the transaction is gone.
+	gUSSDSessions.signal(transactionID);
 }
 
 
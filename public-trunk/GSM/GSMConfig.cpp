@@ -23,6 +23,9 @@
 */
 
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "GSMConfig.h"
 #include "GSMTransfer.h"
 #include "GSMLogicalChannel.h"
@@ -36,9 +39,26 @@ using namespace GSM;
 
 
 GSMConfig::GSMConfig()
-	:mSI5Frame(UNIT_DATA),mSI6Frame(UNIT_DATA),
+	:mAGCHDrops(0),mPCHDrops(0),
+	mSI5Frame(UNIT_DATA),mSI6Frame(UNIT_DATA),
 	mT3122(gConfig.getNum("GSM.T3122Min"))
 {
+	mLock.name("GSMConfig");
+	// C0 carries the beacon; the other carriers only carry traffic and SDCCHs.
+	mARFCNs.push_back(gConfig.getNum("GSM.ARFCN"));
+	mARFCNAtten.push_back(0);
+	if (gConfig.defines("GSM.ARFCNs")) {
+		std::vector<unsigned> others = gConfig.getVector("GSM.ARFCNs");
+		std::vector<unsigned> atten;
+		if (gConfig.defines("GSM.ARFCNs.AttenDB")) atten = gConfig.getVector("GSM.ARFCNs.AttenDB");
+		for (unsigned i=0; i<others.size(); i++) {
+			for (unsigned j=0; j<mARFCNs.size(); j++) {
+				LOG_ASSERT(others[i]!=mARFCNs[j]);
+			}
+			mARFCNs.push_back(others[i]);
+			mARFCNAtten.push_back(i<atten.size() ? atten[i] : 0);
+		}
+	}
 	regenerateBeacon();
 }
 
@@ -72,15 +92,21 @@ void GSMConfig::regenerateBeacon()
 	L3Frame l3(UNIT_DATA);
 
 	// SI1
+	// The cell allocation is every carrier of the cell.
 	L3SystemInformationType1 SI1;
+	SI1.cellChannelDescription(L3FrequencyList(mARFCNs));
 	LOG(INFO) << SI1;
 	SI1.write(l3);
 	L2Header SI1Header(L2Length(l3.length()));
 	mSI1Frame = L2Frame(SI1Header,l3);
 	LOG(DEBUG) << "mSI1Frame " << mSI1Frame;
 
+	// The BA list, for SI2 and SI5.
+	L3NeighborCellsDescription BAList(BCCHFrequencies());
+
 	// SI2
 	L3SystemInformationType2 SI2;
+	SI2.BCCHFrequencyList(BAList);
 	LOG(INFO) << SI2;
 	SI2.write(l3);
 	L2Header SI2Header(L2Length(l3.length()));
@@ -105,6 +131,7 @@ void GSMConfig::regenerateBeacon()
 
 	// SI5
 	L3SystemInformationType5 SI5;
+	SI5.BCCHFrequencyList(BAList);
 	LOG(INFO) << SI5;
 	SI5.write(mSI5Frame);
 	LOG(DEBUG) << "mSI5Frame " << mSI5Frame;
@@ -121,6 +148,131 @@ void GSMConfig::regenerateBeacon()
 
 
 
+std::vector<unsigned> GSMConfig::BCCHFrequencies() const
+{
+	std::vector<unsigned> retVal;
+	std::vector<unsigned> neighbors = gConfig.getVector("GSM.Neighbors");
+	for (unsigned i=0; i<neighbors.size(); i++) {
+		bool ours = false;
+		for (unsigned CN=1; CN<mARFCNs.size(); CN++) {
+			if (neighbors[i]==mARFCNs[CN]) ours = true;
+		}
+		if (ours) {
+			LOG(WARN) << "GSM.Neighbors lists ARFCN " << neighbors[i] << ", a non-C0 carrier of this BTS; leaving it out of the BA list";
+			continue;
+		}
+		retVal.push_back(neighbors[i]);
+	}
+	return retVal;
+}
+
+
+
+/** The number of CCCH blocks reserved for AGCH, as advertised in L3ControlChannelDescription. */
+static unsigned AGBlocksReserved()
+{
+	if (!gConfig.defines("GSM.CCD.BS_AG_BLKS_RES")) return 2;
+	return gConfig.getNum("GSM.CCD.BS_AG_BLKS_RES");
+}
+
+/** The number of multiframes between paging blocks of a paging group; BS_PA_MFRMS=0 in the beacon. */
+static const unsigned BS_PA_MFRMS = 2;
+
+
+
+void GSMConfig::addAGCH(CCCHLogicalChannel* wCCCH)
+{
+	LOG_ASSERT(wCCCH->TN()%2==0);
+	mAGCHPool.push_back(wCCCH);
+	mAGCHGroups[wCCCH->TN()/2].push_back(wCCCH);
+}
+
+
+void GSMConfig::addPCH(CCCHLogicalChannel* wCCCH)
+{
+	LOG_ASSERT(wCCCH->TN()%2==0);
+	mPCHPool.push_back(wCCCH);
+	mPCHGroups[wCCCH->TN()/2].push_back(wCCCH);
+}
+
+
+void GSMConfig::addCCCH(CCCHLogicalChannel* wCCCH, unsigned block)
+{
+	// GSM 05.02 6.5.1: The first BS_AG_BLKS_RES blocks are AGCH only.
+	// The rest are paging blocks, which the AGCH may also use.
+	// The AGCH group lists the reserved blocks first, so they win load ties.
+	addAGCH(wCCCH);
+	if (block>=AGBlocksReserved()) addPCH(wCCCH);
+}
+
+
+unsigned GSMConfig::numCCCHGroups() const
+{
+	unsigned count = 0;
+	while (count<4 && mPCHGroups[count].size()) count++;
+	return count;
+}
+
+
+CCCHLogicalChannel* GSMConfig::getAGCH(unsigned TN)
+{
+	// The MS listens for its assignment on the CCCH timeslot where it sent the RACH burst.
+	if (TN%2==0 && TN<8 && mAGCHGroups[TN/2].size()) return minimumLoad(mAGCHGroups[TN/2]);
+	return getAGCH();
+}
+
+
+CCCHLogicalChannel* GSMConfig::getPCH(const char* IMSI)
+{
+	// GSM 05.02 6.5.2.
+	unsigned BS_CC_CHANS = numCCCHGroups();
+	if (BS_CC_CHANS==0) return NULL;
+	// Paging blocks per multiframe.  All CCCH timeslots have the same layout.
+	unsigned blocks = mPCHGroups[0].size();
+	unsigned N = blocks * BS_PA_MFRMS;
+	size_t len = strlen(IMSI);
+	unsigned IMSIMod1000 = atoi(len>3 ? IMSI+len-3 : IMSI);
+	unsigned val = IMSIMod1000 % (BS_CC_CHANS*N);
+	unsigned CCCH_GROUP = val / N;
+	unsigned PAGING_GROUP = val % N;
+	// The paging group repeats every BS_PA_MFRMS multiframes in the same block.
+	return mPCHGroups[CCCH_GROUP][PAGING_GROUP % blocks];
+}
+
+
+void GSMConfig::countAGCHDrop()
+{
+	mLock.lock();
+	mAGCHDrops++;
+	mLock.unlock();
+}
+
+void GSMConfig::countPCHDrop()
+{
+	mLock.lock();
+	mPCHDrops++;
+	mLock.unlock();
+}
+
+unsigned GSMConfig::AGCHDrops() const
+{
+	mLock.lock();
+	unsigned retVal = mAGCHDrops;
+	mLock.unlock();
+	return retVal;
+}
+
+unsigned GSMConfig::PCHDrops() const
+{
+	mLock.lock();
+	unsigned retVal = mPCHDrops;
+	mLock.unlock();
+	return retVal;
+}
+
+
+
+
 CCCHLogicalChannel* GSMConfig::minimumLoad(CCCHList &chanList)
 {
 	if (chanList.size()==0) return NULL;
@@ -223,6 +375,17 @@ size_t GSMConfig::totalLoad(const CCCHList& chanList) const
 }
 
 
+size_t GSMConfig::maximumLoad(const CCCHList& chanList) const
+{
+	size_t maxLoad = 0;
+	for (unsigned i=0; i<chanList.size(); i++) {
+		size_t thisLoad = chanList[i]->load();
+		if (thisLoad>maxLoad) maxLoad = thisLoad;
+	}
+	return maxLoad;
+}
+
+
 
 template <class ChanType> unsigned countActive(const vector<ChanType*>& chanList)
 {
@@ -247,6 +410,20 @@ unsigned GSMConfig::TCHActive() const
 }
 
 
+void GSMConfig::activeChannels(vector<const LogicalChannel*>& chans) const
+{
+	chans.clear();
+	mLock.lock();
+	for (unsigned i=0; i<mSDCCHPool.size(); i++) {
+		if (mSDCCHPool[i]->active()) chans.push_back(mSDCCHPool[i]);
+	}
+	for (unsigned i=0; i<mTCHPool.size(); i++) {
+		if (mTCHPool[i]->active()) chans.push_back(mTCHPool[i]);
+	}
+	mLock.unlock();
+}
+
+
 unsigned GSMConfig::T3122() const
 {
 	mLock.lock();
@@ -302,13 +479,61 @@ void GSMConfig::createCombinationI(TransceiverManager& TRX, unsigned CN, unsigne
 	TCHFACCHLogicalChannel* chan = new TCHFACCHLogicalChannel(TN,gTCHF_T[TN]);
 	chan->downstream(radio);
 	Thread* thread = new Thread;
-	thread->start((void*(*)(void*))Control::DCCHDispatcher,chan);
+	thread->start((void*(*)(void*))Control::DCCHDispatcher,chan,"TCH dispatch");
 	chan->open();
 	gBTS.addTCH(chan);
 
 }
 
 
+void GSMConfig::createCombinationIV(TransceiverManager& TRX, unsigned CN, unsigned TN)
+{
+	// GSM 05.02 6.4: The CCCH can be on C0 only, in even timeslots.
+	LOG_ASSERT(CN==0);
+	LOG_ASSERT(TN%2==0);
+	LOG_ASSERT(AGBlocksReserved()<8);
+	LOG(NOTICE) << "Configuring combination IV on C" << CN << "T" << TN;
+	ARFCNManager *radio = TRX.ARFCN(CN);
+	radio->setSlot(TN,4);
+	RACHL1FEC* RACH = new RACHL1FEC(gRACHC4Mapping,TN);
+	RACH->downstream(radio);
+	RACH->open();
+	for (unsigned i=0; i<9; i++) {
+		CCCHLogicalChannel* chan = new CCCHLogicalChannel(gCCCH[i],TN);
+		chan->downstream(radio);
+		chan->open();
+		addCCCH(chan,i);
+	}
+}
+
+
+void GSMConfig::createCombinationV(TransceiverManager& TRX, unsigned CN, unsigned TN)
+{
+	LOG_ASSERT((CN==0)&&(TN==0));
+	LOG_ASSERT(AGBlocksReserved()<3);
+	LOG(NOTICE) << "Configuring combination V on C" << CN << "T" << TN;
+	ARFCNManager *radio = TRX.ARFCN(CN);
+	radio->setSlot(TN,5);
+	RACHL1FEC* RACH = new RACHL1FEC(gRACHC5Mapping,TN);
+	RACH->downstream(radio);
+	RACH->open();
+	for (unsigned i=0; i<3; i++) {
+		CCCHLogicalChannel* chan = new CCCHLogicalChannel(gCCCH[i],TN);
+		chan->downstream(radio);
+		chan->open();
+		addCCCH(chan,i);
+	}
+	for (int i=0; i<4; i++) {
+		SDCCHLogicalChannel* chan = new SDCCHLogicalChannel(TN,gSDCCH4[i]);
+		chan->downstream(radio);
+		Thread* thread = new Thread;
+		thread->start((void*(*)(void*))Control::DCCHDispatcher,chan,"SDCCH dispatch");
+		chan->open();
+		gBTS.addSDCCH(chan);
+	}
+}
+
+
 void GSMConfig::createCombinationVII(TransceiverManager& TRX, unsigned CN, unsigned TN)
 {
 	LOG_ASSERT((CN!=0)||(TN!=0));
@@ -319,7 +544,7 @@ void GSMConfig::createCombinationVII(TransceiverManager& TRX, unsigned CN, unsig
 		SDCCHLogicalChannel* chan = new SDCCHLogicalChannel(TN,gSDCCH8[i]);
 		chan->downstream(radio);
 		Thread* thread = new Thread;
-		thread->start((void*(*)(void*))Control::DCCHDispatcher,chan);
+		thread->start((void*(*)(void*))Control::DCCHDispatcher,chan,"SDCCH dispatch");
 		chan->open();
 		gBTS.addSDCCH(chan);
 	}
@@ -44,6 +44,7 @@
 namespace GSM {
 
 
+class LogicalChannel;
 class CCCHLogicalChannel;
 class SDCCHLogicalChannel;
 class TCHFACCHLogicalChannel;
@@ -73,6 +74,18 @@ class GSMConfig : public GSMConfigL1 {
 	CCCHList mPCHPool;		///< paging CCCH subchannels
 	//@}
 
+	/**@name CCCH subchannels by CCCH_GROUP, GSM 05.02 6.5.2; group n is on C0T(2n). */
+	//@{
+	CCCHList mAGCHGroups[4];	///< access grant subchannels, reserved blocks first
+	CCCHList mPCHGroups[4];		///< paging subchannels in multiframe order
+	//@}
+
+	/**@name CCCH statistics. */
+	//@{
+	unsigned mAGCHDrops;		///< access grants dropped for AGCH congestion
+	unsigned mPCHDrops;			///< pages dropped for PCH congestion
+	//@}
+
 	/**@name Allocatable channel pools. */
 	//@{
 	SDCCHList mSDCCHPool;
@@ -99,6 +112,12 @@ class GSMConfig : public GSMConfigL1 {
 
 	bool mHold;		///< If true, do not respond to RACH bursts.
 
+	/**@name Carriers, C0 first. */
+	//@{
+	std::vector<unsigned> mARFCNs;		///< ARFCN of each carrier
+	std::vector<int> mARFCNAtten;		///< attenuation of each carrier beyond C0, in dB
+	//@}
+
 	public:
 	
 	
@@ -108,6 +127,15 @@ class GSMConfig : public GSMConfigL1 {
 
 	/** Start the internal control loops. */
 	void start();
+
+	/**@name Carriers, from GSM.ARFCN for C0 and GSM.ARFCNs for the others. */
+	//@{
+	unsigned numARFCNs() const { return mARFCNs.size(); }
+	unsigned ARFCN(unsigned CN) const { assert(CN<mARFCNs.size()); return mARFCNs[CN]; }
+	const std::vector<unsigned>& ARFCNs() const { return mARFCNs; }
+	/** Attenuation of carrier CN relative to C0, in dB, from GSM.ARFCNs.AttenDB. */
+	int ARFCNAtten(unsigned CN) const { assert(CN<mARFCNAtten.size()); return mARFCNAtten[CN]; }
+	//@}
 	
 	/**@name Get references to L2 frames for BCCH SI messages. */
 	//@{
@@ -134,6 +162,12 @@ class GSMConfig : public GSMConfigL1 {
 	*/
 	void regenerateBeacon();
 
+	/**
+		The BA list for SI2 and SI5: GSM.Neighbors, without our own non-C0 carriers,
+		which have no BCCH for a handset to measure.
+	*/
+	std::vector<unsigned> BCCHFrequencies() const;
+
 	/**
 		Hold off on channel allocations; don't answer RACH.
 		@param val true to hold, false to clear hold
@@ -150,6 +184,9 @@ class GSMConfig : public GSMConfigL1 {
 	/** Find a minimum-load CCCH from a list. */
 	CCCHLogicalChannel* minimumLoad(CCCHList &chanList);
 
+	/** Return the largest load in a CCCH list. */
+	size_t maximumLoad(const CCCHList &chanList) const;
+
 	/** Return the total load of a CCCH list. */
 	size_t totalLoad(const CCCHList &chanList) const;
 
@@ -157,16 +194,27 @@ class GSMConfig : public GSMConfigL1 {
 
 	size_t AGCHLoad() { return totalLoad(mAGCHPool); }
 	size_t PCHLoad() { return totalLoad(mPCHPool); }
+	/** Return the load of the busiest paging block. */
+	size_t PCHMaxLoad() const { return maximumLoad(mPCHPool); }
 
 	/**@name Manage CCCH subchannels. */
 	//@{
 	/** The add method is not mutex protected and should only be used during initialization. */
-	void addAGCH(CCCHLogicalChannel* wCCCH) { mAGCHPool.push_back(wCCCH); }
+	void addAGCH(CCCHLogicalChannel* wCCCH);
 	/** The add method is not mutex protected and should only be used during initialization. */
-	void addPCH(CCCHLogicalChannel* wCCCH) { mPCHPool.push_back(wCCCH); }
+	void addPCH(CCCHLogicalChannel* wCCCH);
+	/**
+		Add a CCCH block as AGCH or PCH according to BS_AG_BLKS_RES, GSM 05.02 6.5.1.
+		Blocks must be added in multiframe order.  Initialization only, like the add methods.
+		@param wCCCH The CCCH subchannel.
+		@param block Its block number in the multiframe, B0..B8.
+	*/
+	void addCCCH(CCCHLogicalChannel* wCCCH, unsigned block);
 
 	/** Return a minimum-load AGCH. */
 	CCCHLogicalChannel* getAGCH() { return minimumLoad(mAGCHPool); }
+	/** Return a minimum-load AGCH on a given CCCH timeslot, where the MS sent its RACH burst. */
+	CCCHLogicalChannel* getAGCH(unsigned TN);
 	/** Return a minimum-load PCH. */
 	CCCHLogicalChannel* getPCH() { return minimumLoad(mPCHPool); }
 	/** Return a specific PCH. */
@@ -175,7 +223,26 @@ class GSMConfig : public GSMConfigL1 {
 		assert(index<mPCHPool.size());
 		return mPCHPool[index];
 	}
+	/**
+		Return the paging block an MS listens to, GSM 05.02 6.5.2.
+		@param IMSI The IMSI digits of the MS.
+	*/
+	CCCHLogicalChannel* getPCH(const char* IMSI);
 	unsigned numAGCHs() const { return mAGCHPool.size(); }
+	unsigned numPCHs() const { return mPCHPool.size(); }
+	/** Number of CCCH timeslots, BS_CC_CHANS. */
+	unsigned numCCCHGroups() const;
+	/** Subchannels of a CCCH_GROUP, for reporting. */
+	const CCCHList& AGCHGroup(unsigned group) const { assert(group<4); return mAGCHGroups[group]; }
+	const CCCHList& PCHGroup(unsigned group) const { assert(group<4); return mPCHGroups[group]; }
+	//@}
+
+	/**@name CCCH congestion statistics. */
+	//@{
+	void countAGCHDrop();
+	void countPCHDrop();
+	unsigned AGCHDrops() const;
+	unsigned PCHDrops() const;
 	//@}
 
 
@@ -211,6 +278,13 @@ class GSMConfig : public GSMConfigL1 {
 	const TCHList& TCHPool() const { return mTCHPool; }
 	//@}
 
+	/**
+		Get the SDCCHs and TCHs that are active at one instant, for reporting.
+		Allocation is blocked only while the pools are scanned, not while the list is used.
+		@param chans A list to receive the active channels, SDCCHs first.
+	*/
+	void activeChannels(std::vector<const LogicalChannel*>& chans) const;
+
 	/**@name T3122 management */
 	//@{
 	unsigned T3122() const;
@@ -224,6 +298,10 @@ class GSMConfig : public GSMConfigL1 {
 	void createCombination0(TransceiverManager &TRX, unsigned CN, unsigned TN);
 	/** Combination I is full rate traffic. */
 	void createCombinationI(TransceiverManager &TRX, unsigned CN, unsigned TN);
+	/** Combination IV is RACH and 9 CCCH blocks, on C0T0, T2, T4 or T6. */
+	void createCombinationIV(TransceiverManager &TRX, unsigned CN, unsigned TN);
+	/** Combination V is RACH, 3 CCCH blocks and 4 SDCCHs, on C0T0 only.  The beacon is made separately. */
+	void createCombinationV(TransceiverManager &TRX, unsigned CN, unsigned TN);
 	/** Combination VII is 8 SDCCHs. */
 	void createCombinationVII(TransceiverManager &TRX, unsigned CN, unsigned TN);
 	//@}
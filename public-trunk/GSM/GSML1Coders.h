@@ -0,0 +1,287 @@
+/**@file Fixed-size L1 coding chains, from GSM 05.03. */
+/*
+* Copyright 2010 Free Software Foundation, Inc.
+*
+* This software is distributed under the terms of the GNU Affero Public License.
+* See the COPYING file in the main directory for details.
+*
+* This use of this software may be subject to additional restrictions.
+* See the LEGAL file in the main directory for details.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#ifndef GSML1CODERS_H
+#define GSML1CODERS_H
+
+#include <stdint.h>
+
+
+namespace GSM {
+
+
+/**@addtogroup L1Coders Fixed-size coding chains of GSM 05.03.
+	These are the block, convolutional and interleaving steps of the
+	L1 channel coders, with the block sizes, polynomials and interleaving
+	depth as template parameters.  Every loop has a compile-time trip count
+	and none branch on the data, so the compiler can unroll and schedule them.
+	They work on the raw bit arrays of BitVector and SoftVector and are used
+	inside the L1Encoder and L1Decoder classes of GSML1FEC.cpp.
+*/
+//@{
+
+
+/**
+	Parity (CRC and Fire) block code, GSM 05.03 4.1.2 and similar.
+	Results are identical to the Parity class in BitVector.h.
+	@param POLY Generator polynomial, LSB is the zero exponent.
+	@param PBITS Number of parity bits.
+	@param DBITS Number of data bits.
+*/
+template <uint64_t POLY, unsigned PBITS, unsigned DBITS>
+class L1BlockCoder {
+
+	public:
+
+	/** Parity register after shifting in d[]. */
+	static uint64_t parity(const char *d)
+	{
+		uint64_t state = 0;
+		for (unsigned i=0; i<DBITS; i++) {
+			const uint64_t fb = ((state>>(PBITS-1)) ^ d[i]) & 0x01;
+			state = (state<<1) ^ (POLY & (0-fb));
+		}
+		return state & mask();
+	}
+
+	/** Write the inverted parity word of d[] into p[], MSB first. */
+	static void writeParityWord(const char *d, char *p)
+	{
+		const uint64_t word = ~parity(d);
+		for (unsigned i=0; i<PBITS; i++) p[i] = (word>>(PBITS-1-i)) & 0x01;
+	}
+
+	/** Syndrome of the codeword d[]:p[]; zero if p[] is the parity of d[]. */
+	static uint64_t syndrome(const char *dp)
+	{
+		uint64_t state = 0;
+		for (unsigned i=0; i<DBITS+PBITS; i++) {
+			const uint64_t fb = (state>>(PBITS-1)) & 0x01;
+			state = ((state<<1) ^ (dp[i] & 0x01)) ^ (POLY & (0-fb));
+		}
+		return state & mask();
+	}
+
+	private:
+
+	static uint64_t mask() { return (1ULL<<PBITS)-1; }
+};
+
+
+
+/**
+	The rate 1/2, memory 4 convolutional code, GSM 05.03 4.1.3,
+	with G0 = 1 + D3 + D4 and G1 = 1 + D + D3 + D4.
+	Results are identical to BitVector::encode and SoftVector::decode
+	with a ViterbiR2O4, without the heap traffic or variable-length arrays.
+	@param UBITS Number of uncoded bits, including the tail.
+*/
+template <unsigned UBITS>
+class L1ConvolutionalCoder {
+
+	public:
+
+	/** Encode u[UBITS] into c[2*UBITS]. */
+	static void encode(const char *u, char *c)
+	{
+		uint32_t history = 0;
+		for (unsigned i=0; i<UBITS; i++) {
+			history = ((history<<1) | (u[i] & 0x01)) & CMASK;
+			const unsigned out = generator(history);
+			c[2*i] = out>>1;
+			c[2*i+1] = out & 0x01;
+		}
+	}
+
+	/**
+		Soft-decision decode c[2*UBITS] into u[UBITS].
+		This is the deferred-decision Viterbi search of ViterbiR2O4,
+		with all 16 states kept in registers and precomputed branch metrics.
+	*/
+	static void decode(const float *c, char *u)
+	{
+		// Sliced code symbol pairs, G0 bit in bit 1, and the cost tables.
+		// The tail is padded with the last sliced bit and unknown costs.
+		unsigned sliced[STEPS];
+		float matchCost[2*STEPS];
+		float mismatchCost[2*STEPS];
+		for (unsigned i=0; i<2*UBITS; i++) {
+			float pVal = c[i];
+			if (pVal>0.5F) pVal = 1.0F-pVal;
+			float ipVal = 1.0F-pVal;
+			if (pVal<0.01F) pVal = 0.01;
+			if (ipVal<0.01F) ipVal = 0.01;
+			matchCost[i] = 0.25F/ipVal;
+			mismatchCost[i] = 0.25F/pVal;
+		}
+		for (unsigned i=2*UBITS; i<2*STEPS; i++) {
+			matchCost[i] = 0.5F;
+			mismatchCost[i] = 0.5F;
+		}
+		for (unsigned i=0; i<UBITS; i++) {
+			sliced[i] = ((c[2*i]>0.5F)<<1) | (c[2*i+1]>0.5F);
+		}
+		const unsigned last = (c[2*UBITS-1]>0.5F) ? 0x03 : 0x00;
+		for (unsigned i=UBITS; i<STEPS; i++) sliced[i] = last;
+
+		uint32_t iState[NSTATES];
+		float cost[NSTATES];
+		for (unsigned s=0; s<NSTATES; s++) {
+			iState[s] = 0;
+			cost[s] = 0.0F;
+		}
+
+		for (unsigned t=0; t<STEPS; t++) {
+			// Branch metric for each of the 4 possible output pairs.
+			const float *match = matchCost + 2*t;
+			const float *mismatch = mismatchCost + 2*t;
+			float branch[4];
+			for (unsigned o=0; o<4; o++) {
+				const unsigned miss = sliced[t] ^ o;
+				branch[o] = ((miss & 0x01) ? mismatch[1] : match[1])
+					+ ((miss & 0x02) ? mismatch[0] : match[0]);
+			}
+			// Add-compare-select.
+			// Survivor s extends from s/2 (0-prefix) or s/2+8 (1-prefix).
+			uint32_t nextState[NSTATES];
+			float nextCost[NSTATES];
+			for (unsigned s=0; s<NSTATES; s++) {
+				const uint32_t s0 = (iState[s>>1]<<1) | (s & 0x01);
+				const uint32_t s1 = (iState[(s>>1)+NSTATES/2]<<1) | (s & 0x01);
+				const float c0 = cost[s>>1] + branch[generator(s0 & CMASK)];
+				const float c1 = cost[(s>>1)+NSTATES/2] + branch[generator(s1 & CMASK)];
+				const bool first = c0 < c1;
+				nextState[s] = first ? s0 : s1;
+				nextCost[s] = first ? c0 : c1;
+			}
+			unsigned best = 0;
+			for (unsigned s=0; s<NSTATES; s++) {
+				iState[s] = nextState[s];
+				cost[s] = nextCost[s];
+				if (cost[s] < cost[best]) best = s;
+			}
+			if (t>=DEFERRAL) u[t-DEFERRAL] = (iState[best]>>DEFERRAL) & 0x01;
+		}
+	}
+
+	private:
+
+	enum {
+		NSTATES = 16,				///< 2^memory
+		CMASK = 0x1f,				///< input history seen by the generators
+		DEFERRAL = 24,				///< decision deferral, as ViterbiR2O4
+		STEPS = UBITS + DEFERRAL	///< trellis steps in decode
+	};
+
+	/** G0:G1 output pair for a 5-bit input history. */
+	static unsigned generator(uint32_t history)
+	{
+		static const unsigned char table[32] = {
+			0, 3, 1, 2, 0, 3, 1, 2, 3, 0, 2, 1, 3, 0, 2, 1,
+			3, 0, 2, 1, 3, 0, 2, 1, 0, 3, 1, 2, 0, 3, 1, 2 };
+		return table[history];
+	}
+};
+
+
+
+/**
+	Diagonal interleaver for 456-bit blocks, GSM 05.03 4.1.4 and 3.1.3.
+	Bit k goes to block (k+offset)%DEPTH at position 2*((49k)%57) + (k%8)/4.
+	The inner loop over k%8 is fixed, so the block for each bit is
+	known at compile time and the modulo of the position is incremental.
+	@param DEPTH 4 for the control channels, 8 for TCH/FS.
+*/
+template <unsigned DEPTH>
+class L1Interleaver {
+
+	public:
+
+	/** Interleave c[456] into i[DEPTH][114]. */
+	template <class T>
+	static void interleave(const T *c, T *const *i, unsigned offset=0)
+	{
+		unsigned base = 0;				// (49*8*m) % 57
+		for (unsigned m=0; m<57; m++) {
+			const T *cp = c + 8*m;
+			for (unsigned r=0; r<8; r++) i[(r+offset)%DEPTH][position(base,r)] = cp[r];
+			base = wrap(base + (49*8)%57);
+		}
+	}
+
+	/**
+		Deinterleave i[DEPTH][114] into c[456].
+		Each i[][] bit taken is replaced by erased, so a missing burst is
+		seen as unknown by the soft decoder.
+	*/
+	template <class T>
+	static void deinterleave(T *const *i, T *c, T erased, unsigned offset=0)
+	{
+		unsigned base = 0;
+		for (unsigned m=0; m<57; m++) {
+			T *cp = c + 8*m;
+			for (unsigned r=0; r<8; r++) {
+				T *ip = i[(r+offset)%DEPTH] + position(base,r);
+				cp[r] = *ip;
+				*ip = erased;
+			}
+			base = wrap(base + (49*8)%57);
+		}
+	}
+
+	private:
+
+	static unsigned wrap(unsigned v) { return (v>=57) ? v-57 : v; }
+
+	/** Position within the block of bit 8*m+r, given base = (49*8*m)%57. */
+	static unsigned position(unsigned base, unsigned r)
+		{ return 2*wrap(base + (49*r)%57) + r/4; }
+};
+
+
+
+/**@name The coding chains used by this BTS. */
+//@{
+typedef L1BlockCoder<0x10004820009ULL,40,184> XCCHBlockCoder;	///< Fire code, GSM 05.03 4.1.2
+typedef L1ConvolutionalCoder<228> XCCHConvolutionalCoder;		///< GSM 05.03 4.1.3
+typedef L1Interleaver<4> XCCHInterleaver;						///< GSM 05.03 4.1.4
+typedef L1BlockCoder<0x0b,3,50> TCHFSBlockCoder;				///< class 1a CRC, GSM 05.03 3.1.2.1
+typedef L1ConvolutionalCoder<189> TCHFSConvolutionalCoder;		///< class 1, GSM 05.03 3.1.2.2
+typedef L1Interleaver<8> TCHFSInterleaver;						///< GSM 05.03 3.1.3
+typedef L1BlockCoder<0x0575,10,25> SCHBlockCoder;				///< GSM 05.03 4.7
+typedef L1ConvolutionalCoder<39> SCHConvolutionalCoder;			///< GSM 05.03 4.7
+typedef L1BlockCoder<0x06f,6,8> RACHBlockCoder;					///< GSM 05.03 4.6
+typedef L1ConvolutionalCoder<18> RACHConvolutionalCoder;		///< GSM 05.03 4.6
+//@}
+
+//@}
+
+};	// namespace GSM
+
+
+#endif
+// vim: ts=4 sw=4
@@ -338,6 +338,9 @@ void L1Decoder::open()
 	mT3101.set();
 	mActive = true;
 	mLock.unlock();
+	// Unmask our frames soon so the first uplink bursts are not lost.
+	// Callers may hold gBTS.mLock, so leave the transceiver command to the mask thread.
+	if (mDownstream) mDownstream->markRxMask(mTN);
 }
 
 
@@ -459,6 +462,7 @@ void RACHL1Decoder::serviceLoop()
 
 void *GSM::RACHL1DecoderServiceLoopAdapter(RACHL1Decoder* obj)
 {
+	AllocScope allocScope(AllocL1FEC);
 	obj->serviceLoop();
 	return NULL;
 }
@@ -468,7 +472,7 @@ void RACHL1Decoder::start()
 {
 	// Start the processing thread.
 	L1Decoder::start();
-	mServiceThread.start((void*(*)(void*))RACHL1DecoderServiceLoopAdapter,this);
+	mServiceThread.start((void*(*)(void*))RACHL1DecoderServiceLoopAdapter,this,"RACH decoder");
 }
 
 
@@ -479,7 +483,7 @@ void RACHL1Decoder::writeLowSide(const RxBurst& burst)
 
 	// Decode the burst.
 	const SoftVector e(burst.segment(49,36));
-	e.decode(mVCoder,mU);
+	RACHConvolutionalCoder::decode(e.begin(),mU.begin());
 
 	// To check validity, we have 4 tail bits and 6 parity bits.
 	// False alarm rate for random inputs is 1/1024.
@@ -493,7 +497,7 @@ void RACHL1Decoder::writeLowSide(const RxBurst& burst)
 	// Check the parity.
 	// The parity word is XOR'd with the BSIC. (GSM 05.03 4.6.)
 	unsigned sentParity = ~mU.peekField(8,6);
-	unsigned checkParity = mD.parity(mParity);
+	unsigned checkParity = RACHBlockCoder::parity(mD.begin());
 	unsigned encodedBSIC = (sentParity ^ checkParity) & 0x03f;
 	if (encodedBSIC != gBTSL1.BSIC()) {
 		countBadFrame();
@@ -552,7 +556,6 @@ XCCHL1Decoder::XCCHL1Decoder(
 		const TDMAMapping& wMapping,
 		L1FEC *wParent)
 	:L1Decoder(wTN,wMapping,wParent),
-	mBlockCoder(0x10004820009ULL, 40, 224),
 	mC(456), mU(228),
 	mP(mU.segment(184,40)),mDP(mU.head(224)),mD(mU.head(184)),
 	mRSSICounter(0)
@@ -656,15 +659,11 @@ void XCCHL1Decoder::deinterleave()
 {
 	// Deinterleave i[][] to c[].
 	// This comes directly from GSM 05.03, 4.1.4.
-	for (int k=0; k<456; k++) {
-		int B = k%4;
-		int j = 2*((49*k) % 57) + ((k%8)/4);
-		mC[k] = mI[B][j];
-		// Mark this i[][] bit as unknown now.
-		// This makes it possible for the soft decoder to work around
-		// a missing burst.
-		mI[B][j] = 0.5F;
-	}
+	// Each i[][] bit is marked as unknown as it is taken.
+	// This makes it possible for the soft decoder to work around
+	// a missing burst.
+	float *i[4] = { mI[0].begin(), mI[1].begin(), mI[2].begin(), mI[3].begin() };
+	XCCHInterleaver::deinterleave(i,mC.begin(),0.5F);
 }
 
 
@@ -676,7 +675,7 @@ bool XCCHL1Decoder::decode()
 	// Convolutional decoding c[] to u[].
 	// GSM 05.03 4.1.3
 	OBJLOG(DEEPDEBUG) <<"XCCHL1Decoder << mC";
-	mC.decode(mVCoder,mU);
+	XCCHConvolutionalCoder::decode(mC.begin(),mU.begin());
 	OBJLOG(DEEPDEBUG) <<"XCCHL1Decoder << mU";
 
 	// The GSM L1 u-frame has a 40-bit parity field.
@@ -686,7 +685,7 @@ bool XCCHL1Decoder::decode()
 	mP.invert();							// parity is inverted
 	// The syndrome should be zero.
 	OBJLOG(DEEPDEBUG) <<"XCCHL1Decoder d[]:p[]=" << mDP;
-	unsigned syndrome = mBlockCoder.syndrome(mDP);
+	unsigned syndrome = XCCHBlockCoder::syndrome(mDP.begin());
 	OBJLOG(DEEPDEBUG) <<"XCCHL1Decoder syndrome=" << hex << syndrome << dec;
 	return (syndrome==0);
 }
@@ -780,7 +779,6 @@ XCCHL1Encoder::XCCHL1Encoder(
 		const TDMAMapping& wMapping,
 		L1FEC* wParent)
 	:L1Encoder(wTN,wMapping,wParent),
-	mBlockCoder(0x10004820009ULL, 40, 224),
 	mC(456), mU(228),
 	mD(mU.head(184)),mP(mU.segment(184,40))
 {
@@ -880,11 +878,11 @@ void XCCHL1Encoder::encode()
 
 	// GSM 05.03 4.1.2
 	// Generate the parity bits.
-	mBlockCoder.writeParityWord(mD,mP);
+	XCCHBlockCoder::writeParityWord(mD.begin(),mP.begin());
 	OBJLOG(DEEPDEBUG) << "XCCHL1Encoder u[]=" << mU;
 	// GSM 05.03 4.1.3
 	// Apply the convolutional encoder.
-	mU.encode(mVCoder,mC);
+	XCCHConvolutionalCoder::encode(mU.begin(),mC.begin());
 	OBJLOG(DEEPDEBUG) << "XCCHL1Encoder c[]=" << mC;
 }
 
@@ -892,12 +890,9 @@ void XCCHL1Encoder::encode()
 
 void XCCHL1Encoder::interleave()
 {
-	// GSM 05.03, 4.1.4.  Verbatim.
-	for (int k=0; k<456; k++) {
-		int B = k%4;
-		int j = 2*((49*k) % 57) + ((k%8)/4);
-		mI[B][j] = mC[k];
-	}
+	// GSM 05.03, 4.1.4.
+	char *i[4] = { mI[0].begin(), mI[1].begin(), mI[2].begin(), mI[3].begin() };
+	XCCHInterleaver::interleave(mC.begin(),i);
 }
 
 
@@ -942,9 +937,9 @@ void SCHL1Encoder::writeHighSide(const L2Frame& frame)
 	vector.copyToSegment(mD, 0, 32);
 
 	// Generate the parity bits.
-	mBlockCoder.writeParityWord(mD, mP);
+	SCHBlockCoder::writeParityWord(mD.begin(), mP.begin());
 	// Apply the convolutional encoder.
-	mU.encode(mVCoder, mE);
+	SCHConvolutionalCoder::encode(mU.begin(), mE.begin());
 
 	mE1.copyToSegment(mBurst, 3);
 	mE2.copyToSegment(mBurst, 106);
@@ -966,13 +961,14 @@ void SCHL1Encoder::writeHighSide(const L2Frame& frame)
 void GeneratorL1Encoder::start()
 {
 	L1Encoder::start();
-	mSendThread.start((void*(*)(void*))GeneratorL1EncoderServiceLoopAdapter,(void*)this);
+	mSendThread.start((void*(*)(void*))GeneratorL1EncoderServiceLoopAdapter,(void*)this,"generator encoder");
 }
 
 
 
 void *GSM::GeneratorL1EncoderServiceLoopAdapter(GeneratorL1Encoder* gen)
 {
+	AllocScope allocScope(AllocL1FEC);
 	gen->serviceLoop();
 	// DONTREACH
 	return NULL;
@@ -982,6 +978,7 @@ void GeneratorL1Encoder::serviceLoop()
 {
 	while(mRunning)
 	{
+		gThreadHeartbeat();
 		if(mActive)
 		{
 			resync();
@@ -1021,8 +1018,7 @@ TCHFACCHL1Decoder::TCHFACCHL1Decoder(
 	L1FEC *wParent)
 	:XCCHL1Decoder(wTN, wMapping, wParent),
 	mTCHU(189),mTCHD(260),
-	mClass1_c(mC.head(378)),mClass1A_d(mTCHD.head(50)),mClass2_c(mC.segment(378,78)),
-	mTCHParity(0x0b,3,50)
+	mClass1_c(mC.head(378)),mClass1A_d(mTCHD.head(50)),mClass2_c(mC.segment(378,78))
 {
 	for (int i=0; i<8; i++) {
 		mI[i] = SoftVector(114);
@@ -1140,12 +1136,9 @@ bool TCHFACCHL1Decoder::processBurst( const RxBurst& inBurst)
 void TCHFACCHL1Decoder::deinterleave(int blockOffset )
 {
 	OBJLOG(DEEPDEBUG) <<"TCHFACCHL1Decoder blockOffset=" << blockOffset;
-	for (int k=0; k<456; k++) {
-		int B = ( k + blockOffset ) % 8;
-		int j = 2*((49*k) % 57) + ((k%8)/4);
-		mC[k] = mI[B][j];
-		mI[B][j] = 0.5F;
-	}
+	float *i[8];
+	for (int B=0; B<8; B++) i[B] = mI[B].begin();
+	TCHFSInterleaver::deinterleave(i,mC.begin(),0.5F,blockOffset);
 }
 
 
@@ -1167,7 +1160,7 @@ bool TCHFACCHL1Decoder::decodeTCH(bool stolen)
 
 		// 3.1.2.2
 		// decode from c[] to u[]
-		mClass1_c.decode(mVCoder,mTCHU);
+		TCHFSConvolutionalCoder::decode(mClass1_c.begin(),mTCHU.begin());
 	
 		// 3.1.2.2
 		// copy class 2 bits c[] to d[]
@@ -1183,7 +1176,7 @@ bool TCHFACCHL1Decoder::decodeTCH(bool stolen)
 		// 3.1.2.1
 		// check parity of class 1A
 		unsigned sentParity = (~mTCHU.peekField(91,3)) & 0x07;
-		unsigned calcParity = mClass1A_d.parity(mTCHParity) & 0x07;
+		unsigned calcParity = TCHFSBlockCoder::parity(mClass1A_d.begin()) & 0x07;
 
 		// 3.1.2.2
 		// Check the tail bits, too.
@@ -1240,7 +1233,9 @@ bool TCHFACCHL1Decoder::decodeTCH(bool stolen)
 
 void GSM::TCHFACCHL1EncoderRoutine( TCHFACCHL1Encoder * encoder )
 {
+	AllocScope allocScope(AllocL1FEC);
 	while (encoder->active()) {
+		gThreadHeartbeat();
 		encoder->dispatch();
 	}
 }
@@ -1255,8 +1250,7 @@ TCHFACCHL1Encoder::TCHFACCHL1Encoder(
 	:XCCHL1Encoder(wTN, wMapping, wParent), 
 	mPreviousFACCH(false),mOffset(0),
 	mTCHU(189),mTCHD(260),
-	mClass1_c(mC.head(378)),mClass1A_d(mTCHD.head(50)),mClass2_d(mTCHD.segment(182,78)),
-	mTCHParity(0x0b,3,50)
+	mClass1_c(mC.head(378)),mClass1A_d(mTCHD.head(50)),mClass2_d(mTCHD.segment(182,78))
 {
 	for(int k = 0; k<8; k++) {
 		mI[k] = BitVector(114);
@@ -1272,7 +1266,7 @@ void TCHFACCHL1Encoder::start()
 {
 	L1Encoder::start();
 	OBJLOG(DEBUG) <<"TCHFACCHL1Encoder";
-	mEncoderThread.start((void*(*)(void*))TCHFACCHL1EncoderRoutine,(void*)this);
+	mEncoderThread.start((void*(*)(void*))TCHFACCHL1EncoderRoutine,(void*)this,"TCH encoder");
 }
 
 
@@ -1296,8 +1290,7 @@ void TCHFACCHL1Encoder::encodeTCH(const VocoderFrame& vFrame)
 	vFrame.payload().map(g610BitOrder,260,mTCHD);
 
 	// 3.1.2.1 -- parity bits
-	BitVector p = mTCHU.segment(91,3);
-   	mTCHParity.writeParityWord(mClass1A_d,p);
+	TCHFSBlockCoder::writeParityWord(mClass1A_d.begin(),mTCHU.begin()+91);
 
 	// 3.1.2.1 -- copy class 1 bits d[] to u[]
 	for (unsigned k=0; k<=90; k++) {
@@ -1310,7 +1303,7 @@ void TCHFACCHL1Encoder::encodeTCH(const VocoderFrame& vFrame)
 	for (unsigned k=185; k<=188; k++) mTCHU[k]=0;
 
 	// 3.1.2.2 -- encode u[] to c[] for class 1
-	mTCHU.encode(mVCoder,mClass1_c);
+	TCHFSConvolutionalCoder::encode(mTCHU.begin(),mClass1_c.begin());
 
 	// 3.1.2.2 -- copy class 2 d[] to c[]
 	mClass2_d.copyToSegment(mC,378);
@@ -1430,11 +1423,9 @@ void TCHFACCHL1Encoder::dispatch()
 void TCHFACCHL1Encoder::interleave(int blockOffset)
 {
 	// GSM 05.03, 3.1.3
-	for (int k=0; k<456; k++) {
-		int B = ( k + blockOffset ) % 8;
-		int j = 2*((49*k) % 57) + ((k%8)/4);
-		mI[B][j] = mC[k];
-	}
+	char *i[8];
+	for (int B=0; B<8; B++) i[B] = mI[B].begin();
+	TCHFSInterleaver::interleave(mC.begin(),i,blockOffset);
 }
 
 
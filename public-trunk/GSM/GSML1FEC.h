@@ -38,6 +38,7 @@
 #include "GSMTDMA.h"
 
 #include "GSM610Tables.h"
+#include "GSML1Coders.h"
 
 
 class ARFCNManager;
@@ -111,9 +112,6 @@ class L1Encoder {
 	bool mActive;					///< true between open() and close()
 	//@}
 
-	ViterbiR2O4 mVCoder;	///< nearly all GSM channels use the same convolutional code
-
-
 	public:
 
 	/**
@@ -243,8 +241,7 @@ class L1Decoder {
 	L1FEC* mParent;			///< a containing L1 processor, if any
 	//@}
 
-	ViterbiR2O4 mVCoder;	///< nearly all GSM channels use the same convolutional code
-
+	ARFCNManager* mDownstream;		///< the radio this decoder is installed on, if any
 
 	public:
 
@@ -260,7 +257,8 @@ class L1Decoder {
 			mActive(false),
 			mRunning(false),
 			mFER(0.0F),
-			mTN(wTN),mMapping(wMapping),mParent(wParent)
+			mTN(wTN),mMapping(wMapping),mParent(wParent),
+			mDownstream(NULL)
 	{
 		// Start T3101 so that the channel will
 		// become recyclable soon.
@@ -292,6 +290,15 @@ class L1Decoder {
 	/** Return true if any timer is expired. */
 	bool recyclable() const;
 
+	/**
+		Return true if this decoder wants uplink bursts now.
+		This drives the uplink activity mask sent to the transceiver.
+	*/
+	virtual bool listening() const { return active(); }
+
+	/** Set by ARFCNManager::installDecoder. */
+	void downstream(ARFCNManager* wDownstream) { mDownstream=wDownstream; }
+
 	/** Connect the upstream SAPMux and L2.  */
 	void upstream(SAPMux * wUpstream)
 	{
@@ -446,7 +453,6 @@ class RACHL1Decoder : public L1Decoder {
 
 	/**@name FEC state. */
 	//@{
-	Parity mParity;					///< block coder
 	BitVector mU;					///< u[], as per GSM 05.03 2.2
 	BitVector mD;					///< d[], as per GSM 05.03 2.2
 	//@}
@@ -462,9 +468,9 @@ class RACHL1Decoder : public L1Decoder {
 	public:
 
 	RACHL1Decoder(const TDMAMapping &wMapping,
-		L1FEC *wParent)
-		:L1Decoder(0,wMapping,wParent),
-		mParity(0x06f,6,8),mU(18),mD(mU.head(8))
+		L1FEC *wParent, unsigned wTN=0)
+		:L1Decoder(wTN,wMapping,wParent),
+		mU(18),mD(mU.head(8))
 	{ }
 
 	/** Start the service thread. */
@@ -473,6 +479,9 @@ class RACHL1Decoder : public L1Decoder {
 	/** Decode the burst and call the channel allocator. */
 	void writeLowSide(const RxBurst&);
 
+	/** The RACH is always open. */
+	bool listening() const { return true; }
+
 	/** A loop to watch the FIFO. */
 	void serviceLoop();
 
@@ -491,7 +500,6 @@ class XCCHL1Decoder : public L1Decoder {
 
 	/**@name FEC state. */
 	//@{
-	Parity mBlockCoder;
 	SoftVector mI[4];			///< i[][], as per GSM 05.03 2.2
 	SoftVector mC;				///< c[], as per GSM 05.03 2.2
 	BitVector mU;				///< u[], as per GSM 05.03 2.2
@@ -652,7 +660,6 @@ class XCCHL1Encoder : public L1Encoder {
 
 	/**@name FEC signal processing state.  */
 	//@{
-	Parity mBlockCoder;			///< block coder for this channel
 	BitVector mI[4];			///< i[][], as per GSM 05.03 2.2
 	BitVector mC;				///< c[], as per GSM 05.03 2.2
 	BitVector mU;				///< u[], as per GSM 05.03 2.2
@@ -719,8 +726,6 @@ private:
 
 	BitVector mFillerC;				///< copy of previous c[] for filling dead time
 
-	Parity mTCHParity;
-
 	VocoderFrameFIFO mSpeechQ;		///< input queue for speech frames
 
 	L2FrameFIFO mL2Q;				///< input queue for L2 FACCH frames
@@ -783,8 +788,6 @@ class TCHFACCHL1Decoder : public XCCHL1Decoder {
 	VocoderFrame mVFrame;				///< unpacking buffer for vocoder frame
 	unsigned char mPrevGoodFrame[33];	///< previous good frame.
 
-	Parity mTCHParity;
-
 	public:
 
 	TCHFACCHL1Decoder( unsigned wTN, 
@@ -867,7 +870,6 @@ class SCHL1Encoder : public XCCHL1Encoder {
 
 	private:
 
-	Parity mBlockCoder;
 	BitVector mU;
 	BitVector mE;
 	BitVector mD;
@@ -878,7 +880,7 @@ class SCHL1Encoder : public XCCHL1Encoder {
 	public:
 
 	SCHL1Encoder(L1FEC *wParent)
-		:XCCHL1Encoder(0,gSCHMapping,wParent), mBlockCoder(0x0575, 10, 25),
+		:XCCHL1Encoder(0,gSCHMapping,wParent),
 		mU(25+10+4), mE(78), mD(mU.head(25)), mP(mU.segment(25, 10)),
 		mE1(mE.segment(0, 39)), mE2(mE.segment(39, 39))
 	{
@@ -979,8 +981,8 @@ class CCCHL1Encoder : public XCCHL1Encoder {
 	public:
 
 	CCCHL1Encoder(const TDMAMapping& wMapping,
-			L1FEC* wParent)
-		:XCCHL1Encoder(0,wMapping,wParent)
+			L1FEC* wParent, unsigned wTN=0)
+		:XCCHL1Encoder(wTN,wMapping,wParent)
 	{}
 
 };
@@ -1106,10 +1108,11 @@ class CCCHL1FEC : public L1FEC {
 
 	public:
 
-	CCCHL1FEC(const TDMAMapping& wMapping)
+	/** The CCCH may be on TN 0, 2, 4 or 6 of C0, GSM 05.02 6.4. */
+	CCCHL1FEC(const TDMAMapping& wMapping, unsigned wTN=0)
 		:L1FEC()
 	{
-		mEncoder = new CCCHL1Encoder(wMapping,this);
+		mEncoder = new CCCHL1Encoder(wMapping,this,wTN);
 	}
 };
 
@@ -1129,10 +1132,11 @@ class RACHL1FEC : public L1FEC {
 
 	public:
 
-	RACHL1FEC(const TDMAMapping& wMapping)
+	/** The RACH is on the timeslot of its CCCH. */
+	RACHL1FEC(const TDMAMapping& wMapping, unsigned wTN=0)
 		:L1FEC()
 	{
-		mDecoder = new RACHL1Decoder(wMapping,this);
+		mDecoder = new RACHL1Decoder(wMapping,this,wTN);
 	}
 };
 
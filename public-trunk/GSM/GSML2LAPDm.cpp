@@ -294,7 +294,7 @@ void L2LAPDm::open()
 		// since N201 may not be defined yet.
 		mMaxIPayloadBits = 8*N201(L2Control::IFormat);
 		mRunning = true;
-		mUpstreamThread.start((void *(*)(void*))LAPDmServiceLoopAdapter,this);
+		mUpstreamThread.start((void *(*)(void*))LAPDmServiceLoopAdapter,this,"LAPDm");
 	}
 	mL3Out.clear();
 	mL1In.clear();
@@ -308,6 +308,7 @@ void L2LAPDm::open()
 
 void *GSM::LAPDmServiceLoopAdapter(L2LAPDm *lapdm)
 {
+	AllocScope allocScope(AllocLAPDm);
 	lapdm->serviceLoop();
 	return NULL;
 }
@@ -405,7 +406,9 @@ void L2LAPDm::serviceLoop()
 		OBJLOG(DEBUG) << "read blocking up to " << timeout << " ms, state=" << mState;
 		mLock.unlock();
 		// FIXME -- If the link is released, there should be no timeout at all.
+		gThreadIdle();
 		L2Frame* frame = mL1In.read(timeout);
+		gThreadHeartbeat();
 		mLock.lock();
 		if (frame!=NULL) {
 			OBJLOG(DEBUG) << "state=" << mState << " received " << *frame;
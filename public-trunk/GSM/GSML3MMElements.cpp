@@ -56,6 +56,7 @@ ostream& GSM::operator<<(ostream& os, L3CMServiceType::TypeCode code)
 		case L3CMServiceType::MobileTerminatedCall: os << "MTC"; break;
 		case L3CMServiceType::MobileTerminatedShortMessage: os << "MTSMS"; break;
 		case L3CMServiceType::TestCall: os << "Test"; break;
+		case L3CMServiceType::LocationSweep: os << "LCSSweep"; break;
 		default: os << "?" << (int)code << "?";
 	}
 	return os;
@@ -53,6 +53,7 @@ class L3CMServiceType : public L3ProtocolElement {
 		MobileTerminatedCall=100,				///< non-standard code
 		MobileTerminatedShortMessage=101,		///< non-standard code
 		TestCall=102,			///< non-standard code
+		LocationSweep=103,		///< non-standard code, RRLP query of a paged MS
 	};
 		
 	private:
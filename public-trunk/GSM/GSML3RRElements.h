@@ -157,11 +157,13 @@ class L3ControlChannelDescription : public L3ProtocolElement {
 	L3ControlChannelDescription():L3ProtocolElement()
 	{
 		// Values dictated by the current implementation are hard-coded.
-		mBS_AG_BLKS_RES=2;			// reserve 2 CCCHs for access grant
 		mBS_PA_MFRMS=0;				// minimum PCH spacing
 		// Configurable values.
 		mATT=gConfig.getNum("GSM.CCD.ATT");
 		mCCCH_CONF=gConfig.getNum("GSM.CCD.CCCH_CONF");
+		// CCCH blocks reserved for access grant in each multiframe
+		mBS_AG_BLKS_RES=2;
+		if (gConfig.defines("GSM.CCD.BS_AG_BLKS_RES")) mBS_AG_BLKS_RES=gConfig.getNum("GSM.CCD.BS_AG_BLKS_RES");
 		mT3212=gConfig.getNum("GSM.T3212")/6;
 	}
 
@@ -262,6 +264,10 @@ class L3NeighborCellsDescription : public L3FrequencyList {
 		:L3FrequencyList(gConfig.getVector("GSM.Neighbors"))
 	{}
 
+	L3NeighborCellsDescription(const std::vector<unsigned>& wARFCNs)
+		:L3FrequencyList(wARFCNs)
+	{}
+
 	void writeV(L3Frame& dest, size_t &wp) const;
 	void parseV(const L3Frame&, size_t&) { assert(0); }
 	void parseV(const L3Frame&, size_t& , size_t) { assert(0); }
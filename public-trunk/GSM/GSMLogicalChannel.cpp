@@ -80,10 +80,10 @@ void LogicalChannel::send(const L3Message& msg,
 
 
 
-CCCHLogicalChannel::CCCHLogicalChannel(const TDMAMapping& wMapping)
+CCCHLogicalChannel::CCCHLogicalChannel(const TDMAMapping& wMapping, unsigned wTN)
 	:mRunning(false)
 {
-	mL1 = new CCCHL1FEC(wMapping);
+	mL1 = new CCCHL1FEC(wMapping,wTN);
 	mL2[0] = new CCCHL2;
 	connect();
 }
@@ -94,7 +94,7 @@ void CCCHLogicalChannel::open()
 	LogicalChannel::open();
 	if (!mRunning) {
 		mRunning=true;
-		mServiceThread.start((void*(*)(void*))CCCHLogicalChannelServiceLoopAdapter,this);
+		mServiceThread.start((void*(*)(void*))CCCHLogicalChannelServiceLoopAdapter,this,"CCCH service");
 	}
 }
 
@@ -189,7 +189,7 @@ void SACCHLogicalChannel::open()
 	LogicalChannel::open();
 	if (!mRunning) {
 		mRunning=true;
-		mServiceThread.start((void*(*)(void*))SACCHLogicalChannelServiceLoopAdapter,this);
+		mServiceThread.start((void*(*)(void*))SACCHLogicalChannelServiceLoopAdapter,this,"SACCH service");
 	}
 }
 
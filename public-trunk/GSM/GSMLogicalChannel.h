@@ -381,7 +381,7 @@ class CCCHLogicalChannel : public NDCCHLogicalChannel {
 
 	public:
 
-	CCCHLogicalChannel(const TDMAMapping& wMapping);
+	CCCHLogicalChannel(const TDMAMapping& wMapping, unsigned wTN=0);
 
 	void open();
 
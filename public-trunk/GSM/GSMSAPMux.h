@@ -55,6 +55,7 @@ class SAPMux  {
 	public:
 
 	SAPMux(){ 
+		mLock.name("SAPMux");
 		mUpstream[0] = NULL;
 		mUpstream[1] = NULL;
 		mUpstream[2] = NULL;
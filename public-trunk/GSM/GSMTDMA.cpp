@@ -77,6 +77,10 @@ MAKE_TDMA_MAPPING(BCCH,TDMA_BEACON_BCCH,true,false,0x55,true,51);
 const unsigned RACHC5Frames[] = {4,5,14,15,16,17,18,19,20,21,22,23,24,25,26,27,28,29,30,31,32,33,34,35,36,45,46};
 MAKE_TDMA_MAPPING(RACHC5,TDMA_BEACON,false,true,0x55,true,51);
 
+// In C-IV, the whole uplink is RACH.
+const unsigned RACHC4Frames[] = {0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,41,42,43,44,45,46,47,48,49,50};
+MAKE_TDMA_MAPPING(RACHC4,TDMA_BEACON,false,true,0x55,true,51);
+
 // CCCH 0-2 are used in C-IV and C-V.  The others are used in C-IV only.
 
 const unsigned CCCH_0Frames[] = {6,7,8,9};
@@ -91,11 +95,27 @@ MAKE_TDMA_MAPPING(CCCH_2,TDMA_BEACON_CCCH,true,false,0x55,true,51);
 const unsigned CCCH_3Frames[] = {22,23,24,25};
 MAKE_TDMA_MAPPING(CCCH_3,TDMA_BEACON_CCCH,true,false,0x55,true,51);
 
-// TODO -- Other CCCH subchannels 4-8 for support of C-IV.
+const unsigned CCCH_4Frames[] = {26,27,28,29};
+MAKE_TDMA_MAPPING(CCCH_4,TDMA_BEACON_CCCH,true,false,0x55,true,51);
+
+const unsigned CCCH_5Frames[] = {32,33,34,35};
+MAKE_TDMA_MAPPING(CCCH_5,TDMA_BEACON_CCCH,true,false,0x55,true,51);
+
+const unsigned CCCH_6Frames[] = {36,37,38,39};
+MAKE_TDMA_MAPPING(CCCH_6,TDMA_BEACON_CCCH,true,false,0x55,true,51);
+
+const unsigned CCCH_7Frames[] = {42,43,44,45};
+MAKE_TDMA_MAPPING(CCCH_7,TDMA_BEACON_CCCH,true,false,0x55,true,51);
+
+const unsigned CCCH_8Frames[] = {46,47,48,49};
+MAKE_TDMA_MAPPING(CCCH_8,TDMA_BEACON_CCCH,true,false,0x55,true,51);
 
-const TDMAMapping GSM::gCCCH[4] = {
+const TDMAMapping GSM::gCCCH[9] = {
 	GSM::gCCCH_0Mapping, GSM::gCCCH_1Mapping,
-	GSM::gCCCH_2Mapping, GSM::gCCCH_3Mapping
+	GSM::gCCCH_2Mapping, GSM::gCCCH_3Mapping,
+	GSM::gCCCH_4Mapping, GSM::gCCCH_5Mapping,
+	GSM::gCCCH_6Mapping, GSM::gCCCH_7Mapping,
+	GSM::gCCCH_8Mapping
 };
 
 const unsigned SDCCH_4_0DFrames[] = {22,23,24,25};
@@ -125,6 +125,8 @@ extern const TDMAMapping gSCHMapping;		///< GSM 05.02 Clause 7 Table 3 Line 2 B0
 extern const TDMAMapping gBCCHMapping;		///< GSM 05.02 Clause 7 Table 3 Line 3
 /// GSM 05.02 Clause 7 Table 3 Line 7 B0-B50, excluding C-V SDCCH parts (SDCCH/4 and SCCH/C4)
 extern const TDMAMapping gRACHC5Mapping;
+/// GSM 05.02 Clause 7 Table 3 Line 7 B0-B50, the full C-IV uplink
+extern const TDMAMapping gRACHC4Mapping;
 extern const TDMAMapping gCCCH_0Mapping;	///< GSM 05.02 Clause 7 Table 3 Line 5 B0
 extern const TDMAMapping gCCCH_1Mapping;	///< GSM 05.02 Clause 7 Table 3 Line 5 B1
 extern const TDMAMapping gCCCH_2Mapping;	///< GSM 05.02 Clause 7 Table 3 Line 5 B2
@@ -135,7 +137,8 @@ extern const TDMAMapping gCCCH_6Mapping;	///< GSM 05.02 Clause 7 Table 3 Line 5
 extern const TDMAMapping gCCCH_7Mapping;	///< GSM 05.02 Clause 7 Table 3 Line 5 B7
 extern const TDMAMapping gCCCH_8Mapping;	///< GSM 05.02 Clause 7 Table 3 Line 5 B8
 
-extern const TDMAMapping gCCCH[4];
+/** CCCH blocks in multiframe order, B0-B8; C-V uses only B0-B2. */
+extern const TDMAMapping gCCCH[9];
 
 //@}
 /**@name SDCCH */
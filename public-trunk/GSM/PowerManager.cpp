@@ -35,6 +35,14 @@ using namespace GSM;
 
 
 
+void PowerManager::applyPower()
+{
+	for (unsigned CN=0; CN<gBTS.numARFCNs(); CN++) {
+		gTRX.ARFCN(CN)->setPower(mAtten + gBTS.ARFCNAtten(CN));
+	}
+}
+
+
 void PowerManager::increasePower()
 {
 	int maxAtten = gConfig.getNum("GSM.PowerManager.MaxAttenDB");
@@ -47,7 +55,7 @@ void PowerManager::increasePower()
 	if (mAtten<minAtten) mAtten=minAtten;
 	if (mAtten>maxAtten) mAtten=maxAtten;
 	LOG(INFO) << "power increased to -" << mAtten << " dB";
-	mRadio->setPower(mAtten);
+	applyPower();
 }
 
 void PowerManager::reducePower()
@@ -62,7 +70,7 @@ void PowerManager::reducePower()
 	if (mAtten<minAtten) mAtten=minAtten;
 	if (mAtten>maxAtten) mAtten=maxAtten;
 	LOG(INFO) << "power decreased to -" << mAtten << " dB";
-	mRadio->setPower(mAtten);
+	applyPower();
 }
 
 
@@ -124,9 +132,8 @@ void* GSM::PowerManagerServiceLoopAdapter(PowerManager *pm)
 
 void PowerManager::start()
 {
-	mRadio = gTRX.ARFCN(0);
-	mRadio->setPower(mAtten);
-	mThread.start((void*(*)(void*))PowerManagerServiceLoopAdapter,this);
+	applyPower();
+	mThread.start((void*(*)(void*))PowerManagerServiceLoopAdapter,this,"power manager");
 }
 
 
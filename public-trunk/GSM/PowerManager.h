@@ -46,7 +46,6 @@ class PowerManager {
 private:
 
 	Thread mThread;
-	ARFCNManager* mRadio;
 	unsigned mAveragedT3122;	///< averaged over the last NumSamples taken SamplePeriod apart kept in mSamples
 	volatile unsigned mAtten;	///< current attenuation - either set by ourselves or by setPower
 	Timeval  mLast;				///< when controller operated last time
@@ -58,6 +57,9 @@ private:
 	void increasePower();
 	void reducePower();
 
+	/** Set every carrier to the current attenuation, plus its own offset from C0. */
+	void applyPower();
+
 	// internal method, does the control step
 	void internalControlStep();
 
@@ -28,9 +28,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <map>
+#include <set>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
 
 using namespace std;
 
@@ -313,6 +316,200 @@ HLR::Status AsteriskHLR::addAddress(const char* IMSI, const char* address)
 
 
 
+/** True if s is non-empty and all characters are accepted by test. */
+static bool allOf(const string& s, int (*test)(int))
+{
+	if (s.empty()) return false;
+	for (unsigned i=0; i<s.size(); i++) if (!test((unsigned char)s[i])) return false;
+	return true;
+}
+
+
+/** Strip leading and trailing whitespace. */
+static string trimmed(const char* start, const char* end)
+{
+	while (start<end && isspace((unsigned char)*start)) start++;
+	while (end>start && isspace((unsigned char)end[-1])) end--;
+	return string(start,end);
+}
+
+
+unsigned AsteriskHLR::readCSV(FILE* fp, vector<Subscriber>& users, ostream* errors)
+{
+	unsigned bad = 0;
+	unsigned lineNumber = 0;
+	char line[200];
+	while (fgets(line,sizeof(line),fp)) {
+		lineNumber++;
+		char *end = line + strlen(line);
+		string whole = trimmed(line,end);
+		if (whole.empty() || whole[0]=='#') continue;
+		const char *comma = strchr(line,',');
+		Subscriber user;
+		if (comma) {
+			user.IMSI = trimmed(line,comma);
+			user.CLID = trimmed(comma+1,end);
+		}
+		// A CLID may have a leading '+', an IMSI may be any SIP username.
+		const char *CLIDDigits = user.CLID.c_str();
+		if (*CLIDDigits=='+') CLIDDigits++;
+		if (comma && allOf(user.IMSI,isalnum) && allOf(CLIDDigits,isdigit)) {
+			users.push_back(user);
+			continue;
+		}
+		// The first line may be a header.
+		if (lineNumber==1 && !isdigit((unsigned char)whole[0])) continue;
+		bad++;
+		if (errors) *errors << "line " << lineNumber << ": bad entry \"" << whole << "\"" << endl;
+	}
+	return bad;
+}
+
+
+bool AsteriskHLR::writeAppended(const char* filename, const string& text, string& tmpname)
+{
+	tmpname = filename;
+	tmpname += ".new";
+	FILE *in = fopen(filename,"r");
+	FILE *out = fopen(tmpname.c_str(),"w");
+	if (!out) {
+		LOG(ALARM) << "AsteriskHLR::writeAppended cannot open " << tmpname;
+		if (in) fclose(in);
+		return false;
+	}
+	bool ok = true;
+	if (in) {
+		// Keep the owner and permissions of the original.
+		struct stat info;
+		if (fstat(fileno(in),&info)==0) {
+			if (fchown(fileno(out),info.st_uid,info.st_gid)!=0) {
+				LOG(WARN) << "AsteriskHLR::writeAppended cannot keep the owner of " << filename << ": " << strerror(errno);
+			}
+			fchmod(fileno(out),info.st_mode);
+		}
+		char buf[8192];
+		size_t count;
+		while ((count=fread(buf,1,sizeof(buf),in))>0) {
+			if (fwrite(buf,1,count,out)!=count) { ok = false; break; }
+		}
+		if (ferror(in)) ok = false;
+		fclose(in);
+	}
+	if (fwrite(text.data(),1,text.size(),out)!=text.size()) ok = false;
+	if (fflush(out)!=0 || fsync(fileno(out))!=0) ok = false;
+	if (fclose(out)!=0) ok = false;
+	if (!ok) {
+		LOG(ALARM) << "AsteriskHLR::writeAppended cannot write " << tmpname;
+		unlink(tmpname.c_str());
+	}
+	return ok;
+}
+
+
+HLR::Status AsteriskHLR::addUsers(const vector<Subscriber>& users, ostream* progress)
+{
+	// Hold the lock from the read to the rename, so addUser() appends wait.
+	if (!lockConfig()) return TRYAGAIN;
+	bool changed = false;
+	bool ok = writeUsers(users,progress,changed);
+	unlockConfig();
+	if (!ok) return FAILURE;
+	if (!changed) return SUCCESS;
+
+	// One reload of each, regardless of the holdoff.
+	mNeedSIPReload = true;
+	mNeedDialplanReload = true;
+	Timeval expired(Timeval().sec()-mHoldoffTime-1,0);
+	mLastSIPReloadTime = expired;
+	mLastDialplanReloadTime = expired;
+	Timeval start;
+	HLR::Status stat = reloadConfig();
+	if (progress) *progress << "reloaded Asterisk in " << start.elapsed() << " ms" << endl;
+	return stat;
+}
+
+
+bool AsteriskHLR::writeUsers(const vector<Subscriber>& users, ostream* progress, bool& changed)
+{
+	static const char SIPFilename[] = "/etc/asterisk/sip.conf";
+	static const char dialplanFilename[] = "/etc/asterisk/extensions.local.conf";
+	Timeval start;
+	changed = false;
+
+	// Users already in sip.conf, from its section names.
+	set<string> existing;
+	FILE *cf = fopen(SIPFilename,"r");
+	if (cf) {
+		char line[200];
+		while (fgets(line,sizeof(line),cf)) {
+			if (line[0]!='[') continue;
+			char *close = strchr(line,']');
+			if (close) existing.insert(string(line+1,close));
+		}
+		fclose(cf);
+	}
+
+	// Build the new entries in memory, in the templates of addUser and addAddress.
+	time_t now = time(NULL);
+	string SIPText = string(";provisioned ") + ctime(&now);
+	string dialplanText = SIPText;
+	unsigned added = 0;
+	unsigned skipped = 0;
+	for (unsigned i=0; i<users.size(); i++) {
+		const Subscriber& user = users[i];
+		if (!existing.insert(user.IMSI).second) {
+			skipped++;
+			continue;
+		}
+		SIPText += "[" + user.IMSI + "]\ncallerid=" + user.CLID + "\n";
+		SIPText += "canreinvite=no\ntype=friend\ncontext=sip-local\nallow=gsm\nhost=dynamic\ndtmfmode=info\n\n";
+		dialplanText += "exten => " + user.CLID + ",1,Dial(SIP/" + user.IMSI + ")\n";
+		added++;
+		if (progress && (i+1)%10000==0) *progress << i+1 << " of " << users.size() << " prepared" << endl;
+	}
+	if (progress && skipped) *progress << skipped << " already provisioned, skipped" << endl;
+	if (!added) return true;
+
+	// Write both files, then swap them in together.
+	string SIPTmp, dialplanTmp;
+	if (!writeAppended(SIPFilename,SIPText,SIPTmp)) return false;
+	if (!writeAppended(dialplanFilename,dialplanText,dialplanTmp)) {
+		unlink(SIPTmp.c_str());
+		return false;
+	}
+	// Keep the old sip.conf, to put back if the dialplan cannot be replaced.
+	string SIPOld = string(SIPFilename) + ".old";
+	unlink(SIPOld.c_str());
+	bool haveOld = link(SIPFilename,SIPOld.c_str())==0;
+	if (rename(SIPTmp.c_str(),SIPFilename)!=0) {
+		LOG(ALARM) << "AsteriskHLR::addUsers cannot replace " << SIPFilename;
+		unlink(SIPTmp.c_str());
+		unlink(dialplanTmp.c_str());
+		if (haveOld) unlink(SIPOld.c_str());
+		return false;
+	}
+	if (rename(dialplanTmp.c_str(),dialplanFilename)!=0) {
+		LOG(ALARM) << "AsteriskHLR::addUsers cannot replace " << dialplanFilename << ", restoring " << SIPFilename;
+		unlink(dialplanTmp.c_str());
+		if (haveOld) rename(SIPOld.c_str(),SIPFilename);
+		else unlink(SIPFilename);
+		return false;
+	}
+	if (haveOld) unlink(SIPOld.c_str());
+	changed = true;
+
+	long writeTime = start.elapsed();
+	LOG(NOTICE) << "AsteriskHLR::addUsers added " << added << " skipped " << skipped << " in " << writeTime << " ms";
+	if (progress) {
+		*progress << added << " users written in " << writeTime << " ms";
+		if (writeTime>0) *progress << ", " << (added*1000LL/writeTime) << " users/s";
+		*progress << endl;
+	}
+	return true;
+}
+
+
+
 HLR::Status AsteriskHLR::reloadSIP()
 {
 	LOG(DEBUG) << "AsteriskHLR::reloadSIP needReload=" << mNeedSIPReload << " elapsed=" << mLastSIPReloadTime.elapsed();
@@ -389,11 +586,32 @@ void HLRCache::flush()
 
 
 
+static const char sLockFilename[] = "/etc/asterisk/HLR.lock";
+
+
+bool AsteriskHLR::lockConfig()
+{
+	int fd = open(sLockFilename,O_WRONLY|O_CREAT|O_EXCL,0644);
+	if (fd<0) {
+		if (errno!=EEXIST) LOG(ALARM) << "AsteriskHLR::lockConfig cannot create " << sLockFilename << ": " << strerror(errno);
+		return false;
+	}
+	close(fd);
+	return true;
+}
+
+
+void AsteriskHLR::unlockConfig()
+{
+	unlink(sLockFilename);
+}
+
+
 bool AsteriskHLR::lockedConfig()
 {
 	// Return true if the lockfile exists.
 	struct stat dummy;
-	int s = stat("/etc/asterisk/HLR.lock",&dummy);
+	int s = stat(sLockFilename,&dummy);
 	LOG(DEBUG) << "AsteriskHLR::lockedConfig stat=" << s;
 	return s==0;
 }
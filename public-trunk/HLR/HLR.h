@@ -29,6 +29,10 @@
 #include <Timeval.h>
 #include <Threads.h>
 #include <map>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <stdio.h>
 #include <stdlib.h>
 
 
@@ -197,6 +201,12 @@ class AsteriskHLR : public HLR {
 
 	public:
 
+	/** A user for bulk provisioning. */
+	struct Subscriber {
+		std::string IMSI;		///< IMSI or SIP username
+		std::string CLID;		///< local CLID, also added as an address
+	};
+
 	AsteriskHLR():
 		mNeedSIPReload(false),
 		mNeedDialplanReload(false)
@@ -213,6 +223,31 @@ class AsteriskHLR : public HLR {
 
 	Status addUser(const char* IMSI, const char* CLIDLocal);
 
+	/**
+		Add many users, as addUser() would, but with one write to each
+		config file and one Asterisk reload for each, at the end.
+		Each file is rewritten to a temporary file and renamed into place,
+		and sip.conf is put back if the dialplan cannot be replaced,
+		so Asterisk sees all of the new users or none of them.
+		The config lockfile is held throughout, so addUser() gets TRYAGAIN meanwhile.
+		Users already in sip.conf are skipped.
+		@param users The users to add.
+		@param progress If not NULL, progress and throughput are reported here.
+		@return The combined status of the reloads, FAILURE if no file changed,
+			or TRYAGAIN if the config is locked.
+	*/
+	Status addUsers(const std::vector<Subscriber>& users, std::ostream* progress=NULL);
+
+	/**
+		Read users from CSV, one "IMSI,CLID" per line.
+		Blank lines, lines starting with '#' and a header line are skipped.
+		@param fp The file to read.
+		@param users Valid users are appended here.
+		@param errors If not NULL, invalid lines are reported here.
+		@return The number of invalid lines.
+	*/
+	static unsigned readCSV(FILE* fp, std::vector<Subscriber>& users, std::ostream* errors=NULL);
+
 	bool useGateway(const char *ISDN);
 
 	private:
@@ -242,6 +277,28 @@ class AsteriskHLR : public HLR {
 	*/
 	Status reloadConfig();
 
+	/**
+		Rewrite a config file with text appended, by way of a temporary file.
+		@param filename The config file.
+		@param text The text to append.
+		@param tmpname Set to the name of the temporary file, which the caller renames into place.
+		@return true on success.
+	*/
+	static bool writeAppended(const char* filename, const std::string& text, std::string& tmpname);
+
+	/**
+		Append users to both config files, for addUsers(); the config lock must be held.
+		@param changed Set true if the files were replaced.
+		@return false if neither file could be replaced.
+	*/
+	bool writeUsers(const std::vector<Subscriber>& users, std::ostream* progress, bool& changed);
+
+	/** Create the config lockfile.  Return false if it already exists. */
+	bool lockConfig();
+
+	/** Remove the config lockfile. */
+	void unlockConfig();
+
 	/**
 		Check the config lockfile.  Return true if lock acquired.
 		Returns true if the lockfile exits.
@@ -0,0 +1,73 @@
+/*
+* Copyright 2009, 2010 Kestrel Signal Processing, Inc.
+*
+* This software is distributed under the terms of the GNU Affero Public License.
+* See the COPYING file in the main directory for details.
+*
+* This use of this software may be subject to additional restrictions.
+* See the LEGAL file in the main directory for details.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+	Bulk provisioning of Asterisk users from CSV.
+	Usage: HLRProvision <file.csv>, or "-" for standard input.
+	See README.HLR for the file format.
+*/
+
+#include "HLR.h"
+#include <iostream>
+#include <Logger.h>
+#include <Configuration.h>
+#include <Timeval.h>
+#include <string.h>
+
+ConfigurationTable gConfig;
+
+int main(int argc, char *argv[]) {
+
+	gLogInit("NOTICE");
+
+	if (argc!=2) {
+		std::cerr << "usage: " << argv[0] << " <file.csv>" << std::endl;
+		exit(-1);
+	}
+
+	FILE *fp = stdin;
+	if (strcmp(argv[1],"-")!=0) fp = fopen(argv[1],"r");
+	if (!fp) {
+		std::cerr << "cannot open " << argv[1] << std::endl;
+		exit(-1);
+	}
+
+	Timeval start;
+	std::vector<AsteriskHLR::Subscriber> users;
+	unsigned bad = AsteriskHLR::readCSV(fp,users,&std::cerr);
+	if (fp!=stdin) fclose(fp);
+	std::cout << "read " << users.size() << " users in " << start.elapsed() << " ms";
+	if (bad) std::cout << ", " << bad << " bad lines";
+	std::cout << std::endl;
+	if (users.empty()) exit(bad ? -1 : 0);
+
+	AsteriskHLR HLR;
+	HLR::Status stat = HLR.addUsers(users,&std::cout);
+	switch (stat) {
+		case HLR::SUCCESS: break;
+		case HLR::TRYAGAIN: std::cerr << "Asterisk config is locked, try again" << std::endl; break;
+		default: std::cerr << "provisioning failed, status " << stat << std::endl; break;
+	}
+	return stat==HLR::SUCCESS ? 0 : -1;
+}
@@ -143,13 +143,8 @@ void SIPEngine::User( const char * wCallID, const char * IMSI, const char *origI
 
 
 
-bool SIPEngine::Register( Method wMethod )
+osip_message_t *SIPEngine::makeREGISTER( Method wMethod )
 {
-	LOG(INFO) << "user " << mSIPUsername << " state " << mState << " " << wMethod << " callID " << mCallID;
-
-	// Before start, need to add mCallID
-	gSIPInterface.addCall(mCallID);
-
 	// Initial configuration for sip message.
 	// Make a new from tag and new branch.
 	// make new mCSeq.
@@ -178,50 +173,71 @@ bool SIPEngine::Register( Method wMethod )
 			mViaBranch.c_str(), mCallID.c_str(), mCSeq
 		);
 	} else abort();
- 
-	// Write message and delete message to
-	// prevent memory leak.	
+	return reg;
+}
+
+
+bool SIPEngine::Register( Method wMethod )
+{
+	LOG(INFO) << "user " << mSIPUsername << " state " << mState << " " << wMethod << " callID " << mCallID;
+
+	// The transaction layer retransmits until a final response or timeout.
+	osip_message_t * reg = makeREGISTER(wMethod);
 	LOG(DEBUG) << "writing " << reg;
-	gSIPInterface.writeAsterisk(reg);	
+	SIPTransactionLayer& transactions = gSIPInterface.transactions();
+	string key = transactions.send(reg, gSIPInterface.asteriskAddress(), REGISTERTimeout);
 	osip_message_free(reg);
+	if (key.empty()) return false;
 
-	// Poll the message FIFO until timeout or OK.
-	// SIPInterface::read will throw SIPTIimeout if it times out.
-	// It should not return NULL.
-	try {
-		static const int SIPTimeout = 10000;
-		osip_message_t *msg = gSIPInterface.read(mCallID, SIPTimeout);
-		assert(msg);
-		while (msg->status_code!=200) {
-			// Looking for 200 OK.
-			// But will keep waiting if we get 1xx status mesasges, e.g. 100 Trying.
-			LOG(DEBUG) << "received status " << msg->status_code << " " << msg->reason_phrase;
-			if (msg->status_code>=300) {
-				gSIPInterface.removeCall(mCallID);
-				osip_message_free(msg);
-				if (msg->status_code==404) {
-					LOG(DEBUG) << "user not found";
-				} else if (msg->status_code>=300 && msg->status_code<400) {
-					LOG(WARN) << "REGISTER redirection requested but not implemented";
-				} else {
-					LOG(WARN) << "unexpected response " << msg->status_code << " " << msg->reason_phrase;
-				}
-				return false;
-			}
-			osip_message_free(msg);
-			msg = gSIPInterface.read(mCallID, SIPTimeout);
-			assert(msg);
-		}
+	osip_message_t *msg = transactions.wait(key);
+	if (!msg) {
+		LOG(ALARM) << "SIP register timed out.  Is Asterisk OK?";
+		throw SIPTimeout();
+	}
+
+	int status = msg->status_code;
+	LOG(DEBUG) << "received status " << status << " " << msg->reason_phrase;
+	osip_message_free(msg);
+	if (status==200) {
 		LOG(DEBUG) << "success";
-		gSIPInterface.removeCall(mCallID);
-		osip_message_free(msg);
 		return true;
 	}
-	catch (SIPTimeout) {
-		LOG(ALARM) << "SIP register timed out.  Is Asterisk OK?";
-		gSIPInterface.removeCall(mCallID);	
-		throw SIPTimeout();
+	if (status==404) {
+		LOG(DEBUG) << "user not found";
+	} else if (status>=300 && status<400) {
+		LOG(WARN) << "REGISTER redirection requested but not implemented";
+	} else {
+		LOG(WARN) << "unexpected response " << status;
 	}
+	return false;
+}
+
+
+/** Log the result of a REGISTER sent by sendUnregister(); arg is the username. */
+static void unregisterDone(const osip_message_t *response, void *arg)
+{
+	string *username = (string*)arg;
+	if (!response) {
+		LOG(ALARM) << "SIP unregister of " << *username << " timed out.  Is Asterisk OK?";
+	} else if (response->status_code!=200) {
+		LOG(NOTICE) << "SIP unregister of " << *username << " failed with status " << response->status_code;
+	} else {
+		LOG(DEBUG) << "SIP unregister of " << *username << " successful";
+	}
+	delete username;
+}
+
+
+void SIPEngine::sendUnregister()
+{
+	LOG(INFO) << "user " << mSIPUsername << " state " << mState << " callID " << mCallID;
+	osip_message_t * reg = makeREGISTER(SIPUnregister);
+	string *username = new string(mSIPUsername);
+	if (!gSIPInterface.transactions().send(reg, gSIPInterface.asteriskAddress(),
+			unregisterDone, username, REGISTERTimeout)) {
+		delete username;
+	}
+	osip_message_free(reg);
 }
 
 
@@ -658,8 +674,6 @@ SIPState SIPEngine::MOSMSSendMESSAGE(const char * wCalledUsername,
 {
 	LOG(DEBUG) << "mState=" << mState;
 	LOG(INFO) << "SIP send to " << wCalledUsername << "@" << wCalledDomain << " MESSAGE " << messageText;
-	// Before start, need to add mCallID
-	gSIPInterface.addCall(mCallID);
 	
 	// Set MESSAGE params. 
 	// New from tag + via branch
@@ -686,10 +700,12 @@ SIPState SIPEngine::MOSMSSendMESSAGE(const char * wCalledUsername,
 		mFromTag.c_str(), mViaBranch.c_str(), mCallID.c_str(), mCSeq,
 		messageText, content_type); 
 	
-	// Send Invite to Asterisk.
-	gSIPInterface.writeMessenger(message);
+	// Send MESSAGE to the messenger.
+	// The transaction layer retransmits until MOSMSWaitForSubmit collects the result.
+	mMESSAGEKey = gSIPInterface.transactions().send(message,
+		gSIPInterface.messengerAddress(), MESSAGETimeout);
 	osip_message_free(message);
-	mState = MessageSubmit;
+	mState = mMESSAGEKey.empty() ? Fail : MessageSubmit;
 	return mState;
 };
 
@@ -697,22 +713,20 @@ SIPState SIPEngine::MOSMSSendMESSAGE(const char * wCalledUsername,
 SIPState SIPEngine::MOSMSWaitForSubmit()
 {
 	LOG(INFO) << "user " << mSIPUsername << " state " << mState;
+	if (mMESSAGEKey.empty()) return mState;
 
-	try {
-		osip_message_t * ok = gSIPInterface.read(mCallID, INVITETimeout);
-		// That should never return NULL.
-		assert(ok);
-		if((ok->status_code==200) || (ok->status_code==202) ) {
-			mState = Cleared;
-			LOG(INFO) << "successful";
-		}
-		osip_message_free(ok);
-	}
-
-	catch (SIPTimeout& e) {
+	osip_message_t * ok = gSIPInterface.transactions().wait(mMESSAGEKey);
+	mMESSAGEKey.clear();
+	if (!ok) {
 		LOG(ALARM) << "timed out, is SMS server OK?"; 
 		mState = Fail;
+		return mState;
+	}
+	if((ok->status_code==200) || (ok->status_code==202) ) {
+		mState = Cleared;
+		LOG(INFO) << "successful";
 	}
+	osip_message_free(ok);
 
 	return mState;
 
@@ -749,17 +763,19 @@ bool SIPEngine::sendINFOAndWaitForOK(unsigned wInfo)
 		mRemoteUsername.c_str(), mRTPPort, mSIPUsername.c_str(), 
 		mSIPPort, gConfig.getStr("SIP.IP"), mAsteriskIP, 
 		mFromTag.c_str(), mViaBranch.c_str(), mCallID.c_str(), mCSeq); 
-	gSIPInterface.writeAsterisk(info);
+	SIPTransactionLayer& transactions = gSIPInterface.transactions();
+	string key = transactions.send(info, gSIPInterface.asteriskAddress(), INFOTimeout);
 	osip_message_free(info);
+	if (key.empty()) return false;
 
-	try {
-		osip_message_t *msg = gSIPInterface.read(mCallID, INVITETimeout);
-		return (msg->status_code == 200);
-	}
-	catch (SIPTimeout& e) { 
+	osip_message_t *msg = transactions.wait(key);
+	if (!msg) {
 		LOG(NOTICE) << "timeout";
 		return false;
 	}
+	bool success = (msg->status_code == 200);
+	osip_message_free(msg);
+	return success;
 
 };
 
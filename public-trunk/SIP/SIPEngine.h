@@ -65,6 +65,9 @@ enum SIPState  {
 //@{
 const unsigned INVITETimeout = 2000;
 const unsigned BYETimeout = 2000;
+const unsigned REGISTERTimeout = 10000;
+const unsigned MESSAGETimeout = 2000;
+const unsigned INFOTimeout = 2000;
 //@}
 
 std::ostream& operator<<(std::ostream& os, SIPState s);
@@ -91,6 +94,7 @@ private:
 	std::string mCallID;
 	std::string mSIPUsername;
 	unsigned  mCSeq;
+	std::string mMESSAGEKey;	///< transaction key of the outstanding MESSAGE
 
 	/**@name SIP UDP parameters */
 	//@{
@@ -167,6 +171,12 @@ public:
 	*/
 	bool Unregister() { return (Register(SIPUnregister)); };
 
+	/**
+		Send sip unregister without waiting for the result,
+		which is only logged.
+	*/
+	void sendUnregister();
+
 	//@}
 
 	
@@ -207,6 +217,7 @@ public:
 		const char * called_domain, const char *message_text,
 		bool plainText);
 
+	/** Wait for the MESSAGE transaction to complete. */
 	SIPState MOSMSWaitForSubmit();
 
 	SIPState MTSMSSendOK();
@@ -290,6 +301,11 @@ public:
 
 	//@}
 
+	private:
+
+	/** Make a REGISTER, with new tags, for Register() and sendUnregister(). */
+	osip_message_t *makeREGISTER(Method wMethod);
+
 };
 
 
@@ -125,7 +125,8 @@ int SIPInterface::fifoSize(const std::string& call_id )
 
 
 SIPInterface::SIPInterface()
-	:mSIPSocket(gConfig.getNum("SIP.Port"), gConfig.getStr("Asterisk.IP"), gConfig.getNum("Asterisk.Port"))
+	:mSIPSocket(gConfig.getNum("SIP.Port"), gConfig.getStr("Asterisk.IP"), gConfig.getNum("Asterisk.Port")),
+	mTransactions(*this)
 {
 	bool bres;
 	mAsteriskPort = gConfig.getNum("Asterisk.Port");
@@ -138,6 +139,7 @@ SIPInterface::SIPInterface()
 
 
 void SIP::driveLoop( SIPInterface * si){
+	AllocScope allocScope(AllocSIP);
 	while (true) {
 		si->drive();
 	}
@@ -150,7 +152,8 @@ void SIPInterface::start(){
 	ortp_scheduler_init();
 	// FIXME -- Can we coordinate this with the global logger?
 	//ortp_set_log_level_mask(ORTP_MESSAGE|ORTP_WARNING|ORTP_ERROR);
-	mDriveThread.start((void *(*)(void*))driveLoop,this );
+	mDriveThread.start((void *(*)(void*))driveLoop,this,"SIP drive");
+	mTransactions.start();
 }
 
 
@@ -165,15 +168,21 @@ void SIPInterface::write(const struct sockaddr_in* dest, osip_message_t *msg)
 		LOG(ERROR) << "osip_message_to_str produced a NULL pointer.";
 		return;
 	}
+	write(dest,str);
+	free(str);
+}
+
+
+void SIPInterface::write(const struct sockaddr_in* dest, const char *str)
+{
 	char line[1000];
-	sscanf(str,"%[^\n]",line);
+	sscanf(str,"%999[^\n]",line);
 	LOG(INFO) << "write " << line;
 	LOG(DEBUG) << "write " << str;
 
 	mSocketLock.lock();
 	mSIPSocket.send((const struct sockaddr*)dest,str);
 	mSocketLock.unlock();
-	free(str);
 }
 
 
@@ -183,7 +192,9 @@ void SIPInterface::drive()
 	char buffer[2048];
 
 	LOG(DEBUG) << "blocking on socket";
+	gThreadIdle();
 	int numRead = mSIPSocket.read(buffer);
+	gThreadHeartbeat();
 	if (numRead<0) {
 		LOG(ALARM) << "cannot read SIP socket.";
 		return;
@@ -203,6 +214,9 @@ void SIPInterface::drive()
 		osip_message_parse(msg, buffer, strlen(buffer));
 	
 		if (msg->sip_method) LOG(DEBUG) << "read method " << msg->sip_method;
+
+		// Responses to REGISTER, MESSAGE and INFO go to the transaction layer.
+		if (mTransactions.receive(msg)) return;
 	
 		// Must check if msg is an invite.
 		// if it is, handle appropriatly.
@@ -32,6 +32,8 @@
 #include <Sockets.h>
 #include <osip2/osip.h>
 
+#include "SIPTransaction.h"
+
 
 
 namespace GSM {
@@ -135,6 +137,7 @@ class SIPInterface
 	Mutex mSocketLock;
 	Thread mDriveThread;	
 	SIPMessageMap mSIPMap;	
+	SIPTransactionLayer mTransactions;	///< client transactions for REGISTER, MESSAGE and INFO
 	
 
 	struct sockaddr_in mAsteriskAddress;
@@ -190,12 +193,22 @@ public:
 
 	void write(const struct sockaddr_in*, osip_message_t*);
 
+	/** Write a message already formatted as a string. */
+	void write(const struct sockaddr_in*, const char*);
+
 	void writeAsterisk(osip_message_t * msg)
 		{ write(&mAsteriskAddress, msg); }
 
 	void writeMessenger(osip_message_t * msg)
 		{ write(&mMessengerAddress, msg); }
 
+	const struct sockaddr_in* asteriskAddress() const { return &mAsteriskAddress; }
+
+	const struct sockaddr_in* messengerAddress() const { return &mMessengerAddress; }
+
+	/** The client transaction layer. */
+	SIPTransactionLayer& transactions() { return mTransactions; }
+
 	osip_message_t* read(const std::string& call_id , unsigned readTimeout=3600000)
 		{ return mSIPMap.read(call_id, readTimeout); }
 
@@ -0,0 +1,376 @@
+/*
+* Copyright 2010 Free Software Foundation, Inc.
+*
+* This software is distributed under the terms of the GNU Affero Public License.
+* See the COPYING file in the main directory for details.
+*
+* This use of this software may be subject to additional restrictions.
+* See the LEGAL file in the main directory for details.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "SIPInterface.h"
+#include "SIPTransaction.h"
+
+#include <Logger.h>
+
+
+using namespace std;
+using namespace SIP;
+
+
+
+/**
+	Find the transaction key of a message, RFC 3261 17.1.3:
+	the branch of the top Via, the CSeq method and the call ID.
+	@return False if the message lacks any of them.
+*/
+static bool transactionKey(osip_message_t *msg, string& key)
+{
+	osip_via_t *via = NULL;
+	osip_message_get_via(msg,0,&via);
+	if (!via) return false;
+	osip_generic_param_t *branch = NULL;
+	osip_via_param_get_byname(via,(char*)"branch",&branch);
+	if (!branch || !branch->gvalue) return false;
+	if (!msg->cseq || !msg->cseq->method) return false;
+	if (!msg->call_id) return false;
+	const char *callID = osip_call_id_get_number(msg->call_id);
+	if (!callID) return false;
+	key = string(branch->gvalue) + " " + msg->cseq->method + " " + callID;
+	return true;
+}
+
+
+/** Add ms to a Timeval. */
+static Timeval addMs(const Timeval& t, unsigned ms)
+{
+	uint64_t usec = t.usec() + (uint64_t)ms*1000;
+	return Timeval(t.sec() + usec/1000000, usec%1000000);
+}
+
+
+
+
+SIPClientTransaction::SIPClientTransaction(const string& wKey, char *wRequest, const struct sockaddr_in *wDest,
+		unsigned timeout, SIPTransactionCallback wCallback, void *wArg)
+	:mKey(wKey),mRequest(wRequest),
+	mTimeout(timeout),mInterval(SIPT1),mProceeding(false),
+	mDone(false),mCollected(false),mResponse(NULL),
+	mCallback(wCallback),mArg(wArg),
+	mScheduled(false),mSlot(0),mRounds(0)
+{
+	memcpy(&mDest,wDest,sizeof(mDest));
+}
+
+
+SIPClientTransaction::~SIPClientTransaction()
+{
+	free(mRequest);
+	if (mResponse) osip_message_free(mResponse);
+}
+
+
+
+
+SIPTransactionLayer::SIPTransactionLayer(SIPInterface &wInterface)
+	:mInterface(wInterface),mWheelPos(0),
+	mStarted(0),mRetransmissions(0),mTimeouts(0)
+{ }
+
+
+void SIPTransactionLayer::start()
+{
+	mTimerThread.start((void*(*)(void*))SIPTimerLoop,this,"SIP timers");
+}
+
+
+SIPClientTransaction* SIPTransactionLayer::start(osip_message_t *request, const struct sockaddr_in *dest,
+		unsigned timeout, SIPTransactionCallback callback, void *arg)
+{
+	string key;
+	if (!transactionKey(request,key)) {
+		LOG(ERROR) << "request with no transaction key";
+		return NULL;
+	}
+	if (mTransactions.find(key)!=mTransactions.end()) {
+		LOG(ERROR) << "duplicate transaction " << key;
+		return NULL;
+	}
+	char *str;
+	size_t msgSize;
+	osip_message_to_str(request,&str,&msgSize);
+	if (!str) {
+		LOG(ERROR) << "osip_message_to_str produced a NULL pointer.";
+		return NULL;
+	}
+
+	SIPClientTransaction *transaction = new SIPClientTransaction(key,str,dest,timeout,callback,arg);
+	mTransactions[key] = transaction;
+	mStarted++;
+	LOG(DEBUG) << "starting transaction " << key << ", timeout " << timeout;
+	mInterface.write(&transaction->mDest,transaction->mRequest);
+	schedule(transaction,timeout<SIPT1 ? timeout : SIPT1);
+	return transaction;
+}
+
+
+string SIPTransactionLayer::send(osip_message_t *request, const struct sockaddr_in *dest, unsigned timeout)
+{
+	mLock.lock();
+	SIPClientTransaction *transaction = start(request,dest,timeout,NULL,NULL);
+	string key = transaction ? transaction->mKey : string();
+	mLock.unlock();
+	return key;
+}
+
+
+bool SIPTransactionLayer::send(osip_message_t *request, const struct sockaddr_in *dest,
+		SIPTransactionCallback callback, void *arg, unsigned timeout)
+{
+	mLock.lock();
+	SIPClientTransaction *transaction = start(request,dest,timeout,callback,arg);
+	// A transaction with a callback needs no one to collect it.
+	if (transaction) transaction->mCollected = true;
+	mLock.unlock();
+	return transaction!=NULL;
+}
+
+
+osip_message_t *SIPTransactionLayer::wait(const string& key)
+{
+	mLock.lock();
+	TransactionMap::iterator i = mTransactions.find(key);
+	if (i==mTransactions.end()) {
+		mLock.unlock();
+		LOG(WARN) << "wait on missing transaction " << key;
+		return NULL;
+	}
+	SIPClientTransaction *transaction = i->second;
+	while (!transaction->mDone) transaction->mDoneSignal.wait(mLock);
+	osip_message_t *response = transaction->mResponse;
+	transaction->mResponse = NULL;
+	transaction->mCollected = true;
+	// Once off the wheel, Timer K has expired and nothing else holds the transaction.
+	if (!transaction->mScheduled) destroy(transaction);
+	mLock.unlock();
+	return response;
+}
+
+
+bool SIPTransactionLayer::receive(osip_message_t *msg)
+{
+	// Only responses belong to client transactions.
+	if (msg->sip_method || msg->status_code==0) return false;
+	string key;
+	if (!transactionKey(msg,key)) return false;
+
+	CompletionList done;
+	mLock.lock();
+	TransactionMap::iterator i = mTransactions.find(key);
+	if (i==mTransactions.end()) {
+		mLock.unlock();
+		return false;
+	}
+	SIPClientTransaction *transaction = i->second;
+	if (transaction->mDone) {
+		// Retransmission of the final response, absorbed during Timer K.
+		LOG(DEBUG) << "absorbing response " << msg->status_code << " for " << key;
+		osip_message_free(msg);
+	}
+	else if (msg->status_code<200) {
+		// RFC 3261 17.1.2.2: retransmit every T2 once proceeding.
+		LOG(DEBUG) << "provisional response " << msg->status_code << " for " << key;
+		transaction->mProceeding = true;
+		transaction->mInterval = SIPT2;
+		osip_message_free(msg);
+	}
+	else {
+		LOG(DEBUG) << "final response " << msg->status_code << " for " << key;
+		complete(transaction,msg,done);
+	}
+	mLock.unlock();
+	runCompletions(done);
+	return true;
+}
+
+
+void SIPTransactionLayer::tick()
+{
+	CompletionList done;
+	mLock.lock();
+	mWheelPos = (mWheelPos+1) % wheelSlots;
+	WheelSlot &slot = mWheel[mWheelPos];
+	WheelSlot::iterator i = slot.begin();
+	while (i!=slot.end()) {
+		SIPClientTransaction *transaction = *i;
+		if (transaction->mRounds) {
+			transaction->mRounds--;
+			++i;
+			continue;
+		}
+		i = slot.erase(i);
+		transaction->mScheduled = false;
+		fire(transaction,done);
+	}
+	mLock.unlock();
+	runCompletions(done);
+}
+
+
+size_t SIPTransactionLayer::size() const
+{
+	mLock.lock();
+	size_t retVal = mTransactions.size();
+	mLock.unlock();
+	return retVal;
+}
+
+
+void SIPTransactionLayer::stats(unsigned& started, unsigned& retransmissions, unsigned& timeouts) const
+{
+	mLock.lock();
+	started = mStarted;
+	retransmissions = mRetransmissions;
+	timeouts = mTimeouts;
+	mLock.unlock();
+}
+
+
+void SIPTransactionLayer::schedule(SIPClientTransaction *transaction, unsigned ms)
+{
+	assert(!transaction->mScheduled);
+	// The current tick began up to a tick ago, so add one to never fire early.
+	unsigned ticks = (ms + wheelTick - 1) / wheelTick + 1;
+	transaction->mSlot = (mWheelPos + ticks) % wheelSlots;
+	transaction->mRounds = (ticks - 1) / wheelSlots;
+	// At the front, so a tick walking this slot does not come to it again.
+	WheelSlot &slot = mWheel[transaction->mSlot];
+	slot.push_front(transaction);
+	transaction->mWheelPos = slot.begin();
+	transaction->mScheduled = true;
+}
+
+
+void SIPTransactionLayer::unschedule(SIPClientTransaction *transaction)
+{
+	if (!transaction->mScheduled) return;
+	mWheel[transaction->mSlot].erase(transaction->mWheelPos);
+	transaction->mScheduled = false;
+}
+
+
+void SIPTransactionLayer::destroy(SIPClientTransaction *transaction)
+{
+	unschedule(transaction);
+	mTransactions.erase(transaction->mKey);
+	delete transaction;
+}
+
+
+void SIPTransactionLayer::complete(SIPClientTransaction *transaction, osip_message_t *response, CompletionList& done)
+{
+	unschedule(transaction);
+	transaction->mDone = true;
+	if (transaction->mCallback) {
+		Completion completion;
+		completion.callback = transaction->mCallback;
+		completion.arg = transaction->mArg;
+		completion.response = response;
+		done.push_back(completion);
+	}
+	else if (transaction->mCollected) {
+		// Nobody wants the result.
+		if (response) osip_message_free(response);
+	}
+	else {
+		transaction->mResponse = response;
+		transaction->mDoneSignal.broadcast();
+	}
+	// Timer K: stay around to absorb retransmitted responses.
+	schedule(transaction,SIPT4);
+}
+
+
+void SIPTransactionLayer::fire(SIPClientTransaction *transaction, CompletionList& done)
+{
+	// Timer K expired.
+	if (transaction->mDone) {
+		if (transaction->mCollected) destroy(transaction);
+		return;
+	}
+
+	// Timer F expired.
+	if (transaction->mTimeout.passed()) {
+		LOG(NOTICE) << "transaction " << transaction->mKey << " timed out";
+		mTimeouts++;
+		complete(transaction,NULL,done);
+		return;
+	}
+
+	// Timer E expired.
+	LOG(DEBUG) << "retransmitting " << transaction->mKey;
+	mRetransmissions++;
+	mInterface.write(&transaction->mDest,transaction->mRequest);
+	if (!transaction->mProceeding) {
+		transaction->mInterval *= 2;
+		if (transaction->mInterval > SIPT2) transaction->mInterval = SIPT2;
+	}
+	unsigned next = transaction->mInterval;
+	long remaining = transaction->mTimeout.remaining();
+	if (remaining < (long)next) next = remaining>0 ? remaining : 0;
+	schedule(transaction,next);
+}
+
+
+void SIPTransactionLayer::runCompletions(CompletionList& done)
+{
+	while (!done.empty()) {
+		Completion &completion = done.front();
+		if (completion.callback) completion.callback(completion.response,completion.arg);
+		if (completion.response) osip_message_free(completion.response);
+		done.pop_front();
+	}
+}
+
+
+
+
+void *SIP::SIPTimerLoop(SIPTransactionLayer *layer)
+{
+	AllocScope allocScope(AllocSIP);
+	// Tick on a fixed schedule, catching up on ticks lost to scheduling delays.
+	Timeval nextTick(SIPTransactionLayer::wheelTick);
+	while (true) {
+		long remaining = nextTick.remaining();
+		if (remaining>0) usleep(remaining*1000);
+		// After a long stall, resynchronize instead of spinning through the backlog.
+		if (remaining < -1000) nextTick.now();
+		layer->tick();
+		nextTick = addMs(nextTick,SIPTransactionLayer::wheelTick);
+	}
+	return NULL;
+}
+
+
+
+// vim: ts=4 sw=4
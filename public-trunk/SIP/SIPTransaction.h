@@ -0,0 +1,227 @@
+/*
+* Copyright 2010 Free Software Foundation, Inc.
+*
+* This software is distributed under the terms of the GNU Affero Public License.
+* See the COPYING file in the main directory for details.
+*
+* This use of this software may be subject to additional restrictions.
+* See the LEGAL file in the main directory for details.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#ifndef SIPTRANSACTION_H
+#define SIPTRANSACTION_H
+
+#include <string>
+#include <map>
+#include <list>
+#include <netinet/in.h>
+#include <osip2/osip.h>
+
+#include <Threads.h>
+#include <Timeval.h>
+
+
+namespace SIP {
+
+
+class SIPInterface;
+
+
+/**@name RFC 3261 timer values for UDP, in ms. */
+//@{
+const unsigned SIPT1 = 500;				///< round trip estimate, first retransmission interval
+const unsigned SIPT2 = 4000;			///< longest retransmission interval
+const unsigned SIPT4 = 5000;			///< longest time a message stays in the network, Timer K
+const unsigned SIPTimerF = 64*SIPT1;	///< default non-INVITE transaction timeout
+//@}
+
+
+/**
+	Completion callback of a client transaction.
+	Called from the SIP receive thread or the transaction timer thread, so it must not block.
+	@param response The final response, or NULL on timeout; freed when the callback returns.
+	@param arg The argument given with the request.
+*/
+typedef void (*SIPTransactionCallback)(const osip_message_t *response, void *arg);
+
+
+/**
+	A non-INVITE client transaction, RFC 3261 17.1.2.
+	Only the SIPTransactionLayer touches these, under its lock.
+*/
+class SIPClientTransaction {
+
+	private:
+
+	friend class SIPTransactionLayer;
+
+	std::string mKey;					///< branch, method and call ID
+	char *mRequest;						///< the request, formatted once for all retransmissions
+	struct sockaddr_in mDest;			///< where the request goes
+	Timeval mTimeout;					///< Timer F
+	unsigned mInterval;					///< current retransmission interval, Timer E
+	bool mProceeding;					///< true once a provisional response arrives
+
+	bool mDone;							///< true once a final response arrives or Timer F expires
+	bool mCollected;					///< true once the result is taken by wait()
+	osip_message_t *mResponse;			///< the final response, until it is collected
+	SIPTransactionCallback mCallback;	///< completion callback, NULL if the result is waited for
+	void *mArg;							///< callback argument
+	Signal mDoneSignal;					///< signaled on completion
+
+	/**@name Position on the timer wheel. */
+	//@{
+	bool mScheduled;
+	unsigned mSlot;
+	unsigned mRounds;					///< full turns of the wheel left before firing
+	std::list<SIPClientTransaction*>::iterator mWheelPos;
+	//@}
+
+	SIPClientTransaction(const std::string& wKey, char *wRequest, const struct sockaddr_in *wDest,
+		unsigned timeout, SIPTransactionCallback wCallback, void *wArg);
+
+	~SIPClientTransaction();
+};
+
+
+
+/**
+	The client transaction layer.
+	Retransmits requests and times them out from a single timer wheel,
+	so callers do not each need a thread blocked for the life of their transaction.
+	Results go to a callback or are kept for a later wait(), like a future.
+*/
+class SIPTransactionLayer {
+
+	public:
+
+	static const unsigned wheelSlots = 256;		///< slots in the timer wheel
+	static const unsigned wheelTick = 50;		///< timer wheel resolution, in ms
+
+	private:
+
+	SIPInterface &mInterface;
+
+	mutable Mutex mLock;
+
+	typedef std::map<std::string,SIPClientTransaction*> TransactionMap;
+	TransactionMap mTransactions;				///< transactions by key
+
+	typedef std::list<SIPClientTransaction*> WheelSlot;
+	WheelSlot mWheel[wheelSlots];
+	unsigned mWheelPos;							///< slot of the current tick
+
+	Thread mTimerThread;
+
+	/**@name Statistics. */
+	//@{
+	unsigned mStarted;
+	unsigned mRetransmissions;
+	unsigned mTimeouts;
+	//@}
+
+	public:
+
+	SIPTransactionLayer(SIPInterface &wInterface);
+
+	/** Start the timer thread. */
+	void start();
+
+	/**
+		Send a request and start its transaction.
+		The caller must pass the returned key to wait() to collect the result.
+		@param request The request; not changed.
+		@param dest Where to send it.
+		@param timeout The transaction timeout in ms, Timer F.
+		@return The transaction key, empty if the request cannot start a transaction.
+	*/
+	std::string send(osip_message_t *request, const struct sockaddr_in *dest, unsigned timeout=SIPTimerF);
+
+	/**
+		Send a request and start its transaction, with the result going to a callback.
+		@param callback Completion callback, or NULL to ignore the result.
+		@return True if the transaction started.
+	*/
+	bool send(osip_message_t *request, const struct sockaddr_in *dest,
+		SIPTransactionCallback callback, void *arg, unsigned timeout=SIPTimerF);
+
+	/**
+		Block until a transaction started by send() completes.
+		@param key The key returned by send().
+		@return The final response, to be freed by the caller, or NULL on timeout.
+	*/
+	osip_message_t *wait(const std::string& key);
+
+	/**
+		Offer a received message to the transaction layer.
+		@return True if it was a response to a client transaction and was consumed.
+	*/
+	bool receive(osip_message_t *msg);
+
+	/** Advance the timer wheel by one tick. */
+	void tick();
+
+	/** Number of transactions in the table. */
+	size_t size() const;
+
+	/** Report statistics. */
+	void stats(unsigned& started, unsigned& retransmissions, unsigned& timeouts) const;
+
+	private:
+
+	/** Create and send a transaction; returns NULL on failure.  mLock must be held. */
+	SIPClientTransaction* start(osip_message_t *request, const struct sockaddr_in *dest,
+		unsigned timeout, SIPTransactionCallback callback, void *arg);
+
+	/** Put a transaction on the wheel ms from now.  mLock must be held. */
+	void schedule(SIPClientTransaction *transaction, unsigned ms);
+
+	/** Take a transaction off the wheel.  mLock must be held. */
+	void unschedule(SIPClientTransaction *transaction);
+
+	/** Remove and delete a transaction.  mLock must be held. */
+	void destroy(SIPClientTransaction *transaction);
+
+	/** A completion callback to run once mLock is released. */
+	struct Completion {
+		SIPTransactionCallback callback;
+		void *arg;
+		osip_message_t *response;
+	};
+	typedef std::list<Completion> CompletionList;
+
+	/** Finish a transaction with a final response, NULL on timeout.  mLock must be held. */
+	void complete(SIPClientTransaction *transaction, osip_message_t *response, CompletionList& done);
+
+	/** Handle a transaction whose wheel slot came up.  mLock must be held. */
+	void fire(SIPClientTransaction *transaction, CompletionList& done);
+
+	/** Run and clear completion callbacks. */
+	static void runCompletions(CompletionList& done);
+};
+
+
+/** Timer thread for the transaction layer. */
+void *SIPTimerLoop(SIPTransactionLayer*);
+
+
+}; // namespace SIP
+
+#endif
+// vim: ts=4 sw=4
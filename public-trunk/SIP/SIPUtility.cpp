@@ -90,8 +90,8 @@ void SIP::make_tag(char * tag)
 
 void SIP::make_branch( char * branch )
 {
-	int val = random()%100000;
-	sprintf(branch,"z9hG4bK%i", val);
+	// Wide enough that thousands of concurrent transactions don't collide.
+	sprintf(branch,"z9hG4bK%lx%lx", random(), random());
 }
 
 // vim: ts=4 sw=4
@@ -32,6 +32,7 @@
 #include "GSMConfig.h"
 #include "GSML1FEC.h"
 #include <string.h>
+#include <unistd.h>
 #include <stdexcept>
 
 #include <Logger.h>
@@ -46,7 +47,9 @@ extern void shutdownOpenbts();
 TransceiverManager::TransceiverManager(int numARFCNs,
 		const char* wTRXAddress, int wBasePort)
 	:mHaveClock(false),
-	mClockSocket(wBasePort+100)
+	mClockSocket(wBasePort+100),
+	mClockSeq(0),mHaveClockSeq(false),
+	mLostClocks(0)
 {
 	// set up the ARFCN managers
 	for (int i=0; i<numARFCNs; i++) {
@@ -59,7 +62,7 @@ TransceiverManager::TransceiverManager(int numARFCNs,
 
 void TransceiverManager::start()
 {
-	mClockThread.start((void*(*)(void*))ClockLoopAdapter,this);
+	mClockThread.start((void*(*)(void*))ClockLoopAdapter,this,"TRX clock");
 	for (unsigned i=0; i<mARFCNs.size(); i++) {
 		mARFCNs[i]->start();
 	}
@@ -98,6 +101,26 @@ void TransceiverManager::clockHandler()
 		return;
 	}
 
+	// Version 2 clock indications are binary and carry a sequence number.
+	const unsigned char *rp = (const unsigned char*)buffer;
+	if ((msgLen==(int)gTRXv2ClockLen) && (rp[0]==TRXV2_CLOCK)) {
+		uint32_t seq = TRXRead32(rp+1);
+		uint32_t FN = TRXRead32(rp+5);
+		if (mHaveClockSeq && (seq>mClockSeq+1)) {
+			LOG(WARN) << "lost " << seq-mClockSeq-1 << " clock indications";
+			mLostClocks += seq-mClockSeq-1;
+		}
+		if (mHaveClockSeq && (seq<=mClockSeq)) {
+			LOG(NOTICE) << "clock sequence restarted at " << seq << ", transceiver restart?";
+		}
+		mClockSeq = seq;
+		mHaveClockSeq = true;
+		LOG(DEBUG) << "CLOCK indication, seq=" << seq << " clock=" << FN;
+		gBTSL1.clock().set(FN);
+		mHaveClock = true;
+		return;
+	}
+
 	if (strncmp(buffer,"IND CLOCK",9)==0) {
 		uint32_t FN;
 		sscanf(buffer,"IND CLOCK %u", &FN);
@@ -123,13 +146,25 @@ void TransceiverManager::clockHandler()
 ::ARFCNManager::ARFCNManager(const char* wTRXAddress, int wBasePort, TransceiverManager &wTransceiver)
 	:mTransceiver(wTransceiver),
 	mDataSocket(wBasePort+100+1,wTRXAddress,wBasePort+1),
-	mControlSocket(wBasePort+100,wTRXAddress,wBasePort)
+	mProtocol(1),
+	mControlSocket(wBasePort+100,wTRXAddress,wBasePort),
+	mRxMaskEnabled(true),
+	mRxMaskDirty(0),
+	mIOStats(true),
+	mBatching(false),
+	mTagged(true),
+	mCommandSeq(0)
 {
 	// The default demux table is full of NULL pointers.
 	for (int i=0; i<8; i++) {
 		for (unsigned j=0; j<maxModulus; j++) {
 			mDemuxTable[i][j] = NULL;
 		}
+		mRxMaskPeriod[i] = 0;
+	}
+	for (unsigned i=0; i<maxTxHold; i++) {
+		mTxHoldFN[i] = -1;
+		mTxHoldMask[i] = 0;
 	}
 }
 
@@ -138,7 +173,9 @@ void TransceiverManager::clockHandler()
 
 void ::ARFCNManager::start()
 {
-	mRxThread.start((void*(*)(void*))ReceiveLoopAdapter,this);
+	mRxThread.start((void*(*)(void*))ReceiveLoopAdapter,this,"TRX receive");
+	mRxMaskThread.start((void*(*)(void*))RxMaskLoopAdapter,this,"TRX rx mask");
+	mTxFlushThread.start((void*(*)(void*))TxFlushLoopAdapter,this,"TRX tx flush");
 }
 
 
@@ -164,6 +201,85 @@ void ::ARFCNManager::installDecoder(GSM::L1Decoder *wL1d)
 		}
 	}
 	mTableLock.unlock();
+	wL1d->downstream(this);
+}
+
+
+
+/** Greatest common divisor, for combining repeat lengths. */
+static unsigned gcd(unsigned a, unsigned b)
+{
+	while (b) {
+		unsigned t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+
+void ::ARFCNManager::updateRxMask(unsigned TN)
+{
+	assert(TN<8);
+
+	// The mask repeats with the LCM of the repeat lengths on this slot.
+	// maxModulus is a multiple of that, so frames 0..period-1 of the
+	// demux table are a complete pattern.
+	bool mask[maxRxMaskPeriod];
+	unsigned period = 1;
+	mTableLock.lock();
+	for (unsigned FN=0; FN<maxModulus; FN++) {
+		const L1Decoder *proc = mDemuxTable[TN][FN];
+		if (!proc) continue;
+		unsigned repeat = proc->mapping().repeatLength();
+		period = period / gcd(period,repeat) * repeat;
+	}
+	if (period<=maxRxMaskPeriod) {
+		for (unsigned FN=0; FN<period; FN++) {
+			const L1Decoder *proc = mDemuxTable[TN][FN];
+			mask[FN] = proc && proc->listening();
+		}
+	}
+	mTableLock.unlock();
+	if (period>maxRxMaskPeriod) {
+		LOG(DEBUG) << "no uplink activity mask for TN " << TN << ", period " << period;
+		return;
+	}
+
+	mRxMaskLock.lock();
+	if (!mRxMaskEnabled ||
+		((period==mRxMaskPeriod[TN]) && (memcmp(mask,mRxMask[TN],period*sizeof(bool))==0))) {
+		mRxMaskLock.unlock();
+		return;
+	}
+	// The mask goes as hex, first frame in the MSB of the first digit.
+	char paramBuf[MAX_UDP_LENGTH];
+	int len = sprintf(paramBuf,"%u %u ",TN,period);
+	for (unsigned FN=0; FN<period; FN+=4) {
+		unsigned nibble = 0;
+		for (unsigned i=FN; i<FN+4; i++) nibble = (nibble<<1) | ((i<period) && mask[i]);
+		paramBuf[len++] = "0123456789abcdef"[nibble];
+	}
+	paramBuf[len] = '\0';
+	int status = sendCommand("SETRXMASK",paramBuf);
+	if (status==0) {
+		memcpy(mRxMask[TN],mask,period*sizeof(bool));
+		mRxMaskPeriod[TN] = period;
+	} else {
+		LOG(WARN) << "SETRXMASK failed with status " << status << ", disabling uplink activity masks";
+		mRxMaskEnabled = false;
+	}
+	mRxMaskLock.unlock();
+}
+
+
+void ::ARFCNManager::markRxMask(unsigned TN)
+{
+	assert(TN<8);
+	mRxMaskDirtyLock.lock();
+	mRxMaskDirty |= 1<<TN;
+	mRxMaskDirtySignal.signal();
+	mRxMaskDirtyLock.unlock();
 }
 
 
@@ -172,6 +288,28 @@ void ::ARFCNManager::installDecoder(GSM::L1Decoder *wL1d)
 void ::ARFCNManager::writeHighSide(const GSM::TxBurst& burst)
 {
 	LOG(DEEPDEBUG) << "transmit at time " << gBTSL1.clock().get() << ": " << burst;
+
+	// Version 2 holds each burst with the rest of its frame until the frame is due.
+	if (mProtocol>=2) {
+		uint32_t FN = burst.time().FN();
+		unsigned TN = burst.time().TN();
+		int32_t now = gBTSL1.clock().FN();
+		unsigned entry = FN % maxTxHold;
+		mDataSocketLock.lock();
+		// A frame more than maxTxHold ahead can find an older one in its entry.
+		if ((mTxHoldFN[entry]>=0) && (mTxHoldFN[entry]!=(int32_t)FN)) sendHeldFrame(entry);
+		unsigned char *wp = mTxHold[entry][TN];
+		/// FIXME -- We hard-code gain to 0 dB for now.
+		*wp++ = 0;
+		TRXPackBits(burst.begin(),gSlotLen,wp);
+		mTxHoldFN[entry] = FN;
+		mTxHoldMask[entry] |= 1<<TN;
+		// A burst for a frame that is already due goes right out.
+		if (FNDelta(FN,now)<=0) sendHeldFrame(entry);
+		mDataSocketLock.unlock();
+		return;
+	}
+
 	// format the transmission request message
 	static const int bufferSize = gSlotLen+1+4+1;
 	char buffer[bufferSize];
@@ -201,6 +339,58 @@ void ::ARFCNManager::writeHighSide(const GSM::TxBurst& burst)
 
 
 
+void ::ARFCNManager::sendHeldFrame(unsigned entry)
+{
+	unsigned char buffer[gTRXv2HeaderLen+8*gTRXv2DownlinkSlotLen];
+	unsigned char *wp = TRXv2StartFrame(buffer,TRXV2_DOWNLINK,mTxHoldFN[entry]);
+	buffer[gTRXv2HeaderLen-1] = mTxHoldMask[entry];
+	for (unsigned TN=0; TN<8; TN++) {
+		if (!(mTxHoldMask[entry] & (1<<TN))) continue;
+		memcpy(wp,mTxHold[entry][TN],gTRXv2DownlinkSlotLen);
+		wp += gTRXv2DownlinkSlotLen;
+	}
+	mDataSocket.write((const char*)buffer,wp-buffer);
+	mTxHoldFN[entry] = -1;
+	mTxHoldMask[entry] = 0;
+}
+
+
+void ::ARFCNManager::sendHeldFrames(int32_t lastFN)
+{
+	for (unsigned i=0; i<maxTxHold; i++) {
+		if (mTxHoldFN[i]<0) continue;
+		if (FNDelta(mTxHoldFN[i],lastFN)<=0) sendHeldFrame(i);
+	}
+}
+
+
+
+
+void ::ARFCNManager::receiveFrame(const unsigned char *rp, unsigned len)
+{
+	int32_t FN = TRXRead32(rp+1);
+	unsigned mask = rp[gTRXv2HeaderLen-1];
+	unsigned numSlots = 0;
+	for (unsigned TN=0; TN<8; TN++) if (mask & (1<<TN)) numSlots++;
+	if (len!=gTRXv2HeaderLen+numSlots*gTRXv2UplinkSlotLen) {
+		LOG(WARN) << "bad uplink frame length " << len << " for timeslot mask " << hex << mask << dec;
+		return;
+	}
+	rp += gTRXv2HeaderLen;
+	for (unsigned TN=0; TN<8; TN++) {
+		if (!(mask & (1<<TN))) continue;
+		// Same physical header and soft symbols as in version 1.
+		int RSSI = (signed char)rp[0];
+		int timingError = (signed char)rp[1];
+		timingError = (timingError<<8) | rp[2];
+		rp += 3;
+		float data[gSlotLen];
+		for (unsigned i=0; i<gSlotLen; i++) data[i] = (*rp++) / 256.0F;
+		receiveBurst(RxBurst(data,GSM::Time(FN,TN),timingError/256.0F,-RSSI));
+	}
+}
+
+
 void ::ARFCNManager::driveRx()
 {
 	// read the message
@@ -209,6 +399,10 @@ void ::ARFCNManager::driveRx()
 	if (msgLen<=0) SOCKET_ERROR;
 	// decode
 	unsigned char *rp = (unsigned char*)buffer;
+	if (rp[0]==TRXV2_UPLINK) {
+		receiveFrame(rp,msgLen);
+		return;
+	}
 	// timeslot number
 	unsigned TN = *rp++;
 	// frame number
@@ -234,6 +428,8 @@ void ::ARFCNManager::driveRx()
 
 
 void* ReceiveLoopAdapter(::ARFCNManager* manager){
+	// The receive thread runs the L1 decoders.
+	AllocScope allocScope(AllocL1FEC);
 	while (true) {
 		manager->driveRx();
 		pthread_testcancel();
@@ -242,6 +438,47 @@ void* ReceiveLoopAdapter(::ARFCNManager* manager){
 }
 
 
+void* TxFlushLoopAdapter(::ARFCNManager* manager){
+	// Send each held downlink frame one frame ahead of its time,
+	// which leaves the bursts written during that frame to join it.
+	while (true) {
+		int32_t now = gBTSL1.clock().FN();
+		if (manager->protocol()>=2) {
+			manager->mDataSocketLock.lock();
+			manager->sendHeldFrames((now+1)%gHyperframe);
+			manager->mDataSocketLock.unlock();
+		}
+		gBTSL1.clock().wait(GSM::Time(now)+1);
+		pthread_testcancel();
+	}
+	return NULL;
+}
+
+
+void* RxMaskLoopAdapter(::ARFCNManager* manager){
+	// Opened channels are marked and refreshed right away.
+	// Channels also go idle when their timers expire, without a close().
+	// Catch those once a second.
+	Timeval nextSweep(1000);
+	while (true) {
+		manager->mRxMaskDirtyLock.lock();
+		if (!manager->mRxMaskDirty) manager->mRxMaskDirtySignal.wait(manager->mRxMaskDirtyLock,1000);
+		unsigned dirty = manager->mRxMaskDirty;
+		manager->mRxMaskDirty = 0;
+		manager->mRxMaskDirtyLock.unlock();
+		if (nextSweep.passed()) {
+			dirty = 0xff;
+			nextSweep.future(1000);
+		}
+		for (unsigned TN=0; TN<8; TN++) {
+			if (dirty & (1<<TN)) manager->updateRxMask(TN);
+		}
+		pthread_testcancel();
+	}
+	return NULL;
+}
+
+
 
 
 
@@ -256,6 +493,8 @@ int ::ARFCNManager::sendCommandPacket(const char* command, char* response)
 	for (int retry=0; retry<10; retry++) {
 		mControlSocket.write(command);
 		msgLen = mControlSocket.read(response,3000);
+		// Skip late answers to resent batch commands.
+		while ((msgLen>=4) && (strncmp(response,"RSP#",4)==0)) msgLen = mControlSocket.read(response,3000);
 		if (msgLen>0) {
 			response[msgLen] = '\0';
 			break;
@@ -277,11 +516,114 @@ int ::ARFCNManager::sendCommandPacket(const char* command, char* response)
 
 
 
+bool ::ARFCNManager::batched(const char* command, const char* param)
+{
+	if (!mBatching || !pthread_equal(mBatchThread,pthread_self())) return false;
+	BatchCommand cmd;
+	cmd.name = command;
+	cmd.params = param;
+	cmd.status = noAnswer;
+	mBatch.push_back(cmd);
+	return true;
+}
+
+
+void ::ARFCNManager::beginBatch()
+{
+	assert(!mBatching);
+	mBatchThread = pthread_self();
+	mBatch.clear();
+	mBatching = true;
+}
+
+
+bool ::ARFCNManager::endBatch()
+{
+	assert(mBatching && pthread_equal(mBatchThread,pthread_self()));
+	mBatching = false;
+	std::vector<BatchCommand> batch;
+	batch.swap(mBatch);
+	if (batch.empty()) return true;
+	LOG(INFO) << "sending " << batch.size() << " commands";
+
+	if (mTagged) sendTagged(batch);
+
+	bool retVal = true;
+	for (unsigned i=0; i<batch.size(); i++) {
+		BatchCommand &cmd = batch[i];
+		if (cmd.status==noAnswer) cmd.status = sendCommand(cmd.name.c_str(),cmd.params.c_str());
+		if (cmd.status!=0) {
+			LOG(ALARM) << cmd.name << " " << cmd.params << " failed with status " << cmd.status;
+			retVal = false;
+		}
+	}
+	return retVal;
+}
+
+
+void ::ARFCNManager::sendTagged(std::vector<BatchCommand>& batch)
+{
+	char command[MAX_UDP_LENGTH];
+	char response[MAX_UDP_LENGTH];
+
+	mControlLock.lock();
+	const unsigned firstSeq = mCommandSeq+1;
+	mCommandSeq += batch.size();
+	unsigned pending = batch.size();
+
+	for (int retry=0; pending && retry<10; retry++) {
+		// Everything unanswered goes out before we wait for any answer.
+		unsigned sent = 0;
+		for (unsigned i=0; i<batch.size(); i++) {
+			if (batch[i].status!=noAnswer) continue;
+			sprintf(command,"CMD#%u %s %s",firstSeq+i,batch[i].name.c_str(),batch[i].params.c_str());
+			mControlSocket.write(command);
+			sent++;
+		}
+		unsigned received = 0;
+		while (pending) {
+			int msgLen = mControlSocket.read(response,3000);
+			if (msgLen<=0) {
+				LOG(WARN) << "TRX link timeout on batch attempt " << retry+1 << ", " << pending << " commands unanswered";
+				break;
+			}
+			received++;
+			response[msgLen] = '\0';
+			unsigned seq;
+			char name[20];
+			int status;
+			if (sscanf(response,"RSP#%u %19s %d",&seq,name,&status)!=3) {
+				// An older transceiver; the caller sends the rest one at a time.
+				// Its answers to the rest of this round would be taken as answers
+				// to those resends, so drain them first.
+				LOG(NOTICE) << "transceiver does not answer tagged commands, sending them one at a time";
+				while ((received<sent) && (mControlSocket.read(response,3000)>0)) received++;
+				mTagged = false;
+				mControlLock.unlock();
+				return;
+			}
+			// Late answers to an earlier batch, or to a resent command, are dropped.
+			if ((seq<firstSeq) || (seq-firstSeq>=batch.size())) continue;
+			BatchCommand &cmd = batch[seq-firstSeq];
+			if ((cmd.status!=noAnswer) || (cmd.name!=name)) continue;
+			cmd.status = status;
+			pending--;
+		}
+	}
+	mControlLock.unlock();
+}
+
+
+
 int ::ARFCNManager::sendCommand(const char*command, int param, int *responseParam)
 {
 	// Send command and get response.
 	char cmdBuf[MAX_UDP_LENGTH];
 	char response[MAX_UDP_LENGTH];
+	if (!responseParam) {
+		sprintf(cmdBuf,"%d",param);
+		if (batched(command,cmdBuf)) return 0;
+	}
 	sprintf(cmdBuf,"CMD %s %d", command, param);
 	int rspLen = sendCommandPacket(cmdBuf,response);
 	if (rspLen<=0) return -1;
@@ -300,6 +642,7 @@ int ::ARFCNManager::sendCommand(const char*command, int param, int *responsePara
 
 int ::ARFCNManager::sendCommand(const char*command, const char* param)
 {
+	if (batched(command,param)) return 0;
 	// Send command and get response.
 	char cmdBuf[MAX_UDP_LENGTH];
 	char response[MAX_UDP_LENGTH];
@@ -319,6 +662,7 @@ int ::ARFCNManager::sendCommand(const char*command, const char* param)
 
 int ::ARFCNManager::sendCommand(const char*command)
 {
+	if (batched(command,"")) return 0;
 	// Send command and get response.
 	char cmdBuf[MAX_UDP_LENGTH];
 	char response[MAX_UDP_LENGTH];
@@ -383,6 +727,81 @@ bool ::ARFCNManager::tuneLoopback(int wARFCN)
 }
 
 
+unsigned ::ARFCNManager::setProtocol(unsigned version)
+{
+	if (version<2) {
+		mProtocol = 1;
+		return mProtocol;
+	}
+	// A transceiver that predates SETPROTO fails the command and stays at version 1.
+	int status = sendCommand("SETPROTO",2);
+	if (status!=0) {
+		LOG(NOTICE) << "SETPROTO failed with status " << status << ", using TRX protocol version 1";
+		mProtocol = 1;
+		return mProtocol;
+	}
+	mProtocol = 2;
+	LOG(INFO) << "using TRX protocol version 2";
+	return mProtocol;
+}
+
+
+bool ::ARFCNManager::getState(TRXState &state)
+{
+	char response[MAX_UDP_LENGTH];
+	int rspLen = sendCommandPacket("CMD STATE",response);
+	if (rspLen<=0) return false;
+	int status = -1;
+	int on;
+	if (sscanf(response,"RSP STATE %d %d %u %u %u %u %d %d %d %d %d %d %d %d", &status, &on,
+			&state.rxKHz, &state.txKHz, &state.TSC, &state.protocol,
+			&state.slot[0], &state.slot[1], &state.slot[2], &state.slot[3],
+			&state.slot[4], &state.slot[5], &state.slot[6], &state.slot[7])!=14 || status!=0) {
+		LOG(NOTICE) << "STATE failed with status " << status;
+		return false;
+	}
+	state.on = (on!=0);
+	return true;
+}
+
+
+bool ::ARFCNManager::resume(int wARFCN, unsigned TSC)
+{
+	TRXState state;
+	if (!getState(state)) return false;
+	unsigned rxFreq = uplinkFreqKHz(gBTSL1.band(),wARFCN);
+	unsigned txFreq = downlinkFreqKHz(gBTSL1.band(),wARFCN);
+	if (!state.on) {
+		LOG(NOTICE) << "transceiver is not on, so not resuming ARFCN " << wARFCN;
+		return false;
+	}
+	if ((state.rxKHz!=rxFreq) || (state.txKHz!=txFreq) || (state.TSC!=TSC)) {
+		LOG(NOTICE) << "running transceiver is not set up for ARFCN " << wARFCN << " TSC " << TSC;
+		return false;
+	}
+	mARFCN = wARFCN;
+
+	// The previous core's uplink activity masks are still installed.
+	// Open every timeslot up and let updateRxMask narrow them again.
+	mRxMaskLock.lock();
+	beginBatch();
+	for (unsigned TN=0; TN<8; TN++) {
+		char paramBuf[20];
+		sprintf(paramBuf,"%u 1 8",TN);
+		sendCommand("SETRXMASK",paramBuf);
+		mRxMaskPeriod[TN] = 1;
+		mRxMask[TN][0] = true;
+	}
+	if (!endBatch()) {
+		LOG(WARN) << "could not clear uplink activity masks, disabling them";
+		mRxMaskEnabled = false;
+	}
+	mRxMaskLock.unlock();
+	LOG(NOTICE) << "resumed running transceiver on ARFCN " << wARFCN;
+	return true;
+}
+
+
 bool ::ARFCNManager::powerOff()
 {
 	int status = sendCommand("POWEROFF");
@@ -477,6 +896,59 @@ signed ::ARFCNManager::getNoiseLevel(void)
         return noiselevel;
 }
 
+bool ::ARFCNManager::getDFEStats(unsigned &estimates, unsigned &redesigns, float &change)
+{
+	char response[MAX_UDP_LENGTH];
+	int rspLen = sendCommandPacket("CMD DFESTATS",response);
+	if (rspLen<=0) return false;
+	int status = -1;
+	int changeMilli = 0;
+	if (sscanf(response,"RSP DFESTATS %d %u %u %d", &status, &estimates, &redesigns, &changeMilli)!=4 || status!=0) {
+		LOG(ALARM) << "DFESTATS failed with status " << status;
+		return false;
+	}
+	change = changeMilli/1000.0F;
+	return true;
+}
+
+bool ::ARFCNManager::getTxStats(unsigned &bursts, unsigned &late, unsigned &stale,
+				unsigned &frames, unsigned &avgFrameTime, unsigned &maxFrameTime)
+{
+	char response[MAX_UDP_LENGTH];
+	int rspLen = sendCommandPacket("CMD TXSTATS",response);
+	if (rspLen<=0) return false;
+	int status = -1;
+	if (sscanf(response,"RSP TXSTATS %d %u %u %u %u %u %u", &status, &bursts, &late, &stale,
+			&frames, &avgFrameTime, &maxFrameTime)!=7 || status!=0) {
+		LOG(ALARM) << "TXSTATS failed with status " << status;
+		return false;
+	}
+	return true;
+}
+
+bool ::ARFCNManager::getIOStats(int &txSlackMin, int &txSlackAvg, unsigned &rxDepthMax,
+				int &rxLagMax, unsigned long &rxOverflows)
+{
+	if (!mIOStats) return false;
+	char response[MAX_UDP_LENGTH];
+	int rspLen = sendCommandPacket("CMD IOSTATS",response);
+	if (rspLen<=0) return false;
+	int status = -1;
+	int count = sscanf(response,"RSP IOSTATS %d %d %d %u %d %lu", &status, &txSlackMin, &txSlackAvg,
+			&rxDepthMax, &rxLagMax, &rxOverflows);
+	// An older transceiver answers an unknown command with status 1.
+	if (count>=1 && status==1) {
+		LOG(INFO) << "transceiver does not report IOSTATS, no longer asking";
+		mIOStats = false;
+		return false;
+	}
+	if (count!=6 || status!=0) {
+		LOG(ALARM) << "IOSTATS failed with status " << status;
+		return false;
+	}
+	return true;
+}
+
 void ::ARFCNManager::receiveBurst(const RxBurst& inBurst)
 {
 	LOG(DEEPDEBUG) << "receiveBurst: " << inBurst;
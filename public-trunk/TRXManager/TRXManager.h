@@ -36,7 +36,10 @@
 #include "Interthread.h"
 #include "GSMCommon.h"
 #include "GSMTransfer.h"
+#include "TRXProtocol.h"
 #include <list>
+#include <string>
+#include <vector>
 
 
 /* Forward refs into the GSM namespace. */
@@ -67,6 +70,12 @@ class TransceiverManager {
 	UDPSocket mClockSocket;		
 	/// a thread to monitor the global clock socket
 	Thread mClockThread;	
+	/// sequence number of the last version 2 clock indication
+	uint32_t mClockSeq;
+	/// set true when the first version 2 clock indication is received
+	bool mHaveClockSeq;
+	/// number of version 2 clock indications lost
+	unsigned mLostClocks;
 
 
 	public:
@@ -83,6 +92,7 @@ class TransceiverManager {
 	/**@name Accessors. */
 	//@{
 	ARFCNManager* ARFCN(unsigned i) { assert(i<mARFCNs.size()); return mARFCNs.at(i); }
+	unsigned lostClocks() const { return mLostClocks; }
 	//@}
 
 	/** Start the clock management thread and all ARFCN managers. */
@@ -117,6 +127,7 @@ class ARFCNManager {
 
 	Mutex mDataSocketLock;			///< lock to prevent contentional for the socket
 	UDPSocket mDataSocket;			///< socket for data transfer
+	unsigned mProtocol;				///< data interface version in use, 1 or 2
 	Mutex mControlLock;				///< lock to prevent overlapping transactions
 	UDPSocket mControlSocket;		///< socket for radio control
 
@@ -129,20 +140,62 @@ class ARFCNManager {
 	GSM::L1Decoder* mDemuxTable[8][maxModulus];		///< the demultiplexing table for received bursts
 	//@}
 
+	/**@name Uplink activity masks, as last sent to the transceiver. */
+	//@{
+	Mutex mRxMaskLock;
+	static const unsigned maxRxMaskPeriod=104;	///< must match RXMASKMAXPERIOD in the transceiver
+	bool mRxMaskEnabled;						///< cleared if the transceiver rejects a mask
+	unsigned mRxMaskPeriod[8];					///< period of each mask, 0 if none sent
+	bool mRxMask[8][maxRxMaskPeriod];			///< true for frames with a listening decoder
+	Thread mRxMaskThread;						///< thread to refresh masks as channels open and time out
+	Mutex mRxMaskDirtyLock;						///< protects mRxMaskDirty, never held across a command
+	Signal mRxMaskDirtySignal;					///< wakes mRxMaskThread
+	unsigned mRxMaskDirty;						///< bit TN set if slot TN needs a refresh
+	//@}
+
+	/**@name Version 2 downlink frames being assembled, protected by mDataSocketLock. */
+	//@{
+	static const unsigned maxTxHold=64;		///< number of frames that can be held
+	int32_t mTxHoldFN[maxTxHold];			///< frame number held in each entry, -1 if none
+	unsigned mTxHoldMask[maxTxHold];		///< timeslots held in each entry
+	unsigned char mTxHold[maxTxHold][8][gTRXv2DownlinkSlotLen];	///< level and packed bits of each timeslot
+	Thread mTxFlushThread;					///< thread to send each frame as it comes due
+	//@}
+
 	unsigned mARFCN;						///< the current ARFCN
+	bool mIOStats;							///< cleared if the transceiver does not answer IOSTATS
+
+	/**@name Pipelined control commands, see beginBatch(). */
+	//@{
+	/** A status-only command held for the batch. */
+	struct BatchCommand {
+		std::string name;
+		std::string params;
+		int status;					///< noAnswer until answered
+	};
+	static const int noAnswer = -1000;
+	bool mBatching;							///< true between beginBatch() and endBatch()
+	pthread_t mBatchThread;					///< the thread whose commands are batched
+	std::vector<BatchCommand> mBatch;		///< commands held for the batch
+	bool mTagged;							///< cleared if the transceiver does not answer CMD#<seq>
+	unsigned mCommandSeq;					///< sequence number of the last tagged command
+	//@}
 
 
 	public:
 
 	ARFCNManager(const char* wTRXAddress, int wBasePort, TransceiverManager &wTRX);
 
-	/** Start the uplink thread. */
+	/** Start the uplink and downlink threads. */
 	void start();
 
 	unsigned ARFCN() const { return mARFCN; }
 
 	void writeHighSide(const GSM::TxBurst& burst);
 
+	/** The data interface version in use. */
+	unsigned protocol() const { return mProtocol; }
+
 
 	/**@name Transceiver controls. */
 	//@{
@@ -161,6 +214,55 @@ class ARFCNManager {
 	*/
 	bool tuneLoopback(int wARFCN);
 
+	/**
+		Negotiate the data and clock interface version with the transceiver.
+		Version 2 carries a whole frame per data message and bit-packs the downlink.
+		@param version The highest version to use.
+		@return The version in use.
+	*/
+	unsigned setProtocol(unsigned version);
+
+	/**
+		Hold the status-only commands of this thread (tune, setTSC, setSlot, setPower, ...)
+		until endBatch(), which sends them all before waiting for any answer.
+		The held commands report success; endBatch() reports the failures.
+		Commands in one batch must not depend on each other, since a lost one is resent late.
+	*/
+	void beginBatch();
+
+	/**
+		Send the commands held since beginBatch() and wait for all their answers.
+		@return true if all of them succeeded.
+	*/
+	bool endBatch();
+
+	/** Settings of a running transceiver, from the STATE command. */
+	struct TRXState {
+		bool on;
+		unsigned rxKHz;
+		unsigned txKHz;
+		unsigned TSC;
+		unsigned protocol;
+		int slot[8];				///< channel combination of each timeslot
+	};
+
+	/**
+		Get the settings of a running transceiver.
+		@return true on success, false if the transceiver does not support STATE.
+	*/
+	bool getState(TRXState &state);
+
+	/**
+		Take over a transceiver left running by a previous core.
+		Succeeds only if it is on, tuned to this ARFCN and using this TSC,
+		and then clears the uplink activity masks the previous core left behind.
+		@param wARFCN The ARFCN the carrier should be on.
+		@param TSC The training sequence code the carrier should use.
+		@return true if the transceiver was taken over and needs no tuning or power-on.
+			If false and the transceiver is on, it rejects retuning and must be restarted.
+	*/
+	bool resume(int wARFCN, unsigned TSC);
+
 	/** Turn off the transceiver. */
 	bool powerOff();
 
@@ -187,6 +289,41 @@ class ARFCNManager {
         */
         signed getNoiseLevel(void);
 
+        /**
+                Get decision-feedback equalizer statistics.
+                @param estimates Number of channel estimates made.
+                @param redesigns Number of estimates that caused a DFE redesign.
+                @param change Largest recent normalized channel change.
+                @return true on success.
+        */
+        bool getDFEStats(unsigned &estimates, unsigned &redesigns, float &change);
+
+        /**
+                Get transmit modulation statistics.
+                @param bursts Number of bursts modulated.
+                @param late Number of bursts modulated after their transmit deadline.
+                @param stale Number of bursts dropped as stale at the radio.
+                @param frames Number of frames modulated.
+                @param avgFrameTime Mean frame modulation time in microseconds.
+                @param maxFrameTime Longest frame modulation time since the last query, in microseconds.
+                @return true on success.
+        */
+        bool getTxStats(unsigned &bursts, unsigned &late, unsigned &stale,
+                        unsigned &frames, unsigned &avgFrameTime, unsigned &maxFrameTime);
+
+        /**
+                Get the timing of the transceiver's radio threads, all in timeslots.
+                Extremes are since the last query.
+                @param txSlackMin Least margin of a burst pushed to the radio ahead of its transmit time.
+                @param txSlackAvg Mean transmit margin.
+                @param rxDepthMax Deepest backlog of received bursts waiting for demodulation.
+                @param rxLagMax Longest delay from reception to demodulation.
+                @param rxOverflows Received bursts dropped because demodulation fell behind.
+                @return true on success, false also if the transceiver does not support the query.
+        */
+        bool getIOStats(int &txSlackMin, int &txSlackAvg, unsigned &rxDepthMax,
+                        int &rxLagMax, unsigned long &rxOverflows);
+
 	/**
 		Set power wrt full scale.
 		@param dB Power level wrt full power.
@@ -215,6 +352,22 @@ class ARFCNManager {
 	/** Install a decoder on this ARFCN. */
 	void installDecoder(GSM::L1Decoder* wL1);
 
+	/**
+		Recompute the uplink activity mask of a timeslot from the demux table
+		and send it to the transceiver if it changed.
+		The transceiver skips bursts in frames without a listening decoder
+		before doing any allocation or DSP on them.
+		@param TN The timeslot number 0..7.
+	*/
+	void updateRxMask(unsigned TN);
+
+	/**
+		Ask the mask thread to refresh the uplink activity mask of a timeslot.
+		This does not wait for the transceiver, so it is safe under channel allocation locks.
+		@param TN The timeslot number 0..7.
+	*/
+	void markRxMask(unsigned TN);
+
 
 
 	private:
@@ -222,12 +375,27 @@ class ARFCNManager {
 	/** Action for reception. */
 	void driveRx();
 
+	/** Unpack and process a version 2 uplink frame. */
+	void receiveFrame(const unsigned char *frame, unsigned len);
+
+	/** Send held downlink frames up to the given frame number; mDataSocketLock must be held. */
+	void sendHeldFrames(int32_t lastFN);
+
+	/** Send one held downlink frame; mDataSocketLock must be held. */
+	void sendHeldFrame(unsigned entry);
+
 	/** Demultiplex and process a received burst. */
 	void receiveBurst(const GSM::RxBurst&);
 
 	/** Receiver loop. */
 	friend void* ReceiveLoopAdapter(ARFCNManager*);
 
+	/** Mask refresh loop. */
+	friend void* RxMaskLoopAdapter(ARFCNManager*);
+
+	/** Downlink frame loop. */
+	friend void* TxFlushLoopAdapter(ARFCNManager*);
+
 	/**
 		Send a command packet and get the response packet.
 		@param command The NULL-terminated command string to send.
@@ -261,12 +429,19 @@ class ARFCNManager {
 	*/
 	int sendCommand(const char* command);
 
+	/** Hold a command for the batch, if this thread is batching. */
+	bool batched(const char* command, const char* param);
+
+	/** Send the batch tagged with sequence numbers; commands left at noAnswer go one at a time. */
+	void sendTagged(std::vector<BatchCommand>& batch);
 
 };
 
 
 /** C interface for ARFCNManager threads. */
 void* ReceiveLoopAdapter(ARFCNManager*);
+void* RxMaskLoopAdapter(ARFCNManager*);
+void* TxFlushLoopAdapter(ARFCNManager*);
 
 
 #endif
@@ -0,0 +1,109 @@
+/*
+* Copyright 2010 Free Software Foundation, Inc.
+*
+* This software is distributed under the terms of the GNU Affero Public License.
+* See the COPYING file in the main directory for details.
+*
+* This use of this software may be subject to additional restrictions.
+* See the LEGAL file in the main directory for details.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef TRXPROTOCOL_H
+#define TRXPROTOCOL_H
+
+#include <stdint.h>
+#include "GSMTransfer.h"
+
+
+/**@file
+	Binary message formats of version 2 of the transceiver data and clock interfaces,
+	shared by the TRX manager and the transceiver.  See README.TRXManager.
+
+	Version 1 data messages start with the timeslot number, 0..7, and version 1 clock
+	messages are ASCII, so the high bit of the first byte tells the versions apart.
+*/
+
+/**@name Version 2 message types, the first byte of every message. */
+//@{
+#define TRXV2_DOWNLINK 0x81		///< all transmit bursts of one frame
+#define TRXV2_UPLINK 0x82		///< all received bursts of one frame
+#define TRXV2_CLOCK 0x83		///< clock indication with a sequence number
+//@}
+
+/**@name Version 2 message sizes, in bytes. */
+//@{
+static const unsigned gTRXv2HeaderLen = 6;			///< type, frame number, timeslot mask
+static const unsigned gTRXv2PackedBurstLen = (GSM::gSlotLen+7)/8;	///< hard bits, 8 per byte
+static const unsigned gTRXv2DownlinkSlotLen = 1+gTRXv2PackedBurstLen;	///< level, packed bits
+static const unsigned gTRXv2UplinkSlotLen = 1+2+GSM::gSlotLen;		///< RSSI, timing, soft bits
+static const unsigned gTRXv2ClockLen = 9;			///< type, sequence number, frame number
+static const unsigned gTRXv2MaxFrameLen = gTRXv2HeaderLen + 8*gTRXv2UplinkSlotLen;
+//@}
+
+
+/** Write a 32-bit value, big endian. */
+inline void TRXWrite32(unsigned char *wp, uint32_t val)
+{
+	wp[0] = (val>>24) & 0x0ff;
+	wp[1] = (val>>16) & 0x0ff;
+	wp[2] = (val>>8) & 0x0ff;
+	wp[3] = val & 0x0ff;
+}
+
+/** Read a 32-bit value, big endian. */
+inline uint32_t TRXRead32(const unsigned char *rp)
+{
+	return (rp[0]<<24) | (rp[1]<<16) | (rp[2]<<8) | rp[3];
+}
+
+/** Start a version 2 frame message; the timeslot mask starts empty. */
+inline unsigned char *TRXv2StartFrame(unsigned char *wp, unsigned type, uint32_t FN)
+{
+	wp[0] = type;
+	TRXWrite32(wp+1,FN);
+	wp[5] = 0;
+	return wp+gTRXv2HeaderLen;
+}
+
+/** Pack the low bits of count chars into bytes, first bit in the MSB. */
+inline void TRXPackBits(const char *bits, unsigned count, unsigned char *wp)
+{
+	for (unsigned i=0; i<(count+7)/8; i++) wp[i] = 0;
+	for (unsigned i=0; i<count; i++)
+		if (bits[i] & 0x01) wp[i/8] |= 0x80 >> (i%8);
+}
+
+/** Unpack count bits packed by TRXPackBits into chars of 0 or 1. */
+inline void TRXUnpackBits(const unsigned char *rp, unsigned count, char *bits)
+{
+	for (unsigned i=0; i<count; i++)
+		bits[i] = (rp[i/8] >> (7-i%8)) & 0x01;
+}
+
+/** Write a version 2 clock indication, returning its length. */
+inline unsigned TRXv2WriteClock(unsigned char *wp, uint32_t seq, uint32_t FN)
+{
+	wp[0] = TRXV2_CLOCK;
+	TRXWrite32(wp+1,seq);
+	TRXWrite32(wp+5,FN);
+	return gTRXv2ClockLen;
+}
+
+
+#endif
+// vim: ts=4 sw=4
@@ -29,16 +29,31 @@
 
 
 #include <stdio.h>
+#include <ctype.h>
+#include <limits.h>
 #include "Transceiver.h"
 #include <Logger.h>
 
 
+/**
+  Normalized squared difference between successive channel estimates
+  above which the DFE is redesigned.
+*/
+#define DFEREDESIGNTHRESHOLD 0.05
+
+/** Timeslots from b to a. */
+static int slotDelta(const GSM::Time &a, const GSM::Time &b)
+{
+  return (a-b)*8 + (int) a.TN() - (int) b.TN();
+}
+
 
 Transceiver::Transceiver(int wBasePort,
 			 const char *TRXAddress,
 			 int wSamplesPerSymbol,
 			 GSM::Time wTransmitLatency,
-			 RadioInterface *wRadioInterface)
+			 RadioInterface *wRadioInterface,
+			 unsigned wNumModulators)
 	:mDataSocket(wBasePort+2,TRXAddress,wBasePort+102),
 	 mControlSocket(wBasePort+1,TRXAddress,wBasePort+101),
 	 mClockSocket(wBasePort,TRXAddress,wBasePort+100)
@@ -47,10 +62,33 @@ Transceiver::Transceiver(int wBasePort,
   //GSM::Time startTime(gHyperframe/2 - 4*216*60,0);
   GSM::Time startTime(random() % gHyperframe,0);
 
-  mFIFOServiceLoopThread = new Thread(32768);  ///< thread to push bursts into transmit FIFO
+  mRxRadioServiceLoopThread = new Thread(32768);  ///< thread to read the device into the receive FIFO
+  mTxRadioServiceLoopThread = new Thread(32768);  ///< thread to push bursts to the device
+  mRxFIFOServiceLoopThread = new Thread(32768);  ///< thread to demodulate received bursts
   mControlServiceLoopThread = new Thread(32768);       ///< thread to process control messages from GSM core
   mTransmitPriorityQueueServiceLoopThread = new Thread(32768);///< thread to process transmit bursts from GSM core
 
+  mNumModulators = wNumModulators;
+  if (mNumModulators > TXMAXMODULATORS) mNumModulators = TXMAXMODULATORS;
+  for (unsigned i = 0; i < mNumModulators; i++)
+    mTxModulatorThreads[i] = new Thread(32768);
+  mTxBatchSize = 0;
+  mTxBatchFN = 0;
+  mTxBursts = 0;
+  mTxLate = 0;
+  mTxStale = 0;
+  mTxFrames = 0;
+  mTxFrameTimeTotal = 0.0;
+  mTxFrameTimeMax = 0;
+  mTxSlackMin = INT_MAX;
+  mTxSlackTotal = 0.0;
+  mTxSlackCount = 0;
+  mRxDepthMax = 0;
+  mRxLagMax = 0;
+  mProtocol = 1;
+  mClockSeq = 0;
+  mRxFramePtr = NULL;
+  mRxFrameFN = 0;
 
   mSamplesPerSymbol = wSamplesPerSymbol;
   mRadioInterface = wRadioInterface;
@@ -76,20 +114,26 @@ Transceiver::Transceiver(int wBasePort,
 					   mSamplesPerSymbol);
     scaleVector(*modBurst,txFullScale);
     fillerModulus[i]=26;
+    dummyBurstTable[i] = modBurst;
     for (int j = 0; j < 102; j++) {
-      fillerTable[j][i] = new signalVector(*modBurst);
+      fillerTable[j][i] = modBurst;
     }
-    delete modBurst;
     mChanType[i] = NONE;
     channelResponse[i] = NULL;
     DFEForward[i] = NULL;
     DFEFeedback[i] = NULL;
     channelEstimateTime[i] = startTime;
+    channelEstimateStale[i] = true;
+    DFEChangeMetric[i] = 0.0;
+    mL1RxMaskPeriod[i] = 0;
   }
+  mDFEEstimates = 0;
+  mDFERedesigns = 0;
 
   mOn = false;
   mTxFreq = 0.0;
   mRxFreq = 0.0;
+  mTSC = 0;
   mPower = -10;
   mEnergyThreshold = 5.0; // based on empirical data
   prevFalseDetectionTime = startTime;
@@ -112,12 +156,65 @@ void Transceiver::addRadioVector(BitVector &burst,
 					 8 + (wTime.TN() % 4 == 0),
 					 mSamplesPerSymbol);
   scaleVector(*modBurst,txFullScale * pow(10,-RSSI/10));
-  radioVector *newVec = new radioVector(*modBurst,wTime);
+  radioVector *newVec = new radioVector(modBurst,wTime);
   mTransmitPriorityQueue.write(newVec);
 
+  // the samples now belong to newVec
   delete modBurst;
 }
 
+void Transceiver::dispatchTxBatch()
+{
+  if (mTxBatchSize==0) return;
+  TxFrameBatch *batch = new TxFrameBatch(mTxBatchSize);
+  for (unsigned i = 0; i < mTxBatchSize; i++) {
+    mTxBatch[i]->batch = batch;
+    mTxModulationQueue.write(mTxBatch[i]);
+  }
+  mTxBatchSize = 0;
+}
+
+void Transceiver::modulateTxBurst(TxBurstJob *job)
+{
+  addRadioVector(job->burst,job->RSSI,job->time);
+  // The deadline clock belongs to the FIFO thread; a torn read only skews the count.
+  bool late = (job->time < mTransmitDeadlineClock);
+  if (late) LOG(NOTICE) << "burst for " << job->time << " modulated after its deadline " << mTransmitDeadlineClock;
+
+  // the worker that finishes the last burst of a frame times the frame
+  TxFrameBatch *batch = job->batch;
+  delete job;
+  bool frameDone = false;
+  unsigned frameTime = 0;
+  if (batch) {
+    batch->lock.lock();
+    frameDone = (--batch->pending==0);
+    batch->lock.unlock();
+    if (frameDone) {
+      Timeval now;
+      frameTime = (now.sec()-batch->dispatched.sec())*1000000 + now.usec() - batch->dispatched.usec();
+      delete batch;
+    }
+  }
+
+  mTxStatsLock.lock();
+  mTxBursts++;
+  if (late) mTxLate++;
+  if (frameDone) {
+    mTxFrames++;
+    mTxFrameTimeTotal += frameTime;
+    if (frameTime > mTxFrameTimeMax) mTxFrameTimeMax = frameTime;
+  }
+  mTxStatsLock.unlock();
+}
+
+void Transceiver::updateFillerTable(int modFN, int TN, signalVector *burst)
+{
+  if (fillerTable[modFN][TN] != dummyBurstTable[TN])
+    delete fillerTable[modFN][TN];
+  fillerTable[modFN][TN] = burst;
+}
+
 #ifdef TRANSMIT_LOGGING
 void Transceiver::unModulateVector(signalVector wVector) 
 {
@@ -149,11 +246,13 @@ void Transceiver::pushRadioVector(GSM::Time &nowTime)
     // Even if the burst is stale, put it in the fillter table.
     // (It might be an idle pattern.)
     LOG(NOTICE) << "dumping STALE burst in TRX->USRP interface";
+    mTxStatsLock.lock();
+    mTxStale++;
+    mTxStatsLock.unlock();
     const GSM::Time& nextTime = staleBurst->getTime();
     int TN = nextTime.TN();
     int modFN = nextTime.FN() % fillerModulus[TN];
-    delete fillerTable[modFN][TN];
-    fillerTable[modFN][TN] = staleBurst;
+    updateFillerTable(modFN,TN,staleBurst);
   }
   
   int TN = nowTime.TN();
@@ -162,10 +261,9 @@ void Transceiver::pushRadioVector(GSM::Time &nowTime)
   // if queue contains data at the desired timestamp, stick it into FIFO
   if (radioVector *next = (radioVector*) mTransmitPriorityQueue.getCurrentBurst(nowTime)) {
     LOG(DEBUG) << "transmitFIFO: wrote burst " << next << " at time: " << nowTime;
-    delete fillerTable[modFN][TN];
-    fillerTable[modFN][TN] = new signalVector(*(next));
-    mRadioInterface->driveTransmitRadio(*(next),(mChanType[TN]==NONE)); //fillerTable[modFN][TN]));
-    delete next;
+    mRadioInterface->driveTransmitRadio(*(next),(mChanType[TN]==NONE));
+    // the burst itself becomes the filler, no copy
+    updateFillerTable(modFN,TN,next);
 #ifdef TRANSMIT_LOGGING
     if (nowTime.TN()==TRANSMIT_LOGGING) { 
       unModulateVector(*(fillerTable[modFN][TN]));
@@ -272,6 +370,38 @@ Transceiver::CorrType Transceiver::expectedCorrType(GSM::Time currTime)
 
 }
     
+void Transceiver::updateRxMask(int timeslot)
+{
+  // The combination's idle frames repeat every 51 frames at most.
+  unsigned pattern = 1;
+  switch (mChanType[timeslot]) {
+  case II:
+    pattern = 2;
+    break;
+  case V:
+  case VII:
+  case LOOPBACK:
+    pattern = 51;
+    break;
+  default:
+    break;
+  }
+
+  unsigned period = mL1RxMaskPeriod[timeslot];
+  if (period == 0) period = pattern;
+  // If the two patterns don't line up, fold in only whole-slot OFF.
+  bool foldIdle = (period % pattern == 0);
+
+  bool mask[RXMASKMAXPERIOD];
+  for (unsigned FN = 0; FN < period; FN++) {
+    bool active = (mL1RxMaskPeriod[timeslot] == 0) || mL1RxMask[timeslot][FN];
+    CorrType type = expectedCorrType(GSM::Time(foldIdle ? FN : 0,timeslot));
+    if ((type == OFF) || (foldIdle && (type == IDLE))) active = false;
+    mask[FN] = active;
+  }
+  mRadioInterface->setRxMask(timeslot,period,mask);
+}
+
 SoftVector *Transceiver::pullRadioVector(GSM::Time &wTime,
 				      int &RSSI,
 				      int &timingOffset)
@@ -282,6 +412,9 @@ SoftVector *Transceiver::pullRadioVector(GSM::Time &wTime,
 
   if (!rxBurst) return NULL;
 
+  // The caller needs the time even of bursts that are dropped.
+  wTime = rxBurst->getTime();
+
   LOG(DEBUG) << "receiveFIFO: read radio vector at time: " << rxBurst->getTime() << ", new size: " << mReceiveFIFO->size();
 
   int timeslot = rxBurst->getTime().TN();
@@ -319,16 +452,7 @@ SoftVector *Transceiver::pullRadioVector(GSM::Time &wTime,
     LOG(DEBUG) << "looking for TSC at time: " << rxBurst->getTime();
     signalVector *channelResp;
     double framesElapsed = rxBurst->getTime()-channelEstimateTime[timeslot];
-    bool estimateChannel = false;
-    if ((framesElapsed > 50) || (channelResponse[timeslot]==NULL)) {
-	if (channelResponse[timeslot]) delete channelResponse[timeslot];
-        if (DFEForward[timeslot]) delete DFEForward[timeslot];
-        if (DFEFeedback[timeslot]) delete DFEFeedback[timeslot];
-        channelResponse[timeslot] = NULL;
-        DFEForward[timeslot] = NULL;
-        DFEFeedback[timeslot] = NULL;
-	estimateChannel = true;
-    }
+    bool estimateChannel = (framesElapsed > 50) || channelEstimateStale[timeslot];
     if (!needDFE) estimateChannel = false;
     float chanOffset;
     success = analyzeTrafficBurst(*vectorBurst,
@@ -348,13 +472,29 @@ SoftVector *Transceiver::pullRadioVector(GSM::Time &wTime,
       SNRestimate[timeslot] = amplitude.norm2()/(mEnergyThreshold*mEnergyThreshold+1.0); // this is not highly accurate
       if (estimateChannel) {
          LOG(DEBUG) << "estimating channel...";
-         channelResponse[timeslot] = channelResp;
-       	 chanRespOffset[timeslot] = chanOffset;
-         chanRespAmplitude[timeslot] = amplitude;
 	 scaleVector(*channelResp, complex(1.0,0.0)/amplitude);
-         designDFE(*channelResp, SNRestimate[timeslot], 7, &DFEForward[timeslot], &DFEFeedback[timeslot]);
+         mDFEEstimates++;
          channelEstimateTime[timeslot] = rxBurst->getTime();  
-         LOG(DEBUG) << "SNR: " << SNRestimate[timeslot] << ", DFE forward: " << *DFEForward[timeslot] << ", DFE backward: " << *DFEFeedback[timeslot];
+         channelEstimateStale[timeslot] = false;
+         if (channelChanged(timeslot,*channelResp)) {
+           // Keep the estimate the DFE was designed for as the reference for the next comparison.
+           if (channelResponse[timeslot]) delete channelResponse[timeslot];
+           channelResponse[timeslot] = channelResp;
+           chanRespOffset[timeslot] = chanOffset;
+           chanRespAmplitude[timeslot] = amplitude;
+           if (designDFE(*channelResp, SNRestimate[timeslot], 7, &DFEForward[timeslot], &DFEFeedback[timeslot])) {
+             mDFERedesigns++;
+             LOG(DEBUG) << "SNR: " << SNRestimate[timeslot] << ", DFE forward: " << *DFEForward[timeslot] << ", DFE backward: " << *DFEFeedback[timeslot];
+           }
+           else {
+             // The old filters do not match the new estimate.
+             LOG(WARN) << "DFE design failed on TN " << timeslot;
+             clearDFE(timeslot);
+           }
+         }
+         else {
+           delete channelResp;
+         }
       }
     }
     else {
@@ -362,7 +502,7 @@ SoftVector *Transceiver::pullRadioVector(GSM::Time &wTime,
       LOG(DEBUG) << "wTime: " << rxBurst->getTime() << ", pTime: " << prevFalseDetectionTime << ", fElapsed: " << framesElapsed;
       mEnergyThreshold += 10.0F/10.0F*exp(-framesElapsed);
       prevFalseDetectionTime = rxBurst->getTime();
-      channelResponse[timeslot] = NULL;
+      channelEstimateStale[timeslot] = true;
     }
   }
   else {
@@ -376,7 +516,7 @@ SoftVector *Transceiver::pullRadioVector(GSM::Time &wTime,
       LOG(DEBUG) << "FOUND RACH!!!!!! " << amplitude << " " << TOA;
       mEnergyThreshold -= (1.0F/10.0F);
       if (mEnergyThreshold < 0.0) mEnergyThreshold = 0.0;
-      channelResponse[timeslot] = NULL; 
+      channelEstimateStale[timeslot] = true;
     }
     else {
       double framesElapsed = rxBurst->getTime()-prevFalseDetectionTime;
@@ -389,7 +529,7 @@ SoftVector *Transceiver::pullRadioVector(GSM::Time &wTime,
   // demodulate burst
   SoftVector *burst = NULL;
   if ((rxBurst) && (success)) {
-    if ((corrType==RACH) || (!needDFE)) {
+    if ((corrType==RACH) || (!needDFE) || (!DFEForward[timeslot])) {
       burst = demodulateBurst(*vectorBurst,
 			      *gsmPulse,
 			      mSamplesPerSymbol,
@@ -402,6 +542,10 @@ SoftVector *Transceiver::pullRadioVector(GSM::Time &wTime,
 			    mSamplesPerSymbol,
 			    *DFEForward[timeslot],
 			    *DFEFeedback[timeslot]);
+      if (!burst) {
+        LOG(WARN) << "DFE equalization failed on TN " << timeslot;
+        clearDFE(timeslot);
+      }
     }
     wTime = rxBurst->getTime();
     RSSI = (int) floor(20.0*log10(rxFullScale/amplitude.abs()));
@@ -416,6 +560,36 @@ SoftVector *Transceiver::pullRadioVector(GSM::Time &wTime,
   return burst;
 }
 
+bool Transceiver::channelChanged(int timeslot, const signalVector &newResponse)
+{
+  const signalVector *oldResponse = channelResponse[timeslot];
+  if (!oldResponse || !DFEForward[timeslot] || (oldResponse->size() != newResponse.size())) {
+    DFEChangeMetric[timeslot] = 1.0;
+    return true;
+  }
+
+  float diff = 0.0;
+  float ref = 0.0;
+  signalVector::const_iterator oldPtr = oldResponse->begin();
+  signalVector::const_iterator newPtr = newResponse.begin();
+  while (newPtr < newResponse.end()) {
+    diff += (*newPtr - *oldPtr).norm2();
+    ref += oldPtr->norm2();
+    newPtr++; oldPtr++;
+  }
+  DFEChangeMetric[timeslot] = (ref > 0.0) ? diff/ref : 1.0;
+  LOG(DEBUG) << "channel change on TN " << timeslot << ": " << DFEChangeMetric[timeslot];
+  return (DFEChangeMetric[timeslot] > DFEREDESIGNTHRESHOLD);
+}
+
+void Transceiver::clearDFE(int timeslot)
+{
+  delete DFEForward[timeslot];
+  DFEForward[timeslot] = NULL;
+  delete DFEFeedback[timeslot];
+  DFEFeedback[timeslot] = NULL;
+}
+
 void Transceiver::start()
 {
   mControlServiceLoopThread->start((void * (*)(void*))ControlServiceLoopAdapter,(void*) this);
@@ -445,6 +619,19 @@ void Transceiver::driveControl()
     return;
   }
 
+  // A command sent as "CMD#<seq>" is answered as "RSP#<seq>",
+  // so the core can have several commands in flight.
+  char tag[20];
+  tag[0] = '\0';
+  if (strncmp(buffer,"CMD#",4)==0) {
+    unsigned seq;
+    int tagLen = 0;
+    if (sscanf(buffer+4,"%u%n",&seq,&tagLen)==1) {
+      sprintf(tag,"#%u",seq);
+      memmove(buffer+3,buffer+4+tagLen,strlen(buffer+4+tagLen)+1);
+    }
+  }
+
   char cmdcheck[4];
   char command[MAX_PACKET_LENGTH];
   char response[MAX_PACKET_LENGTH];
@@ -476,8 +663,12 @@ void Transceiver::driveControl()
         generateRACHSequence(*gsmPulse,mSamplesPerSymbol);
 
         // Start radio interface threads.
-        mFIFOServiceLoopThread->start((void * (*)(void*))FIFOServiceLoopAdapter,(void*) this);
+        mRxRadioServiceLoopThread->start((void * (*)(void*))RxRadioServiceLoopAdapter,(void*) this);
+        mTxRadioServiceLoopThread->start((void * (*)(void*))TxRadioServiceLoopAdapter,(void*) this);
+        mRxFIFOServiceLoopThread->start((void * (*)(void*))RxFIFOServiceLoopAdapter,(void*) this);
         mTransmitPriorityQueueServiceLoopThread->start((void * (*)(void*))TransmitPriorityQueueServiceLoopAdapter,(void*) this);
+        for (unsigned i = 0; i < mNumModulators; i++)
+          mTxModulatorThreads[i]->start((void * (*)(void*))TxModulatorLoopAdapter,(void*) this);
         writeClockInterface();
 
         mOn = true;
@@ -507,6 +698,38 @@ void Transceiver::driveControl()
       sprintf(response,"RSP NOISELEV 1  0");
     }
   }   
+  else if (strcmp(command,"DFESTATS")==0) {
+    // report channel estimate and DFE redesign counts, and the largest recent channel change in 1/1000
+    float maxChange = 0.0;
+    for (int i = 0; i < 8; i++)
+      if (DFEChangeMetric[i] > maxChange) maxChange = DFEChangeMetric[i];
+    sprintf(response,"RSP DFESTATS 0 %u %u %d",
+            mDFEEstimates, mDFERedesigns, (int) round(maxChange*1000.0));
+  }
+  else if (strcmp(command,"TXSTATS")==0) {
+    // report bursts modulated, late and stale, frames modulated, and mean and peak frame modulation time in us
+    mTxStatsLock.lock();
+    unsigned avgFrameTime = mTxFrames ? (unsigned) round(mTxFrameTimeTotal/mTxFrames) : 0;
+    sprintf(response,"RSP TXSTATS 0 %u %u %u %u %u %u",
+            mTxBursts, mTxLate, mTxStale, mTxFrames, avgFrameTime, mTxFrameTimeMax);
+    mTxFrameTimeMax = 0;
+    mTxStatsLock.unlock();
+  }
+  else if (strcmp(command,"IOSTATS")==0) {
+    // report least and mean transmit slack, deepest receive FIFO and longest receive lag, in timeslots,
+    // and bursts dropped on a full receive FIFO
+    mIOStatsLock.lock();
+    int txSlackMin = mTxSlackCount ? mTxSlackMin : 0;
+    int txSlackAvg = mTxSlackCount ? (int) round(mTxSlackTotal/mTxSlackCount) : 0;
+    sprintf(response,"RSP IOSTATS 0 %d %d %u %d %lu",
+            txSlackMin, txSlackAvg, mRxDepthMax, mRxLagMax, mRadioInterface->rxOverflows());
+    mTxSlackMin = INT_MAX;
+    mTxSlackTotal = 0.0;
+    mTxSlackCount = 0;
+    mRxDepthMax = 0;
+    mRxLagMax = 0;
+    mIOStatsLock.unlock();
+  }
   else if (strcmp(command,"SETPOWER")==0) {
     // set output power in dB
     int dbPwr;
@@ -580,13 +803,73 @@ void Transceiver::driveControl()
     }     
     mChanType[timeslot] = (ChannelCombination) corrCode;
     setModulus(timeslot);
+    updateRxMask(timeslot);
     sprintf(response,"RSP SETSLOT 0 %d %d",timeslot,corrCode);
 
   }
+  else if (strcmp(command,"SETPROTO")==0) {
+    // select the version of the data and clock interfaces
+    int version;
+    sscanf(buffer,"%3s %s %d",cmdcheck,command,&version);
+    if ((version < 1) || (version > 2)) {
+      LOG(WARN) << "unsupported TRX protocol version " << version;
+      sprintf(response,"RSP SETPROTO 1 %u",mProtocol);
+    }
+    else {
+      mClockLock.lock();
+      mProtocol = version;
+      mClockLock.unlock();
+      LOG(INFO) << "TRX protocol version " << mProtocol;
+      sprintf(response,"RSP SETPROTO 0 %u",mProtocol);
+    }
+  }
+  else if (strcmp(command,"SETRXMASK")==0) {
+    // set the L1 uplink activity mask of a timeslot
+    // the mask is hex, first frame in the MSB of the first digit
+    int timeslot;
+    unsigned period;
+    char hexMask[MAX_PACKET_LENGTH];
+    hexMask[0] = '\0';
+    sscanf(buffer,"%3s %s %d %u %s",cmdcheck,command,&timeslot,&period,hexMask);
+    if ((timeslot < 0) || (timeslot > 7) || (period == 0) || (period > RXMASKMAXPERIOD)
+        || (strlen(hexMask) != (period+3)/4)
+        || (strspn(hexMask,"0123456789abcdefABCDEF") != strlen(hexMask))) {
+      LOG(WARN) << "bogus message on control interface";
+      sprintf(response,"RSP SETRXMASK 1 %d",timeslot);
+    }
+    else {
+      for (unsigned FN = 0; FN < period; FN++) {
+        char digit = hexMask[FN/4];
+        unsigned nibble = isdigit(digit) ? digit - '0' : tolower(digit) - 'a' + 10;
+        mL1RxMask[timeslot][FN] = (nibble >> (3 - FN%4)) & 0x01;
+      }
+      mL1RxMaskPeriod[timeslot] = period;
+      updateRxMask(timeslot);
+      LOG(INFO) << "uplink activity mask for TN " << timeslot << ": " << period << " " << hexMask
+                << ", " << mRadioInterface->rxSkipped() << " bursts skipped so far";
+      sprintf(response,"RSP SETRXMASK 0 %d",timeslot);
+    }
+  }
+  else if (strcmp(command,"STATE")==0) {
+    // report the settings a restarted core can keep: power, tuning in kHz, TSC, protocol and slot types
+    sprintf(response,"RSP STATE 0 %d %d %d %u %u %d %d %d %d %d %d %d %d",
+            mOn ? 1 : 0,
+            (int) round((mRxFreq-FREQOFFSET)/1.0e3), (int) round((mTxFreq-FREQOFFSET)/1.0e3),
+            mTSC, mProtocol,
+            mChanType[0], mChanType[1], mChanType[2], mChanType[3],
+            mChanType[4], mChanType[5], mChanType[6], mChanType[7]);
+  }
   else {
     LOG(WARN) << "bogus command " << command << " on control interface.";
+    snprintf(response,MAX_PACKET_LENGTH,"RSP %s 1",command);
   }
 
+  if (tag[0]) {
+    char tagged[MAX_PACKET_LENGTH+20];
+    sprintf(tagged,"RSP%s%s",tag,response+3);
+    mControlSocket.write(tagged,strlen(tagged)+1);
+    return;
+  }
   mControlSocket.write(response,strlen(response)+1);
 
 }
@@ -594,10 +877,28 @@ void Transceiver::driveControl()
 bool Transceiver::driveTransmitPriorityQueue() 
 {
 
-  char buffer[gSlotLen+50];
+  char buffer[MAX_UDP_LENGTH];
 
-  // check data socket
-  size_t msgLen = mDataSocket.read(buffer);
+  // Check data socket.
+  // While a frame is being collected, don't wait long for the rest of it.
+  int msgLen;
+  if (mNumModulators && mTxBatchSize) {
+    msgLen = mDataSocket.read(buffer,1);
+    if (msgLen < 0) {
+      dispatchTxBatch();
+      return true;
+    }
+  }
+  else msgLen = mDataSocket.read(buffer);
+
+  // periodically update GSM core clock
+  LOG(DEEPDEBUG) << "mTransmitDeadlineClock " << mTransmitDeadlineClock
+		<< " mLastClockUpdateTime " << mLastClockUpdateTime;
+  if (mTransmitDeadlineClock > mLastClockUpdateTime + GSM::Time(216,0))
+    writeClockInterface();
+
+  if ((msgLen > 0) && ((unsigned char) buffer[0] == TRXV2_DOWNLINK))
+    return receiveTxFrame((unsigned char*) buffer,msgLen);
 
   if (msgLen!=gSlotLen+1+4+1) {
     LOG(ERROR) << "badly formatted packet on GSM->TRX interface";
@@ -624,33 +925,73 @@ bool Transceiver::driveTransmitPriorityQueue()
     return false;
   }
 */
-  
-  // periodically update GSM core clock
-  LOG(DEEPDEBUG) << "mTransmitDeadlineClock " << mTransmitDeadlineClock
-		<< " mLastClockUpdateTime " << mLastClockUpdateTime;
-  if (mTransmitDeadlineClock > mLastClockUpdateTime + GSM::Time(216,0))
-    writeClockInterface();
-
 
   LOG(DEEPDEBUG) << "rcvd. burst at: " << GSM::Time(frameNum,timeSlot);
   
-  int RSSI = (int) buffer[5];
-  static BitVector newBurst(gSlotLen);
-  BitVector::iterator itr = newBurst.begin();
+  TxBurstJob *job = new TxBurstJob;
+  job->RSSI = (int) buffer[5];
+  BitVector::iterator itr = job->burst.begin();
   char *bufferItr = buffer+6;
-  while (itr < newBurst.end()) 
+  while (itr < job->burst.end()) 
     *itr++ = *bufferItr++;
-  
-  GSM::Time currTime = GSM::Time(frameNum,timeSlot);
-  
-  addRadioVector(newBurst,RSSI,currTime);
-  
-  LOG(DEEPDEBUG) "added burst - time: " << currTime << ", RSSI: " << RSSI; // << ", data: " << newBurst; 
+  job->time = GSM::Time(frameNum,timeSlot);
+
+  LOG(DEEPDEBUG) "added burst - time: " << job->time << ", RSSI: " << job->RSSI; // << ", data: " << job->burst; 
+
+  queueTxBurst(job);
 
   return true;
 
 
 }
+
+bool Transceiver::receiveTxFrame(const unsigned char *frame, int len)
+{
+  uint32_t frameNum = TRXRead32(frame+1);
+  unsigned mask = frame[gTRXv2HeaderLen-1];
+  unsigned numSlots = 0;
+  for (unsigned TN = 0; TN < 8; TN++)
+    if (mask & (1 << TN)) numSlots++;
+  if ((unsigned) len != gTRXv2HeaderLen + numSlots*gTRXv2DownlinkSlotLen) {
+    LOG(ERROR) << "badly formatted frame on GSM->TRX interface";
+    return false;
+  }
+
+  LOG(DEEPDEBUG) << "rcvd. frame " << frameNum << ", timeslot mask " << mask;
+
+  const unsigned char *rp = frame + gTRXv2HeaderLen;
+  for (unsigned TN = 0; TN < 8; TN++) {
+    if (!(mask & (1 << TN))) continue;
+    TxBurstJob *job = new TxBurstJob;
+    job->RSSI = (signed char) *rp++;
+    TRXUnpackBits(rp,gSlotLen,job->burst.begin());
+    rp += gTRXv2PackedBurstLen;
+    job->time = GSM::Time(frameNum,TN);
+    queueTxBurst(job);
+  }
+
+  // The whole frame is here, so don't wait for more of it.
+  if (mTxBatchSize) dispatchTxBatch();
+
+  return true;
+}
+
+void Transceiver::queueTxBurst(TxBurstJob *job)
+{
+  if (!mNumModulators) {
+    modulateTxBurst(job);
+    return;
+  }
+
+  // Collect the bursts of a frame and modulate them in parallel,
+  // as soon as the last timeslot or a later frame shows up.
+  uint32_t frameNum = job->time.FN();
+  if (mTxBatchSize && (frameNum!=mTxBatchFN)) dispatchTxBatch();
+  if (mTxBatchSize==8) dispatchTxBatch();
+  mTxBatch[mTxBatchSize++] = job;
+  mTxBatchFN = frameNum;
+  if (job->time.TN()==7) dispatchTxBatch();
+}
  
 void Transceiver::driveReceiveFIFO() 
 {
@@ -660,10 +1001,22 @@ void Transceiver::driveReceiveFIFO()
   int TOA;  // in 1/256 of a symbol
   GSM::Time burstTime;
 
-  mRadioInterface->driveReceiveRadio();
+  // Sleep until the device receive thread delivers a burst.
+  if (!mReceiveFIFO->wait(RADIOWAITTIMEOUT)) return;
+
+  // This is the only reader of the receive FIFO,
+  // so pullRadioVector will see a burst time.
+  unsigned depth = mReceiveFIFO->size();
 
   rxBurst = pullRadioVector(burstTime,RSSI,TOA);
 
+  // How far demodulation trails the radio, including the receive offset.
+  int lag = slotDelta(mRadioInterface->getClock()->get(),burstTime);
+  mIOStatsLock.lock();
+  if (depth > mRxDepthMax) mRxDepthMax = depth;
+  if (lag > mRxLagMax) mRxLagMax = lag;
+  mIOStatsLock.unlock();
+
   if (rxBurst) { 
 
     LOG(DEBUG) << "burst parameters: "
@@ -671,7 +1024,21 @@ void Transceiver::driveReceiveFIFO()
 	  << " RSSI: " << RSSI
 	  << " TOA: "  << TOA
 	  << " bits: " << *rxBurst;
-    
+
+    if (mProtocol >= 2) {
+      addRxFrameBurst(*rxBurst,burstTime,RSSI,TOA);
+      delete rxBurst;
+      rxBurst = NULL;
+    }
+  }
+
+  // A version 2 frame goes up after its last timeslot, even one with nothing in it.
+  if (mRxFramePtr && ((burstTime.FN() != mRxFrameFN) || (burstTime.TN() == 7)))
+    sendRxFrame();
+
+  if (rxBurst) {
+    if (mRxFramePtr) sendRxFrame();
+
     char burstString[gSlotLen+10];
     burstString[0] = burstTime.TN();
     for (int i = 0; i < 4; i++)
@@ -707,10 +1074,10 @@ void Transceiver::driveTransmitFIFO()
 
 
   RadioClock *radioClock = (mRadioInterface->getClock());
+  GSM::Time radioTime = radioClock->get();
   
   if (mOn) {
-    //radioClock->wait(); // wait until clock updates
-    LOG(DEBUG) << "radio clock " << radioClock->get();
+    LOG(DEBUG) << "radio clock " << radioTime;
     while (radioClock->get() + mTransmitLatency > mTransmitDeadlineClock) {
       // if underrun, then we're not providing bursts to radio/USRP fast
       //   enough.  Need to increase latency by one GSM frame.
@@ -736,49 +1103,120 @@ void Transceiver::driveTransmitFIFO()
         }
       }
       // time to push burst to transmit FIFO
+      radioTime = radioClock->get();
+      int slack = slotDelta(mTransmitDeadlineClock,radioTime);
+      mIOStatsLock.lock();
+      if (slack < mTxSlackMin) mTxSlackMin = slack;
+      mTxSlackTotal += slack;
+      mTxSlackCount++;
+      mIOStatsLock.unlock();
       pushRadioVector(mTransmitDeadlineClock);
       mTransmitDeadlineClock.incTN();
     }
     
   }
-  // FIXME -- This should not be a hard spin.
-  // But any delay here causes us to throw omni_thread_fatal.
-  //else radioClock->wait();
+  // Nothing is due until the device receive thread advances the radio clock.
+  radioClock->wait(radioTime,RADIOWAITTIMEOUT);
 }
 
 
 
+void Transceiver::addRxFrameBurst(const SoftVector &burst, const GSM::Time &time, int RSSI, int TOA)
+{
+  if (mRxFramePtr && (time.FN() != mRxFrameFN)) sendRxFrame();
+  if (!mRxFramePtr) {
+    mRxFramePtr = TRXv2StartFrame(mRxFrame,TRXV2_UPLINK,time.FN());
+    mRxFrameFN = time.FN();
+  }
+
+  // Bursts come out of the receive FIFO in timeslot order.
+  mRxFrame[gTRXv2HeaderLen-1] |= 1 << time.TN();
+  unsigned char *wp = mRxFramePtr;
+  *wp++ = RSSI;
+  *wp++ = (TOA >> 8) & 0x0ff;
+  *wp++ = TOA & 0x0ff;
+  SoftVector::const_iterator burstItr = burst.begin();
+  for (unsigned int i = 0; i < gSlotLen; i++)
+    *wp++ = (unsigned char) round((*burstItr++)*255.0);
+  mRxFramePtr = wp;
+}
+
+void Transceiver::sendRxFrame()
+{
+  if (!mRxFramePtr) return;
+  mDataSocket.write((char*) mRxFrame,mRxFramePtr-mRxFrame);
+  mRxFramePtr = NULL;
+}
+
 void Transceiver::writeClockInterface()
 {
-  char command[50];
   // FIXME -- This should be adaptive.
-  sprintf(command,"IND CLOCK %llu",(unsigned long long) (mTransmitDeadlineClock.FN()+2));
+  unsigned long long FN = mTransmitDeadlineClock.FN()+2;
 
-  LOG(INFO) << "ClockInterface: sending " << command;
+  mClockLock.lock();
 
-  mClockSocket.write(command,strlen(command)+1);
+  if (mProtocol >= 2) {
+    // binary, with a sequence number so the core can count lost indications
+    unsigned char indication[gTRXv2ClockLen];
+    TRXv2WriteClock(indication,++mClockSeq,FN);
+    LOG(INFO) << "ClockInterface: sending clock " << FN << ", seq " << mClockSeq;
+    mClockSocket.write((char*) indication,gTRXv2ClockLen);
+  }
+  else {
+    char command[50];
+    sprintf(command,"IND CLOCK %llu",FN);
+    LOG(INFO) << "ClockInterface: sending " << command;
+    mClockSocket.write(command,strlen(command)+1);
+  }
 
   mLastClockUpdateTime = mTransmitDeadlineClock;
 
+  mClockLock.unlock();
+
 }   
   
 
 
 
-void *FIFOServiceLoopAdapter(Transceiver *transceiver)
+void *RxRadioServiceLoopAdapter(Transceiver *transceiver)
 {
+  AllocScope allocScope(AllocTransceiver);
+  transceiver->setPriority();
+
+  while (1) {
+    transceiver->mRadioInterface->driveReceiveRadio();
+    pthread_testcancel();
+  }
+  return NULL;
+}
+
+void *TxRadioServiceLoopAdapter(Transceiver *transceiver)
+{
+  AllocScope allocScope(AllocTransceiver);
   transceiver->setPriority();
 
   while (1) {
-    transceiver->driveReceiveFIFO();
     transceiver->driveTransmitFIFO();
     pthread_testcancel();
   }
   return NULL;
 }
 
+void *RxFIFOServiceLoopAdapter(Transceiver *transceiver)
+{
+  AllocScope allocScope(AllocTransceiver);
+  transceiver->setPriority();
+
+  while (1) {
+    transceiver->driveReceiveFIFO();
+    pthread_testcancel();
+  }
+  return NULL;
+}
+
 void *ControlServiceLoopAdapter(Transceiver *transceiver)
 {
+  AllocScope allocScope(AllocTransceiver);
   while (1) {
     transceiver->driveControl();
     pthread_testcancel();
@@ -786,8 +1224,25 @@ void *ControlServiceLoopAdapter(Transceiver *transceiver)
   return NULL;
 }
 
+void Transceiver::driveTxModulator()
+{
+  TxBurstJob *job = mTxModulationQueue.read();
+  modulateTxBurst(job);
+}
+
+void *TxModulatorLoopAdapter(Transceiver *transceiver)
+{
+  AllocScope allocScope(AllocTransceiver);
+  while (1) {
+    transceiver->driveTxModulator();
+    pthread_testcancel();
+  }
+  return NULL;
+}
+
 void *TransmitPriorityQueueServiceLoopAdapter(Transceiver *transceiver)
 {
+  AllocScope allocScope(AllocTransceiver);
   while (1) {
     bool stale = false;
     // Flush the UDP packets until a successful transfer.
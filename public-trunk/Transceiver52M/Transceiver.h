@@ -33,6 +33,7 @@
 #include "Interthread.h"
 #include "GSMCommon.h"
 #include "Sockets.h"
+#include "TRXProtocol.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -40,6 +41,41 @@
 /** Define this to be the slot number to be logged. */
 //#define TRANSMIT_LOGGING 1
 
+/** Default number of transmit modulation worker threads */
+#define TXMODULATORS 2
+/** Largest allowed number of transmit modulation worker threads */
+#define TXMAXMODULATORS 8
+
+/** Longest wait, in ms, of the radio and receive threads, so they notice cancellation */
+#define RADIOWAITTIMEOUT 10
+
+/** The transmit bursts of one TDMA frame, modulated as a group */
+class TxFrameBatch {
+
+public:
+
+  Mutex lock;			///< protects pending
+  unsigned pending;		///< bursts of the frame not yet modulated
+  Timeval dispatched;		///< when the frame was handed to the workers
+
+  TxFrameBatch(unsigned wPending):pending(wPending) {}
+};
+
+/** A transmit burst from the GSM core, waiting for a modulation worker */
+class TxBurstJob {
+
+public:
+
+  BitVector burst;
+  int RSSI;
+  GSM::Time time;
+  TxFrameBatch *batch;		///< the frame this burst belongs to
+
+  TxBurstJob():burst(gSlotLen),batch(NULL) {}
+};
+
+typedef InterthreadQueue<TxBurstJob> TxBurstJobQueue;
+
 /** The Transceiver class, responsible for physical layer of basestation */
 class Transceiver {
   
@@ -52,13 +88,47 @@ private:
   UDPSocket mControlSocket;	  ///< socket for writing/reading control commands from GSM core
   UDPSocket mClockSocket;	  ///< socket for writing clock updates to GSM core
 
+  unsigned mProtocol;			///< data and clock interface version, 1 or 2, set by SETPROTO
+  Mutex mClockLock;			///< keeps clock indications in sequence number order
+  uint32_t mClockSeq;			///< sequence number of the last version 2 clock indication
+  unsigned char mRxFrame[gTRXv2MaxFrameLen];	///< version 2 uplink frame being assembled
+  unsigned char *mRxFramePtr;		///< end of the data in mRxFrame, NULL if no frame is started
+  int mRxFrameFN;			///< frame number of mRxFrame
+
   VectorQueue  mTransmitPriorityQueue;   ///< priority queue of transmit bursts received from GSM core
   VectorFIFO*  mTransmitFIFO;     ///< radioInterface FIFO of transmit bursts 
   VectorFIFO*  mReceiveFIFO;      ///< radioInterface FIFO of receive bursts 
 
-  Thread *mFIFOServiceLoopThread;  ///< thread to push/pull bursts into transmit/receive FIFO
+  Thread *mRxRadioServiceLoopThread;	///< thread to read the device into the receive FIFO
+  Thread *mTxRadioServiceLoopThread;	///< thread to push bursts to the device by their deadlines
+  Thread *mRxFIFOServiceLoopThread;	///< thread to demodulate bursts from the receive FIFO
   Thread *mControlServiceLoopThread;       ///< thread to process control messages from GSM core
   Thread *mTransmitPriorityQueueServiceLoopThread;///< thread to process transmit bursts from GSM core
+  Thread *mTxModulatorThreads[TXMAXMODULATORS];	///< threads to modulate transmit bursts
+
+  unsigned mNumModulators;		///< number of modulation worker threads, 0 to modulate on the receiving thread
+  TxBurstJobQueue mTxModulationQueue;	///< bursts waiting for a modulation worker
+  TxBurstJob *mTxBatch[8];		///< bursts of the frame being collected from the GSM core
+  unsigned mTxBatchSize;		///< number of bursts in mTxBatch
+  uint32_t mTxBatchFN;			///< frame number of the bursts in mTxBatch
+
+  Mutex mTxStatsLock;			///< protects the transmit statistics
+  unsigned mTxBursts;			///< bursts modulated
+  unsigned mTxLate;			///< bursts that finished modulation after their transmit deadline
+  unsigned mTxStale;			///< bursts dumped as stale at the radio interface
+  unsigned mTxFrames;			///< frames modulated
+  double mTxFrameTimeTotal;		///< summed frame modulation time, in microseconds
+  unsigned mTxFrameTimeMax;		///< longest frame modulation time since the last TXSTATS, in microseconds
+
+  /**@name Per-stage slack of the radio threads, reported by IOSTATS, all in timeslots. */
+  //@{
+  Mutex mIOStatsLock;			///< protects the radio thread statistics
+  int mTxSlackMin;			///< least transmit slack, deadline minus radio clock, since the last IOSTATS
+  double mTxSlackTotal;			///< summed transmit slack
+  unsigned mTxSlackCount;		///< bursts summed into mTxSlackTotal
+  unsigned mRxDepthMax;			///< deepest receive FIFO seen by the demodulator since the last IOSTATS
+  int mRxLagMax;			///< longest delay from radio clock to demodulation since the last IOSTATS
+  //@}
 
   GSM::Time mTransmitDeadlineClock;       ///< deadline for pushing bursts into transmit FIFO 
   GSM::Time mLastClockUpdateTime;         ///< last time clock update was sent up to core
@@ -101,6 +171,15 @@ private:
 		      int RSSI,
 		      GSM::Time &wTime);
 
+  /** hand the collected bursts of a frame to the modulation workers */
+  void dispatchTxBatch();
+
+  /** modulate a burst on a worker thread, then account for its frame */
+  void modulateTxBurst(TxBurstJob *job);
+
+  /** Replace a filler table entry with a transmitted burst, taking ownership of it */
+  void updateFillerTable(int modFN, int TN, signalVector *burst);
+
   /** Push modulated burst into transmit FIFO corresponding to a particular timestamp */
   void pushRadioVector(GSM::Time &nowTime);
 
@@ -115,9 +194,27 @@ private:
   /** return the expected burst type for the specified timestamp */
   CorrType expectedCorrType(GSM::Time currTime);
 
+  /**
+    Combine the L1 activity mask of a timeslot with the OFF and IDLE
+    frames of its channel combination and install it in the radio interface.
+  */
+  void updateRxMask(int timeslot);
+
   /** send messages over the clock socket */
   void writeClockInterface(void);
 
+  /** add a received burst to the version 2 uplink frame */
+  void addRxFrameBurst(const SoftVector &burst, const GSM::Time &time, int RSSI, int TOA);
+
+  /** send the version 2 uplink frame, if one is started */
+  void sendRxFrame();
+
+  /** queue the bursts of a version 2 downlink frame */
+  bool receiveTxFrame(const unsigned char *frame, int len);
+
+  /** queue a burst received from the GSM core */
+  void queueTxBurst(TxBurstJob *job);
+
   signalVector *gsmPulse;              ///< the GSM shaping pulse for modulation
 
   int mSamplesPerSymbol;               ///< number of samples per GSM symbol
@@ -132,6 +229,7 @@ private:
   GSM::Time prevFalseDetectionTime;    ///< last timestamp of a false energy detection
   int fillerModulus[8];                ///< modulus values of all timeslots, in frames
   signalVector *fillerTable[102][8];   ///< table of modulated filler waveforms for all timeslots
+  signalVector *dummyBurstTable[8];    ///< modulated dummy burst of each timeslot, shared by its fillerTable entries
   unsigned mMaxExpectedDelay;            ///< maximum expected time-of-arrival offset in GSM symbols
 
   GSM::Time    channelEstimateTime[8]; ///< last timestamp of each timeslot's channel estimate
@@ -141,6 +239,25 @@ private:
   signalVector *DFEFeedback[8];        ///< most recent DFE feedback filter of all timeslots
   float        chanRespOffset[8];      ///< most recent timing offset, e.g. TOA, of all timeslots
   complex      chanRespAmplitude[8];   ///< most recent channel amplitude of all timeslots
+  bool         channelEstimateStale[8]; ///< true if the next normal burst should refresh the channel estimate
+  float        DFEChangeMetric[8];     ///< normalized channel change seen at the last estimate of all timeslots
+  unsigned     mDFEEstimates;          ///< number of channel estimates made for the DFE
+  unsigned     mDFERedesigns;          ///< number of those estimates that caused a DFE redesign
+
+  unsigned     mL1RxMaskPeriod[8];     ///< repeat period of the L1 uplink activity mask, 0 if none was sent
+  bool         mL1RxMask[8][RXMASKMAXPERIOD]; ///< L1 uplink activity mask of all timeslots
+
+  /**
+    Decide whether a new channel estimate differs enough from the one the
+    current DFE was designed for to justify a redesign.
+    @param timeslot The timeslot of the estimate.
+    @param newResponse The new, amplitude-normalized channel estimate.
+    @return True if the DFE should be redesigned.
+  */
+  bool channelChanged(int timeslot, const signalVector &newResponse);
+
+  /** Drop the DFE of a timeslot, so it demodulates without one until the next redesign. */
+  void clearDFE(int timeslot);
 
 public:
 
@@ -150,12 +267,14 @@ public:
       @param wSamplesPerSymbol number of samples per GSM symbol
       @param wTransmitLatency initial setting of transmit latency
       @param radioInterface associated radioInterface object
+      @param wNumModulators number of transmit modulation worker threads, 0 for none
   */
   Transceiver(int wBasePort,
 	      const char *TRXAddress,
 	      int wSamplesPerSymbol,
 	      GSM::Time wTransmitLatency,
-	      RadioInterface *wRadioInterface);
+	      RadioInterface *wRadioInterface,
+	      unsigned wNumModulators = TXMODULATORS);
    
   /** Destructor */
   ~Transceiver();
@@ -171,27 +290,36 @@ public:
 
 protected:
 
-  /** drive reception and demodulation of GSM bursts */ 
+  /** drive demodulation of GSM bursts, waiting on the receive FIFO */ 
   void driveReceiveFIFO();
 
-  /** drive transmission of GSM bursts */
+  /** drive transmission of GSM bursts, waiting on the radio clock */
   void driveTransmitFIFO();
 
   /** drive handling of control messages from GSM core */
   void driveControl();
 
   /**
-    drive modulation and sorting of GSM bursts from GSM core
-    @return true if a burst was transferred successfully
+    drive collection of GSM bursts from GSM core into per-frame batches for modulation
+    @return false if a badly formatted packet was received
   */
   bool driveTransmitPriorityQueue();
 
-  friend void *FIFOServiceLoopAdapter(Transceiver *);
+  /** drive one modulation worker */
+  void driveTxModulator();
+
+  friend void *RxRadioServiceLoopAdapter(Transceiver *);
+
+  friend void *TxRadioServiceLoopAdapter(Transceiver *);
+
+  friend void *RxFIFOServiceLoopAdapter(Transceiver *);
 
   friend void *ControlServiceLoopAdapter(Transceiver *);
 
   friend void *TransmitPriorityQueueServiceLoopAdapter(Transceiver *);
 
+  friend void *TxModulatorLoopAdapter(Transceiver *);
+
   void reset();
 
   /** set priority on current thread */
@@ -199,8 +327,16 @@ protected:
 
 };
 
-/** FIFO thread loop */
-void *FIFOServiceLoopAdapter(Transceiver *);
+// The radio runs on three threads, so that transmit timing never waits on demodulation.
+
+/** device receive thread loop, reads samples into the receive FIFO and advances the radio clock */
+void *RxRadioServiceLoopAdapter(Transceiver *);
+
+/** device transmit thread loop, wakes on the radio clock and pushes bursts by their deadlines */
+void *TxRadioServiceLoopAdapter(Transceiver *);
+
+/** receive thread loop, demodulates bursts from the receive FIFO */
+void *RxFIFOServiceLoopAdapter(Transceiver *);
 
 /** control message handler thread loop */
 void *ControlServiceLoopAdapter(Transceiver *);
@@ -208,3 +344,6 @@ void *ControlServiceLoopAdapter(Transceiver *);
 /** transmit queueing thread loop */
 void *TransmitPriorityQueueServiceLoopAdapter(Transceiver *);
 
+/** transmit modulation worker thread loop */
+void *TxModulatorLoopAdapter(Transceiver *);
+
@@ -0,0 +1,173 @@
+/*
+* Copyright 2010 Free Software Foundation, Inc.
+*
+* This software is distributed under the terms of the GNU Affero Public License.
+* See the COPYING file in the main directory for details.
+*
+* This use of this software may be subject to additional restrictions.
+* See the LEGAL file in the main directory for details.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+	Compares the two-stage burst search against the full correlation:
+	detection agreement, TOA and amplitude accuracy, and CPU time per burst.
+	Usage: burstSearchTest [maxTOA [SNRdB]]
+*/
+
+
+#include "sigProcLib.h"
+#include <Logger.h>
+#include <Configuration.h>
+#include <Timeval.h>
+
+#include <stdlib.h>
+#include <math.h>
+
+using namespace std;
+
+ConfigurationTable gConfig;
+
+static const int numBursts = 1000;
+static const int numPasses = 20;
+
+/** Detector output for one burst. */
+struct Detection {
+  bool found;
+  complex amplitude;
+  float TOA;
+};
+
+static BitVector randomBits(unsigned len)
+{
+  BitVector bits(len);
+  for (unsigned i = 0; i < len; i++) bits[i] = random() & 0x01;
+  return bits;
+}
+
+/** Modulate a burst, delay it by TOA symbols and add noise of the given variance. */
+static signalVector *makeBurst(const BitVector &bits, signalVector &gsmPulse, int guard,
+			       int samplesPerSymbol, float TOA, float noiseVariance)
+{
+  signalVector *burst = modulateBurst(bits,gsmPulse,guard,samplesPerSymbol);
+  delayVector(*burst,TOA*samplesPerSymbol);
+  signalVector *noise = gaussianNoise(burst->size(),noiseVariance);
+  addVector(*burst,*noise);
+  delete noise;
+  return burst;
+}
+
+/** Run one detector over every burst numPasses times; return microseconds per burst. */
+static float runDetector(bool RACH, bool twoStage, signalVector **bursts, Detection *results,
+			 int TSC, int samplesPerSymbol, unsigned maxTOA)
+{
+  setTwoStageBurstSearch(twoStage);
+  Timeval start;
+  for (int pass = 0; pass < numPasses; pass++) {
+    for (int i = 0; i < numBursts; i++) {
+      Detection &d = results[i];
+      if (RACH)
+	d.found = detectRACHBurst(*bursts[i],5.0,samplesPerSymbol,&d.amplitude,&d.TOA);
+      else
+	d.found = analyzeTrafficBurst(*bursts[i],TSC,3.0,samplesPerSymbol,&d.amplitude,&d.TOA,maxTOA);
+    }
+  }
+  return start.elapsed()*1000.0F/(numPasses*numBursts);
+}
+
+static void compare(const char *name, bool RACH, signalVector **bursts, const float *delays,
+		    int TSC, int samplesPerSymbol, unsigned maxTOA)
+{
+  Detection full[numBursts], fast[numBursts];
+  float fullTime = runDetector(RACH,false,bursts,full,TSC,samplesPerSymbol,maxTOA);
+  float fastTime = runDetector(RACH,true,bursts,fast,TSC,samplesPerSymbol,maxTOA);
+
+  int numFull = 0, numFast = 0, numDisagree = 0, numBoth = 0;
+  double fullErr = 0.0, fastErr = 0.0;
+  float maxTOADiff = 0.0, maxAmplDiff = 0.0;
+  for (int i = 0; i < numBursts; i++) {
+    if (full[i].found) numFull++;
+    if (fast[i].found) numFast++;
+    if (full[i].found != fast[i].found) numDisagree++;
+    if (!full[i].found || !fast[i].found) continue;
+    numBoth++;
+    fullErr += (full[i].TOA-delays[i])*(full[i].TOA-delays[i]);
+    fastErr += (fast[i].TOA-delays[i])*(fast[i].TOA-delays[i]);
+    float TOADiff = fabs(full[i].TOA-fast[i].TOA);
+    if (TOADiff > maxTOADiff) maxTOADiff = TOADiff;
+    float amplDiff = (full[i].amplitude-fast[i].amplitude).abs()/full[i].amplitude.abs();
+    if (amplDiff > maxAmplDiff) maxAmplDiff = amplDiff;
+  }
+  if (numBoth==0) numBoth = 1;
+
+  cout << name << ": full " << fullTime << " us/burst, two-stage " << fastTime << " us/burst" << endl;
+  cout << "  detected: full " << numFull << ", two-stage " << numFast << ", disagree " << numDisagree
+       << " of " << numBursts << endl;
+  cout << "  rms TOA error: full " << sqrt(fullErr/numBoth) << ", two-stage " << sqrt(fastErr/numBoth)
+       << "; max TOA difference " << maxTOADiff << ", max relative amplitude difference " << maxAmplDiff << endl;
+}
+
+int main(int argc, char **argv)
+{
+  gLogInit("NOTICE");
+
+  int samplesPerSymbol = 1;
+  int TSC = 2;
+  unsigned maxTOA = 63;
+  float SNR = 10.0;
+  if (argc>1) maxTOA = atoi(argv[1]);
+  if (argc>2) SNR = atof(argv[2]);
+  // a normal burst has 66 symbols ahead of the searched part of the midamble
+  if (maxTOA > 63) maxTOA = 63;
+  float noiseVariance = dBinv(-SNR);
+
+  sigProcLibSetup(samplesPerSymbol);
+  signalVector *gsmPulse = generateGSMPulse(2,samplesPerSymbol);
+  generateMidamble(*gsmPulse,samplesPerSymbol,TSC);
+  generateRACHSequence(*gsmPulse,samplesPerSymbol);
+
+  srandom(1);
+  static signalVector *normalBursts[numBursts];
+  static signalVector *accessBursts[numBursts];
+  static float normalDelays[numBursts];
+  static float accessDelays[numBursts];
+  for (int i = 0; i < numBursts; i++) {
+    // 3 tail, 58 data, 26 training, 58 data, 3 tail, 9 guard
+    BitVector tail(3);
+    tail.fill(0);
+    BitVector normal(BitVector(BitVector(tail,randomBits(58)),gTrainingSequence[TSC]),
+		     BitVector(randomBits(58),tail));
+    normalDelays[i] = maxTOA*(float) random()/(float) RAND_MAX;
+    normalBursts[i] = makeBurst(normal,*gsmPulse,9,samplesPerSymbol,normalDelays[i],noiseVariance);
+
+    // 8 tail, 41 synch, 36 data, 3 tail, 69 guard
+    BitVector access(BitVector(BitVector("00111010"),gRACHSynchSequence),
+		     BitVector(randomBits(36),tail));
+    accessDelays[i] = 63.0F*(float) random()/(float) RAND_MAX;
+    accessBursts[i] = makeBurst(access,*gsmPulse,69,samplesPerSymbol,accessDelays[i],noiseVariance);
+  }
+
+  cout << "maxTOA=" << maxTOA << " SNR=" << SNR << " dB" << endl;
+  compare("TSC",false,normalBursts,normalDelays,TSC,samplesPerSymbol,maxTOA);
+  compare("RACH",true,accessBursts,accessDelays,TSC,samplesPerSymbol,maxTOA);
+
+  for (int i = 0; i < numBursts; i++) {
+    delete normalBursts[i];
+    delete accessBursts[i];
+  }
+  delete gsmPulse;
+  sigProcLibDestroy();
+}
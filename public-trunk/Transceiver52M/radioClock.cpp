@@ -52,3 +52,10 @@ void RadioClock::wait()
 	updateSignal.wait(mLock,1);
 	mLock.unlock();
 }
+
+void RadioClock::wait(const GSM::Time& wTime, unsigned timeout)
+{
+	mLock.lock();
+	if (mClock == wTime) updateSignal.wait(mLock,timeout);
+	mLock.unlock();
+}
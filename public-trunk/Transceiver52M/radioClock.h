@@ -30,6 +30,8 @@ public:
 	void incTN();
 	GSM::Time get();
 	void wait();
+	/** Wait up to timeout ms for the clock to move past wTime. */
+	void wait(const GSM::Time& wTime, unsigned timeout);
 
 private:
 	GSM::Time mClock;
@@ -26,17 +26,30 @@
 static short rx_buf[OUTCHUNK * 2 * 2];
 static short tx_buf[INCHUNK * 2 * 2];
 
-/* Complex float to short conversion */
-static int float_to_short(short *shrt_out, float *flt_in, int num)
+/*
+ * Scale and convert a burst straight into the device transmit buffer
+ * at the send cursor, without an intermediate float copy.
+ */
+int RadioInterface::radioifyVector(signalVector &wVector,
+				   float scale,
+				   bool zero)
 {
-	int i;
+	size_t i;
+	short *shrt_out = tx_buf + 2 * sendCursor;
+	signalVector::iterator itr = wVector.begin();
 
-	for (i = 0; i < num; i++) {
-		shrt_out[2 * i + 0] = flt_in[2 * i + 0];
-		shrt_out[2 * i + 1] = flt_in[2 * i + 1];
+	if (zero) {
+		memset(shrt_out, 0, wVector.size() * 2 * sizeof(short));
+		return wVector.size();
 	}
 
-	return i;
+	for (i = 0; i < wVector.size(); i++) {
+		shrt_out[2 * i + 0] = itr->real() * scale;
+		shrt_out[2 * i + 1] = itr->imag() * scale;
+		itr++;
+	}
+
+	return wVector.size();
 }
 
 /* Comlpex short to float conversion */
@@ -77,14 +90,12 @@ void RadioInterface::pushBuffer()
 	if (sendCursor < INCHUNK)
 		return;
 
-	float_to_short(tx_buf, sendBuffer, sendCursor);
-
 	/* Write samples. Fail if we don't get what we want. */
 	int num_smpls = mRadio->writeSamples(tx_buf,
 					     sendCursor,
 					     &underrun,
 					     writeTimestamp);
-	assert(num_smpls == sendCursor);
+	assert(num_smpls == (int) sendCursor);
 
 	writeTimestamp += (TIMESTAMP) num_smpls;
 	sendCursor = 0;
@@ -271,6 +271,29 @@ int tx_resmpl_flt_int(short *smpls_out, float *smpls_in, int num_smpls)
 	return num_resmpl; 
 }
 
+/* Scale and stage a burst in the float send buffer for resampling */
+int RadioInterface::radioifyVector(signalVector &wVector,
+				   float scale,
+				   bool zero)
+{
+	size_t i;
+	float *retVector = sendBuffer + 2 * sendCursor;
+	signalVector::iterator itr = wVector.begin();
+
+	if (zero) {
+		memset(retVector, 0, wVector.size() * 2 * sizeof(float));
+		return wVector.size();
+	}
+
+	for (i = 0; i < wVector.size(); i++) {
+		retVector[2 * i + 0] = itr->real() * scale;
+		retVector[2 * i + 1] = itr->imag() * scale;
+		itr++;
+	}
+
+	return wVector.size();
+}
+
 /* Receive a timestamped chunk from the device */ 
 void RadioInterface::pullBuffer()
 {
@@ -308,7 +331,7 @@ void RadioInterface::pushBuffer()
 
 	/* Resample and convert */
 	num_cv = tx_resmpl_flt_int(tx_buf, sendBuffer, sendCursor);
-	assert(num_cv > sendCursor);
+	assert(num_cv > (int) sendCursor);
 
 	/* Write samples. Fail if we don't get what we want. */
 	num_wr = mRadio->writeSamples(tx_buf + OUTHISTORY * 2,
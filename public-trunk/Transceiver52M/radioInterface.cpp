@@ -24,6 +24,7 @@
 
 #include "radioInterface.h"
 #include <Logger.h>
+#include <MemoryLock.h>
 
 bool started = false;
 
@@ -37,11 +38,17 @@ RadioInterface::RadioInterface(RadioDevice *wRadio,
     samplesPerSymbol(wRadioOversampling), powerScaling(1.0)
 {
   mClock.set(wStartTime);
+  sendBuffer = NULL;
+  rcvBuffer = NULL;
+  for (int i = 0; i < 8; i++) mRxMaskPeriod[i] = 0;
+  mRxSkipped = 0;
+  mRxOverflows = 0;
 }
 
 
 RadioInterface::~RadioInterface(void) {
-  if (rcvBuffer!=NULL) delete rcvBuffer;
+  gFreeSampleBuffer(sendBuffer);
+  gFreeSampleBuffer(rcvBuffer);
   //mReceiveFIFO.clear();
 }
 
@@ -66,28 +73,6 @@ void RadioInterface::setPowerAttenuation(double atten)
     powerScaling = 1.0/sqrt(pow(10, (digAtten/10.0)));
 }
 
-int RadioInterface::radioifyVector(signalVector &wVector,
-				   float *retVector,
-				   float scale,
-				   bool zero)
-{
-  int i;
-  signalVector::iterator itr = wVector.begin();
-
-  if (zero) {
-    memset(retVector, 0, wVector.size() * 2 * sizeof(float));
-    return wVector.size();
-  }
-
-  for (i = 0; i < wVector.size(); i++) {
-    retVector[2 * i + 0] = itr->real() * scale;
-    retVector[2 * i + 1] = itr->imag() * scale;
-    itr++;
-  }
-
-  return wVector.size();
-}
-
 int RadioInterface::unRadioifyVector(float *floatVector,
 				     signalVector& newVector)
 {
@@ -125,14 +110,17 @@ void RadioInterface::start()
   mRadio->updateAlignment(writeTimestamp-10000); 
   mRadio->updateAlignment(writeTimestamp-10000);
 
-  sendBuffer = new float[2*2*INCHUNK*samplesPerSymbol];
-  rcvBuffer = new float[2*2*OUTCHUNK*samplesPerSymbol];
+  // In deterministic-memory mode these land on prefaulted hugepages.
+  sendBuffer = (float*) gAllocSampleBuffer(sizeof(float)*2*2*INCHUNK*samplesPerSymbol);
+  rcvBuffer = (float*) gAllocSampleBuffer(sizeof(float)*2*2*OUTCHUNK*samplesPerSymbol);
+  assert(sendBuffer && rcvBuffer);
  
   mOn = true;
 }
 
 void *AlignRadioServiceLoopAdapter(RadioInterface *radioInterface)
 {
+  AllocScope allocScope(AllocTransceiver);
   while (1) {
     radioInterface->alignRadio();
     pthread_testcancel();
@@ -149,9 +137,7 @@ void RadioInterface::driveTransmitRadio(signalVector &radioBurst, bool zeroBurst
 
   if (!mOn) return;
 
-  radioifyVector(radioBurst, sendBuffer + 2 * sendCursor, powerScaling, zeroBurst);
-
-  sendCursor += radioBurst.size();
+  sendCursor += radioifyVector(radioBurst, powerScaling, zeroBurst);
 
   pushBuffer();
 }
@@ -160,8 +146,8 @@ void RadioInterface::driveReceiveRadio() {
 
   if (!mOn) return;
 
-  if (mReceiveFIFO.size() > 8) return;
-
+  // Blocks in the device until samples arrive.  This thread only reads the
+  // device; demodulation runs on the other side of the receive FIFO.
   pullBuffer();
 
   GSM::Time rcvClock = mClock.get();
@@ -174,24 +160,35 @@ void RadioInterface::driveReceiveRadio() {
   // while there's enough data in receive buffer, form received 
   //    GSM bursts and pass up to Transceiver
   // Using the 157-156-156-156 symbols per timeslot format.
+  // Bursts in frames the uplink activity mask marks as unused are skipped
+  //    without being copied or allocated.
+  mRxMaskLock.lock();
   while (rcvSz > (symbolsPerSlot + (tN % 4 == 0))*samplesPerSymbol) {
-    signalVector rxVector((symbolsPerSlot + (tN % 4 == 0)*samplesPerSymbol));
-    unRadioifyVector(rcvBuffer+readSz*2,rxVector);
     GSM::Time tmpTime = rcvClock;
     if (rcvClock.FN() >= 0) {
-      LOG(DEEPDEBUG) << "FN: " << rcvClock.FN();
-      radioVector* rxBurst = new radioVector(rxVector,tmpTime);
-      mReceiveFIFO.put(rxBurst); 
+      if (!rxActive(rcvClock)) mRxSkipped++;
+      else {
+        signalVector rxVector((symbolsPerSlot + (tN % 4 == 0)*samplesPerSymbol));
+        unRadioifyVector(rcvBuffer+readSz*2,rxVector);
+        LOG(DEEPDEBUG) << "FN: " << rcvClock.FN();
+        radioVector* rxBurst = new radioVector(rxVector,tmpTime);
+        // If the demodulator has fallen this far behind, drop the burst
+        // rather than stop reading the device.
+        if (!mReceiveFIFO.put(rxBurst)) {
+          delete rxBurst;
+          mRxOverflows++;
+        }
+      }
     }
     mClock.incTN(); 
     rcvClock.incTN();
-    //if (mReceiveFIFO.size() >= 16) mReceiveFIFO.wait(8);
     LOG(DEBUG) << "receiveFIFO: wrote radio vector at time: " << mClock.get() << ", new size: " << mReceiveFIFO.size() ;
     readSz += (symbolsPerSlot+(tN % 4 == 0))*samplesPerSymbol;
     rcvSz -= (symbolsPerSlot+(tN % 4 == 0))*samplesPerSymbol;
 
     tN = rcvClock.TN();
   }
+  mRxMaskLock.unlock();
 
   if (readSz > 0) {
     rcvCursor -= readSz;
@@ -199,6 +196,16 @@ void RadioInterface::driveReceiveRadio() {
   }
 }
 
+bool RadioInterface::setRxMask(unsigned TN, unsigned period, const bool *mask)
+{
+  if ((TN > 7) || (period > RXMASKMAXPERIOD)) return false;
+  mRxMaskLock.lock();
+  for (unsigned i = 0; i < period; i++) mRxMask[TN][i] = mask[i];
+  mRxMaskPeriod[TN] = period;
+  mRxMaskLock.unlock();
+  return true;
+}
+
 bool RadioInterface::isUnderrun()
 {
   bool retVal = underrun;
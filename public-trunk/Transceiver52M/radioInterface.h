@@ -36,6 +36,9 @@
 #define INCHUNK    625
 #define OUTCHUNK   625
 
+/** longest repeat period of an uplink activity mask, in frames */
+#define RXMASKMAXPERIOD 104
+
 /** class to interface the transceiver with the USRP */
 class RadioInterface {
 
@@ -69,9 +72,28 @@ private:
 
   double powerScaling;
 
-  /** format samples to USRP */ 
+  /**@name Uplink activity masks, one per timeslot. */
+  //@{
+  Mutex mRxMaskLock;
+  unsigned mRxMaskPeriod[8];		      ///< mask repeat period in frames, 0 for no mask
+  bool mRxMask[8][RXMASKMAXPERIOD];	      ///< true for frames that may carry uplink bursts
+  unsigned long mRxSkipped;		      ///< bursts dropped by the masks
+  //@}
+
+  unsigned long mRxOverflows;		      ///< bursts dropped because the receive FIFO was full
+
+  /** true if the burst at this time is wanted; call with mRxMaskLock held */
+  bool rxActive(const GSM::Time &wTime) const
+  {
+    const unsigned period = mRxMaskPeriod[wTime.TN()];
+    return (period==0) || mRxMask[wTime.TN()][wTime.FN() % period];
+  }
+
+  /**
+    format samples to USRP, writing them at the send cursor of the transmit buffer
+    @return the number of samples written
+  */
   int radioifyVector(signalVector &wVector,
-                     float *floatVector,
                      float scale,
                      bool zero);
 
@@ -126,9 +148,28 @@ public:
   /** drive transmission of GSM bursts */
   void driveTransmitRadio(signalVector &radioBurst, bool zeroBurst);
 
-  /** drive reception of GSM bursts */
+  /**
+    drive reception of GSM bursts into the receive FIFO
+    Blocks on the device, and never on the consumer of the receive FIFO.
+  */
   void driveReceiveRadio();
 
+  /**
+    Set the uplink activity mask of a timeslot.
+    Bursts in inactive frames are dropped before they are copied out of the receive buffer.
+    @param TN The timeslot.
+    @param period Mask repeat period in frames, 0 to accept every burst.
+    @param mask Activity of frames 0..period-1, indexed by FN modulo period.
+    @return false if the period is too long.
+  */
+  bool setRxMask(unsigned TN, unsigned period, const bool *mask);
+
+  /** number of bursts dropped by the uplink activity masks */
+  unsigned long rxSkipped() const { return mRxSkipped; }
+
+  /** number of bursts dropped because the receive FIFO was full */
+  unsigned long rxOverflows() const { return mRxOverflows; }
+
   void setPowerAttenuation(double atten); 
 
   /** returns the full-scale transmit amplitude **/
@@ -26,6 +26,16 @@ radioVector::radioVector(const signalVector& wVector, GSM::Time& wTime)
 {
 }
 
+radioVector::radioVector(signalVector* wVector, const GSM::Time& wTime)
+	: mTime(wTime)
+{
+	// Vector assignment from a non-const reference shifts ownership, no copy.
+	Vector<complex>::operator=(*(Vector<complex>*) wVector);
+	setSymmetry(wVector->getSymmetry());
+	isRealOnly(wVector->isRealOnly());
+	wVector->clear();
+}
+
 GSM::Time radioVector::getTime() const
 {
 	return mTime;
@@ -46,14 +56,19 @@ unsigned VectorFIFO::size()
 	return mQ.size();
 }
 
-void VectorFIFO::put(radioVector *ptr)
+bool VectorFIFO::put(radioVector *ptr)
 {
-	mQ.put((void*) ptr);
+	return mQ.write(ptr);
 }
 
 radioVector *VectorFIFO::get()
 {
-	return (radioVector*) mQ.get();
+	return mQ.readNoBlock();
+}
+
+bool VectorFIFO::wait(unsigned timeout)
+{
+	return mQ.wait(timeout);
 }
 
 GSM::Time VectorQueue::nextTime() const
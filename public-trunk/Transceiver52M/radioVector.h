@@ -24,10 +24,13 @@
 
 #include "sigProcLib.h"
 #include "GSMCommon.h"
+#include "Interthread.h"
 
 class radioVector : public signalVector {
 public:
 	radioVector(const signalVector& wVector, GSM::Time& wTime);
+	/** Build a radioVector by taking over the sample block of wVector, leaving it empty. */
+	radioVector(signalVector* wVector, const GSM::Time& wTime);
 	GSM::Time getTime() const;
 	void setTime(const GSM::Time& wTime);
 	bool operator>(const radioVector& other) const;
@@ -36,14 +39,23 @@ private:
 	GSM::Time mTime;
 };
 
+/**
+	Bursts from the device receive thread to the receive DSP thread.
+	Exactly one thread puts and one thread gets; neither takes a lock.
+*/
 class VectorFIFO {
 public:
+	VectorFIFO(unsigned wCapacity = 64) : mQ(wCapacity) {}
 	unsigned size();
-	void put(radioVector *ptr);
+	/** @return false if the FIFO is full; the caller keeps the burst. */
+	bool put(radioVector *ptr);
+	/** @return the oldest burst, or NULL if the FIFO is empty. */
 	radioVector *get();
+	/** Wait up to timeout ms for a burst; true if one is ready. */
+	bool wait(unsigned timeout);
 
 private:
-	PointerFIFO mQ;
+	InterthreadRing<radioVector> mQ;
 };
 
 class VectorQueue : public InterthreadPriorityQueue<radioVector> {
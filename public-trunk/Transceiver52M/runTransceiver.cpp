@@ -29,10 +29,14 @@
 
 #include <time.h>
 #include <signal.h>
+#include <string.h>
+#include <errno.h>
+#include <sstream>
 
 #include <GSMCommon.h>
 #include <Logger.h>
 #include <Configuration.h>
+#include <MemoryLock.h>
 
 #ifdef RESAMPLE
   #define DEVICERATE 400e3
@@ -40,6 +44,9 @@
   #define DEVICERATE 1625e3/6 
 #endif
 
+/** Seconds between page-fault reports in deterministic-memory mode. */
+#define PAGEFAULTREPORTPERIOD 60
+
 using namespace std;
 
 ConfigurationTable gConfig;
@@ -67,29 +74,75 @@ int main(int argc, char *argv[])
     exit(1);
   }
 
+  // Deterministic-memory mode must be enabled before any threads start.
+  bool lockMemory = false;
+  unsigned numModulators = TXMODULATORS;
+  while ((argc>1) && (argv[1][0]=='-')) {
+    if (strcmp(argv[1],"-m")==0) lockMemory = true;
+    else if (strcmp(argv[1],"-a")==0) gAllocTracking = true;
+    else if ((strcmp(argv[1],"-w")==0) && (argc>2)) {
+      numModulators = atoi(argv[2]);
+      argc--; argv++;
+    }
+    else break;
+    argc--; argv++;
+  }
+
   // Configure logger.
   if (argc<2) {
-    cerr << argv[0] << " <logLevel> [logFilePath]" << endl;
+    cerr << argv[0] << " [-m] [-a] [-w workers] <logLevel> [logFilePath]" << endl;
     cerr << "Log levels are ERROR, ALARM, WARN, NOTICE, INFO, DEBUG, DEEPDEBUG" << endl;
+    cerr << "-m locks all memory and prefaults thread stacks and sample buffers" << endl;
+    cerr << "-a counts allocations per thread and logs them periodically" << endl;
+    cerr << "-w sets the number of transmit modulation threads, 0 to modulate on the socket thread (default " << TXMODULATORS << ")" << endl;
     exit(0);
   }
   gLogInit(argv[1]);
   if (argc>2) gSetLogFile(argv[2]);
 
+  if (lockMemory) {
+    if (gEnableDeterministicMemory()) {
+      LOG(NOTICE) << "deterministic-memory mode, all memory locked";
+    } else {
+      LOG(ALARM) << "deterministic-memory mode, but mlockall failed: " << strerror(errno);
+    }
+  }
+
   srandom(time(NULL));
 
+  AllocScope allocScope(AllocTransceiver);
+
   RadioDevice *usrp = RadioDevice::make(DEVICERATE);
   if (!usrp->open()) {
     //delete usrp;
     return EXIT_FAILURE;
   }
   RadioInterface* radio = new RadioInterface(usrp,3);
-  Transceiver *trx = new Transceiver(5700,"127.0.0.1",SAMPSPERSYM,GSM::Time(3,0),radio);
+  Transceiver *trx = new Transceiver(5700,"127.0.0.1",SAMPSPERSYM,GSM::Time(3,0),radio,numModulators);
   trx->receiveFIFO(radio->receiveFIFO());
 
   trx->start();
-  //int i = 0;
-  while(!gbShutdown) { sleep(1); }//i++; if (i==60) break;}
+  // Establish the fault baseline so later reports show only steady-state faults.
+  ostringstream faults;
+  if (lockMemory) gPageFaultReport(faults,true);
+  unsigned seconds = 0;
+  while(!gbShutdown) {
+    sleep(1);
+    if (++seconds % PAGEFAULTREPORTPERIOD) continue;
+    if (gAllocTracking) {
+      ostringstream allocs;
+      gAllocReport(allocs);
+      LOG(NOTICE) << "allocations:\n" << allocs.str();
+    }
+    if (!lockMemory) continue;
+    faults.str("");
+    unsigned long count = gPageFaultReport(faults,true);
+    if (count) {
+      LOG(WARN) << count << " page faults in last " << PAGEFAULTREPORTPERIOD << " seconds:\n" << faults.str();
+    } else {
+      LOG(INFO) << "no page faults in last " << PAGEFAULTREPORTPERIOD << " seconds";
+    }
+  }
 
   cout << "Shutting down transceiver..." << endl;
 
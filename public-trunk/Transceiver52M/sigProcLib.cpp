@@ -33,8 +33,26 @@
 
 #include <Logger.h>
 
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
 #define TABLESIZE 1024
 
+/** Fractional-delay filter bank dimensions */
+#define FRACDELAYRES 64      ///< number of filter phases per sample
+#define FRACDELAYHALF 10     ///< one-sided span of each sinc kernel
+#define FRACDELAYTAPS 22     ///< taps per phase, 2*FRACDELAYHALF+1 padded to an even count
+
+/** DFE workspace dimensions */
+#define DFEMAXFF 8           ///< maximum number of feedforward taps
+#define DFEMAXCHAN 24        ///< maximum channel response length, less one
+#define DFEMAXBURST 1024     ///< maximum burst length, in samples
+
+/** Burst search dimensions */
+#define CORRMAXTAPS 158      ///< longest correlation sequence (modulateBurst output), padded to an even count
+#define CORRREFINEMARGIN 14  ///< lags either side of a peak read by the early-late interpolation
+
 /** Lookup tables for trigonometric approximation */
 float cosTable[TABLESIZE+1]; // add 1 element for wrap around
 float sinTable[TABLESIZE+1];
@@ -44,6 +62,13 @@ static const float M_PI_F = (float)M_PI;
 static const float M_2PI_F = (float)(2.0*M_PI);
 static const float M_1_2PI_F = 1/M_2PI_F;
 
+/**
+  Polyphase fractional-delay filter bank.
+  Row p holds sinc(pi*(k-FRACDELAYHALF-p/FRACDELAYRES)) for k in [0,2*FRACDELAYHALF],
+  with each tap stored twice so that it multiplies both halves of an interleaved complex sample.
+*/
+static float fracDelayTable[FRACDELAYRES+1][2*FRACDELAYTAPS] __attribute__((aligned(16)));
+
 /** Static vectors that contain a precomputed +/- f_b/4 sinusoid */ 
 signalVector *GMSKRotation = NULL;
 signalVector *GMSKReverseRotation = NULL;
@@ -54,11 +79,21 @@ typedef struct {
   signalVector *sequenceReversedConjugated;
   float        TOA;
   complex      gain;
+  const float  *tapsRe;     ///< sequence in complexDotProduct form, NULL if too long
+  const float  *tapsIm;
+  int          tapsLen;
 } CorrelationSequence;
 
 CorrelationSequence *gMidambles[] = {NULL,NULL,NULL,NULL,NULL,NULL,NULL,NULL};
 CorrelationSequence *gRACHSequence = NULL;
 
+/** Dot-product taps for the 8 midambles and, in the last row, the RACH sequence */
+static float corrTapsRe[9][2*CORRMAXTAPS] __attribute__((aligned(16)));
+static float corrTapsIm[9][2*CORRMAXTAPS] __attribute__((aligned(16)));
+
+/** Use the two-stage burst search in detectRACHBurst and analyzeTrafficBurst */
+static bool twoStageSearch = true;
+
 void sigProcLibDestroy(void) {
   if (GMSKRotation) {
     delete GMSKRotation;
@@ -227,9 +262,25 @@ void initGMSKRotationTables(int samplesPerSymbol) {
   }
 }
 
+void initFracDelayTable() {
+  for (int p = 0; p <= FRACDELAYRES; p++) {
+    float *taps = fracDelayTable[p];
+    for (int k = 0; k < FRACDELAYTAPS; k++) {
+      double arg = M_PI*(k - FRACDELAYHALF - (double) p/FRACDELAYRES);
+      float tap;
+      if (k > 2*FRACDELAYHALF) tap = 0.0F;
+      else if (fabs(arg) < 1e-6) tap = 1.0F;
+      else tap = sin(arg)/arg;
+      taps[2*k] = tap;
+      taps[2*k+1] = tap;
+    }
+  }
+}
+
 void sigProcLibSetup(int samplesPerSymbol) {
   initTrigTables();
   initGMSKRotationTables(samplesPerSymbol);
+  initFracDelayTable();
 }
 
 void GMSKRotate(signalVector &x) {
@@ -548,13 +599,14 @@ signalVector *modulateBurst(const BitVector &wBurst,
 			    int samplesPerSymbol)
 {
 
-  static complex staticBurst[157];
+  // on the stack, so that bursts can be modulated concurrently
+  complex burstData[157];
 
   int burstSize = samplesPerSymbol*(wBurst.size()+guardPeriodLength);
-  signalVector modBurst((complex *) staticBurst,0,burstSize);
+  signalVector modBurst((complex *) burstData,0,burstSize);
   //signalVector *modBurst = new signalVector(burstSize);
   modBurst.isRealOnly(true);
-  memset(staticBurst,0,sizeof(complex)*burstSize);
+  memset(burstData,0,sizeof(complex)*burstSize);
   //modBurst.fill(0.0);
   signalVector::iterator modBurstItr = modBurst.begin();
 
@@ -598,6 +650,91 @@ float sinc(float x)
   return 1.0F;
 }
 
+/**
+  Complex dot product of x against taps prepared by prepareDotTaps.
+  tapsRe holds each tap's real part twice, tapsIm holds (-imag,imag) pairs,
+  so the sum is x*re + swap(x)*im over interleaved floats.
+  len is in complex samples and must be even.
+*/
+static complex complexDotProduct(const complex *x, const float *tapsRe, const float *tapsIm, int len)
+{
+  const float *xf = (const float *) x;
+#ifdef __SSE__
+  __m128 accRe = _mm_setzero_ps();
+  __m128 accIm = _mm_setzero_ps();
+  for (int k = 0; k < 2*len; k += 4) {
+    __m128 xv = _mm_loadu_ps(xf+k);
+    __m128 xs = _mm_shuffle_ps(xv,xv,_MM_SHUFFLE(2,3,0,1));
+    accRe = _mm_add_ps(accRe, _mm_mul_ps(xv, _mm_load_ps(tapsRe+k)));
+    accIm = _mm_add_ps(accIm, _mm_mul_ps(xs, _mm_load_ps(tapsIm+k)));
+  }
+  float sum[4] __attribute__((aligned(16)));
+  _mm_store_ps(sum, _mm_add_ps(accRe,accIm));
+  return complex(sum[0]+sum[2], sum[1]+sum[3]);
+#else
+  float sumR = 0.0F, sumI = 0.0F;
+  for (int k = 0; k < 2*len; k += 2) {
+    sumR += xf[k]*tapsRe[k] + xf[k+1]*tapsIm[k];
+    sumI += xf[k+1]*tapsRe[k+1] + xf[k]*tapsIm[k+1];
+  }
+  return complex(sumR, sumI);
+#endif
+}
+
+/**
+  Time-reverse the N taps of h into the form used by complexDotProduct,
+  zero-padded to an even length, which is returned.
+*/
+static int prepareDotTaps(const complex *h, int N, float *tapsRe, float *tapsIm)
+{
+  int padded = (N+1) & ~1;
+  for (int k = 0; k < padded; k++) {
+    complex tap = (k < N) ? h[N-1-k] : complex(0.0);
+    tapsRe[2*k] = tap.real();
+    tapsRe[2*k+1] = tap.real();
+    tapsIm[2*k] = -tap.imag();
+    tapsIm[2*k+1] = tap.imag();
+  }
+  return padded;
+}
+
+/**
+  Apply one phase of the fractional-delay filter bank, centered on sample base.
+  Samples outside of [0,len) are treated as zero.
+  The fully overlapped case runs as a straight dot product over interleaved floats.
+*/
+static complex fracDelayFilter(const complex *x, int len, int base, int phase)
+{
+  const float *taps = fracDelayTable[phase];
+  int start = base - FRACDELAYHALF;
+
+  if ((start >= 0) && (start + FRACDELAYTAPS <= len)) {
+    const float *xf = (const float *) (x + start);
+#ifdef __SSE__
+    __m128 acc = _mm_setzero_ps();
+    for (int k = 0; k < 2*FRACDELAYTAPS; k += 4)
+      acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(xf+k), _mm_load_ps(taps+k)));
+    float sum[4] __attribute__((aligned(16)));
+    _mm_store_ps(sum, acc);
+    return complex(sum[0]+sum[2], sum[1]+sum[3]);
+#else
+    float sumR = 0.0F, sumI = 0.0F;
+    for (int k = 0; k < 2*FRACDELAYTAPS; k += 2) {
+      sumR += xf[k]*taps[k];
+      sumI += xf[k+1]*taps[k+1];
+    }
+    return complex(sumR, sumI);
+#endif
+  }
+
+  complex sum = 0.0;
+  int kStart = (start < 0) ? -start : 0;
+  int kEnd = (start + FRACDELAYTAPS > len) ? len - start : FRACDELAYTAPS;
+  for (int k = kStart; k < kEnd; k++)
+    sum += x[start+k] * taps[2*k];
+  return sum;
+}
+
 void delayVector(signalVector &wBurst,
 		 float delay)
 {
@@ -605,19 +742,22 @@ void delayVector(signalVector &wBurst,
   int   intOffset = (int) floor(delay);
   float fracOffset = delay - intOffset;
   
-  // do fractional shift first, only do it for reasonable offsets
-  if (fabs(fracOffset) > 1e-2) {
-    // create sinc function
-    static complex staticData[21];
-    signalVector sincVector(staticData,0,21); 
-    sincVector.isRealOnly(true);
-    signalVector::iterator sincBurstItr = sincVector.begin();
-    for (int i = 0; i < 21; i++) 
-      *sincBurstItr++ = (complex) sinc(M_PI_F*(i-10-fracOffset));
-  
+  // quantize the fractional shift to the filter bank resolution
+  int phase = (int) rint(fracOffset*FRACDELAYRES);
+  if (phase == FRACDELAYRES) {
+    intOffset++;
+    phase = 0;
+  }
+
+  // do fractional shift first, only do it for non-zero filter phases
+  // delaying by phase/FRACDELAYRES is interpolating at n-1+(FRACDELAYRES-phase)/FRACDELAYRES
+  if (phase != 0) {
     static complex shiftedData[300];
-    signalVector shiftedBurst(shiftedData,0,wBurst.size());
-    convolve(&wBurst,&sincVector,&shiftedBurst,NO_DELAY);
+    int len = wBurst.size();
+    const complex *burst = wBurst.begin();
+    for (int n = 0; n < len; n++)
+      shiftedData[n] = fracDelayFilter(burst,len,n-1,FRACDELAYRES-phase);
+    signalVector shiftedBurst(shiftedData,0,len);
     wBurst.clone(shiftedBurst);
   }
 
@@ -665,52 +805,38 @@ complex interpolatePoint(const signalVector &inSig,
 			 float ix)
 {
   
-  int start = (int) (floor(ix) - 10);
-  if (start < 0) start = 0;
-  int end = (int) (floor(ix) + 11);
-  if ((unsigned) end > inSig.size()-1) end = inSig.size()-1;
-  
-  complex pVal = 0.0;
-  if (!inSig.isRealOnly()) {
-    for (int i = start; i < end; i++) 
-      pVal += inSig[i] * sinc(M_PI_F*(i-ix));
-  }
-  else {
-    for (int i = start; i < end; i++) 
-      pVal += inSig[i].real() * sinc(M_PI_F*(i-ix));
+  int base = (int) floor(ix);
+  int phase = (int) rint((ix - base)*FRACDELAYRES);
+  if (phase == FRACDELAYRES) {
+    base++;
+    phase = 0;
   }
+
+  // the last sample of the vector is not used, as before
+  complex pVal = fracDelayFilter(inSig.begin(),inSig.size()-1,base,phase);
+  if (inSig.isRealOnly()) pVal = pVal.real();
    
   return pVal;
 }
 
   
  
-complex peakDetect(const signalVector &rxBurst,
-		   float *peakIndex,
-		   float *avgPwr) 
+/**
+  Early-late refinement of an integer peak with the fractional-delay filter bank.
+  Only reads samples within CORRREFINEMARGIN of maxIndex.
+*/
+static complex peakInterpolate(const signalVector &rxBurst,
+			       float maxIndex,
+			       float *peakIndex)
 {
-  
-
-  complex maxVal = 0.0;
-  float maxIndex = -1;
-  float sumPower = 0.0;
-
-  for (unsigned int i = 0; i < rxBurst.size(); i++) {
-    float samplePower = rxBurst[i].norm2();
-    if (samplePower > maxVal.real()) {
-      maxVal = samplePower;
-      maxIndex = i;
-    }
-    sumPower += samplePower;
-  }
-
   // interpolate around the peak
   // to save computation, we'll use early-late balancing
   float earlyIndex = maxIndex-1;
   float lateIndex = maxIndex+1;
   
+  // no point in searching below the resolution of the fractional-delay filter bank
   float incr = 0.5;
-  while (incr > 1.0/1024.0) {
+  while (incr >= 0.5/FRACDELAYRES) {
     complex earlyP = interpolatePoint(rxBurst,earlyIndex);
     complex lateP =  interpolatePoint(rxBurst,lateIndex);
     if (earlyP < lateP) 
@@ -723,11 +849,35 @@ complex peakDetect(const signalVector &rxBurst,
   }
 
   maxIndex = earlyIndex + 1.0;
-  maxVal = interpolatePoint(rxBurst,maxIndex);
+  complex maxVal = interpolatePoint(rxBurst,maxIndex);
 
   if (peakIndex!=NULL)
     *peakIndex = maxIndex;
 
+  return maxVal;
+}
+
+complex peakDetect(const signalVector &rxBurst,
+		   float *peakIndex,
+		   float *avgPwr) 
+{
+  
+
+  complex maxVal = 0.0;
+  float maxIndex = -1;
+  float sumPower = 0.0;
+
+  for (unsigned int i = 0; i < rxBurst.size(); i++) {
+    float samplePower = rxBurst[i].norm2();
+    if (samplePower > maxVal.real()) {
+      maxVal = samplePower;
+      maxIndex = i;
+    }
+    sumPower += samplePower;
+  }
+
+  maxVal = peakInterpolate(rxBurst,maxIndex,peakIndex);
+
   if (avgPwr!=NULL)
     *avgPwr = (sumPower-maxVal.norm2()) / (rxBurst.size()-1);
 
@@ -735,6 +885,7 @@ complex peakDetect(const signalVector &rxBurst,
 
 }
 
+
 void scaleVector(signalVector &x,
 		 complex scale)
 {
@@ -801,6 +952,19 @@ void offsetVector(signalVector &x,
   }
 }
 
+/** Load the dot-product form of a correlation sequence into one row of the tap tables. */
+static void prepareCorrelationTaps(CorrelationSequence *seq, int row)
+{
+  const signalVector *b = seq->sequenceReversedConjugated;
+  seq->tapsRe = NULL;
+  seq->tapsIm = NULL;
+  seq->tapsLen = 0;
+  if (b->size() > CORRMAXTAPS) return;
+  seq->tapsLen = prepareDotTaps(b->begin(),b->size(),corrTapsRe[row],corrTapsIm[row]);
+  seq->tapsRe = corrTapsRe[row];
+  seq->tapsIm = corrTapsIm[row];
+}
+
 bool generateMidamble(signalVector &gsmPulse,
 		      int samplesPerSymbol,
 		      int TSC)
@@ -845,6 +1009,7 @@ bool generateMidamble(signalVector &gsmPulse,
   gMidambles[TSC] = new CorrelationSequence;
   gMidambles[TSC]->sequence = middleMidamble;
   gMidambles[TSC]->sequenceReversedConjugated = reverseConjugate(middleMidamble);
+  prepareCorrelationTaps(gMidambles[TSC],TSC);
   gMidambles[TSC]->gain = peakDetect(*autocorr,&gMidambles[TSC]->TOA,NULL);
 
   LOG(DEBUG) << "midamble autocorr: " << *autocorr;
@@ -882,6 +1047,7 @@ bool generateRACHSequence(signalVector &gsmPulse,
   gRACHSequence = new CorrelationSequence;
   gRACHSequence->sequence = RACHSeq;
   gRACHSequence->sequenceReversedConjugated = reverseConjugate(RACHSeq);
+  prepareCorrelationTaps(gRACHSequence,8);
   gRACHSequence->gain = peakDetect(*autocorr,&gRACHSequence->TOA,NULL);
  
   delete autocorr;
@@ -891,6 +1057,114 @@ bool generateRACHSequence(signalVector &gsmPulse,
 }
 
 				
+void setTwoStageBurstSearch(bool twoStage)
+{
+  twoStageSearch = twoStage;
+}
+
+/**
+  One output sample of correlate(x,seq->sequenceReversedConjugated,...,true),
+  at index t of the full-span correlation.  Samples outside of x are treated as zero.
+*/
+static complex correlateLag(const signalVector &x,
+			    const CorrelationSequence *seq,
+			    int t)
+{
+  const signalVector *b = seq->sequenceReversedConjugated;
+  int Lb = b->size();
+  int Lx = x.size();
+  int start = t - Lb + 1;
+  if ((start >= 0) && (start + seq->tapsLen <= Lx))
+    return complexDotProduct(x.begin()+start,seq->tapsRe,seq->tapsIm,seq->tapsLen);
+
+  complex sum = 0.0;
+  for (int k = 0; (k < Lb) && (t-k >= 0); k++)
+    if (t-k < Lx) sum += x[t-k]*(*b)[k];
+  return sum;
+}
+
+/**
+  Two-stage correlation peak search, filling corr with lags firstLag... of x.
+  The first stage evaluates every coarseStep-th lag across the whole window;
+  the second evaluates every lag within coarseStep+CORRREFINEMARGIN of the
+  strongest candidate, so peakInterpolate sees what a full correlation would give.
+  Lags in neither set are left zero.
+  @return The index of the integer peak; [*refineStart,*refineEnd) is fully evaluated.
+*/
+static int twoStagePeakSearch(const signalVector &x,
+			      const CorrelationSequence *seq,
+			      int firstLag,
+			      int coarseStep,
+			      signalVector &corr,
+			      int *refineStart,
+			      int *refineEnd)
+{
+  int len = corr.size();
+  if (coarseStep > 1) corr.fill(0.0);
+
+  int coarseIx = 0;
+  float coarseMax = -1.0F;
+  for (int i = 0; i < len; i += coarseStep) {
+    corr[i] = correlateLag(x,seq,firstLag+i);
+    float power = corr[i].norm2();
+    if (power > coarseMax) {
+      coarseMax = power;
+      coarseIx = i;
+    }
+  }
+
+  int start = coarseIx - coarseStep - CORRREFINEMARGIN;
+  if (start < 0) start = 0;
+  int end = coarseIx + coarseStep + CORRREFINEMARGIN + 1;
+  if (end > len) end = len;
+  for (int i = start; i < end; i++)
+    if (i % coarseStep) corr[i] = correlateLag(x,seq,firstLag+i);
+
+  // the true peak is next to the coarse winner
+  int peakIx = coarseIx;
+  float peakMax = coarseMax;
+  for (int i = coarseIx-coarseStep+1; i < coarseIx+coarseStep; i++) {
+    if ((i < 0) || (i >= len)) continue;
+    float power = corr[i].norm2();
+    if (power > peakMax) {
+      peakMax = power;
+      peakIx = i;
+    }
+  }
+
+  *refineStart = start;
+  *refineEnd = end;
+  return peakIx;
+}
+
+/** Evaluate the lags skipped by twoStagePeakSearch. */
+static void completeCorrelation(const signalVector &x,
+				const CorrelationSequence *seq,
+				int firstLag,
+				int coarseStep,
+				signalVector &corr,
+				int refineStart,
+				int refineEnd)
+{
+  for (int i = 0; i < (int) corr.size(); i++) {
+    if ((i % coarseStep == 0) || ((i >= refineStart) && (i < refineEnd))) continue;
+    corr[i] = correlateLag(x,seq,firstLag+i);
+  }
+}
+
+/**
+  Lag spacing of the first search stage, or 0 to fall back on the full correlation.
+  The spacing is one symbol; at symbol-rate sampling the main lobe of the correlation
+  is a single sample wide, so no lag can be skipped and only the refinement is local.
+*/
+static int coarseSearchStep(const signalVector &rxBurst,
+			    const CorrelationSequence *seq,
+			    int samplesPerSymbol)
+{
+  if (!twoStageSearch || (seq->tapsRe==NULL) || rxBurst.isRealOnly()) return 0;
+  return samplesPerSymbol;
+}
+
 bool detectRACHBurst(signalVector &rxBurst,
 		     float detectThreshold,
 		     int samplesPerSymbol,
@@ -901,10 +1175,24 @@ bool detectRACHBurst(signalVector &rxBurst,
   static complex staticData[500];
 
   signalVector correlatedRACH(staticData,0,rxBurst.size());
-  correlate(&rxBurst,gRACHSequence->sequenceReversedConjugated,&correlatedRACH,NO_DELAY,true);
 
-  float meanPower;
-  complex peakAmpl = peakDetect(correlatedRACH,TOA,&meanPower);
+  complex peakAmpl;
+  int coarseStep = coarseSearchStep(rxBurst,gRACHSequence,samplesPerSymbol);
+  int refineStart = 0;
+  int refineEnd = correlatedRACH.size();
+  if (coarseStep > 0) {
+    // same lags as the NO_DELAY correlation
+    int Lb = gRACHSequence->sequenceReversedConjugated->size();
+    int firstLag = (Lb % 2) ? Lb/2 : Lb/2-1;
+    int peakIx = twoStagePeakSearch(rxBurst,gRACHSequence,firstLag,coarseStep,
+				    correlatedRACH,&refineStart,&refineEnd);
+    peakAmpl = peakInterpolate(correlatedRACH,peakIx,TOA);
+  }
+  else {
+    correlate(&rxBurst,gRACHSequence->sequenceReversedConjugated,&correlatedRACH,NO_DELAY,true);
+    peakAmpl = peakDetect(correlatedRACH,TOA,NULL);
+    coarseStep = 1;
+  }
 
   float valleyPower = 0.0; 
 
@@ -917,10 +1205,13 @@ bool detectRACHBurst(signalVector &rxBurst,
 
   LOG(DEEPDEBUG) << "RACH corr: " << correlatedRACH;
 
+  // the valley is estimated from whichever lags the search evaluated
   float numSamples = 0.0;
   for (int i = 57*samplesPerSymbol; i <= 107*samplesPerSymbol;i++) {
     if (peakPtr+i >= correlatedRACH.end())
       break;
+    int ix = peakPtr+i-correlatedRACH.begin();
+    if ((ix % coarseStep) && ((ix < refineStart) || (ix >= refineEnd))) continue;
     valleyPower += (peakPtr+i)->norm2();
     numSamples++;
   }
@@ -995,12 +1286,22 @@ bool analyzeTrafficBurst(signalVector &rxBurst,
 
   static complex staticData[200];
   signalVector correlatedBurst(staticData,0,corrLen);
-  correlate(&burstSegment, gMidambles[TSC]->sequenceReversedConjugated,
+
+  int coarseStep = coarseSearchStep(rxBurst,gMidambles[TSC],samplesPerSymbol);
+  int refineStart = 0;
+  int refineEnd = corrLen;
+  if (coarseStep > 0) {
+    int peakIx = twoStagePeakSearch(burstSegment,gMidambles[TSC],expectedTOAPeak-maxTOA,coarseStep,
+				    correlatedBurst,&refineStart,&refineEnd);
+    *amplitude = peakInterpolate(correlatedBurst,peakIx,TOA);
+  }
+  else {
+    correlate(&burstSegment, gMidambles[TSC]->sequenceReversedConjugated,
 					    &correlatedBurst, CUSTOM,true,
 					    expectedTOAPeak-maxTOA,corrLen);
-
-  float meanPower;
-  *amplitude = peakDetect(correlatedBurst,TOA,&meanPower);
+    *amplitude = peakDetect(correlatedBurst,TOA,NULL);
+    coarseStep = 1;
+  }
   float valleyPower = 0.0; //amplitude->norm2();
   complex *peakPtr = correlatedBurst.begin() + (int) rint(*TOA);
 
@@ -1044,6 +1345,10 @@ bool analyzeTrafficBurst(signalVector &rxBurst,
   LOG(DEBUG) << "autocorr: " << correlatedBurst;
   
   if (requestChannel && (peakToMean > detectThreshold)) {
+    // the channel estimate is taken from the whole correlation
+    if (coarseStep > 1)
+      completeCorrelation(burstSegment,gMidambles[TSC],expectedTOAPeak-maxTOA,coarseStep,
+			  correlatedBurst,refineStart,refineEnd);
     float TOAoffset = maxTOA; //gMidambles[TSC]->TOA+(66*samplesPerSymbol-startIx);
     delayVector(correlatedBurst,-(*TOA));
     // midamble only allows estimation of a 6-tap channel
@@ -1279,6 +1584,7 @@ signalVector *resampleVector(signalVector &wVector,
 
 // Assumes symbol-spaced sampling!!!
 // Based upon paper by Al-Dhahir and Cioffi
+// The recursion runs on a fixed workspace; the output filters are reused if already allocated.
 bool designDFE(signalVector &channelResponse,
 	       float SNRestimate,
 	       int Nf,
@@ -1286,87 +1592,79 @@ bool designDFE(signalVector &channelResponse,
 	       signalVector **feedbackFilter)
 {
   
-  signalVector G0(Nf);
-  signalVector G1(Nf);
-  signalVector::iterator G0ptr = G0.begin();
-  signalVector::iterator G1ptr = G1.begin();
+  int nu = channelResponse.size()-1;
+  if ((Nf < 1) || (Nf > DFEMAXFF) || (nu < 0) || (nu > DFEMAXCHAN)) {
+    LOG(WARN) << "DFE design with " << Nf << " feedforward taps and " << nu+1 << " channel taps exceeds the workspace";
+    return false;
+  }
+
+  complex G0[DFEMAXFF];
+  complex G1[DFEMAXFF];
+  complex L[DFEMAXFF][2*DFEMAXFF+DFEMAXCHAN];
   signalVector::iterator chanPtr = channelResponse.begin();
 
-  int nu = channelResponse.size()-1;
+  for (int j = 0; j < Nf; j++) {
+    G0[j] = 0.0;
+    G1[j] = (j <= nu) ? chanPtr[j].conj() : complex(0.0);
+  }
+  G0[0] = 1.0/sqrtf(SNRestimate);
 
-  *G0ptr = 1.0/sqrtf(SNRestimate);
-  for(int j = 0; j <= nu; j++) {
-    *G1ptr = chanPtr->conj();
-    G1ptr++; chanPtr++;
-  }
-
-  signalVector *L[Nf];
-  signalVector::iterator Lptr;
-  float d;
-  for(int i = 0; i < Nf; i++) {
-    d = G0.begin()->norm2() + G1.begin()->norm2();
-    L[i] = new signalVector(Nf+nu);
-    Lptr = L[i]->begin()+i;
-    G0ptr = G0.begin(); G1ptr = G1.begin();
-    while ((G0ptr < G0.end()) &&  (Lptr < L[i]->end())) {
-      *Lptr = (*G0ptr*(G0.begin()->conj()) + *G1ptr*(G1.begin()->conj()) )/d;
-      Lptr++;
-      G0ptr++;
-      G1ptr++;
-    }
-    complex k = (*G1.begin())/(*G0.begin());
+  float d = 0.0;
+  for (int i = 0; i < Nf; i++) {
+    d = G0[0].norm2() + G1[0].norm2();
+    complex *Lrow = L[i];
+    for (int j = 0; j < Nf+nu+Nf; j++) Lrow[j] = 0.0;
+    complex G0conj = G0[0].conj();
+    complex G1conj = G1[0].conj();
+    for (int j = 0; (j < Nf) && (i+j < Nf+nu); j++)
+      Lrow[i+j] = (G0[j]*G0conj + G1[j]*G1conj)/d;
+    complex k = G1[0]/G0[0];
 
     if (i != Nf-1) {
-      signalVector G0new = G1;
-      scaleVector(G0new,k.conj());
-      addVector(G0new,G0);
-
-      signalVector G1new = G0;
-      scaleVector(G1new,k*(-1.0));
-      addVector(G1new,G1);
-      delayVector(G1new,-1.0);
-
-      scaleVector(G0new,1.0/sqrtf(1.0+k.norm2()));
-      scaleVector(G1new,1.0/sqrtf(1.0+k.norm2()));
-      G0 = G0new;
-      G1 = G1new;
+      // G0 <- (G0 + conj(k)*G1)/sqrt(1+|k|^2)
+      // G1 <- (G1 - k*G0)/sqrt(1+|k|^2), advanced by one tap
+      float norm = 1.0/sqrtf(1.0+k.norm2());
+      complex kConj = k.conj();
+      for (int j = 0; j < Nf; j++) {
+        complex g0 = G0[j];
+        complex g1 = G1[j];
+        G0[j] = (g0 + g1*kConj)*norm;
+        if (j > 0) G1[j-1] = (g1 - g0*k)*norm;
+      }
+      G1[Nf-1] = 0.0;
     }
   }
 
-  *feedbackFilter = new signalVector(nu);
-  L[Nf-1]->segmentCopyTo(**feedbackFilter,Nf,nu);
-  scaleVector(**feedbackFilter,(complex) -1.0);
-  conjugateVector(**feedbackFilter);
-
-  signalVector v(Nf);
-  signalVector::iterator vStart = v.begin();
-  signalVector::iterator vPtr;
-  *(vStart+Nf-1) = (complex) 1.0;
-  for(int k = Nf-2; k >= 0; k--) {
-    Lptr = L[k]->begin()+k+1;
-    vPtr = vStart + k+1;
+  if (*feedbackFilter && ((*feedbackFilter)->size() != (unsigned) nu)) {
+    delete *feedbackFilter;
+    *feedbackFilter = NULL;
+  }
+  if (!*feedbackFilter) *feedbackFilter = new signalVector(nu);
+  signalVector::iterator bPtr = (*feedbackFilter)->begin();
+  for (int j = 0; j < nu; j++)
+    *bPtr++ = L[Nf-1][Nf+j].conj()*(-1.0F);
+
+  complex v[DFEMAXFF];
+  v[Nf-1] = 1.0;
+  for (int k = Nf-2; k >= 0; k--) {
     complex v_k = 0.0;
-    for (int j = k+1; j < Nf; j++) {
-      v_k -= (*vPtr)*(*Lptr);
-      vPtr++; Lptr++;
-    }
-     *(vStart + k) = v_k;
+    for (int j = k+1; j < Nf; j++)
+      v_k -= v[j]*L[k][j];
+    v[k] = v_k;
   }
 
-  *feedForwardFilter = new signalVector(Nf);
+  if (*feedForwardFilter && ((*feedForwardFilter)->size() != (unsigned) Nf)) {
+    delete *feedForwardFilter;
+    *feedForwardFilter = NULL;
+  }
+  if (!*feedForwardFilter) *feedForwardFilter = new signalVector(Nf);
   signalVector::iterator w = (*feedForwardFilter)->begin();
   for (int i = 0; i < Nf; i++) {
-    delete L[i];
     complex w_i = 0.0;
     int endPt = ( nu < (Nf-1-i) ) ? nu : (Nf-1-i);
-    vPtr = vStart+i;
-    chanPtr = channelResponse.begin();
-    for (int k = 0; k < endPt+1; k++) {
-      w_i += (*vPtr)*(chanPtr->conj());
-      vPtr++; chanPtr++;
-    }
-    *w = w_i/d;
-    w++;
+    for (int k = 0; k < endPt+1; k++)
+      w_i += v[i+k]*(chanPtr[k].conj());
+    *w++ = w_i/d;
   }
 
 
@@ -1382,53 +1680,58 @@ SoftVector *equalizeBurst(signalVector &rxBurst,
 		       signalVector &b) // feedback filter
 {
 
-  delayVector(rxBurst,-TOA);
+  int len = rxBurst.size();
+  int Nf = w.size();
+  int Nb = b.size();
+  if ((len > DFEMAXBURST) || (Nf > DFEMAXFF)) {
+    LOG(WARN) << "DFE equalization of " << len << " samples with " << Nf << " feedforward taps exceeds the workspace";
+    return NULL;
+  }
 
-  signalVector* postForwardFull = convolve(&rxBurst,&w,NULL,FULL_SPAN);
+  delayVector(rxBurst,-TOA);
 
-  signalVector* postForward = new signalVector(rxBurst.size());
-  postForwardFull->segmentCopyTo(*postForward,w.size()-1,rxBurst.size());
-  delete postForwardFull;
+  // Time-reverse the feedforward filter so that each output sample is a straight dot product.
+  float tapsRe[2*DFEMAXFF] __attribute__((aligned(16)));
+  float tapsIm[2*DFEMAXFF] __attribute__((aligned(16)));
+  int NfPadded = prepareDotTaps(w.begin(),Nf,tapsRe,tapsIm);
+
+  // feed forward filter, equivalent to the tail-aligned FULL_SPAN convolution
+  static complex postForward[DFEMAXBURST];
+  const complex *x = rxBurst.begin();
+  for (int n = 0; n < len; n++) {
+    if (n + NfPadded <= len) {
+      postForward[n] = complexDotProduct(x+n,tapsRe,tapsIm,NfPadded);
+      continue;
+    }
+    complex sum = 0.0;
+    for (int k = 0; (k < Nf) && (n+k < len); k++)
+      sum += x[n+k]*w[Nf-1-k];
+    postForward[n] = sum;
+  }
 
-  signalVector::iterator dPtr = postForward->begin();
-  signalVector::iterator dBackPtr;
   signalVector::iterator rotPtr = GMSKRotation->begin();
   signalVector::iterator revRotPtr = GMSKReverseRotation->begin();
+  signalVector::iterator bStart = b.begin();
 
-  signalVector *DFEoutput = new signalVector(postForward->size());
-  signalVector::iterator DFEItr = DFEoutput->begin();
+  SoftVector *burstBits = new SoftVector(len);
+  SoftVector::iterator burstItr = burstBits->begin();
 
   // NOTE: can insert the midamble and/or use midamble to estimate BER
-  for (; dPtr < postForward->end(); dPtr++) {
-    dBackPtr = dPtr-1;
-    signalVector::iterator bPtr = b.begin();
-    while ( (bPtr < b.end()) && (dBackPtr >= postForward->begin()) ) {
-      *dPtr = *dPtr + (*bPtr)*(*dBackPtr);
-      bPtr++;
-      dBackPtr--;
-    }
-    *dPtr = *dPtr * (*revRotPtr);
-    *DFEItr = *dPtr;
+  // Past entries of postForward are overwritten with the rotated decisions.
+  for (int n = 0; n < len; n++) {
+    complex sum = postForward[n];
+    int taps = (Nb < n) ? Nb : n;
+    for (int m = 0; m < taps; m++)
+      sum += bStart[m]*postForward[n-1-m];
+    sum = sum * revRotPtr[n];
+    // soft slicer
+    float soft = 0.5F*(sum.real()+1.0F);
+    if (soft > 1.0F) soft = 1.0F;
+    if (soft < 0.0F) soft = 0.0F;
+    *burstItr++ = soft;
     // make decision on symbol
-    *dPtr = (dPtr->real() > 0.0) ? 1.0 : -1.0;
-    //*DFEItr = *dPtr;
-    *dPtr = *dPtr * (*rotPtr);
-    DFEItr++;
-    rotPtr++;
-    revRotPtr++;
+    postForward[n] = rotPtr[n] * ((sum.real() > 0.0) ? 1.0F : -1.0F);
   }
 
-  vectorSlicer(DFEoutput);
-
-  SoftVector *burstBits = new SoftVector(postForward->size());
-  SoftVector::iterator burstItr = burstBits->begin();
-  DFEItr = DFEoutput->begin();
-  for (; DFEItr < DFEoutput->end(); DFEItr++) 
-    *burstItr++ = DFEItr->real();
-
-  delete postForward;
-
-  delete DFEoutput;
-
   return burstBits;
 }
@@ -174,7 +174,7 @@ signalVector* correlate(signalVector *a,
 /** Operate soft slicer on real-valued portion of vector */ 
 bool vectorSlicer(signalVector *x);
 
-/** GMSK modulate a GSM burst of bits */
+/** GMSK modulate a GSM burst of bits; reentrant, for the transmit modulation workers */
 signalVector *modulateBurst(const BitVector &wBurst,
 			    const signalVector &gsmPulse,
 			    int guardPeriodLength,
@@ -183,7 +183,13 @@ signalVector *modulateBurst(const BitVector &wBurst,
 /** Sinc function */
 float sinc(float x);
 
-/** Delay a vector */
+/**
+	Delay a vector.
+	The fractional part of the delay is quantized to the resolution of the
+	fractional-delay filter bank built in sigProcLibSetup().
+	@param wBurst The vector to be delayed, in place.
+	@param delay The delay in samples.
+*/
 void delayVector(signalVector &wBurst,
 		 float delay);
 
@@ -198,6 +204,8 @@ signalVector *gaussianNoise(int length,
 
 /**
 	Given a non-integer index, interpolate a sample.
+	Uses the precomputed fractional-delay filter bank, so the fractional
+	part of the index is quantized to the filter bank resolution.
 	@param inSig The signal from which to interpolate.
 	@param ix The index.
 	@return The interpolated signal value.
@@ -304,6 +312,13 @@ bool analyzeTrafficBurst(signalVector &rxBurst,
 			 signalVector** channelResponse = NULL,
 			 float *channelResponseOffset = NULL);
 
+/**
+	Select the correlation search used by detectRACHBurst and analyzeTrafficBurst.
+	@param twoStage True (the default) to search the delay window at one lag per symbol
+		and evaluate every lag only near the strongest candidate, false to evaluate every lag.
+*/
+void setTwoStageBurstSearch(bool twoStage);
+
 /**
 	Decimate a vector.
         @param wVector The vector of interest.
@@ -367,8 +382,8 @@ signalVector *resampleVector(signalVector &wVector,
 	@param channelResponse The multipath channel that we're mitigating.
 	@param SNRestimate The signal-to-noise estimate of the channel, a linear value
 	@param Nf The number of taps in the feedforward filter.
-	@param feedForwardFilter The designed feed forward filter.
-	@param feedbackFilter The designed feedback filter.
+	@param feedForwardFilter The designed feed forward filter, reused if already allocated.
+	@param feedbackFilter The designed feedback filter, reused if already allocated.
 	@return True if DFE can be designed.
 */
 bool designDFE(signalVector &channelResponse,
@@ -384,7 +399,7 @@ bool designDFE(signalVector &channelResponse,
 	@param samplesPerSymbol The number of samples per GSM symbol.
 	@param w The feed forward filter of the DFE.
 	@param b The feedback filter of the DFE.
-	@return The demodulated bit sequence.
+	@return The demodulated bit sequence, or NULL if the burst or filter exceeds the DFE workspace.
 */
 SoftVector *equalizeBurst(signalVector &rxBurst,
 		       float TOA,
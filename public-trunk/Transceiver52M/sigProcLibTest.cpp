@@ -134,7 +134,7 @@ int main(int argc, char **argv) {
   /*
   COUT("chanResp: " << *chanResp);
 
-  signalVector *w,*b;
+  signalVector *w = NULL, *b = NULL;
   designDFE(*chanResp,1.0/noisePwr,7,&w,&b); 
   COUT("w: " << *w);
   COUT("b: " << *b);
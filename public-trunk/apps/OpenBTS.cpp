@@ -41,12 +41,15 @@
 #include <CLIParser.h>
 #include <PowerManager.h>
 #include <RRLPQueryController.h>
+#include <RRLPSweep.h>
 #include <Configuration.h>
+#include <MemoryLock.h>
 
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
 #include <signal.h>
+#include <vector>
 #include <sys/stat.h>
 
 using namespace std;
@@ -119,7 +122,8 @@ GSMConfig gBTS;
 GSMConfigL1 &gBTSL1 = gBTS;
 
 /// Our interface to the software-defined radio.
-TransceiverManager gTRX(1, gConfig.getStr("TRX.IP"), gConfig.getNum("TRX.Port"));
+/// One ARFCN manager per carrier, C0 first.
+TransceiverManager gTRX(gBTS.numARFCNs(), gConfig.getStr("TRX.IP"), gConfig.getNum("TRX.Port"));
 
 /// Pointer to the server socket if we run remote CLI.
 static ConnectionServerSocket *sgCLIServerSock = NULL;
@@ -128,6 +132,10 @@ static ConnectionServerSocket *sgCLIServerSock = NULL;
 static pid_t sgTransceiverPid = 0;
 static int sgTransceiverPidFileFd = -1;
 static std::string sgTransceiverPidFile;
+static bool sgTransceiverKept = false;	///< true if we re-attached to a running transceiver
+
+static Thread sgWatchdogThread;
+static unsigned sgStallDeadline = 0;	///< ms, from Server.StallDeadline
 
 /** Function to shutdown the process when something wrong happens. */
 void shutdownOpenbts()
@@ -199,6 +207,39 @@ static int readPidFile(const std::string &lockfile, int lfp, int &pid)
 	return EXIT_SUCCESS;
 }
 
+/** Start the transceiver binary and record its PID; the PID file must be open and locked. */
+static int launchTransceiver()
+{
+	const char *TRXPath = gConfig.getStr("TRX.Path");
+	const char *TRXLogLevel = gConfig.getStr("TRX.LogLevel");
+	const char *TRXLogFileName = NULL;
+	if (gConfig.defines("TRX.LogFileName")) TRXLogFileName=gConfig.getStr("TRX.LogFileName");
+	// Build the argument list before the vfork.
+	const char *TRXArgs[10];
+	int numArgs = 0;
+	TRXArgs[numArgs++] = "transceiver";
+	if (gConfig.defines("TRX.DeterministicMemory")) TRXArgs[numArgs++] = "-m";
+	if (gConfig.defines("TRX.AllocTracking")) TRXArgs[numArgs++] = "-a";
+	if (gConfig.defines("TRX.Modulators")) {
+		TRXArgs[numArgs++] = "-w";
+		TRXArgs[numArgs++] = gConfig.getStr("TRX.Modulators");
+	}
+	TRXArgs[numArgs++] = TRXLogLevel;
+	TRXArgs[numArgs++] = TRXLogFileName;
+	TRXArgs[numArgs] = NULL;
+	sgTransceiverPid = vfork();
+	LOG_ASSERT(sgTransceiverPid>=0);
+	if (sgTransceiverPid==0) {
+		// Pid==0 means this is the process that starts the transceiver.
+		execv(TRXPath,(char* const*)TRXArgs);
+		LOG(ERROR) << "cannot start transceiver";
+		_exit(0);
+	}
+	// Now we can finally write transceiver PID to the file.
+	if (writePidFile(sgTransceiverPidFile, sgTransceiverPidFileFd, sgTransceiverPid) != EXIT_SUCCESS) return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
+
 static int startTransceiver()
 {
 	// Start the transceiver binary, if the path is defined.
@@ -215,30 +256,39 @@ static int startTransceiver()
 			return EXIT_FAILURE;
 		}
 		if (readPidFile(sgTransceiverPidFile, sgTransceiverPidFileFd, pid) == EXIT_SUCCESS) {
+			// For a warm restart, keep a transceiver that is still running.
+			// We will re-attach to it and reuse its configuration.
+			if (gConfig.defines("TRX.WarmRestart") && pid>0 && kill(pid,0)==0) {
+				LOG(NOTICE) << "re-attaching to running transceiver, pid " << pid;
+				sgTransceiverPid = pid;
+				sgTransceiverKept = true;
+				return EXIT_SUCCESS;
+			}
 			// There is no harm in this. Transceiver's owner is not
 			// running and could safely kill it.
 			kill(pid, SIGTERM);
 		}
 
-		// Start transceiver
-		const char *TRXPath = gConfig.getStr("TRX.Path");
-		const char *TRXLogLevel = gConfig.getStr("TRX.LogLevel");
-		const char *TRXLogFileName = NULL;
-		if (gConfig.defines("TRX.LogFileName")) TRXLogFileName=gConfig.getStr("TRX.LogFileName");
-		sgTransceiverPid = vfork();
-		LOG_ASSERT(sgTransceiverPid>=0);
-		if (sgTransceiverPid==0) {
-			// Pid==0 means this is the process that starts the transceiver.
-			execl(TRXPath,"transceiver",TRXLogLevel,TRXLogFileName,NULL);
-			LOG(ERROR) << "cannot start transceiver";
-			_exit(0);
-		}
-		// Now we can finally write transceiver PID to the file.
-		if (writePidFile(sgTransceiverPidFile, sgTransceiverPidFileFd, sgTransceiverPid) != EXIT_SUCCESS) return EXIT_FAILURE;
+		return launchTransceiver();
 	}
 	return EXIT_SUCCESS;
 }
 
+/**
+	Replace a kept transceiver that is set up for another configuration.
+	A transceiver that is on rejects retuning, and POWEROFF does not turn it off.
+*/
+static int restartTransceiver()
+{
+	LOG(NOTICE) << "stopping running transceiver, pid " << sgTransceiverPid;
+	kill(sgTransceiverPid, SIGTERM);
+	// It is not our child, so poll for its exit.
+	for (int i=0; i<50 && kill(sgTransceiverPid,0)==0; i++) usleep(100000);
+	if (kill(sgTransceiverPid,0)==0) kill(sgTransceiverPid, SIGKILL);
+	sgTransceiverKept = false;
+	return launchTransceiver();
+}
+
 static void serverCleanup()
 {
 	if (sgTransceiverPid) {
@@ -479,8 +529,66 @@ static void signalHandler(int sig)
 	}	
 }
 
+/** Check the service loops for stalls, four times per deadline. */
+static void *watchdogLoop(void*)
+{
+	while (true) {
+		usleep(sgStallDeadline*250);
+		std::vector<std::string> stalled, recovered;
+		gThreadStallCheck(sgStallDeadline,stalled,recovered);
+		for (unsigned i=0; i<stalled.size(); i++) LOG(ALARM) << stalled[i];
+		for (unsigned i=0; i<recovered.size(); i++) LOG(NOTICE) << recovered[i] << " recovered";
+	}
+	return NULL;
+}
+
+/**
+	Step a slot count past the C0 timeslots taken by C-IV CCCHs.
+	@param sCount The next slot, counted across all ARFCNs.
+	@param CCCHConf GSM.CCD.CCCH_CONF; C-IV CCCHs are on the even C0 timeslots up to it.
+*/
+static unsigned skipCCCHSlots(unsigned sCount, unsigned CCCHConf)
+{
+	if (CCCHConf==1) return sCount;
+	while (sCount<8 && sCount%2==0 && sCount<=CCCHConf) sCount++;
+	return sCount;
+}
+
+/**
+	List the slots left for C-VII, C-I and idle filling, as CN*8+TN.
+	Each round takes the next slot of every carrier, C0 first.
+	@param numARFCNs The number of carriers.
+	@param CCCHConf GSM.CCD.CCCH_CONF.
+	@param halfDuplex If true, use only every other timeslot.
+*/
+static std::vector<unsigned> freeSlots(unsigned numARFCNs, unsigned CCCHConf, bool halfDuplex)
+{
+	const unsigned step = halfDuplex ? 2 : 1;
+	std::vector< std::vector<unsigned> > carrierSlots(numARFCNs);
+	// C0T0 is the beacon; half duplex also skips T1.
+	unsigned TN = step;
+	while ((TN=skipCCCHSlots(TN,CCCHConf))<8) {
+		carrierSlots[0].push_back(TN);
+		TN += step;
+	}
+	for (unsigned CN=1; CN<numARFCNs; CN++) {
+		for (TN=0; TN<8; TN+=step) carrierSlots[CN].push_back(CN*8+TN);
+	}
+
+	std::vector<unsigned> retVal;
+	for (unsigned round=0; round<8; round++) {
+		for (unsigned CN=0; CN<numARFCNs; CN++) {
+			if (round<carrierSlots[CN].size()) retVal.push_back(carrierSlots[CN][round]);
+		}
+	}
+	return retVal;
+}
+
 int main(int argc, char *argv[])
 {
+	// For the bring-up time report.
+	Timeval startTime;
+
 	srandom(time(NULL));
 
 	// Catch signal to re-read config
@@ -504,6 +612,29 @@ int main(int argc, char *argv[])
 	signal(SIGTTOU,SIG_IGN);
 	signal(SIGTTIN,SIG_IGN);
 
+	if (gConfig.defines("Server.AllocTracking")) gAllocTracking = true;
+
+	// Lock memory before any of our threads start.
+	if (gConfig.defines("Server.DeterministicMemory")) {
+		if (gEnableDeterministicMemory()) {
+			LOG(NOTICE) << "deterministic-memory mode, all memory locked";
+		} else {
+			LOG(ALARM) << "deterministic-memory mode, but mlockall failed: " << strerror(errno);
+		}
+	}
+
+	// GSM 04.08 10.5.2.11: BS_AG_BLKS_RES is 3 bits, and C-V has only 3 CCCH blocks.
+	// At least one block has to be left for paging.
+	if (gConfig.defines("GSM.CCD.BS_AG_BLKS_RES")) {
+		unsigned AGBlocks = gConfig.getNum("GSM.CCD.BS_AG_BLKS_RES");
+		unsigned maxAGBlocks = gConfig.getNum("GSM.CCD.CCCH_CONF")==1 ? 2 : 7;
+		if (AGBlocks>maxAGBlocks) {
+			LOG(ALARM) << "GSM.CCD.BS_AG_BLKS_RES " << AGBlocks << " is out of range, at most "
+				<< maxAGBlocks << " with GSM.CCD.CCCH_CONF " << gConfig.getNum("GSM.CCD.CCCH_CONF");
+			return EXIT_FAILURE;
+		}
+	}
+
 	cout << endl << endl << gOpenBTSWelcome << endl;
 
 	try {
@@ -514,6 +645,10 @@ int main(int argc, char *argv[])
 	if (gConfig.defines("Control.TMSITable.SavePath")) {
 		gTMSITable.load(gConfig.getStr("Control.TMSITable.SavePath"));
 	}
+	if (gConfig.defines("Control.TMSITable.SharedPath")) {
+		// The SIP port is unique among the BTS processes on a host.
+		gTMSITable.share(gConfig.getStr("Control.TMSITable.SharedPath"),gBTS.LAI(),gConfig.getNum("SIP.Port"));
+	}
 
 	LOG(ALARM) << "OpenBTS starting, ver " << VERSION << " build date " << __DATE__;
 
@@ -522,35 +657,77 @@ int main(int argc, char *argv[])
 	// Start the SIP interface.
 	gSIPInterface.start();
 
+	// Start the USSD session workers.
+	gUSSDSessions.start(gConfig.defines("USSD.Workers") ? gConfig.getNum("USSD.Workers") : 4);
+
 	// Start the transceiver interface.
-	// Sleep long enough for the USRP to bootload.
-	sleep(5);
+	// Sleep long enough for the USRP to bootload, unless it is already running.
+	if (!sgTransceiverKept) sleep(5);
 	gTRX.start();
 
-	// Set up the interface to the radio.
-	// Get a handle to the C0 transceiver interface.
-	ARFCNManager* radio = gTRX.ARFCN(0);
+	// Set up the interfaces to the radios, one per carrier.
+	// Data and clock interface version.
+	unsigned TRXProtocol = 2;
+	if (gConfig.defines("TRX.Protocol")) TRXProtocol = gConfig.getNum("TRX.Protocol");
+	// Independent commands go out in batches, one round trip per batch.
+	// For a warm restart, a transceiver already tuned and on is kept as it is.
+	std::vector<bool> resumed(gBTS.numARFCNs(),false);
+	if (gConfig.defines("TRX.WarmRestart")) {
+		bool all = true;
+		for (unsigned CN=0; CN<gBTS.numARFCNs(); CN++) {
+			resumed[CN] = gTRX.ARFCN(CN)->resume(gBTS.ARFCN(CN),gBTS.BCC());
+			all = all && resumed[CN];
+		}
+		// Anything short of a full match on a kept transceiver means a fresh one, configured cold.
+		if (!all && sgTransceiverKept) {
+			LOG(NOTICE) << "running transceiver does not match the configuration, restarting it";
+			restartTransceiver();
+			sleep(5);
+			resumed.assign(resumed.size(),false);
+		}
+	}
+	bool resumedC0 = resumed[0];
+	for (unsigned CN=0; CN<gBTS.numARFCNs(); CN++) {
+		ARFCNManager* carrier = gTRX.ARFCN(CN);
+		LOG(NOTICE) << (resumed[CN] ? "Resuming C" : "Configuring C") << CN << " on ARFCN " << gBTS.ARFCN(CN);
+
+		if (!resumed[CN]) {
+			// Tuning.
+			carrier->beginBatch();
+			// Make sure its off for tuning.
+			carrier->powerOff();
+			// Set TSC same as BCC everywhere.
+			carrier->setTSC(gBTS.BCC());
+			// Tune.
+			carrier->tune(gBTS.ARFCN(CN));
+			carrier->endBatch();
+		}
+		carrier->setProtocol(TRXProtocol);
 
-	// Tuning.
-	// Make sure its off for tuning.
-	radio->powerOff();
-	// Set TSC same as BCC everywhere.
-	radio->setTSC(gBTS.BCC());
-	// Tune.
-	radio->tune(gConfig.getNum("GSM.ARFCN"));
+		// Turn on and power up.
+		if (!resumed[CN]) carrier->powerOn();
 
-	// Turn on and power up.
-	radio->powerOn();
-	radio->setPower(gConfig.getNum("GSM.PowerManager.MinAttenDB"));
+		// Set Receiver Gain
+		carrier->setRxGain(gConfig.getNum("GSM.RxGain"));
 
-	// Set maximum expected delay spread.
-	radio->setMaxDelay(gConfig.getNum("GSM.MaxExpectedDelaySpread"));
+		// The rest of the carrier setup, and its slot configuration,
+		// goes out in one batch, below.
+		carrier->beginBatch();
+		carrier->setPower(gConfig.getNum("GSM.PowerManager.MinAttenDB") + gBTS.ARFCNAtten(CN));
 
-	// Set Receiver Gain
-	radio->setRxGain(gConfig.getNum("GSM.RxGain"));
+		// Set maximum expected delay spread.
+		carrier->setMaxDelay(gConfig.getNum("GSM.MaxExpectedDelaySpread"));
+	}
+
+	// Get a handle to the C0 transceiver interface, for the beacon.
+	ARFCNManager* radio = gTRX.ARFCN(0);
 
-	// C-V on C0T0
-	radio->setSlot(0,5);
+	// C0T0 carries the beacon and the first CCCH, C-V or C-IV.
+	// GSM 04.08 10.5.2.11: CCCH_CONF 1 is C-V, 0, 2, 4 and 6 are C-IV on 1-4 timeslots.
+	unsigned CCCHConf = gConfig.getNum("GSM.CCD.CCCH_CONF");
+	LOG_ASSERT(CCCHConf==1 || (CCCHConf%2==0 && CCCHConf<=6));
+	if (CCCHConf==1) gBTS.createCombinationV(gTRX,0,0);
+	else gBTS.createCombinationIV(gTRX,0,0);
 	// SCH
 	SCHL1FEC SCH;
 	SCH.downstream(radio);
@@ -563,70 +740,58 @@ int main(int argc, char *argv[])
 	BCCHL1FEC BCCH;
 	BCCH.downstream(radio);
 	BCCH.open();
-	// RACH
-	RACHL1FEC RACH(gRACHC5Mapping);
-	RACH.downstream(radio);
-	RACH.open();
-	// CCCHs
-	CCCHLogicalChannel CCCH0(gCCCH_0Mapping);
-	CCCH0.downstream(radio);
-	CCCH0.open();
-	CCCHLogicalChannel CCCH1(gCCCH_1Mapping);
-	CCCH1.downstream(radio);
-	CCCH1.open();
-	CCCHLogicalChannel CCCH2(gCCCH_2Mapping);
-	CCCH2.downstream(radio);
-	CCCH2.open();
-	// use CCCHs as AGCHs
-	gBTS.addAGCH(&CCCH0);
-	gBTS.addAGCH(&CCCH1);
-	gBTS.addAGCH(&CCCH2);
-
-	// C-V C0T0 SDCCHs
-	SDCCHLogicalChannel C0T0SDCCH[4] = {
-		SDCCHLogicalChannel(0,gSDCCH_4_0),
-			SDCCHLogicalChannel(0,gSDCCH_4_1),
-			SDCCHLogicalChannel(0,gSDCCH_4_2),
-			SDCCHLogicalChannel(0,gSDCCH_4_3),
-	};
-	Thread C0T0SDCCHControlThread[4];
-	for (int i=0; i<4; i++) {
-		C0T0SDCCH[i].downstream(radio);
-		C0T0SDCCHControlThread[i].start((void*(*)(void*))Control::DCCHDispatcher,&C0T0SDCCH[i]);
-		C0T0SDCCH[i].open();
-		gBTS.addSDCCH(&C0T0SDCCH[i]);
-	}
-
-	// Count configured slots.
-	unsigned sCount = 1;
+	// Additional C-IV CCCHs on C0T2, T4 and T6.
+	for (unsigned TN=2; CCCHConf!=1 && TN<=CCCHConf; TN+=2) {
+		gBTS.createCombinationIV(gTRX,0,TN);
+	}
+	// Get the beacon on the air before configuring the rest.
+	if (!radio->endBatch()) LOG(ALARM) << "C0 beacon setup incomplete";
+	LOG(NOTICE) << "SCH/BCCH on the air " << startTime.elapsed() << " ms after start"
+		<< (resumedC0 ? ", warm restart" : ", cold start");
+	radio->beginBatch();
+	if (CCCHConf!=1 && gConfig.getNum("GSM.NumC7s")==0) {
+		LOG(WARN) << "C-IV beacon with no C-VII slots, so there are no SDCCHs";
+	}
 
 	bool halfDuplex = gConfig.defines("GSM.HalfDuplex");
 	if (halfDuplex) { LOG(NOTICE) << "Configuring for half-duplex operation." ; }
 	else { LOG(NOTICE) << "Configuring for full-duplex operation."; }
 
-	if (halfDuplex) sCount++;
+	// Collect the free slots, as CN*8+TN, taking one from each carrier in turn
+	// so that the SDCCH and TCH pools spread over the carriers.
+	std::vector<unsigned> slots = freeSlots(gBTS.numARFCNs(),CCCHConf,halfDuplex);
+	unsigned sCount = 0;
 
 	// Create C-VII slots.
 	for (int i=0; i<gConfig.getNum("GSM.NumC7s"); i++) {
-		gBTS.createCombinationVII(gTRX,sCount/8,sCount);
-		if (halfDuplex) sCount++;
+		if (sCount==slots.size()) {
+			LOG(ALARM) << "no timeslot left for C-VII " << i << ", raise the number of carriers or lower GSM.NumC7s";
+			break;
+		}
+		gBTS.createCombinationVII(gTRX,slots[sCount]/8,slots[sCount]%8);
 		sCount++;
 	}
 
 	// Create C-I slots.
 	for (int i=0; i<gConfig.getNum("GSM.NumC1s"); i++) {
-		gBTS.createCombinationI(gTRX,sCount/8,sCount);
-		if (halfDuplex) sCount++;
+		if (sCount==slots.size()) {
+			LOG(ALARM) << "no timeslot left for C-I " << i << ", raise the number of carriers or lower GSM.NumC1s";
+			break;
+		}
+		gBTS.createCombinationI(gTRX,slots[sCount]/8,slots[sCount]%8);
 		sCount++;
 	}
 
-
 	// Set up idle filling on C0 as needed.
-	while (sCount<8) {
-		gBTS.createCombination0(gTRX,sCount/8,sCount);
-		if (halfDuplex) sCount++;
-		sCount++;
+	// Only C0 must transmit in every timeslot; the other carriers leave unused slots dark.
+	for (; sCount<slots.size(); sCount++) {
+		if (slots[sCount]/8==0) gBTS.createCombination0(gTRX,0,slots[sCount]%8);
+	}
+
+	for (unsigned CN=0; CN<gBTS.numARFCNs(); CN++) {
+		if (!gTRX.ARFCN(CN)->endBatch()) LOG(ALARM) << "C" << CN << " setup incomplete";
 	}
+	LOG(NOTICE) << "all carriers configured " << startTime.elapsed() << " ms after start";
 
 	/*
 		Note: The number of different paging subchannels on       
@@ -638,10 +803,9 @@ int main(int argc, char *argv[])
 			for other values of CCCH-CONF               
 	*/
 
-	// Set up the pager.
-	// Set up paging channels.
-	// HACK -- For now, use a single paging channel, since paging groups are broken.
-	gBTS.addPCH(&CCCH2);
+	// The paging channels were set up with the CCCHs, according to BS_AG_BLKS_RES.
+	LOG(NOTICE) << gBTS.numCCCHGroups() << " CCCH timeslot(s), "
+		<< gBTS.numAGCHs() << " AGCH and " << gBTS.numPCHs() << " PCH blocks";
 
 	// Be sure we are not over-reserving.
 	LOG_ASSERT(gConfig.getNum("GSM.PagingReservations")<gBTS.numAGCHs());
@@ -649,6 +813,16 @@ int main(int argc, char *argv[])
 	// OK, now it is safe to start the BTS.
 	gBTS.start();
 
+	if (gConfig.defines("Server.StallDeadline")) {
+		sgStallDeadline = gConfig.getNum("Server.StallDeadline");
+		if (sgStallDeadline) sgWatchdogThread.start(watchdogLoop,NULL,"watchdog");
+	}
+
+	// Periodic location sweeps, the first one period after startup.
+	if (gConfig.defines("RRLP.Sweep.Period")) {
+		GSM::RRLP::RRLPSweep::instance()->start(gConfig.getNum("RRLP.Sweep.Period"),false);
+	}
+
 	LOG(INFO) << "system ready";
 #endif
 
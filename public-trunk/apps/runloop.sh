@@ -1,4 +1,12 @@
 #!/bin/sh
 
 # A script to restart and just keep OpenBTS running.
-while true; do killall transceiver; sleep 2; ./OpenBTS; done
+# With TRX.WarmRestart defined, OpenBTS re-attaches to a running transceiver,
+# so leave it alone; run with -k to restart the transceiver every time anyway.
+KILLTRX=yes
+grep -q '^TRX.WarmRestart' OpenBTS.config 2>/dev/null && KILLTRX=no
+[ "$1" = "-k" ] && KILLTRX=yes
+while true; do
+	[ $KILLTRX = yes ] && { killall transceiver; sleep 2; }
+	./OpenBTS
+done
@@ -0,0 +1,138 @@
+/*
+ * SMarena.cpp - Compact storage for queued Short Messages in smqueue.
+ *
+ * Copyright 2010 Free Software Foundation, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * See the COPYING file in the main directory for details.
+ */
+
+#include "smarena.h"
+#include <string.h>
+
+
+using namespace std;
+using namespace SMqueue;
+
+namespace SMqueue {
+	void abfuckingort();		// in smqueue.cpp
+}
+
+SMarena SMqueue::sm_arena;
+SMintern SMqueue::sm_addresses;
+
+
+SMarena::~SMarena()
+{
+	while (!chunks.empty())
+		free_chunk(chunks.begin());
+}
+
+SMarena::chunk *
+SMarena::new_chunk(size_t size)
+{
+	chunk c;
+	c.base = new char[size];
+	c.size = size;
+	c.used = 0;
+	c.live = 0;
+	c.counted = gAllocNew(size);
+	bytes_reserved += size;
+	return &chunks.insert(make_pair(c.base, c)).first->second;
+}
+
+void
+SMarena::free_chunk(chunk_map::iterator c)
+{
+	if (&c->second == current)
+		current = NULL;
+	bytes_reserved -= c->second.size;
+	gAllocDelete(c->second.counted, c->second.size);
+	delete [] c->second.base;
+	chunks.erase(c);
+}
+
+char *
+SMarena::alloc(size_t len)
+{
+	// Keep strings aligned, so a chunk never ends up with a sliver.
+	len = rounded(len);
+
+	chunk *c;
+	if (len > chunk_size / 4) {
+		// Big ones get their own chunk; it goes when they do.
+		c = new_chunk(len);
+	} else {
+		if (!current || current->size - current->used < len)
+			current = new_chunk(chunk_size);
+		c = current;
+	}
+	char *result = c->base + c->used;
+	c->used += len;
+	c->live++;
+	bytes_live += len;
+	return result;
+}
+
+char *
+SMarena::strndup(const char *str, size_t len)
+{
+	char *result = alloc(len+1);
+	memcpy(result, str, len);
+	result[len] = '\0';
+	return result;
+}
+
+char *
+SMarena::strdup(const char *str)
+{
+	return strndup(str, strlen(str));
+}
+
+void
+SMarena::release(char *str)
+{
+	if (!str)
+		return;
+	// The owner is the chunk with the highest base at or below str.
+	chunk_map::iterator c = chunks.upper_bound(str);
+	if (c == chunks.begin())
+		abfuckingort();		// Not ours!
+	--c;
+	chunk &ch = c->second;
+	if (str >= ch.base + ch.used || ch.live == 0)
+		abfuckingort();		// Not ours, or released twice.
+	// We don't keep string lengths, so the bytes go back by chunk.
+	if (--ch.live == 0) {
+		bytes_live -= ch.used;
+		if (&ch == current) {
+			// Empty, but still where new strings go.  Reuse it.
+			ch.used = 0;
+		} else {
+			free_chunk(c);
+		}
+	}
+}
+
+
+const char *
+SMintern::intern(const char *str)
+{
+	if (!str)
+		return NULL;
+	pair<string_set::iterator, bool> ins = strings.insert(string(str));
+	if (ins.second)
+		bytes += ins.first->length() + 1 + sizeof(string) + 4*sizeof(void *);
+	return ins.first->c_str();
+}
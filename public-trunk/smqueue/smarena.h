@@ -0,0 +1,131 @@
+/*
+ * SMarena.h - Compact storage for queued Short Messages in smqueue.
+ *
+ * Copyright 2010 Free Software Foundation, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * See the COPYING file in the main directory for details.
+ */
+
+#ifndef SM_ARENA_H
+#define SM_ARENA_H
+
+#include <stddef.h>
+#include <map>
+#include <set>
+#include <string>
+
+#include <AllocTracking.h>
+
+namespace SMqueue {
+
+/*
+ * Arena for the text and tags of queued messages.
+ *
+ * Strings are carved out of large chunks, so a queued message costs
+ * its own length plus a few bytes, instead of a malloc header and
+ * rounding for every string.  Each chunk counts its live strings and
+ * goes back to the heap when the last one is released.  A message
+ * that sits in the queue for a long time pins its chunk, but messages
+ * arrive and leave roughly in order, so chunks drain together.
+ */
+class SMarena {
+  public:
+	/* Size of a normal chunk.  Bigger strings get a chunk to themselves. */
+	static const size_t chunk_size = 64*1024;
+
+  private:
+	struct chunk {
+		char *base;
+		size_t size;
+		size_t used;		// Bytes handed out, from the front.
+		unsigned live;		// Strings handed out and not yet released.
+		AllocCounters *counted;	// For allocation tracking, or NULL.
+	};
+	/* Chunks by base address, to find the owner of a string. */
+	typedef std::map<char *, chunk> chunk_map;
+	chunk_map chunks;
+	chunk *current;			// Where new strings go.
+
+	size_t bytes_live;		// Bytes in strings not yet released.
+	size_t bytes_reserved;		// Bytes in all chunks.
+
+	chunk *new_chunk(size_t size);
+	void free_chunk(chunk_map::iterator c);
+
+	/* No copies. */
+	SMarena(const SMarena &);
+	SMarena & operator= (const SMarena &);
+
+  public:
+	SMarena() : chunks(), current(NULL), bytes_live(0), bytes_reserved(0)
+	{ }
+	~SMarena();
+
+	/* Bytes actually taken up by a string of len bytes. */
+	static size_t rounded(size_t len) {
+		len = (len + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+		return len? len: sizeof(void *);
+	}
+
+	/* Get len bytes of storage.  Never fails; aborts if out of memory. */
+	char *alloc(size_t len);
+
+	/* Copy a string of len bytes into the arena, with a null at the end. */
+	char *strndup(const char *str, size_t len);
+	char *strdup(const char *str);
+
+	/* Give back a string from alloc() or strdup().  NULL is ignored. */
+	void release(char *str);
+
+	/* Statistics, for the debug dump and the stats short code. */
+	size_t live() const { return bytes_live; }
+	size_t reserved() const { return bytes_reserved; }
+	size_t nchunks() const { return chunks.size(); }
+};
+
+/* The arena holding the text and tags of every queued message. */
+extern SMarena sm_arena;
+
+
+/*
+ * Interned strings for message addresses.
+ *
+ * The same IMSIs, phone numbers and cell hosts appear in message
+ * after message, so each distinct one is stored once and shared.
+ * Interned strings are never freed; there are only as many as there
+ * are subscribers and cells.
+ */
+class SMintern {
+	typedef std::set<std::string> string_set;
+	string_set strings;
+	size_t bytes;
+
+  public:
+	SMintern() : strings(), bytes(0) { }
+
+	/* Return the shared copy of str, or NULL if str is NULL. */
+	const char *intern(const char *str);
+
+	/* Statistics. */
+	size_t size() const { return strings.size(); }
+	size_t memory() const { return bytes; }
+};
+
+/* The table of interned message addresses. */
+extern SMintern sm_addresses;
+
+} // namespace SMqueue
+
+#endif
@@ -24,6 +24,7 @@
 #include "smqueue.h"
 #include "smnet.h"
 #include "smsc.h"
+#include "smshard.h"
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -79,6 +80,33 @@ shortcode_quick_chk (const char *imsi, const char *msgtext,
 	ostringstream answer;
 	
 	answer << scp->scp_smq->time_sorted_list.size() << " queued.";
+	sm_shards.describe_all(answer);
+	scp->scp_reply = new_strdup(answer.str().c_str());
+	return SCA_REPLY;
+}
+
+/*
+ * Memory used by the queue: messages, bytes per message, parsed trees
+ * still in memory, and the text arena and address table behind them.
+ */
+enum short_code_action
+shortcode_stats (const char *imsi, const char *msgtext,
+		 short_code_params *scp)
+{
+	ostringstream answer;
+	SMq *smq = scp->scp_smq;
+	size_t n = smq->time_sorted_list.size();
+	size_t bytes = smq->memory_used();
+
+	answer << n << " queued, " << bytes << " bytes";
+	if (n)
+		answer << " (" << bytes / n << "/msg)";
+	answer << ", " << short_msg::parsed_resident << " parsed. "
+	       << "Arena " << sm_arena.live() / 1024 << "K/"
+	       << sm_arena.reserved() / 1024 << "K, "
+	       << sm_addresses.size() << " addrs "
+	       << sm_addresses.memory() / 1024 << "K.";
+	sm_shards.describe_all(answer);
 	scp->scp_reply = new_strdup(answer.str().c_str());
 	return SCA_REPLY;
 }
@@ -95,6 +123,13 @@ shortcode_ussd_test (const char *imsi, const char *msgtext,
 	return SCA_REPLY;
 }
 
+/* Compare a string with a routing field that may be missing. */
+static bool
+same (const char *str, const char *field)
+{
+	return field && 0 == strcmp (str, field);
+}
+
 /*
  * 411 -- information.
  * Start by telling people their phone number.
@@ -116,14 +151,15 @@ shortcode_four_one_one (const char *imsi, const char *msgtext,
 		case REQUEST_MSG_DELIVERY:
 		case ASKED_FOR_MSG_DELIVERY:
 		case AWAITING_TRY_MSG_DELIVERY:
-		    x->make_text_valid();
-		    if (0 == strcmp ("127.0.0.1", x->parsed->req_uri->host))
+		    // Use the saved routing fields; queued messages
+		    // don't keep their parsed trees.
+		    if (same ("127.0.0.1", x->dest_host))
 			missing++;
-		    if (0 == strcmp (gConfig.getStr("SC.Register.Code"),x->parsed->from->url->username))
+		    if (same (gConfig.getStr("SC.Register.Code"), x->from_user))
 			registering++;
-		    if (0 == strcmp (gConfig.getStr("SC.Register.Code"), x->parsed->req_uri->username))
+		    if (same (gConfig.getStr("SC.Register.Code"), x->to_user))
 		    	registering++;
-		    if (0 == strcmp (gConfig.getStr("SC.Info.Code"), x->parsed->from->url->username))
+		    if (same (gConfig.getStr("SC.Info.Code"), x->from_user))
 			bouncing++;
 		    break;
 
@@ -388,6 +424,8 @@ SMqueue::init_smcommands (short_code_map_t *scm)
 		(*scm)[gConfig.getStr("SC.DebugDump.Code")] = shortcode_debug_dump;
 	if (gConfig.defines("SC.QuickChk.Code"))
 		(*scm)[gConfig.getStr("SC.QuickChk.Code")] = shortcode_quick_chk;
+	if (gConfig.defines("SC.Stats.Code"))
+		(*scm)[gConfig.getStr("SC.Stats.Code")] = shortcode_stats;
 	if (gConfig.defines("SC.ZapQueued.Code"))
 		(*scm)[gConfig.getStr("SC.ZapQueued.Code")] = shortcode_zap_queued;
 	if (gConfig.defines("SC.WhiplashQuit.Code"))
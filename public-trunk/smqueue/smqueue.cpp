@@ -22,6 +22,7 @@
 #include "smqueue.h"
 #include "smnet.h"
 #include "smsc.h"
+#include "smshard.h"
 #include <time.h>
 #include <osipparser2/osip_message.h>	/* from osipparser2 */
 #include <iostream>
@@ -159,6 +160,8 @@ struct osip *SMqueue::osipptr = NULL;	// Ptr to struct sorta used by library
 const char *short_msg_pending::smp_my_ipaddress = NULL;	// Accessible copy
 const char *short_msg_pending::smp_my_2nd_ipaddress = NULL;	// Accessible copy
 
+unsigned short_msg::parsed_resident = 0;
+
 bool print_as_we_validate = false;      // Debugging
 
 /*
@@ -250,6 +253,16 @@ SMq::process_timeout()
 		if (qmsg->next_action_time > now)
 			return;			/* Wait til later to do more */
 
+		// The parsed tree was freed while the message waited.
+		// Get it back before doing anything with the message.
+		if (qmsg->state != NO_STATE && qmsg->state != DELETE_ME_STATE
+		    && !qmsg->parse()) {
+			LOG(ERROR) << "Queued message '" << qmsg->qtag
+			     << "' no longer parses.";
+			set_state(qmsg, NO_STATE);
+			continue;
+		}
+
 		switch (qmsg->state) {
 		case INITIAL_STATE:
 			// This is the initial state in which a message
@@ -522,6 +535,12 @@ SMq::handle_response(short_msg_p_list::iterator qmsgit)
 				// retry loop somewhere.  Ignore it.
 				// Eventually it'll notice...?  FIXME.
 			}
+
+			// Other workers may be holding messages for it.
+			if (sm_shards.sharded() && sent_msg->parsed->to
+			    && sent_msg->parsed->to->url)
+				shard_registered(
+				    sent_msg->parsed->to->url->username);
 		}
 
 		// Whether a response to a REGISTER or a MESSAGE, delete 
@@ -852,7 +871,7 @@ short_msg_pending::set_qtag()
 	if (!p->cseq)
 		return 402;
 	
-	delete [] qtag;		// slag the old one, if any.
+	sm_arena.release(qtag);		// slag the old one, if any.
 
 	int len = strlen(p->cseq->number) + 2	// crlf or --
 #ifdef USE_CALL_ID_TAG
@@ -860,7 +879,7 @@ short_msg_pending::set_qtag()
 		+ strlen(p->call_id->host) + 2	// crlf or --
 #endif
 		+ strlen(fromtag) + 1;		// null at end
-	qtag = new char[len];
+	qtag = sm_arena.alloc(len);
 	// There's probably some fancy C++ way to do this.  FIXME.
 	strcpy(qtag, p->cseq->number);
 	strcat(qtag, "--");
@@ -897,6 +916,23 @@ short_msg_pending::taghash_of (const char *fromtag)
 	return fromtag[0];
 }
 
+/*
+ * Bytes used by a queued message.  The list node costs two pointers
+ * on top of the object itself.
+ */
+size_t
+short_msg_pending::memory_used() const
+{
+	size_t bytes = sizeof(*this) + 2 * sizeof(void *);
+	if (text)
+		bytes += SMarena::rounded(text_length + 1);
+	if (qtag)
+		bytes += SMarena::rounded(strlen(qtag) + 1);
+	if (linktag)
+		bytes += SMarena::rounded(strlen(linktag) + 1);
+	return bytes;
+}
+
 /* Check the host and port number specified.
  * Currently, be conservative and only take localhost refs.
  * We know FIXME that this will have to be expanded...
@@ -959,10 +995,8 @@ SMq::set_linktag(short_msg_p_list::iterator newmsg,
 		oldmsg->set_qtag();
 	}
 
-	size_t len = strlen(oldmsg->qtag);
-	newmsg->linktag = new char[1+len];
-	strncpy(newmsg->linktag, oldmsg->qtag, len);
-	newmsg->linktag[len] = '\0';
+	sm_arena.release(newmsg->linktag);
+	newmsg->linktag = sm_arena.strdup(oldmsg->qtag);
 }
 
 // Get the other message that this message links to.
@@ -1008,8 +1042,7 @@ SMq::originate_half_sm(string method)
 	response = &*smpl->begin();	// Here's our short_msg_pending!
 	response->initialize (0, NULL, true);
 
-	osip_message_init(&response->parsed);
-	response->parsed_is_valid = true;
+	response->new_parsed();
 
 	if (!have_register_call_id || method != "REGISTER") {
 		// If it's a MESSAGE, or if it's the first REGISTER,
@@ -1153,6 +1186,7 @@ SMq::bounce_message(short_msg_pending *sent_msg, const char *errstr)
 	std::string thetext;
 	int status;
 
+	sent_msg->parse();	// Its tree may have been released.
 	username = sent_msg->parsed->to->url->username;
 	thetext = sent_msg->get_text();
 
@@ -1790,8 +1824,7 @@ SMq::respond_sip_ack(int errcode, short_msg_pending *smp,
 	if (MSG_IS_RESPONSE(smp->parsed))
 		return;		// Don't ack a response message, or we loop!
 
-	osip_message_init(&response.parsed);
-	response.parsed_is_valid = true;
+	response.new_parsed();
 
 	// Copy over the CSeq, From, To, Call-ID, Via, etc.
 	osip_to_clone(smp->parsed->to,     &response.parsed->to);
@@ -1911,6 +1944,9 @@ SMq::main_loop()
 	} else if (len == 0) {
 		// Timeout.  Just push things along.
 		LOG(DEBUG) << "Timeout...";
+	} else if (SMshards::is_control(buffer, len)) {
+		// Not SIP; a note from the shard front end or another worker.
+		handle_shard_control(buffer, len);
 	} else {
 		// We got a datagram.  Dump it into the queue, copying it.
 		//
@@ -1948,6 +1984,8 @@ SMq::main_loop()
 		}
 
 		errcode = smp->validate_short_msg();
+		if (sm_shards.sharded() && smp->parsed)
+			restore_source(smp);
 		if (errcode == 0) {
 			if (MSG_IS_REQUEST(smp->parsed)) {
 				LOG(NOTICE) << "Got SMS '"
@@ -1980,20 +2018,64 @@ SMq::main_loop()
 	}
 
 	process_timeout();
+	release_parsed();
     } /* while (!stop_main_loop) */
 }
 
 
+/*
+ * Messages only need their parsed trees while they're being worked on,
+ * and the trees are many times the size of the text.  Once the queue
+ * has been processed, free them all.  We count the resident trees so
+ * we can stop looking as soon as the last one is gone.
+ */
+void
+SMq::release_parsed()
+{
+	short_msg_p_list::iterator x = time_sorted_list.begin();
+	for (; x != time_sorted_list.end() && short_msg::parsed_resident; ++x) {
+		if (x->parsed)
+			x->unparse();
+	}
+}
+
+/* How much memory the queue is taking up. */
+size_t
+SMq::memory_used()
+{
+	size_t total = 0;
+	short_msg_p_list::iterator x = time_sorted_list.begin();
+	for (; x != time_sorted_list.end(); ++x)
+		total += x->memory_used();
+	return total;
+}
+
+
 /* Debug dump of SMq and mainly the queue. */
 void SMq::debug_dump() {
 	short_msg_p_list::iterator x = time_sorted_list.begin();
 	time_t now = time(NULL);
+	size_t total = 0;
 	for (; x != time_sorted_list.end(); ++x) {
 		x->make_text_valid();
+		total += x->memory_used();
 		LOG(DEBUG) << "== State: " << sm_state_string (x->state) << "\t"
-		     << (x->next_action_time - now) << endl << "MSG = "
+		     << (x->next_action_time - now) << "\t"
+		     << x->memory_used() << " bytes" << endl << "MSG = "
 		     << x->text;
 	}
+	LOG(DEBUG) << "== " << time_sorted_list.size() << " queued, "
+	     << total << " bytes, "
+	     << short_msg::parsed_resident << " parsed; arena "
+	     << sm_arena.live() << "/" << sm_arena.reserved() << " bytes in "
+	     << sm_arena.nchunks() << " chunks; "
+	     << sm_addresses.size() << " addresses in "
+	     << sm_addresses.memory() << " bytes.";
+	if (gAllocTracking) {
+		ostringstream allocs;
+		gAllocReport(allocs);
+		LOG(DEBUG) << "== allocations:" << endl << allocs.str();
+	}
 }
 
 /* Print net addr in hex.  Returns a static buffer.  */
@@ -2125,8 +2207,7 @@ SMq::read_queue_from_file(std::string qfile)
 		smpl = new short_msg_p_list (1);
 		smp = &*smpl->begin();	// Here's our short_msg_pending!
 		smp->initialize (alength, msgtext, true);
-		// We use the just-allocated msgtext; it gets freed after
-		// delivery of message.
+		// The text is copied into the arena, and msgtext freed.
 
 		// Restore saved state
 		smp->ms_to_sc = ms_to_sc;
@@ -2150,7 +2231,7 @@ SMq::read_queue_from_file(std::string qfile)
 				LOG(WARN) << "Read bad SMS "
 				     << smp->parsed->status_code
 				     << " Response '"
-				     << smp->qtag << "':" << msgtext;
+				     << smp->qtag << "':" << smp->text;
 			}
 			insert_new_message (*smpl, mystate, mytime);
 		} else {
@@ -2163,6 +2244,7 @@ SMq::read_queue_from_file(std::string qfile)
 	}
 	LOG(INFO) << "=== Read " << howmany << " messages total, " << howmanyerrs
 	     << " bad ones.";
+	release_parsed();
 	ifile.close();
 	return true;
 }
@@ -2232,6 +2314,8 @@ int
 main(int argc, char **argv)
 {
   bool please_re_exec = false;
+  AllocScope allocScope(AllocSMqueue);
+  int shard = -1;		// Which shard worker we are, if any.
   // short_msg_p_list aq;
   // short_msg *sm;
   // short_msg_pending *smp;
@@ -2240,6 +2324,10 @@ main(int argc, char **argv)
   // Set up short-code commands users can type
   init_smcommands(&short_code_map);
 
+  // "smqueue N" runs as worker N of a sharded queue.
+  if (argc > 1)
+    shard = atoi(argv[1]);
+
   // This scope lets us delete the smq (and the network sockets)
   // before we re-exec ourself.
   while (true) {
@@ -2262,13 +2350,31 @@ main(int argc, char **argv)
     smq.set_my_ipaddress(gConfig.getStr("SIP.myIP" /* "127.0.0.1" */));
     smq.set_my_2nd_ipaddress(gConfig.getStr("SIP.myIP2" /* "NAT crap" */));
 
+    // Are we one of several smqueues?
+    if (!sm_shards.configure(smq.my_network, shard)) {
+      LOG(ALARM) << "Bad shard configuration, exiting.";
+      return 1;
+    }
+
     // Port number that we (smqueue) listen on.
-    smq.init_listener(gConfig.getStr("SIP.myPort"));	// Port number to listen on.
+    if (sm_shards.sharded() && !sm_shards.front_end())
+      smq.init_listener(sm_shards.my_port());
+    else
+      smq.init_listener(gConfig.getStr("SIP.myPort"));	// Port number to listen on.
+
+    // The front end of a sharded queue keeps no queue of its own.
+    if (sm_shards.front_end()) {
+      sm_shards.front_end_loop(smq.my_network, short_code_map);
+      break;
+    }
 
     // Debug -- print all msgs in log
   //  print_as_we_validate = gConfig.getBool("Debug.print_as_we_validate");
     print_as_we_validate = gConfig.defines("Debug.print_as_we_validate");
 
+    // Count the arena's allocations, reported with the queue dump.
+    gAllocTracking = gConfig.defines("Debug.AllocTracking");
+
     // system() calls in backgrounded jobs hang if stdin is still open on tty.
     // So, close it.
     close(0);     // Shut off stdin in case we're in background
@@ -2278,6 +2384,12 @@ main(int argc, char **argv)
     LOG(INFO) << "The HLR registry is at " << smq.my_register_hostport;
 
     savefile = gConfig.getStr("savefile");
+    if (sm_shards.sharded()) {
+      // Each worker keeps its own queue.
+      ostringstream shardfile;
+      shardfile << savefile << "." << shard;
+      savefile = shardfile.str();
+    }
 
     if (!smq.read_queue_from_file (savefile)) {
 	LOG(WARN) << "Failed to read queue from file " << savefile;
@@ -34,6 +34,7 @@
 
 #include "smnet.h"			// My network support
 #include "HLR.h"			// My home location register
+#include "smarena.h"			// Compact storage for queued msgs
 
 // That's awful OSIP has a CR define.
 // It clashes with our innocent L2Address::CR().
@@ -107,7 +108,10 @@ extern struct osip *osipptr;
 /* In-memory object representing a Short Message.  These are kept as
    text strings (as we received them) and only parsed when we need to
    process them.  This keeps memory usage way down for medium to long
-   term storage in the queue.  */
+   term storage in the queue.  The text lives in sm_arena, and the
+   parsed tree is freed by SMq::release_parsed() once each pass through
+   the queue is done; the routing fields we need to look at while the
+   message waits are kept, interned, in from_user..dest_port.  */
 class short_msg {
   public:
 
@@ -127,8 +131,15 @@ class short_msg {
 	   copy is no longer valid, this will be true.  */
 	bool parsed_is_better;
 	osip_message_t *parsed;
-	// from;
-	// to;
+	/* How many messages have a parsed tree in memory right now. */
+	static unsigned parsed_resident;
+
+	/* Routing fields, copied from the parsed tree whenever it is
+	   made or freed.  Interned in sm_addresses; NULL if absent. */
+	const char *from_user;		// From: username (IMSI or number)
+	const char *to_user;		// Request-URI username
+	const char *dest_host;		// Request-URI host
+	const char *dest_port;		// Request-URI port
 	// time_t date;
 	// expiration;
 	ContentType content_type; // Content-Type of the message
@@ -151,6 +162,10 @@ class short_msg {
 		parsed_is_valid (false),
 		parsed_is_better (false),
 		parsed (NULL),
+		from_user (NULL),
+		to_user (NULL),
+		dest_host (NULL),
+		dest_port (NULL),
 		content_type(UNSUPPORTED_CONTENT),
 		rp_data(NULL),
 		tl_message(NULL),
@@ -161,22 +176,22 @@ class short_msg {
 	// Make a short message, perhaps taking responsibility for deleting
 	// the "new"-allocated memory passed in.
   	short_msg (int len, char * const cstr, bool use_my_memory) :
-		text_length (len),
-		text (cstr),
+		text_length (0),
+		text (NULL),
 		parsed_is_valid (false),
 		parsed_is_better (false),
 		parsed (NULL),
+		from_user (NULL),
+		to_user (NULL),
+		dest_host (NULL),
+		dest_port (NULL),
 		content_type(UNSUPPORTED_CONTENT),
 		rp_data(NULL),
 		tl_message(NULL),
 		ms_to_sc(false),
 		need_repack(true)
 	{
-		if (!use_my_memory) {
-			text = new char [text_length+1];
-			strncpy(text, cstr, text_length);
-			text[text_length] = '\0';
-		}
+		store_text (len, cstr, use_my_memory);
 	};
 
 	/* When created from another short_msg, must copy the string. */
@@ -191,17 +206,18 @@ class short_msg {
 		parsed_is_valid (false),
 		parsed_is_better (false),
 		parsed (NULL),
+		from_user (sm.from_user),
+		to_user (sm.to_user),
+		dest_host (sm.dest_host),
+		dest_port (sm.dest_port),
 		content_type(UNSUPPORTED_CONTENT),
 		rp_data(NULL),
 		tl_message(NULL),
 		ms_to_sc(false),
 		need_repack(true)
 	{
-		if (text_length) {
-			text = new char [text_length+1];
-			strncpy(text, sm.text, text_length);
-			text[text_length] = '\0';
-		}
+		if (text_length)
+			store_text (sm.text_length, sm.text, false);
 	};
 
 #if 0
@@ -211,6 +227,10 @@ class short_msg {
 		parsed_is_valid (false),
 		parsed_is_better (false),
 		parsed (NULL),
+		from_user (NULL),
+		to_user (NULL),
+		dest_host (NULL),
+		dest_port (NULL),
 		content_type(UNSUPPORTED_CONTENT),
 		rp_data(NULL),
 		tl_message(NULL),
@@ -231,9 +251,11 @@ class short_msg {
 	/* Destructor */
 	virtual ~short_msg ()
 	{
-		if (parsed)
+		if (parsed) {
 			osip_message_free(parsed);
-		delete [] text;
+			parsed_resident--;
+		}
+		sm_arena.release(text);
 		delete rp_data;
 		delete tl_message;
 	};
@@ -248,13 +270,25 @@ class short_msg {
 	{
 		// default constructor needs these things revised to
 		// initialize with a message in a string.
+		store_text (len, cstr, use_my_memory);
+	}
+
+	// Copy len bytes of text into the arena.  If we were given
+	// responsibility for the "new"-allocated cstr, free it; the
+	// arena copy is what stays in the queue.
+	void
+	store_text (int len, const char *cstr, bool use_my_memory)
+	{
+		sm_arena.release(text);
 		text_length = len;
-		text = cstr;
-		if (!use_my_memory) {
-			text = new char [text_length+1];
+		text = NULL;
+		if (cstr) {
+			text = sm_arena.alloc(text_length+1);
 			strncpy(text, cstr, text_length);
 			text[text_length] = '\0';
 		}
+		if (use_my_memory)
+			delete [] cstr;
 	}
 
 	/* Parsing, validating, and unparsing messages.  */
@@ -277,10 +311,15 @@ class short_msg {
 		i = osip_message_init(&sip);
 		if (i != 0) abfuckingort();	/* throw out-of-memory */
 		i = osip_message_parse(sip, text, text_length);
-		if (i != 0) return false;
+		if (i != 0) {
+			osip_message_free(sip);
+			return false;
+		}
 		parsed = sip;
+		parsed_resident++;
 		parsed_is_valid = true;
 		parsed_is_better = false;
+		note_routing();
 
 		// Now parse SMS if needed
 		if (parsed->content_type == NULL)
@@ -346,13 +385,9 @@ class short_msg {
 					  << std::endl;
 				abfuckingort();
 			}
-			delete [] text;
 			/* Because "osip_free" != "delete", we have to recopy
 			   the string!!!  Don't you love C++?  */
-			text_length = length;
-			text = new char [text_length+1];
-			strncpy(text, dest, text_length);
-			text[text_length] = '\0';
+			store_text (length, dest, false);
 			osip_free(dest);
 			parsed_is_valid = true;
 			parsed_is_better = false;
@@ -374,13 +409,41 @@ class short_msg {
 		// Now unparse SIP
 		if (parsed_is_better)
 			make_text_valid();
-		if (parsed)
+		if (parsed) {
+			note_routing();		// Last look, it may have changed.
 			osip_message_free(parsed);
+			parsed_resident--;
+		}
 		parsed = NULL;
 		parsed_is_valid = false;
 		parsed_is_better = false;
 	}
 
+	/* Start a fresh, empty parsed tree, for building a message. */
+	void new_parsed() {
+		unparse();
+		if (osip_message_init(&parsed) != 0)
+			abfuckingort();		/* throw out-of-memory */
+		parsed_resident++;
+		parsed_is_valid = true;
+	}
+
+	/* Copy the routing fields out of the parsed tree, so we can
+	   still see them after the tree is freed. */
+	void note_routing() {
+		if (!parsed)
+			return;
+		from_user = NULL;
+		if (parsed->from && parsed->from->url)
+			from_user = sm_addresses.intern(parsed->from->url->username);
+		to_user = dest_host = dest_port = NULL;
+		if (parsed->req_uri) {
+			to_user   = sm_addresses.intern(parsed->req_uri->username);
+			dest_host = sm_addresses.intern(parsed->req_uri->host);
+			dest_port = sm_addresses.intern(parsed->req_uri->port);
+		}
+	}
+
 	std::string get_text() const
 	{
 		switch (content_type) {
@@ -515,19 +578,11 @@ class short_msg_pending: public short_msg {
 			memcpy(srcaddr, smp.srcaddr, smp.srcaddrlen);
 		}
 			
-		if (smp.qtag) {
-			int len = strlen(smp.qtag);
-			this->qtag = new char[len+1];
-			strncpy(this->qtag, smp.qtag, len);
-			this->qtag[len] = '\0';
-		}
+		if (smp.qtag)
+			this->qtag = sm_arena.strdup(smp.qtag);
 		
-		if (smp.linktag) {
-			int len = strlen(smp.linktag);
-			this->linktag = new char[len+1];
-			strncpy(this->linktag, smp.linktag, len);
-			this->linktag[len] = '\0';
-		}
+		if (smp.linktag)
+			this->linktag = sm_arena.strdup(smp.linktag);
 	}
 
 	/* Override operator= to avoid pointer-sharing problems */
@@ -537,8 +592,8 @@ class short_msg_pending: public short_msg {
 
 	/* Destructor */
 	virtual ~short_msg_pending () {
-		delete [] qtag;
-		delete [] linktag;
+		sm_arena.release(qtag);
+		sm_arena.release(linktag);
 	}
 
 	/* Methods */
@@ -617,6 +672,11 @@ class short_msg_pending: public short_msg {
 	// Hash the tag to an int, for speedier searching.
 	int taghash_of(const char *tag);
 
+	// Bytes this message takes while it sits in the queue: the object,
+	// its list node, and its strings in the arena.  Not counted are
+	// the parsed tree (if it's resident) and the shared addresses.
+	size_t memory_used() const;
+
 	/* Check host and port for validity.  */
 	bool
 	check_host_port(char *host, char *port);
@@ -801,6 +861,19 @@ class SMq {
 	/* If nothing happens for a while, handle that.  */
 	void process_timeout();
 
+	/* Free the parsed trees of queued messages; they'll be parsed
+	   again from their text when next they need processing.  */
+	void release_parsed();
+
+	/* Total bytes used by queued messages (see memory_used()). */
+	size_t memory_used();
+
+	/* Sharding across several smqueue workers (see smshard.h). */
+	void handle_shard_control(char *buffer, int len);
+	void shard_registered(const char *imsi);
+	void kick_subscriber(const char *imsi);
+	void restore_source(short_msg_pending *smp);
+
 	/* Send a SIP response to acknowledge reciept of a short msg. */
 	void respond_sip_ack(int errcode, short_msg_pending *smp, 
 		char *netaddr, size_t netaddrlen);
@@ -0,0 +1,448 @@
+/*
+ * SMshard.cpp - Spreading the Short Message queue over several smqueues.
+ *
+ * Copyright 2010 Free Software Foundation, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * See the COPYING file in the main directory for details.
+ */
+
+#include "smshard.h"
+#include <osipparser2/osip_message.h>	/* from osipparser2 */
+#include <sstream>
+#include <string.h>
+#include <strings.h>			// strcasecmp
+#include <errno.h>
+
+#include <Logger.h>
+#include <Configuration.h>
+
+using namespace std;
+using namespace SMqueue;
+
+extern ConfigurationTable gConfig;
+
+SMshards SMqueue::sm_shards;
+
+
+bool
+SMshards::configure(SMnet &net, int index)
+{
+	my_index = index;
+	workers.clear();
+	if (gConfig.defines("Shard.StatusInterval"))
+		status_interval = gConfig.getNum("Shard.StatusInterval");
+	if (status_interval < 1)
+		status_interval = 1;
+
+	if (gConfig.defines("Shard.Workers")) {
+		istringstream names(gConfig.getStr("Shard.Workers"));
+		string name;
+		while (names >> name) {
+			worker w;
+			w.name = name;
+			w.heard = 0;
+			w.queued = 0;
+			w.bytes = 0;
+			w.parsed = 0;
+			if (!net.parse_addr(name.c_str(), w.sockaddr,
+					    sizeof(w.sockaddr), &w.sockaddrlen)) {
+				LOG(ERROR) << "Can't look up shard worker " << name;
+				return false;
+			}
+			w.addr = net.string_addr((struct sockaddr *)w.sockaddr,
+						 w.sockaddrlen, true);
+			workers.push_back(w);
+		}
+	}
+
+	/* Workers take control messages, and the sources of SIP
+	   messages, only from the front end.  It sends from its
+	   listening socket, SIP.myIP:SIP.myPort unless told otherwise. */
+	front_addr.clear();
+	if (!workers.empty()) {
+		string front;
+		if (gConfig.defines("Shard.FrontEnd"))
+			front = gConfig.getStr("Shard.FrontEnd");
+		else
+			front = string(gConfig.getStr("SIP.myIP")) + ":"
+				+ gConfig.getStr("SIP.myPort");
+		char sa[sizeof(struct sockaddr_storage)];
+		socklen_t salen = 0;
+		if (!net.parse_addr(front.c_str(), sa, sizeof(sa), &salen)) {
+			LOG(ERROR) << "Can't look up shard front end " << front;
+			return false;
+		}
+		front_addr = net.string_addr((struct sockaddr *)sa, salen, true);
+	}
+
+	if (index >= (int)workers.size()) {
+		LOG(ERROR) << "Asked to be shard worker " << index << " of "
+		     << workers.size() << "; check Shard.Workers.";
+		return false;
+	}
+	if (sharded())
+		LOG(INFO) << "Sharded over " << workers.size() << " workers; we are "
+		     << (front_end()? string("the front end"): workers[index].name);
+	return true;
+}
+
+string
+SMshards::my_port() const
+{
+	const string &name = workers[my_index].name;
+	return name.substr(name.rfind(':') + 1);
+}
+
+/* FNV-1a.  A leading '+' doesn't change which worker a number goes to. */
+unsigned
+SMshards::shard_of(const char *key) const
+{
+	unsigned hash = 2166136261u;
+
+	if (workers.empty())
+		return 0;
+	if (!key)
+		return 0;
+	if (*key == '+')
+		key++;
+	for (; *key; key++) {
+		hash ^= (unsigned char)*key;
+		hash *= 16777619u;
+	}
+	return hash % workers.size();
+}
+
+int
+SMshards::worker_at(const string &addr) const
+{
+	for (unsigned i = 0; i < workers.size(); i++) {
+		if (workers[i].addr == addr || workers[i].name == addr)
+			return i;
+	}
+	return -1;
+}
+
+bool
+SMshards::is_control(const char *buffer, int len)
+{
+	int clen = sizeof(SHARD_CONTROL) - 1;
+	return len >= clen && 0 == strncmp(buffer, SHARD_CONTROL, clen);
+}
+
+bool
+SMshards::send_to(SMnet &net, unsigned i, const string &msg)
+{
+	return net.send_dgram((char *)msg.data(), msg.length(),
+			      workers[i].sockaddr, workers[i].sockaddrlen);
+}
+
+void
+SMshards::describe_all(ostream &os) const
+{
+	if (!all_when)
+		return;
+	os << " All " << all_up << "/" << workers.size() << " shards: "
+	   << all_queued << " queued";
+	if (time(NULL) - all_when > 3 * status_interval)
+		os << " (stale)";
+	os << ".";
+}
+
+
+/*
+ * The front end.
+ */
+
+void
+SMshards::front_end_loop(SMnet &net, const short_code_map_t &scm)
+{
+	char buffer[5000];
+	time_t now, next_poll = 0;
+	int len;
+
+	LOG(NOTICE) << "Front end for " << workers.size() << " smqueue workers.";
+	while (true) {
+		now = time(NULL);
+		if (now >= next_poll) {
+			poll_workers(net, now);
+			next_poll = now + status_interval;
+		}
+		len = net.get_next_dgram(buffer, sizeof(buffer)-1,
+					 1000 * (next_poll - now));
+		if (len < 0) {
+			LOG(ERROR) << "Error from get_next_dgram: " << strerror(errno);
+			continue;
+		}
+		if (len == 0)
+			continue;
+		buffer[len] = '\0';
+
+		if (is_control(buffer, len)) {
+			int from = worker_at(net.string_addr(
+				(struct sockaddr *)net.src_addr, net.recvaddrlen, true));
+			if (from < 0) {
+				LOG(WARN) << "Shard control from a stranger: " << buffer;
+			} else {
+				heard_from(from, buffer);
+			}
+			continue;
+		}
+		route(net, buffer, len, scm);
+	}
+}
+
+/* Pass a SIP datagram to the worker that should have it. */
+void
+SMshards::route(SMnet &net, char *buffer, int len, const short_code_map_t &scm)
+{
+	short_msg msg(len, buffer, false);
+	osip_via_t *via = NULL;
+	int target;
+
+	if (!msg.parse()) {
+		LOG(WARN) << "Front end dropping unparseable datagram:" << endl
+		     << buffer;
+		return;
+	}
+	osip_message_get_via(msg.parsed, 0, &via);
+
+	if (!MSG_IS_REQUEST(msg.parsed)) {
+		// A response goes back to whoever sent the request.
+		// That's the worker in the top Via.
+		target = -1;
+		if (via && via_get_host(via) && via_get_port(via))
+			target = worker_at(string(via_get_host(via)) + ":"
+					   + via_get_port(via));
+		if (target < 0) {
+			LOG(WARN) << "Front end can't route response "
+			     << msg.parsed->status_code << " to a worker.";
+			return;
+		}
+		send_to(net, target, string(buffer, len));
+		return;
+	}
+
+	// Messages to a short code are about the sender, so they go to
+	// the sender's worker; that's where his registration happens.
+	const char *key = msg.to_user;
+	if (key && scm.find(key) != scm.end())
+		key = msg.from_user;
+	target = shard_of(key);
+
+	// Say where it really came from, so the worker can answer the
+	// cell directly, and register the handset at the right place.
+	if (via) {
+		string src = net.string_addr((struct sockaddr *)net.src_addr,
+					     net.recvaddrlen, true);
+		string::size_type colon = src.rfind(':');
+		osip_via_param_add(via, osip_strdup("received"),
+				   osip_strdup(src.substr(0, colon).c_str()));
+		osip_via_param_add(via, osip_strdup("rport"),
+				   osip_strdup(src.substr(colon+1).c_str()));
+		msg.parsed_was_changed();
+		msg.make_text_valid();
+	}
+	LOG(DEBUG) << "Routing " << (key? key: "(none)") << " to worker "
+	     << target;
+	send_to(net, target, string(msg.text, msg.text_length));
+}
+
+/* A worker has told us how it's doing. */
+void
+SMshards::heard_from(unsigned i, const char *buffer)
+{
+	istringstream in(buffer + sizeof(SHARD_CONTROL) - 1);
+	string what;
+	unsigned index;
+	worker &w = workers[i];
+
+	in >> what;
+	if (what != "STAT") {
+		LOG(WARN) << "Unknown shard control from " << w.name << ": "
+		     << buffer;
+		return;
+	}
+	in >> index >> w.queued >> w.bytes >> w.parsed;
+	if (!in || index != i) {
+		LOG(WARN) << "Bad shard status from " << w.name << ": " << buffer;
+		return;
+	}
+	w.heard = time(NULL);
+}
+
+/* Total up the last round of reports, tell everybody, and ask again. */
+void
+SMshards::poll_workers(SMnet &net, time_t now)
+{
+	ostringstream line, all;
+	unsigned up = 0, queued = 0;
+	unsigned long bytes = 0;
+
+	for (unsigned i = 0; i < workers.size(); i++) {
+		worker &w = workers[i];
+		line << " " << w.name;
+		if (!w.heard || now - w.heard > 2 * status_interval) {
+			line << " silent;";
+			continue;
+		}
+		line << " " << w.queued << " queued;";
+		up++;
+		queued += w.queued;
+		bytes += w.bytes;
+	}
+	if (all_when)		// Nothing to report on the first round.
+		LOG(INFO) << "=== Shards:" << line.str() << " total " << queued
+		     << " queued, " << bytes << " bytes, " << up << "/"
+		     << workers.size() << " up.";
+	all_when = now;
+
+	all << SHARD_CONTROL << "ALL " << up << " " << workers.size() << " "
+	    << queued << " " << bytes;
+	for (unsigned i = 0; i < workers.size(); i++) {
+		send_to(net, i, all.str());
+		send_to(net, i, SHARD_CONTROL "STAT?");
+	}
+}
+
+
+/*
+ * The worker side, in the queue itself.
+ */
+
+/* Handle a control datagram from the front end or another worker. */
+void
+SMq::handle_shard_control(char *buffer, int len)
+{
+	string msg(buffer, len);
+	istringstream in(msg.substr(sizeof(SHARD_CONTROL) - 1));
+	string what;
+
+	// Only the front end and our fellow workers may steer us.
+	string from = my_network.string_addr((struct sockaddr *)
+		my_network.src_addr, my_network.recvaddrlen, true);
+	if (!sm_shards.is_front_end(from) && sm_shards.worker_at(from) < 0) {
+		LOG(WARN) << "Shard control from a stranger " << from
+		     << ": " << msg;
+		return;
+	}
+
+	in >> what;
+	if (what == "STAT?") {
+		ostringstream reply;
+		reply << SHARD_CONTROL << "STAT " << sm_shards.my_index << " "
+		      << time_sorted_list.size() << " " << memory_used() << " "
+		      << short_msg::parsed_resident;
+		string r = reply.str();
+		my_network.send_dgram((char *)r.data(), r.length(),
+				      my_network.src_addr, my_network.recvaddrlen);
+	} else if (what == "ALL") {
+		unsigned of;
+		in >> sm_shards.all_up >> of >> sm_shards.all_queued
+		   >> sm_shards.all_bytes;
+		sm_shards.all_when = time(NULL);
+	} else if (what == "REG") {
+		string imsi;
+		in >> imsi;
+		if (!imsi.empty())
+			kick_subscriber(imsi.c_str());
+	} else {
+		LOG(WARN) << "Unknown shard control: " << msg;
+	}
+}
+
+/*
+ * We registered a handset.  Messages waiting for it, here or in
+ * any other worker, can go now rather than at their next retry.
+ */
+void
+SMq::shard_registered(const char *imsi)
+{
+	if (!imsi)
+		return;
+	kick_subscriber(imsi);
+	string msg = string(SHARD_CONTROL "REG ") + imsi;
+	for (unsigned i = 0; i < sm_shards.workers.size(); i++) {
+		if ((int)i != sm_shards.my_index)
+			sm_shards.send_to(my_network, i, msg);
+	}
+}
+
+/* Retry delivery of the messages for this IMSI right away. */
+void
+SMq::kick_subscriber(const char *imsi)
+{
+	time_t now = time(NULL);
+	short_msg_p_list::iterator x, next;
+	int n = 0;
+
+	for (x = time_sorted_list.begin(); x != time_sorted_list.end();
+	     x = next) {
+		next = x;
+		++next;
+		if (!x->to_user || 0 != strcasecmp(x->to_user, imsi))
+			continue;
+		if (x->next_action_time <= now)
+			continue;		// It's going anyway.
+		switch (x->state) {
+		case AWAITING_TRY_DESTINATION_SIPURL:
+		case REQUEST_DESTINATION_SIPURL:
+		case AWAITING_TRY_MSG_DELIVERY:
+		case ASKED_FOR_MSG_DELIVERY:
+			set_state(x, REQUEST_DESTINATION_SIPURL, now);
+			n++;
+			break;
+		default:
+			break;
+		}
+	}
+	if (n)
+		LOG(INFO) << "Registration of " << imsi << " woke " << n
+		     << " queued messages.";
+}
+
+/*
+ * The front end marked where this message really came from.
+ * Answer there, not to the front end.  Anyone else's marks are
+ * ignored, or we would send our answers wherever a stranger said.
+ */
+void
+SMq::restore_source(short_msg_pending *smp)
+{
+	osip_via_t *via = NULL;
+	osip_generic_param_t *received = NULL, *rport = NULL;
+
+	if (!smp->parsed)
+		return;
+	string from = my_network.string_addr((struct sockaddr *)
+		my_network.src_addr, my_network.recvaddrlen, true);
+	if (!sm_shards.is_front_end(from))
+		return;
+	osip_message_get_via(smp->parsed, 0, &via);
+	if (!via)
+		return;
+	osip_via_param_get_byname(via, (char *)"received", &received);
+	osip_via_param_get_byname(via, (char *)"rport", &rport);
+	if (!received || !received->gvalue || !rport || !rport->gvalue)
+		return;
+
+	string addr = string(received->gvalue) + ":" + rport->gvalue;
+	socklen_t len = 0;
+	if (!my_network.parse_addr(addr.c_str(), smp->srcaddr,
+				   sizeof(smp->srcaddr), &len)) {
+		LOG(WARN) << "Can't use source " << addr << " from front end.";
+		return;
+	}
+	smp->srcaddrlen = len;
+}
@@ -0,0 +1,134 @@
+/*
+ * SMshard.h - Spreading the Short Message queue over several smqueues.
+ *
+ * Copyright 2010 Free Software Foundation, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * See the COPYING file in the main directory for details.
+ */
+
+#ifndef SM_SHARD_H
+#define SM_SHARD_H
+
+#include <time.h>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "smqueue.h"
+
+namespace SMqueue {
+
+/*
+ * A single smqueue runs on one core.  To go faster, run several
+ * smqueue "workers", each with its own queue and its own save file,
+ * and a front end that listens where the cells send their SMS's.
+ *
+ * The front end hashes each incoming request's destination (or, for
+ * short codes, its sender) to a worker, marks the top Via with where
+ * it really came from (RFC 3581 received/rport), and passes it on.
+ * The worker answers the cell directly.  Responses from the cells go
+ * back to the worker named in their top Via.
+ *
+ * Workers and the front end also trade little control datagrams, which
+ * start with SHARD_CONTROL and so can never be mistaken for SIP:
+ *	SMSHARD STAT?			front end asks a worker how it's doing
+ *	SMSHARD STAT i queued bytes parsed	worker i answers
+ *	SMSHARD ALL up of queued bytes	front end tells workers the totals
+ *	SMSHARD REG imsi		a worker registered this handset
+ */
+#define SHARD_CONTROL	"SMSHARD "
+
+class SMshards {
+  public:
+	struct worker {
+		std::string name;	// host:port as configured, and in its Via
+		std::string addr;	// numeric host:port, as recvfrom sees it
+		char sockaddr[sizeof(struct sockaddr_storage)];
+		socklen_t sockaddrlen;
+
+		// Last status report, kept by the front end.
+		time_t heard;		// When it answered, or 0
+		unsigned queued;
+		unsigned long bytes;
+		unsigned parsed;
+	};
+	std::vector<worker> workers;	// Empty if we're not sharded.
+	std::string front_addr;		// Numeric host:port of the front end.
+	int my_index;			// Which worker we are; -1 = front end.
+	int status_interval;		// Seconds between status polls.
+
+	// Totals over all workers, as last reported by the front end.
+	time_t all_when;
+	unsigned all_up;
+	unsigned all_queued;
+	unsigned long all_bytes;
+
+	SMshards() :
+		workers (),
+		my_index (-1),
+		status_interval (10),
+		all_when (0),
+		all_up (0),
+		all_queued (0),
+		all_bytes (0)
+	{
+	}
+
+	/* Read Shard.Workers from the config.  Index is which worker we
+	   are, or -1 for the front end (or an unsharded smqueue).
+	   Result is false if the configuration doesn't make sense.  */
+	bool configure(SMnet &net, int index);
+
+	bool sharded() const { return !workers.empty(); }
+	bool front_end() const { return sharded() && my_index < 0; }
+
+	/* The port a worker listens on: the part of its name after ':'. */
+	std::string my_port() const;
+
+	/* Which worker handles messages for this IMSI or phone number. */
+	unsigned shard_of(const char *key) const;
+
+	/* Which worker has this numeric address, or this Via host:port.
+	   Result is -1 if it's not one of ours. */
+	int worker_at(const std::string &addr) const;
+
+	/* Is this numeric address the front end's? */
+	bool is_front_end(const std::string &addr) const
+		{ return !front_addr.empty() && addr == front_addr; }
+
+	/* Is this datagram one of our control messages, rather than SIP? */
+	static bool is_control(const char *buffer, int len);
+
+	/* Send a control message to worker i. */
+	bool send_to(SMnet &net, unsigned i, const std::string &msg);
+
+	/* Append the totals for all workers, if we've been told them. */
+	void describe_all(std::ostream &os) const;
+
+	/* The front end.  Route datagrams to workers, forever. */
+	void front_end_loop(SMnet &net, const short_code_map_t &scm);
+
+  private:
+	void route(SMnet &net, char *buffer, int len,
+		   const short_code_map_t &scm);
+	void heard_from(unsigned i, const char *buffer);
+	void poll_workers(SMnet &net, time_t now);
+};
+
+extern SMshards sm_shards;
+
+} // namespace SMqueue
+
+#endif